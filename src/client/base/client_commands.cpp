@@ -228,6 +228,24 @@ void CL_Skins_f()
 	}
 }
 
+/*
+=================
+CL_NetStats_f
+
+The client socket's counters, see sv_netstats
+=================
+*/
+void CL_NetStats_f()
+{
+	if (Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "reset"))
+	{
+		Net_ResetStats();
+		Com_Printf("Network counters reset.\n");
+		return;
+	}
+
+	Net_PrintStats(NS_CLIENT);
+}
 
 /*
 ==============
@@ -469,6 +487,9 @@ void CL_InitCommands()
 
 	Cmd_AddCommand("download", CL_Download_f);
 
+	Cmd_AddCommand("cl_netstats", CL_NetStats_f);
+	Cmd_AddCommand("cl_deltareport", CL_DeltaReport_f);
+
 	//
 	// forward to server commands
 	//
@@ -488,6 +488,7 @@ void CL_RequestNextDownload()
 		precache_check = ENV_CNT + 1;
 
 		Map_Load(cl.configstrings[CS_MODELS + 1], true, &map_checksum);
+		CL_PrefetchMapTextures();
 
 		if (map_checksum != atoi(cl.configstrings[CS_MAPCHECKSUM]))
 		{
@@ -568,6 +569,7 @@ void CL_Precache_f()
 	{
 		uint32_t	map_checksum;		// for detecting cheater maps
 		Map_Load(cl.configstrings[CS_MODELS + 1], true, &map_checksum);
+		CL_PrefetchMapTextures();
 		CL_RegisterSounds();
 		Render3D_PrepRefresh();
 		return;
@@ -57,8 +57,10 @@ cvar_t* cl_drawhud;
 
 cvar_t* cl_shownet;
 cvar_t* cl_showmiss;
+cvar_t* cl_showprediction;
 cvar_t* cl_showclamp;
 cvar_t* cl_showinfo;
+cvar_t* cl_deltastats;
 
 cvar_t* cl_showintro;
 
@@ -147,12 +149,14 @@ void CL_InitCvars()
 
 	cl_shownet = Cvar_Get("cl_shownet", "0", 0);
 	cl_showmiss = Cvar_Get("cl_showmiss", "0", 0);
+	cl_showprediction = Cvar_Get("cl_showprediction", "0", 0);
 	cl_showclamp = Cvar_Get("showclamp", "0", 0);
 #ifndef NDEBUG
 	cl_showinfo = Cvar_Get("cl_showinfo", "1", 0);
 #else
 	cl_showinfo = Cvar_Get("cl_showinfo", "0", 0);
 #endif
+	cl_deltastats = Cvar_Get("cl_deltastats", "0", 0);
 	cl_timeout = Cvar_Get("cl_timeout", "120", 0);
 	cl_paused = Cvar_Get("paused", "0", 0);
 	cl_timedemo = Cvar_Get("timedemo", "0", 0);
@@ -55,6 +55,16 @@ void CL_Drop()
 		Render2D_EndLoadingPlaque();	// get rid of loading plaque
 }
 
+/*
+================
+CL_IsConnected
+================
+*/
+bool CL_IsConnected()
+{
+	return cls.state >= ca_connected;
+}
+
 
 /*
 =======================
@@ -147,6 +157,7 @@ void CL_ClearState()
 	// wipe the entire cl structure
 	memset(&cl, 0, sizeof(cl));
 	memset(&cl_entities, 0, sizeof(cl_entities));
+	CL_ClearPrediction();
 
 	// disable any active UIs
 	UI_Reset();
@@ -184,6 +195,8 @@ void CL_Disconnect()
 
 	UI_Reset();
 
+	FS_FlushPrefetch();
+
 	cls.connect_time = 0;
 
 	if (cls.demorecording)
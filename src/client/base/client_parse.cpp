@@ -319,10 +319,15 @@ void CL_ParseConfigString()
 
 	strcpy(cl.configstrings[i], s);
 
+	// start loading it in the background if we're still connecting
+	CL_PrefetchConfigString(i);
+
 	// do something apropriate 
 
 	if (i >= CS_LIGHTS && i < CS_LIGHTS + MAX_LIGHTSTYLES)
 		CL_SetLightstyle(i - CS_LIGHTS);
+	else if (i >= CS_PHYS_STOPSPEED && i <= CS_PHYS_FRICTION_WATER)
+		CL_ParsePhysicsConfigStrings();
 	else if (i == CS_CDTRACK)
 	{
 		if (cl.refresh_prepped)
@@ -68,20 +68,55 @@ void CL_CheckPredictionError()
 
 /*
 ====================
-CL_ClipMoveToEntities
+PREDICTION BROADPHASE
 
+Every trace pmove makes used to clip against every solid entity in the frame. The solid ones, and the
+world space box each takes up, are gathered once per frame so a trace only does the exact clip against
+the ones its move overlaps.
 ====================
 */
-void CL_ClipMoveToEntities(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, trace_t* tr)
+
+typedef struct
 {
-	int32_t 		i, x, zd, zu;
-	trace_t		trace;
-	int32_t 		headnode;
-	float* angles;
+	entity_state_t* ent;
+	int32_t 		headnode;		// for bmodels, -1 for an encoded box
+	vec3_t			bmins, bmaxs;	// the encoded box
+	vec3_t			absmin, absmax;	// everything the entity could touch
+} cl_solid_t;
+
+static cl_solid_t	cl_solids[MAX_PARSE_ENTITIES];
+static int32_t		cl_numsolids;
+
+// the frame cl_solids was built for
+static int32_t		cl_solids_serverframe = -1;
+static int32_t		cl_solids_parse_entities;
+static int32_t		cl_solids_num_entities;
+
+/*
+====================
+CL_BuildSolidList
+
+Gathers the frame's solid entities, if it hasn't been done for this frame already
+====================
+*/
+static void CL_BuildSolidList()
+{
+	int32_t 		i, j, x, zd, zu;
 	entity_state_t* ent;
 	int32_t 		num;
-	cmodel_t* cmodel;
-	vec3_t		bmins, bmaxs;
+	cmodel_t*		cmodel;
+	cl_solid_t*		solid;
+	float			max, v;
+
+	if (cl_solids_serverframe == cl.frame.serverframe
+		&& cl_solids_parse_entities == cl.frame.parse_entities
+		&& cl_solids_num_entities == cl.frame.num_entities)
+		return;
+
+	cl_solids_serverframe = cl.frame.serverframe;
+	cl_solids_parse_entities = cl.frame.parse_entities;
+	cl_solids_num_entities = cl.frame.num_entities;
+	cl_numsolids = 0;
 
 	for (i = 0; i < cl.frame.num_entities; i++)
 	{
@@ -94,13 +129,39 @@ void CL_ClipMoveToEntities(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, t
 		if (ent->number == cl.playernum + 1)
 			continue;
 
+		solid = &cl_solids[cl_numsolids];
+		solid->ent = ent;
+
 		if (ent->solid == 31)
 		{	// special value for bmodel
 			cmodel = cl.model_clip[ent->modelindex];
 			if (!cmodel)
 				continue;
-			headnode = cmodel->headnode;
-			angles = ent->angles;
+			solid->headnode = cmodel->headnode;
+
+			if (ent->angles[0] || ent->angles[1] || ent->angles[2])
+			{	// expand for rotation, the same way the server links it
+				max = 0;
+				for (j = 0; j < 3; j++)
+				{
+					v = fabsf(cmodel->mins[j]);
+					if (v > max)
+						max = v;
+					v = fabsf(cmodel->maxs[j]);
+					if (v > max)
+						max = v;
+				}
+				for (j = 0; j < 3; j++)
+				{
+					solid->absmin[j] = ent->origin[j] - max;
+					solid->absmax[j] = ent->origin[j] + max;
+				}
+			}
+			else
+			{
+				VectorAdd3(ent->origin, cmodel->mins, solid->absmin);
+				VectorAdd3(ent->origin, cmodel->maxs, solid->absmax);
+			}
 		}
 		else
 		{	// encoded bbox
@@ -108,12 +169,148 @@ void CL_ClipMoveToEntities(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, t
 			zd = 8 * ((ent->solid >> 5) & 31);
 			zu = 8 * ((ent->solid >> 10) & 63) - 32;
 
-			bmins[0] = bmins[1] = -x;
-			bmaxs[0] = bmaxs[1] = x;
-			bmins[2] = -zd;
-			bmaxs[2] = zu;
+			solid->bmins[0] = solid->bmins[1] = -x;
+			solid->bmaxs[0] = solid->bmaxs[1] = x;
+			solid->bmins[2] = -zd;
+			solid->bmaxs[2] = zu;
+			solid->headnode = -1;
+
+			VectorAdd3(ent->origin, solid->bmins, solid->absmin);
+			VectorAdd3(ent->origin, solid->bmaxs, solid->absmax);
+		}
+
+		// the same slack the server gives its area links, so nothing the exact clip would hit gets culled
+		for (j = 0; j < 3; j++)
+		{
+			solid->absmin[j] -= 1;
+			solid->absmax[j] += 1;
+		}
+
+		cl_numsolids++;
+	}
+}
+
+// the movement physics the server sent, parsed when they change rather than every prediction
+typedef struct
+{
+	float	stopspeed;
+	float	maxspeed_player;
+	float	maxspeed_director;
+	float	duckspeed;
+	float	accelerate_player;
+	float	accelerate_director;
+	float	airaccelerate;
+	float	wateraccelerate;
+	float	friction;
+	float	waterfriction;
+} cl_physics_t;
+
+static cl_physics_t cl_physics;
+
+// the result of each command predicted since the last server frame, so a render frame only has to
+// run the commands sent since the one before it
+static pmove_t		cl_predicted_moves[CMD_BACKUP];
+static bool 		cl_predicted_valid;
+static int32_t		cl_predicted_serverframe;	// the server frame the moves started from
+static int32_t		cl_predicted_ack;			// the command it had acknowledged
+static int32_t		cl_predicted_last;			// the newest command in cl_predicted_moves
+
+/*
+====================
+CL_ClearPrediction
+
+Forgets everything kept from earlier frames, as the frame numbers start again on a new server
+====================
+*/
+void CL_ClearPrediction()
+{
+	cl_solids_serverframe = -1;
+	cl_numsolids = 0;
+	cl_predicted_valid = false;
+
+	// the configstrings were cleared too
+	CL_ParsePhysicsConfigStrings();
+}
+
+/*
+====================
+CL_ParsePhysicsConfigStrings
+
+Called when any of the CS_PHYS_ configstrings change
+====================
+*/
+void CL_ParsePhysicsConfigStrings()
+{
+	cl_physics.stopspeed = (float)atof(cl.configstrings[CS_PHYS_STOPSPEED]);
+	cl_physics.maxspeed_player = (float)atof(cl.configstrings[CS_PHYS_MAXSPEED_PLAYER]);
+	cl_physics.maxspeed_director = (float)atof(cl.configstrings[CS_PHYS_MAXSPEED_DIRECTOR]);
+	cl_physics.duckspeed = (float)atof(cl.configstrings[CS_PHYS_DUCKSPEED]);
+	cl_physics.accelerate_player = (float)atof(cl.configstrings[CS_PHYS_ACCELERATE_PLAYER]);
+	cl_physics.accelerate_director = (float)atof(cl.configstrings[CS_PHYS_ACCELERATE_DIRECTOR]);
+	cl_physics.airaccelerate = (float)atof(cl.configstrings[CS_PHYS_ACCELERATE_AIR]);
+	cl_physics.wateraccelerate = (float)atof(cl.configstrings[CS_PHYS_ACCELERATE_WATER]);
+	cl_physics.friction = (float)atof(cl.configstrings[CS_PHYS_FRICTION]);
+	cl_physics.waterfriction = (float)atof(cl.configstrings[CS_PHYS_FRICTION_WATER]);
+
+	// the predicted moves used the old ones
+	cl_predicted_valid = false;
+}
+
+/*
+====================
+CL_ClipMoveToEntities
+
+====================
+*/
+void CL_ClipMoveToEntities(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, trace_t* tr)
+{
+	int32_t 		i;
+	trace_t		trace;
+	int32_t 		headnode;
+	float* angles;
+	entity_state_t* ent;
+	cl_solid_t*		solid;
+	vec3_t		boxmins, boxmaxs;
+
+	CL_BuildSolidList();
+
+	// the box the whole move sweeps through
+	for (i = 0; i < 3; i++)
+	{
+		if (end[i] > start[i])
+		{
+			boxmins[i] = start[i] + mins[i] - 1;
+			boxmaxs[i] = end[i] + maxs[i] + 1;
+		}
+		else
+		{
+			boxmins[i] = end[i] + mins[i] - 1;
+			boxmaxs[i] = start[i] + maxs[i] + 1;
+		}
+	}
+
+	for (i = 0; i < cl_numsolids; i++)
+	{
+		solid = &cl_solids[i];
+
+		if (solid->absmin[0] > boxmaxs[0]
+			|| solid->absmin[1] > boxmaxs[1]
+			|| solid->absmin[2] > boxmaxs[2]
+			|| solid->absmax[0] < boxmins[0]
+			|| solid->absmax[1] < boxmins[1]
+			|| solid->absmax[2] < boxmins[2])
+			continue;
 
-			headnode = Map_HeadnodeForBox(bmins, bmaxs);
+		ent = solid->ent;
+
+		if (solid->headnode >= 0)
+		{
+			headnode = solid->headnode;
+			angles = ent->angles;
+		}
+		else
+		{
+			headnode = Map_HeadnodeForBox(solid->bmins, solid->bmaxs);
 			angles = vec3_origin;	// boxes don't rotate
 		}
 
@@ -196,18 +393,24 @@ int32_t CL_PMpointcontents(vec3_t point)
 CL_PredictMovement
 
 Sets cl.predicted_origin and cl.predicted_angles
+
+Only a new server frame means starting again from what the server acknowledged, otherwise
+only the commands sent since the last call need to be run
 =================
 */
 void CL_PredictMovement()
 {
 	int32_t 	ack, current;
+	int32_t 	sequence;
 	int32_t 	frame;
 	int32_t 	oldframe;
-	usercmd_t*	cmd;
 	pmove_t		pm;
 	int32_t 	i;
 	int32_t 	step;
 	int32_t 	oldz;
+	int32_t 	runs;
+	bool		replayed;
+	trace_caller_t	previous_caller;
 
 	if (cls.state != ca_active)
 		return;
@@ -221,6 +424,7 @@ void CL_PredictMovement()
 		{
 			cl.predicted_angles[i] = cl.viewangles[i] + SHORT2ANGLE(cl.frame.playerstate.pmove.delta_angles[i]);
 		}
+		cl_predicted_valid = false;
 		return;
 	}
 
@@ -232,51 +436,95 @@ void CL_PredictMovement()
 	{
 		if (cl_showmiss->value)
 			Com_Printf("exceeded CMD_BACKUP\n");
+		cl_predicted_valid = false;
 		return;
 	}
 
-	// copy current state to pmove
-	memset(&pm, 0, sizeof(pm));
-	pm.trace = CL_PMTrace;
-	pm.pointcontents = CL_PMpointcontents;
+	// the listen server sets these too, and from the same values
+	phys_stopspeed = cl_physics.stopspeed;
+	phys_maxspeed_player = cl_physics.maxspeed_player;
+	phys_maxspeed_director = cl_physics.maxspeed_director;
+	phys_duckspeed = cl_physics.duckspeed;
+	phys_accelerate_player = cl_physics.accelerate_player;
+	phys_accelerate_director = cl_physics.accelerate_director;
+	phys_airaccelerate = cl_physics.airaccelerate;
+	phys_wateraccelerate = cl_physics.wateraccelerate;
+	phys_friction = cl_physics.friction;
+	phys_waterfriction = cl_physics.waterfriction;
+
+	replayed = !cl_predicted_valid
+		|| cl_predicted_serverframe != cl.frame.serverframe
+		|| cl_predicted_ack != ack;
+
+	if (replayed)
+	{
+		// copy current state to pmove
+		memset(&pm, 0, sizeof(pm));
+		pm.trace = CL_PMTrace;
+		pm.pointcontents = CL_PMpointcontents;
+
+		VectorCopy3(cl.frame.playerstate.vieworigin, pm.vieworigin);
+		pm.s = cl.frame.playerstate.pmove;
+
+		cl_predicted_valid = true;
+		cl_predicted_serverframe = cl.frame.serverframe;
+		cl_predicted_ack = ack;
+		sequence = ack;
+	}
+	else
+	{
+		// carry on from the last command predicted
+		sequence = cl_predicted_last;
 
-	phys_stopspeed = (float)atof(cl.configstrings[CS_PHYS_STOPSPEED]);
-	phys_maxspeed_player = (float)atof(cl.configstrings[CS_PHYS_MAXSPEED_PLAYER]);
-	phys_maxspeed_director = (float)atof(cl.configstrings[CS_PHYS_MAXSPEED_DIRECTOR]);
-	phys_duckspeed = (float)atof(cl.configstrings[CS_PHYS_DUCKSPEED]);
-	phys_accelerate_player = (float)atof(cl.configstrings[CS_PHYS_ACCELERATE_PLAYER]);
-	phys_accelerate_director = (float)atof(cl.configstrings[CS_PHYS_ACCELERATE_DIRECTOR]);
-	phys_airaccelerate = (float)atof(cl.configstrings[CS_PHYS_ACCELERATE_AIR]);
-	phys_wateraccelerate = (float)atof(cl.configstrings[CS_PHYS_ACCELERATE_WATER]);
-	phys_friction = (float)atof(cl.configstrings[CS_PHYS_FRICTION]);
-	phys_waterfriction = (float)atof(cl.configstrings[CS_PHYS_FRICTION_WATER]);
+		if (sequence == ack)
+		{
+			memset(&pm, 0, sizeof(pm));
+			pm.trace = CL_PMTrace;
+			pm.pointcontents = CL_PMpointcontents;
 
-	VectorCopy3(cl.frame.playerstate.vieworigin, pm.vieworigin);
-	pm.s = cl.frame.playerstate.pmove;
+			VectorCopy3(cl.frame.playerstate.vieworigin, pm.vieworigin);
+			pm.s = cl.frame.playerstate.pmove;
+		}
+		else
+			pm = cl_predicted_moves[sequence & (CMD_BACKUP - 1)];
+	}
 
-	frame = 0;
+	runs = 0;
 
 	// run frames
-	while (++ack < current)
+	while (++sequence < current)
 	{
-		frame = ack & (CMD_BACKUP - 1);
-		cmd = &cl.cmds[frame];
+		frame = sequence & (CMD_BACKUP - 1);
 
-		pm.cmd = *cmd;
+		pm.cmd = cl.cmds[frame];
+		previous_caller = Map_PushTraceCaller(trace_caller_prediction);
 		Player_Move(&pm);
+		Map_PopTraceCaller(previous_caller);
+		runs++;
+
+		cl_predicted_moves[frame] = pm;
 
 		// save for debug checking
 		VectorCopy3(pm.vieworigin, cl.predicted_origins[frame]);
 	}
 
-	oldframe = (ack - 2) & (CMD_BACKUP - 1);
-	oldz = cl.predicted_origins[oldframe][2];
-	step = pm.vieworigin[2] - oldz;
+	cl_predicted_last = current - 1;
+
+	if (cl_showprediction->value && runs)
+		Com_Printf("%i pmove runs%s\n", runs, replayed ? " (new server frame)" : "");
 
-	if (step > 63 && step < 160 && (pm.s.pm_flags & PMF_ON_GROUND))
+	// the step only changes when a command was run, and its time is when that happened
+	if (runs)
 	{
-		cl.predicted_step = step;
-		cl.predicted_step_time = cls.realtime - cls.frametime * 500;
+		oldframe = (current - 2) & (CMD_BACKUP - 1);
+		oldz = cl.predicted_origins[oldframe][2];
+		step = pm.vieworigin[2] - oldz;
+
+		if (step > 63 && step < 160 && (pm.s.pm_flags & PMF_ON_GROUND))
+		{
+			cl.predicted_step = step;
+			cl.predicted_step_time = cls.realtime - cls.frametime * 500;
+		}
 	}
 
 	// copy results out for rendering
@@ -286,4 +534,4 @@ void CL_PredictMovement()
 	cl.predicted_origin[2] = pm.vieworigin[2];
 
 	VectorCopy3(pm.viewangles, cl.predicted_angles);
-}
\ No newline at end of file
+}
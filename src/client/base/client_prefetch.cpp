@@ -0,0 +1,168 @@
+/*
+Copyright (C) 2023-2024 starfrost
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+// client_prefetch.cpp: Starts loading and decoding assets on worker threads as soon as the server names them,
+// so that by the time Render3D_PrepRefresh and CL_RegisterSounds run, all that's left is GL upload and table insertion.
+
+#include <client/client.hpp>
+#include <client/include/sound.hpp>
+
+static const char* prefetch_env_suf[6] = { "rt", "bk", "lf", "ft", "up", "dn" };
+
+/*
+===============
+CL_PrefetchDecodeImage
+
+Decodes a targa into a prefetched_image_t on a prefetch job
+===============
+*/
+void* CL_PrefetchDecodeImage(const char* path, uint8_t* data, int32_t length, int32_t* decoded_length)
+{
+	prefetched_image_t* image;
+	int32_t				width, height;
+
+	if (!re.DecodeTGA
+		|| !re.DecodeTGA(data, length, NULL, &width, &height)
+		|| width <= 0
+		|| height <= 0)
+	{
+		return NULL;
+	}
+
+	image = (prefetched_image_t*)Memory_ZoneTryMalloc(sizeof(prefetched_image_t) + width * height * 4);
+
+	if (!image)
+		return NULL;
+
+	image->width = width;
+	image->height = height;
+
+	re.DecodeTGA(data, length, (uint8_t*)(image + 1), &width, &height);
+
+	if (decoded_length)
+		*decoded_length = sizeof(prefetched_image_t) + width * height * 4;
+
+	return image;
+}
+
+/*
+===============
+CL_PrefetchImage
+===============
+*/
+void CL_PrefetchImage(const char* path)
+{
+	FS_PrefetchFile(path, CL_PrefetchDecodeImage);
+}
+
+/*
+===============
+CL_PrefetchConfigString
+
+Called by CL_ParseConfigString for every configstring received before the refresh has been prepped.
+The paths built here have to match the ones the renderer and sound system will ask for.
+===============
+*/
+void CL_PrefetchConfigString(int32_t index)
+{
+	char	path[MAX_QPATH];
+	char*	s;
+	int32_t i;
+
+	if (cl.refresh_prepped
+		|| !graphics_mode)
+	{
+		return;
+	}
+
+	s = cl.configstrings[index];
+
+	if (!s[0])
+		return;
+
+	if (index >= CS_MODELS && index < CS_MODELS + MAX_MODELS)
+	{
+		// inline models come out of the map, # are player weapon models loaded per skin
+		if (s[0] == '*' || s[0] == '#')
+			return;
+
+		FS_PrefetchFile(s, NULL);
+	}
+	else if (index >= CS_SOUNDS && index < CS_SOUNDS + MAX_SOUNDS)
+	{
+		// sexed sounds are resolved per player
+		if (s[0] == '*')
+			return;
+
+		if (s[0] == '#')
+			strncpy(path, s + 1, sizeof(path) - 1);
+		else
+			snprintf(path, sizeof(path), "sound/%s", s);
+
+		FS_PrefetchFile(path, S_DecodeSound);
+	}
+	else if (index >= CS_IMAGES && index < CS_IMAGES + MAX_IMAGES)
+	{
+		// same as Draw_FindPic
+		if (s[0] != '/' && s[0] != '\\')
+			snprintf(path, sizeof(path), "%s.tga", s);
+		else
+			strncpy(path, s + 1, sizeof(path) - 1);
+
+		CL_PrefetchImage(path);
+	}
+	else if (index == CS_SKY)
+	{
+		for (i = 0; i < 6; i++)
+		{
+			snprintf(path, sizeof(path), "env/%s%s.tga", s, prefetch_env_suf[i]);
+			CL_PrefetchImage(path);
+		}
+	}
+}
+
+/*
+===============
+CL_PrefetchMapTextures
+
+The wall textures are the bulk of a level load, but their names are only known once the map has been loaded
+===============
+*/
+void CL_PrefetchMapTextures()
+{
+	// from common/map_loader.cpp
+	extern int32_t 		numtexinfo;
+	extern mapsurface_t	map_surfaces[];
+
+	char	path[MAX_QPATH];
+	int32_t i;
+
+	if (cl.refresh_prepped
+		|| !graphics_mode)
+	{
+		return;
+	}
+
+	for (i = 0; i < numtexinfo; i++)
+	{
+		snprintf(path, sizeof(path), "textures/%s.tga", map_surfaces[i].rname);
+		CL_PrefetchImage(path);
+	}
+}
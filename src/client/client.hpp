@@ -283,8 +283,10 @@ extern cvar_t* cl_anglespeedkey;
 
 extern cvar_t* cl_shownet;
 extern cvar_t* cl_showmiss;
+extern cvar_t* cl_showprediction;
 extern cvar_t* cl_showclamp;
 extern cvar_t* cl_showinfo;
+extern cvar_t* cl_deltastats;
 
 extern cvar_t* lookstrafe;
 extern cvar_t* sensitivity;
@@ -412,6 +414,7 @@ void CL_ParticleSmokeEffect(vec3_t org, vec3_t dir, color4_t color, int32_t coun
 int32_t CL_ParseEntityBits(uint32_t* bits);
 void CL_ParseDelta(entity_state_t* from, entity_state_t* to, int32_t number, int32_t bits);
 void CL_ParseFrame();
+void CL_DeltaReport_f();
 
 void CL_ParseTEnt();
 void CL_ParseConfigString();
@@ -485,11 +488,19 @@ void CL_RegisterTEntSounds();
 void CL_RegisterTEntModels();
 void CL_SmokeAndFlash(vec3_t origin);
 
+//
+// client_prefetch.cpp
+//
+void CL_PrefetchConfigString(int32_t index);
+void CL_PrefetchMapTextures();
+
 //
 // cl_pred.c
 //
 void CL_PredictMovement();
 void CL_CheckPredictionError();
+void CL_ClearPrediction();
+void CL_ParsePhysicsConfigStrings();
 
 //
 // cl_fx_dlight.c
@@ -42,39 +42,16 @@ Returns the entity number and the header bits
 int32_t bitcounts[32];	/// just for protocol profiling
 int32_t CL_ParseEntityBits(uint32_t* bits)
 {
-	uint32_t		b, total;
 	int32_t 		i;
 	int32_t 		number;
 
-	total = MSG_ReadByte(&net_message);
-	if (total & U_MOREBITS1)
-	{
-		b = MSG_ReadByte(&net_message);
-		total |= b << 8;
-	}
-	if (total & U_MOREBITS2)
-	{
-		b = MSG_ReadByte(&net_message);
-		total |= b << 16;
-	}
-	if (total & U_MOREBITS3)
-	{
-		b = MSG_ReadByte(&net_message);
-		total |= b << 24;
-	}
+	number = MSG_ReadEntityBits(&net_message, bits);
 
 	// count the bits for net profiling
 	for (i = 0; i < 32; i++)
-		if (total & (1 << i))
+		if (*bits & (1 << i))
 			bitcounts[i]++;
 
-	if (total & U_NUMBER16)
-		number = MSG_ReadShort(&net_message);
-	else
-		number = MSG_ReadByte(&net_message);
-
-	*bits = total;
-
 	return number;
 }
 
@@ -87,74 +64,7 @@ Can go from either a baseline or a previous packet_entity
 */
 void CL_ParseDelta(entity_state_t* from, entity_state_t* to, int32_t number, int32_t bits)
 {
-	// set everything to the state we are delta'ing from
-	*to = *from;
-
-	VectorCopy3(from->origin, to->old_origin);
-	to->number = number;
-
-	if (bits & U_MODEL)
-		to->modelindex = MSG_ReadByte(&net_message);
-	if (bits & U_MODEL2)
-		to->modelindex2 = MSG_ReadByte(&net_message);
-	if (bits & U_MODEL3)
-		to->modelindex3 = MSG_ReadByte(&net_message);
-	if (bits & U_MODEL4)
-		to->modelindex4 = MSG_ReadByte(&net_message);
-
-	if (bits & U_FRAME8)
-		to->frame = MSG_ReadByte(&net_message);
-	if (bits & U_FRAME16)
-		to->frame = MSG_ReadShort(&net_message);
-
-	if ((bits & U_SKIN8) && (bits & U_SKIN16))		//used for laser colors
-		to->skinnum = MSG_ReadInt(&net_message);
-	else if (bits & U_SKIN8)
-		to->skinnum = MSG_ReadByte(&net_message);
-	else if (bits & U_SKIN16)
-		to->skinnum = MSG_ReadShort(&net_message);
-
-	if ((bits & (U_EFFECTS8 | U_EFFECTS16)) == (U_EFFECTS8 | U_EFFECTS16))
-		to->effects = MSG_ReadInt(&net_message);
-	else if (bits & U_EFFECTS8)
-		to->effects = MSG_ReadByte(&net_message);
-	else if (bits & U_EFFECTS16)
-		to->effects = MSG_ReadShort(&net_message);
-
-	if ((bits & (U_RENDERFX8 | U_RENDERFX16)) == (U_RENDERFX8 | U_RENDERFX16))
-		to->renderfx = MSG_ReadInt(&net_message);
-	else if (bits & U_RENDERFX8)
-		to->renderfx = MSG_ReadByte(&net_message);
-	else if (bits & U_RENDERFX16)
-		to->renderfx = MSG_ReadShort(&net_message);
-
-	if (bits & U_ORIGIN1)
-		to->origin[0] = MSG_ReadCoord(&net_message);
-	if (bits & U_ORIGIN2)
-		to->origin[1] = MSG_ReadCoord(&net_message);
-	if (bits & U_ORIGIN3)
-		to->origin[2] = MSG_ReadCoord(&net_message);
-
-	if (bits & U_ANGLE1)
-		to->angles[0] = MSG_ReadAngle(&net_message);
-	if (bits & U_ANGLE2)
-		to->angles[1] = MSG_ReadAngle(&net_message);
-	if (bits & U_ANGLE3)
-		to->angles[2] = MSG_ReadAngle(&net_message);
-
-	if (bits & U_OLDORIGIN)
-		MSG_ReadPos(&net_message, to->old_origin);
-
-	if (bits & U_SOUND)
-		to->sound = MSG_ReadByte(&net_message);
-
-	if (bits & U_EVENT)
-		to->event = MSG_ReadByte(&net_message);
-	else
-		to->event = 0;
-
-	if (bits & U_SOLID)
-		to->solid = MSG_ReadShort(&net_message);
+	MSG_ReadDeltaEntity(&net_message, from, to, number, bits);
 }
 
 /*
@@ -495,6 +405,132 @@ void CL_FireEntityEvents(frame_t* frame)
 }
 
 
+// with cl_deltastats, how big the snapshots are and how big they would have been with the byte aligned
+// entity encoding of protocol 2, so recorded demos can be played to see what the bit packing saves
+static uint64_t	deltastats_snapshots;
+static uint64_t	deltastats_entities;
+static uint64_t	deltastats_packed;			// packetentities as received
+static uint64_t	deltastats_aligned;			// the same entities, byte aligned
+static uint64_t	deltastats_snapshot;		// the whole frame, player state and entities, as received
+
+/*
+==================
+CL_MeasurePacketEntities
+
+Encodes the entities just parsed into newframe again with MSG_WriteDeltaEntityBytes, deltaed the same way
+SV_EmitPacketEntities does. They have already been quantized, so origins that moved less than 1/8 unit aren't
+counted, which makes the protocol 2 numbers a little smaller than they really were
+==================
+*/
+static void CL_MeasurePacketEntities(frame_t* oldframe, frame_t* newframe, int32_t packed, int32_t snapshot)
+{
+	entity_state_t	*oldent = NULL, *newent = NULL;
+	int32_t 	oldindex, newindex;
+	int32_t 	oldnum, newnum;
+	int32_t 	from_num_entities;
+	int32_t 	maxclients;
+	int32_t 	aligned;
+	sizebuf_t	buf;
+	uint8_t		buf_data[128];
+
+	SZ_Init(&buf, buf_data, sizeof(buf_data));
+
+	maxclients = atoi(cl.configstrings[CS_MAXCLIENTS]);
+	from_num_entities = oldframe ? oldframe->num_entities : 0;
+	aligned = 0;
+
+	newindex = 0;
+	oldindex = 0;
+	while (newindex < newframe->num_entities || oldindex < from_num_entities)
+	{
+		if (newindex >= newframe->num_entities)
+			newnum = 9999;
+		else
+		{
+			newent = &cl_parse_entities[(newframe->parse_entities + newindex) & (MAX_PARSE_ENTITIES - 1)];
+			newnum = newent->number;
+		}
+
+		if (oldindex >= from_num_entities)
+			oldnum = 9999;
+		else
+		{
+			oldent = &cl_parse_entities[(oldframe->parse_entities + oldindex) & (MAX_PARSE_ENTITIES - 1)];
+			oldnum = oldent->number;
+		}
+
+		SZ_Clear(&buf);
+
+		if (newnum == oldnum)
+		{
+			MSG_WriteDeltaEntityBytes(oldent, newent, &buf, false, newnum <= maxclients);
+			oldindex++;
+			newindex++;
+		}
+		else if (newnum < oldnum)
+		{
+			MSG_WriteDeltaEntityBytes(&cl_entities[newnum].baseline, newent, &buf, true, true);
+			newindex++;
+		}
+		else
+		{
+			// U_REMOVE, with U_MOREBITS1 and U_NUMBER16 past 255
+			buf.cursize = (oldnum >= 256) ? 4 : 2;
+			oldindex++;
+		}
+
+		aligned += buf.cursize;
+	}
+
+	aligned += 2;		// end of packetentities
+
+	deltastats_snapshots++;
+	deltastats_entities += newframe->num_entities;
+	deltastats_packed += packed;
+	deltastats_aligned += aligned;
+	deltastats_snapshot += snapshot;
+}
+
+/*
+==================
+CL_DeltaReport_f
+==================
+*/
+void CL_DeltaReport_f()
+{
+	double	snapshots;
+
+	if (Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "reset"))
+	{
+		deltastats_snapshots = 0;
+		deltastats_entities = 0;
+		deltastats_packed = 0;
+		deltastats_aligned = 0;
+		deltastats_snapshot = 0;
+		Com_Printf("Delta counters reset.\n");
+		return;
+	}
+
+	if (!deltastats_snapshots)
+	{
+		Com_Printf("No snapshots measured. Set cl_deltastats 1 and play a demo or connect.\n");
+		return;
+	}
+
+	snapshots = (double)deltastats_snapshots;
+
+	Com_Printf("%llu snapshots, %.1f entities each, average bytes:\n", (unsigned long long)deltastats_snapshots,
+		deltastats_entities / snapshots);
+	Com_Printf("              snapshot  packetentities  per entity\n");
+	Com_Printf("bit packed  %10.1f  %14.1f  %10.2f\n", deltastats_snapshot / snapshots,
+		deltastats_packed / snapshots, deltastats_entities ? deltastats_packed / (double)deltastats_entities : 0.0);
+	Com_Printf("protocol 2  %10.1f  %14.1f  %10.2f\n", (deltastats_snapshot - deltastats_packed + deltastats_aligned) / snapshots,
+		deltastats_aligned / snapshots, deltastats_entities ? deltastats_aligned / (double)deltastats_entities : 0.0);
+	Com_Printf("packetentities are %.1f%% smaller, whole snapshots %.1f%%\n",
+		100.0 - 100.0 * deltastats_packed / deltastats_aligned,
+		100.0 - 100.0 * deltastats_snapshot / (deltastats_snapshot - deltastats_packed + deltastats_aligned));
+}
+
 /*
 ================
 CL_ParseFrame
@@ -504,8 +540,11 @@ void CL_ParseFrame()
 {
 	int32_t cmd;
 	int32_t len;
+	int32_t frame_start, entities_start;
 	frame_t* old;
 
+	frame_start = net_message.readcount - 1;		// svc_frame has been read
+
 	memset(&cl.frame, 0, sizeof(cl.frame));
 
 	cl.frame.serverframe = MSG_ReadInt(&net_message);
@@ -571,8 +610,12 @@ void CL_ParseFrame()
 	if (cmd != svc_packetentities)
 		Com_Error(ERR_DROP, "CL_ParseFrame: not packetentities");
 
+	entities_start = net_message.readcount;
 	CL_ParsePacketEntities(old, &cl.frame);
 
+	if (cl_deltastats->value && cl.frame.valid)
+		CL_MeasurePacketEntities(old, &cl.frame, net_message.readcount - entities_start, net_message.readcount - frame_start);
+
 	// save the frame off in the backup array for later delta comparisons
 	cl.frames[cl.frame.serverframe & UPDATE_MASK] = cl.frame;
 
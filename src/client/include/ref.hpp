@@ -100,6 +100,13 @@ typedef struct lightstyle_s
 	float	white;			// highest of rgb
 } lightstyle_t;
 
+// an image decoded by the engine's prefetch jobs, the RGBA pixels follow the header
+typedef struct prefetched_image_s
+{
+	int32_t			width;
+	int32_t			height;
+} prefetched_image_t;
+
 typedef struct refdef_s
 {
 	int32_t 		x;
@@ -128,7 +135,7 @@ typedef struct refdef_s
 	particle_t*		particles;
 } refdef_t;
 
-#define	REF_API_VERSION		1
+#define	REF_API_VERSION		3
 
 //
 // these are the functions exported by the refresh module
@@ -191,6 +198,9 @@ typedef struct refexport_s
 	void	(*GetCursorPosition)(double* x, double* y);
 	void	(*SetCursorPosition)(double x, double y);
 	void	(*SetWindowPosition)(double x, double y);
+
+	// decodes a targa into RGBA, or if pic is NULL just returns its size. Thread safe, the engine calls it from prefetch jobs
+	bool	(*DecodeTGA)(uint8_t* buffer, int32_t length, uint8_t* pic, int32_t* width, int32_t* height);
 } refexport_t;
 
 //
@@ -216,10 +226,18 @@ typedef struct
 	int32_t	(*FS_LoadFile)(const char* name, void** buf);
 	void	(*FS_FreeFile)(void* buf);
 
+	// returns something the engine already loaded and decoded ahead of time (for images, a prefetched_image_t)
+	// or NULL if it wasn't prefetched. free it with FS_FreeFile
+	void*	(*FS_TakePrefetched)(const char* name, int32_t* length);
+
 	// gamedir will be the current directory that generated
 	// files should be stored to, ie: "f:\quake\id1"
 	char*	(*FS_Gamedir)();
 
+	// lumps the engine already converted for collision, if it has name loaded, otherwise NULL
+	const cplane_t*	(*Map_SharedPlanes)(const char* name, int32_t* count);
+	const dvis_t*	(*Map_SharedVisibility)(const char* name, int32_t* length);
+
 	cvar_t* (*Cvar_Get)(const char* name, const char* value, int32_t flags);
 	cvar_t* (*Cvar_Set)(const char* name, const char* value);
 	void	(*Cvar_SetValue)(const char* name, float value);
@@ -175,6 +175,7 @@ wavinfo_t GetWavInfo (char *name, uint8_t *wav, int32_t wavlength);
 void S_InitScaletable ();
 
 sfxcache_t *S_LoadSound (sfx_t *s);
+void* S_DecodeSound (const char *path, uint8_t *data, int32_t size, int32_t *decoded_length);	// an fs_decodefunc_t
 
 void S_IssuePlaysound (playsound_t *ps);
 
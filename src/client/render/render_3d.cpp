@@ -268,6 +268,9 @@ void Render3D_PrepRefresh()
 	// the renderer can now free unneeded stuff
 	re.EndRegistration();
 
+	// and so can the prefetcher
+	FS_FlushPrefetch();
+
 	// clear any lines of console text
 	Con_ClearRecentHistory();
 
@@ -132,6 +132,9 @@ void Vid_ChangeResolution()
 
 void Vid_FreeReflib()
 {
+	// prefetch jobs may be decoding with the old library's code
+	FS_FlushPrefetch();
+
 	if (!FreeLibrary(reflib_library))
 		Com_Error(ERR_FATAL, "Reflib FreeLibrary failed");
 	memset(&re, 0, sizeof(re));
@@ -173,7 +176,10 @@ bool Vid_LoadRefresh(char* name)
 	ri.Sys_Error = Vid_Error;
 	ri.FS_LoadFile = FS_LoadFile;
 	ri.FS_FreeFile = FS_FreeFile;
+	ri.FS_TakePrefetched = FS_TakePrefetched;
 	ri.FS_Gamedir = FS_Gamedir;
+	ri.Map_SharedPlanes = Map_SharedPlanes;
+	ri.Map_SharedVisibility = Map_SharedVisibility;
 	ri.Cvar_Get = Cvar_Get;
 	ri.Cvar_Set = Cvar_Set;
 	ri.Cvar_SetValue = Cvar_SetValue;
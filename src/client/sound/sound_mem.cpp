@@ -90,6 +90,56 @@ void ResampleSfx (sfx_t *sfx, int32_t inrate, int32_t inwidth, uint8_t *data)
 
 //=============================================================================
 
+/*
+==============
+S_DecodeSound
+
+Parses a wav and resamples it to the output rate. Also run by prefetch jobs,
+so it only prints and never calls Com_Error
+==============
+*/
+void* S_DecodeSound (const char *path, uint8_t *data, int32_t size, int32_t *decoded_length)
+{
+	wavinfo_t	info;
+	int32_t 	len;
+	float		stepscale;
+	sfxcache_t	*sc;
+	sfx_t		sfx;
+
+	info = GetWavInfo ((char *)path, data, size);
+
+	if (info.channels != 1)
+	{
+		if (info.channels)
+			Com_Printf ("%s is a stereo sample\n", path);
+		return NULL;
+	}
+
+	stepscale = (float)info.rate / dma.speed;	
+	len = info.samples / stepscale;
+
+	len = len * info.width * info.channels;
+
+	sc = (sfxcache_t*)Memory_ZoneTryMalloc (len + sizeof(sfxcache_t));
+	if (!sc)
+		return NULL;
+	
+	sc->length = info.samples;
+	sc->loopstart = info.loopstart;
+	sc->speed = info.rate;
+	sc->width = info.width;
+	sc->stereo = info.channels;
+
+	// ResampleSfx only looks at the cache
+	sfx.cache = sc;
+	ResampleSfx (&sfx, sc->speed, sc->width, data + info.dataofs);
+
+	if (decoded_length)
+		*decoded_length = len + sizeof(sfxcache_t);
+
+	return sc;
+}
+
 /*
 ==============
 S_LoadSound
@@ -99,9 +149,6 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 {
     char	namebuffer[MAX_QPATH];
 	uint8_t* data;
-	wavinfo_t	info;
-	int32_t 	len;
-	float	stepscale;
 	sfxcache_t	*sc;
 	int32_t 	size;
 	char	*name;
@@ -128,6 +175,11 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 
 //	Com_Printf ("loading %s\n",namebuffer);
 
+	// already decoded by a prefetch job?
+	sc = s->cache = (sfxcache_t*)FS_TakePrefetched (namebuffer, NULL);
+	if (sc)
+		return sc;
+
 	size = FS_LoadFile (namebuffer, (void **)&data);
 
 	if (!data)
@@ -136,33 +188,7 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 		return NULL;
 	}
 
-	info = GetWavInfo (s->name, data, size);
-	if (info.channels != 1)
-	{
-		Com_Printf ("%s is a stereo sample\n",s->name);
-		FS_FreeFile (data);
-		return NULL;
-	}
-
-	stepscale = (float)info.rate / dma.speed;	
-	len = info.samples / stepscale;
-
-	len = len * info.width * info.channels;
-
-	sc = s->cache = (sfxcache_t*)Memory_ZoneMalloc (len + sizeof(sfxcache_t));
-	if (!sc)
-	{
-		FS_FreeFile (data);
-		return NULL;
-	}
-	
-	sc->length = info.samples;
-	sc->loopstart = info.loopstart;
-	sc->speed = info.rate;
-	sc->width = info.width;
-	sc->stereo = info.channels;
-
-	ResampleSfx (s, sc->speed, sc->width, data + info.dataofs);
+	sc = s->cache = (sfxcache_t*)S_DecodeSound (s->name, data, size, NULL);
 
 	FS_FreeFile (data);
 
@@ -179,11 +205,12 @@ WAV loading
 ===============================================================================
 */
 
-uint8_t* data_p;
-uint8_t* iff_end;
-uint8_t* last_chunk;
-uint8_t* iff_data;
-uint8_t	iff_chunk_len;
+// thread_local, as sounds are also parsed by prefetch jobs
+thread_local uint8_t* data_p;
+thread_local uint8_t* iff_end;
+thread_local uint8_t* last_chunk;
+thread_local uint8_t* iff_data;
+thread_local uint8_t	iff_chunk_len;
 
 
 int16_t GetLittleShort()
@@ -345,7 +372,16 @@ wavinfo_t GetWavInfo(char* name, uint8_t* wav, int32_t wavlength)
 	if (info.samples)
 	{
 		if (samples < info.samples)
+		{
+			// jobs can't Com_Error, so fail and let the main thread load it again and raise the error
+			if (!Jobs_IsMainThread())
+			{
+				memset(&info, 0, sizeof(info));
+				return info;
+			}
+
 			Com_Error(ERR_DROP, "Sound %s has a bad loop length", name);
+		}
 	}
 	else
 	{
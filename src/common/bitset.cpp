@@ -0,0 +1,336 @@
+/*
+Copyright (C) 2023-2024 starfrost
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+// bitset.cpp: Vectorised bit vector operations used for visibility (PVS merging, cluster tests)
+//
+// Every operation has a scalar, SSE2 and AVX2 version. Bitset_Init picks the best one the CPU supports
+// once CPUID_Init has run, and bitset_simd can cap it for comparison. Bits are numbered the same way
+// the PVS is: bit n is (bits[n >> 3] >> (n & 7)) & 1.
+
+#include "common.hpp"
+#include <chrono>
+
+#ifdef CPUID_X86
+#include <immintrin.h>
+#endif
+
+#define BITSET_SCALAR	0
+#define BITSET_SSE2		1
+#define BITSET_AVX2		2
+
+typedef struct bitset_impl_s
+{
+	const char*		name;
+	int32_t			level;			// BITSET_*
+	cpu_feature		feature;		// needed to use it
+	void			(*Or)(uint8_t* dst, const uint8_t* src, int32_t bytes);
+	bool			(*TestAny)(const uint8_t* bits, const int32_t* indices, int32_t count);
+} bitset_impl_t;
+
+cvar_t*			bitset_simd;
+
+void			(*Bitset_Or)(uint8_t* dst, const uint8_t* src, int32_t bytes);
+bool			(*Bitset_TestAny)(const uint8_t* bits, const int32_t* indices, int32_t count);
+
+/*
+=============================================================================
+
+SCALAR
+
+=============================================================================
+*/
+
+static void Bitset_OrScalar(uint8_t* dst, const uint8_t* src, int32_t bytes)
+{
+	uint64_t	a, b;
+	int32_t		i;
+
+	// memcpy so rows don't have to be 8 byte aligned
+	for (i = 0; i + 8 <= bytes; i += 8)
+	{
+		memcpy(&a, dst + i, 8);
+		memcpy(&b, src + i, 8);
+		a |= b;
+		memcpy(dst + i, &a, 8);
+	}
+
+	for (; i < bytes; i++)
+		dst[i] |= src[i];
+}
+
+static bool Bitset_TestAnyScalar(const uint8_t* bits, const int32_t* indices, int32_t count)
+{
+	int32_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (bits[indices[i] >> 3] & (1 << (indices[i] & 7)))
+			return true;
+	}
+
+	return false;
+}
+
+#ifdef CPUID_X86
+
+/*
+=============================================================================
+
+SSE2
+
+=============================================================================
+*/
+
+CPUID_TARGET_SSE2 static void Bitset_OrSSE2(uint8_t* dst, const uint8_t* src, int32_t bytes)
+{
+	__m128i a, b;
+	int32_t i;
+
+	for (i = 0; i + 16 <= bytes; i += 16)
+	{
+		a = _mm_loadu_si128((const __m128i*)(dst + i));
+		b = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(a, b));
+	}
+
+	Bitset_OrScalar(dst + i, src + i, bytes - i);
+}
+
+/*
+=============================================================================
+
+AVX2
+
+=============================================================================
+*/
+
+CPUID_TARGET_AVX2 static void Bitset_OrAVX2(uint8_t* dst, const uint8_t* src, int32_t bytes)
+{
+	__m256i a, b;
+	int32_t i;
+
+	for (i = 0; i + 32 <= bytes; i += 32)
+	{
+		a = _mm256_loadu_si256((const __m256i*)(dst + i));
+		b = _mm256_loadu_si256((const __m256i*)(src + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(a, b));
+	}
+
+	Bitset_OrScalar(dst + i, src + i, bytes - i);
+}
+
+// gathers the 32-bit word holding each of 8 bits at once, so bits has to be readable up to a whole word past the highest index
+CPUID_TARGET_AVX2 static bool Bitset_TestAnyAVX2(const uint8_t* bits, const int32_t* indices, int32_t count)
+{
+	__m256i index, words, mask;
+	int32_t i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		index = _mm256_loadu_si256((const __m256i*)(indices + i));
+		words = _mm256_i32gather_epi32((const int*)bits, _mm256_srli_epi32(index, 5), 4);
+		mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_and_si256(index, _mm256_set1_epi32(31)));
+
+		if (!_mm256_testz_si256(words, mask))
+			return true;
+	}
+
+	return Bitset_TestAnyScalar(bits, indices + i, count - i);
+}
+
+#endif
+
+// in order of preference, worst first
+static bitset_impl_t bitset_impls[] =
+{
+	{ "scalar", BITSET_SCALAR, (cpu_feature)0, Bitset_OrScalar, Bitset_TestAnyScalar },
+#ifdef CPUID_X86
+	// there is no gather before AVX2, so a single bit at a time is as good as it gets
+	{ "SSE2", BITSET_SSE2, cpu_feature_sse2, Bitset_OrSSE2, Bitset_TestAnyScalar },
+	{ "AVX2", BITSET_AVX2, cpu_feature_avx2, Bitset_OrAVX2, Bitset_TestAnyAVX2 },
+#endif
+};
+
+#define NUM_BITSET_IMPLS	(int32_t)(sizeof(bitset_impls) / sizeof(bitset_impls[0]))
+
+/*
+=============================================================================
+
+BENCHMARK
+
+=============================================================================
+*/
+
+#define BENCH_ROWS		4		// clusters merged per fat PVS, about what SV_FatPVS sees
+#define BENCH_INDICES	16		// clusters tested per entity
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+static double Bitset_BenchNanoseconds(bench_clock::time_point start, int32_t iterations)
+{
+	return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / iterations;
+}
+
+/*
+=============
+Bitset_Bench_f
+
+Times the PVS merge and cluster tests of the loaded map with every implementation the CPU supports,
+against the loops they replaced
+=============
+*/
+void Bitset_Bench_f()
+{
+	static uint8_t		merged[65536 / 8 + 32];
+	static int32_t		indices[BENCH_INDICES];
+	int32_t				clusters[BENCH_ROWS];
+	bench_clock::time_point start;
+	volatile int32_t	sink;
+	int32_t				iterations;
+	int32_t				numclusters;
+	int32_t				words, bytes;
+	int32_t				i, j, k, l;
+
+	numclusters = Map_GetNumClusters();
+
+	if (numclusters <= 1
+		|| numclusters > 65536)
+	{
+		Com_Printf("bitset_bench: load a map first\n");
+		return;
+	}
+
+	iterations = (Cmd_Argc() > 1) ? atoi(Cmd_Argv(1)) : 100000;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	words = (numclusters + 31) >> 5;
+	bytes = words << 2;
+	sink = 0;
+
+	for (i = 0; i < BENCH_ROWS; i++)
+		clusters[i] = rand() % numclusters;
+
+	for (i = 0; i < BENCH_INDICES; i++)
+		indices[i] = rand() % numclusters;
+
+	Com_Printf("bitset_bench: %i clusters (%i bytes per row), %i iterations\n", numclusters, bytes, iterations);
+
+	// the loops that used to do this work, as they were meant to work (SV_FatPVS used long, which is 64 bits on LP64)
+	start = bench_clock::now();
+
+	for (i = 0; i < iterations; i++)
+	{
+		memcpy(merged, Map_ClusterPVS(clusters[0]), bytes);
+
+		for (j = 1; j < BENCH_ROWS; j++)
+		{
+			const uint8_t* src = Map_ClusterPVS(clusters[(i + j) % BENCH_ROWS]);
+
+			for (k = 0; k < words; k++)
+				((uint32_t*)merged)[k] |= ((const uint32_t*)src)[k];
+		}
+	}
+
+	Com_Printf("%-8s merge %8.1f ns", "original", Bitset_BenchNanoseconds(start, iterations));
+
+	start = bench_clock::now();
+
+	for (i = 0; i < iterations; i++)
+	{
+		for (j = 0; j < BENCH_INDICES; j++)
+		{
+			l = indices[(i + j) % BENCH_INDICES];
+
+			if (merged[l >> 3] & (1 << (l & 7)))
+				break;
+		}
+
+		sink += j;
+	}
+
+	Com_Printf("   test %6.1f ns\n", Bitset_BenchNanoseconds(start, iterations));
+
+	for (k = 0; k < NUM_BITSET_IMPLS; k++)
+	{
+		bitset_impl_t* impl = &bitset_impls[k];
+
+		if (impl->feature
+			&& !CPUID_HasFeature(impl->feature))
+		{
+			Com_Printf("%-8s not supported by this CPU\n", impl->name);
+			continue;
+		}
+
+		start = bench_clock::now();
+
+		for (i = 0; i < iterations; i++)
+		{
+			memcpy(merged, Map_ClusterPVS(clusters[0]), bytes);
+
+			for (j = 1; j < BENCH_ROWS; j++)
+				impl->Or(merged, Map_ClusterPVS(clusters[(i + j) % BENCH_ROWS]), bytes);
+		}
+
+		Com_Printf("%-8s merge %8.1f ns", impl->name, Bitset_BenchNanoseconds(start, iterations));
+
+		start = bench_clock::now();
+
+		for (i = 0; i < iterations; i++)
+			sink += impl->TestAny(merged, indices, BENCH_INDICES);
+
+		Com_Printf("   test %6.1f ns%s\n", Bitset_BenchNanoseconds(start, iterations), (impl->Or == Bitset_Or) ? " (in use)" : "");
+	}
+}
+
+/*
+=============
+Bitset_Init
+
+Picks the fastest implementation the CPU supports, up to the level bitset_simd allows
+=============
+*/
+void Bitset_Init()
+{
+	bitset_impl_t*	impl;
+	int32_t			i;
+
+	// 0 = scalar, 1 = up to SSE2, 2 = up to AVX2
+	bitset_simd = Cvar_Get("bitset_simd", "2", CVAR_NOSET);
+
+	impl = &bitset_impls[0];
+
+	for (i = 1; i < NUM_BITSET_IMPLS; i++)
+	{
+		if (bitset_impls[i].level <= bitset_simd->value
+			&& CPUID_HasFeature(bitset_impls[i].feature))
+		{
+			impl = &bitset_impls[i];
+		}
+	}
+
+	Bitset_Or = impl->Or;
+	Bitset_TestAny = impl->TestAny;
+
+	Cmd_AddCommand("bitset_bench", Bitset_Bench_f);
+
+	Com_Printf("Bitset_Init: using %s visibility bitsets\n", impl->name);
+}
@@ -22,6 +22,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // common.c -- misc functions used in client and server
 #include "common.hpp"
 #include <setjmp.h>
+#include <atomic>
+#include <mutex>
 
 #define	MAXPRINTMSG	8192
 
@@ -60,6 +62,9 @@ int64_t time_before_game;
 int64_t time_after_game;
 int64_t time_before_ref;
 int64_t time_after_ref;
+int64_t time_trace_batches;
+int32_t num_trace_batches;
+int32_t num_batched_traces;
 
 #if DEBUG
 cvar_t* hunk_total;
@@ -111,6 +116,9 @@ Both client and server can use this, and it will output
 to the apropriate place.
 =============
 */
+static std::mutex	deferred_print_lock;
+static char			deferred_prints[MAXPRINTMSG * 4];
+
 void Com_Printf(const char* fmt, ...)
 {
 	va_list	 argptr;
@@ -120,6 +128,17 @@ void Com_Printf(const char* fmt, ...)
 	vsnprintf(msg, MAXPRINTMSG, fmt, argptr);
 	va_end(argptr);
 
+	// the console isn't thread safe, so hold on to anything printed from a job until Com_FlushDeferredPrints
+	if (!Jobs_IsMainThread())
+	{
+		std::lock_guard<std::mutex> lock(deferred_print_lock);
+
+		if (strlen(deferred_prints) + strlen(msg) < sizeof(deferred_prints))
+			strcat(deferred_prints, msg);
+
+		return;
+	}
+
 	if (rd_target)
 	{
 		if ((strlen(msg) + strlen(rd_buffer)) > (rd_buffersize - 1))
@@ -157,6 +176,30 @@ void Com_Printf(const char* fmt, ...)
 }
 
 
+/*
+================
+Com_FlushDeferredPrints
+
+Prints anything jobs printed since the last call
+================
+*/
+void Com_FlushDeferredPrints()
+{
+	char msg[sizeof(deferred_prints)];
+
+	{
+		std::lock_guard<std::mutex> lock(deferred_print_lock);
+
+		if (!deferred_prints[0])
+			return;
+
+		strcpy(msg, deferred_prints);
+		deferred_prints[0] = 0;
+	}
+
+	Com_Printf("%s", msg);
+}
+
 /*
 ================
 Com_DPrintf
@@ -245,6 +288,7 @@ void Com_Quit()
 	SV_Shutdown("Server quit\n", false);
 	SV_ShutdownGameLibraries();
 	CL_Shutdown();
+	Jobs_Shutdown();
 
 	if (logfile)
 	{
@@ -371,6 +415,51 @@ void MSG_WriteAngle16(sizebuf_t* sb, float f)
 	MSG_WriteShort(sb, ANGLE2SHORT(f));
 }
 
+/*
+==================
+MSG_WriteBits
+
+Writes the low bits of value after the last bits written, starting a new byte when the last one is full
+or something else has been written since
+==================
+*/
+void MSG_WriteBits(sizebuf_t* sb, int32_t value, int32_t bits)
+{
+	uint32_t	remaining;
+	uint8_t*	byte;
+	int32_t 	put;
+
+	remaining = (uint32_t)value;
+
+	if (bits < 32)
+		remaining &= (1u << bits) - 1;
+
+	while (bits > 0)
+	{
+		if (!sb->writebit
+			|| !sb->cursize)
+		{
+			byte = (uint8_t*)SZ_GetSpace(sb, 1);
+			*byte = 0;
+		}
+		else
+		{
+			byte = &sb->data[sb->cursize - 1];
+		}
+
+		put = 8 - sb->writebit;
+
+		if (put > bits)
+			put = bits;
+
+		*byte |= (remaining & ((1u << put) - 1)) << sb->writebit;
+		remaining >>= put;
+		bits -= put;
+
+		sb->writebit = (sb->writebit + put) & 7;
+	}
+}
+
 
 void MSG_WriteDeltaUsercmd(sizebuf_t* buf, usercmd_t* from, usercmd_t* cmd)
 {
@@ -470,13 +559,13 @@ void MSG_ReadDir(sizebuf_t* sb, vec3_t dir)
 
 /*
 ==================
-MSG_WriteDeltaEntity
+MSG_WriteDeltaEntityBytes
 
-Writes part of a packetentities message.
-Can delta from either a baseline or a previous packet_entity
+The protocol 2 encoding of an entity delta, byte aligned with float origins.
+Nothing sends it any more, cl_deltareport uses it to show what the bit packing saves
 ==================
 */
-void MSG_WriteDeltaEntity(entity_state_t* from, entity_state_t* to, sizebuf_t* msg, bool force, bool newentity)
+void MSG_WriteDeltaEntityBytes(entity_state_t* from, entity_state_t* to, sizebuf_t* msg, bool force, bool newentity)
 {
 	int32_t 	bits;
 
@@ -670,6 +759,330 @@ void MSG_WriteDeltaEntity(entity_state_t* from, entity_state_t* to, sizebuf_t* m
 		MSG_WriteShort(msg, to->solid);
 }
 
+/*
+==================
+MSG_QuantizeCoord
+==================
+*/
+static int32_t MSG_QuantizeCoord(float f)
+{
+	float	scaled;
+
+	scaled = floorf(f * COORD_SCALE + 0.5f);
+
+	// keep anything out of the world in range rather than wrapping it
+	if (!(scaled > -(1 << (COORD_BITS - 1))))
+		return -(1 << (COORD_BITS - 1));
+	if (scaled > (1 << (COORD_BITS - 1)) - 1)
+		return (1 << (COORD_BITS - 1)) - 1;
+
+	return (int32_t)scaled;
+}
+
+/*
+==================
+MSG_QuantizeAngle
+==================
+*/
+static int32_t MSG_QuantizeAngle(float f)
+{
+	return (int32_t)(f * 256 / 360) & 255;
+}
+
+/*
+==================
+MSG_WriteDeltaCoord
+
+A quantized coordinate, as a delta from the last one when it is small
+==================
+*/
+static void MSG_WriteDeltaCoord(sizebuf_t* msg, int32_t from, int32_t to)
+{
+	int32_t 	delta;
+
+	delta = to - from;
+
+	if (delta >= -(1 << (COORD_DELTA_BITS - 1))
+		&& delta < (1 << (COORD_DELTA_BITS - 1)))
+	{
+		MSG_WriteBits(msg, 0, 1);
+		MSG_WriteBits(msg, delta, COORD_DELTA_BITS);
+	}
+	else
+	{
+		MSG_WriteBits(msg, 1, 1);
+		MSG_WriteBits(msg, to, COORD_BITS);
+	}
+}
+
+/*
+==================
+MSG_WriteDeltaAngle
+==================
+*/
+static void MSG_WriteDeltaAngle(sizebuf_t* msg, int32_t from, int32_t to)
+{
+	int32_t 	delta;
+
+	// the shortest way round
+	delta = ((to - from + 128) & 255) - 128;
+
+	if (delta >= -(1 << (ANGLE_DELTA_BITS - 1))
+		&& delta < (1 << (ANGLE_DELTA_BITS - 1)))
+	{
+		MSG_WriteBits(msg, 0, 1);
+		MSG_WriteBits(msg, delta, ANGLE_DELTA_BITS);
+	}
+	else
+	{
+		MSG_WriteBits(msg, 1, 1);
+		MSG_WriteBits(msg, to, ANGLE_BITS);
+	}
+}
+
+/*
+==================
+MSG_WriteSizedBits
+
+A 2 bit size, then the value in 8, 16 or 32 bits
+==================
+*/
+static void MSG_WriteSizedBits(sizebuf_t* msg, int32_t value)
+{
+	if ((uint32_t)value < 0x100)
+	{
+		MSG_WriteBits(msg, 0, 2);
+		MSG_WriteBits(msg, value, 8);
+	}
+	else if ((uint32_t)value < 0x10000)
+	{
+		MSG_WriteBits(msg, 1, 2);
+		MSG_WriteBits(msg, value, 16);
+	}
+	else
+	{
+		MSG_WriteBits(msg, 2, 2);
+		MSG_WriteBits(msg, value, 32);
+	}
+}
+
+// the order the field bits are sent in, most often changed first
+static const int32_t entity_fields[] =
+{
+	U_ORIGIN1, U_ORIGIN2, U_ANGLE2, U_FRAME8, U_ORIGIN3, U_EVENT, U_ANGLE1, U_ANGLE3, U_OLDORIGIN,
+	U_EFFECTS8, U_MODEL, U_RENDERFX8, U_SKIN8, U_SOUND, U_SOLID, U_MODEL2, U_MODEL3, U_MODEL4,
+};
+
+#define	NUM_ENTITY_FIELDS	(int32_t)(sizeof(entity_fields) / sizeof(entity_fields[0]))
+
+/*
+==================
+MSG_WriteDeltaEntity
+
+Writes part of a packetentities message.
+Can delta from either a baseline or a previous packet_entity
+==================
+*/
+void MSG_WriteDeltaEntity(entity_state_t* from, entity_state_t* to, sizebuf_t* msg, bool force, bool newentity)
+{
+	int32_t 	bits, count, i;
+	int32_t 	from_origin[3], to_origin[3], old_origin[3];
+	int32_t 	from_angles[3], to_angles[3];
+
+	if (!to->number)
+		Com_Error(ERR_FATAL, "Unset entity number");
+	if (to->number >= MAX_EDICTS)
+		Com_Error(ERR_FATAL, "Entity number >= MAX_EDICTS");
+
+	// compare what the client will see, so changes too small to send don't cost anything
+	for (i = 0; i < 3; i++)
+	{
+		from_origin[i] = MSG_QuantizeCoord(from->origin[i]);
+		to_origin[i] = MSG_QuantizeCoord(to->origin[i]);
+		from_angles[i] = MSG_QuantizeAngle(from->angles[i]);
+		to_angles[i] = MSG_QuantizeAngle(to->angles[i]);
+	}
+
+	// send an update
+	bits = 0;
+
+	if (to_origin[0] != from_origin[0])
+		bits |= U_ORIGIN1;
+	if (to_origin[1] != from_origin[1])
+		bits |= U_ORIGIN2;
+	if (to_origin[2] != from_origin[2])
+		bits |= U_ORIGIN3;
+
+	if (to_angles[0] != from_angles[0])
+		bits |= U_ANGLE1;
+	if (to_angles[1] != from_angles[1])
+		bits |= U_ANGLE2;
+	if (to_angles[2] != from_angles[2])
+		bits |= U_ANGLE3;
+
+	if (to->skinnum != from->skinnum)
+		bits |= U_SKIN8;
+
+	if (to->frame != from->frame)
+		bits |= U_FRAME8;
+
+	if (to->effects != from->effects)
+		bits |= U_EFFECTS8;
+
+	if (to->renderfx != from->renderfx)
+		bits |= U_RENDERFX8;
+
+	if (to->solid != from->solid)
+		bits |= U_SOLID;
+
+	// event is not delta compressed, just 0 compressed
+	if (to->event)
+		bits |= U_EVENT;
+
+	if (to->modelindex != from->modelindex)
+		bits |= U_MODEL;
+	if (to->modelindex2 != from->modelindex2)
+		bits |= U_MODEL2;
+	if (to->modelindex3 != from->modelindex3)
+		bits |= U_MODEL3;
+	if (to->modelindex4 != from->modelindex4)
+		bits |= U_MODEL4;
+
+	if (to->sound != from->sound)
+		bits |= U_SOUND;
+
+	if (newentity || (to->renderfx & RF_BEAM))
+		bits |= U_OLDORIGIN;
+
+	//
+	// write the message
+	//
+	if (!bits && !force)
+		return;		// nothing to send!
+
+	//----------
+
+	MSG_WriteBits(msg, to->number, ENTITY_NUMBER_BITS);
+	MSG_WriteBits(msg, 0, 1);		// not removed
+
+	// only up to the last field that changed
+	for (count = NUM_ENTITY_FIELDS; count > 0; count--)
+	{
+		if (bits & entity_fields[count - 1])
+			break;
+	}
+
+	MSG_WriteBits(msg, count, ENTITY_FIELD_BITS);
+
+	for (i = 0; i < count; i++)
+		MSG_WriteBits(msg, (bits & entity_fields[i]) != 0, 1);
+
+	//----------
+
+	if (bits & U_ORIGIN1)
+		MSG_WriteDeltaCoord(msg, from_origin[0], to_origin[0]);
+	if (bits & U_ORIGIN2)
+		MSG_WriteDeltaCoord(msg, from_origin[1], to_origin[1]);
+
+	if (bits & U_ANGLE2)
+		MSG_WriteDeltaAngle(msg, from_angles[1], to_angles[1]);
+
+	if (bits & U_FRAME8)
+	{
+		// animations mostly step one frame at a time
+		if (to->frame == from->frame + 1)
+		{
+			MSG_WriteBits(msg, 1, 1);
+		}
+		else
+		{
+			MSG_WriteBits(msg, 0, 1);
+
+			if ((uint32_t)to->frame < 0x100)
+			{
+				MSG_WriteBits(msg, 0, 1);
+				MSG_WriteBits(msg, to->frame, 8);
+			}
+			else
+			{
+				MSG_WriteBits(msg, 1, 1);
+				MSG_WriteBits(msg, to->frame, 16);
+			}
+		}
+	}
+
+	if (bits & U_ORIGIN3)
+		MSG_WriteDeltaCoord(msg, from_origin[2], to_origin[2]);
+
+	if (bits & U_EVENT)
+		MSG_WriteBits(msg, to->event, 8);
+
+	if (bits & U_ANGLE1)
+		MSG_WriteDeltaAngle(msg, from_angles[0], to_angles[0]);
+	if (bits & U_ANGLE3)
+		MSG_WriteDeltaAngle(msg, from_angles[2], to_angles[2]);
+
+	// usually close to the origin, except for beams
+	if (bits & U_OLDORIGIN)
+	{
+		for (i = 0; i < 3; i++)
+		{
+			old_origin[i] = MSG_QuantizeCoord(to->old_origin[i]);
+			MSG_WriteDeltaCoord(msg, to_origin[i], old_origin[i]);
+		}
+	}
+
+	if (bits & U_EFFECTS8)
+		MSG_WriteSizedBits(msg, to->effects);
+
+	if (bits & U_MODEL)
+		MSG_WriteBits(msg, to->modelindex, 8);
+
+	if (bits & U_RENDERFX8)
+		MSG_WriteSizedBits(msg, to->renderfx);
+
+	if (bits & U_SKIN8)		// laser colors need all 32 bits
+		MSG_WriteSizedBits(msg, to->skinnum);
+
+	if (bits & U_SOUND)
+		MSG_WriteBits(msg, to->sound, 8);
+
+	if (bits & U_SOLID)
+		MSG_WriteBits(msg, to->solid, 16);
+
+	if (bits & U_MODEL2)
+		MSG_WriteBits(msg, to->modelindex2, 8);
+	if (bits & U_MODEL3)
+		MSG_WriteBits(msg, to->modelindex3, 8);
+	if (bits & U_MODEL4)
+		MSG_WriteBits(msg, to->modelindex4, 8);
+}
+
+/*
+==================
+MSG_WriteEntityRemove
+
+Tells the client an entity in the frame being deltaed from has gone
+==================
+*/
+void MSG_WriteEntityRemove(sizebuf_t* msg, int32_t number)
+{
+	MSG_WriteBits(msg, number, ENTITY_NUMBER_BITS);
+	MSG_WriteBits(msg, 1, 1);
+}
+
+/*
+==================
+MSG_WriteEntityEnd
+
+Ends a packetentities message
+==================
+*/
+void MSG_WriteEntityEnd(sizebuf_t* msg)
+{
+	MSG_WriteBits(msg, 0, ENTITY_NUMBER_BITS);
+}
+
 
 //============================================================
 
@@ -680,6 +1093,7 @@ void MSG_WriteDeltaEntity(entity_state_t* from, entity_state_t* to, sizebuf_t* m
 void MSG_BeginReading(sizebuf_t* msg)
 {
 	msg->readcount = 0;
+	msg->readbit = 0;
 }
 
 // returns -1 if no more characters are available
@@ -875,6 +1289,241 @@ void MSG_ReadDeltaUsercmd(sizebuf_t* msg_read, usercmd_t* from, usercmd_t* move)
 }
 
 
+/*
+==================
+MSG_ReadBits
+
+Reads the bits after the last ones read, starting on a new byte when the last one is used up
+or something else has been read since
+==================
+*/
+int32_t MSG_ReadBits(sizebuf_t* msg_read, int32_t bits)
+{
+	uint32_t	value;
+	int32_t 	bit, got, get;
+	bool		past_end;
+
+	value = 0;
+	got = 0;
+	past_end = false;
+
+	while (got < bits)
+	{
+		bit = msg_read->readbit;
+
+		if (!(bit & 7)
+			|| (bit >> 3) != msg_read->readcount - 1)
+		{
+			bit = msg_read->readcount * 8;
+			msg_read->readcount++;
+		}
+
+		get = 8 - (bit & 7);
+
+		if (get > bits - got)
+			get = bits - got;
+
+		if ((bit >> 3) >= msg_read->cursize)
+			past_end = true;
+		else
+			value |= ((uint32_t)(msg_read->data[bit >> 3] >> (bit & 7)) & ((1u << get) - 1)) << got;
+
+		got += get;
+		msg_read->readbit = bit + get;
+	}
+
+	if (past_end)
+		return -1;
+
+	return (int32_t)value;
+}
+
+/*
+==================
+MSG_ReadSignedBits
+==================
+*/
+static int32_t MSG_ReadSignedBits(sizebuf_t* msg_read, int32_t bits)
+{
+	uint32_t	value;
+
+	value = (uint32_t)MSG_ReadBits(msg_read, bits);
+
+	// sign extend
+	return (int32_t)(value << (32 - bits)) >> (32 - bits);
+}
+
+/*
+==================
+MSG_ReadDeltaCoord
+==================
+*/
+static int32_t MSG_ReadDeltaCoord(sizebuf_t* msg_read, int32_t from)
+{
+	if (!MSG_ReadBits(msg_read, 1))
+		return from + MSG_ReadSignedBits(msg_read, COORD_DELTA_BITS);
+
+	return MSG_ReadSignedBits(msg_read, COORD_BITS);
+}
+
+/*
+==================
+MSG_ReadDeltaAngle
+
+Returns the angle in degrees, from -180 like MSG_ReadAngle
+==================
+*/
+static float MSG_ReadDeltaAngle(sizebuf_t* msg_read, float from)
+{
+	int32_t 	angle;
+
+	angle = (int32_t)(from * 256 / 360) & 255;
+
+	if (!MSG_ReadBits(msg_read, 1))
+		angle += MSG_ReadSignedBits(msg_read, ANGLE_DELTA_BITS);
+	else
+		angle = MSG_ReadBits(msg_read, ANGLE_BITS);
+
+	return (int8_t)(angle & 255) * (360.0f / 256);
+}
+
+/*
+==================
+MSG_ReadSizedBits
+==================
+*/
+static int32_t MSG_ReadSizedBits(sizebuf_t* msg_read)
+{
+	switch (MSG_ReadBits(msg_read, 2))
+	{
+	case 0:
+		return MSG_ReadBits(msg_read, 8);
+	case 1:
+		return MSG_ReadBits(msg_read, 16);
+	default:
+		return MSG_ReadBits(msg_read, 32);
+	}
+}
+
+/*
+==================
+MSG_ReadEntityBits
+
+Returns the entity number and the U_ bits of an entity delta, 0 at the end of a packetentities
+==================
+*/
+int32_t MSG_ReadEntityBits(sizebuf_t* msg_read, uint32_t* bits)
+{
+	int32_t 	number, count, i;
+
+	*bits = 0;
+
+	number = MSG_ReadBits(msg_read, ENTITY_NUMBER_BITS);
+
+	if (number <= 0)
+		return number;
+
+	if (MSG_ReadBits(msg_read, 1))
+	{
+		*bits = U_REMOVE;
+		return number;
+	}
+
+	count = MSG_ReadBits(msg_read, ENTITY_FIELD_BITS);
+
+	if (count > NUM_ENTITY_FIELDS)
+		Com_Error(ERR_DROP, "MSG_ReadEntityBits: %i fields", count);
+
+	for (i = 0; i < count; i++)
+	{
+		if (MSG_ReadBits(msg_read, 1) > 0)
+			*bits |= entity_fields[i];
+	}
+
+	return number;
+}
+
+/*
+==================
+MSG_ReadDeltaEntity
+
+Can go from either a baseline or a previous packet_entity
+==================
+*/
+void MSG_ReadDeltaEntity(sizebuf_t* msg_read, entity_state_t* from, entity_state_t* to, int32_t number, uint32_t bits)
+{
+	int32_t 	i;
+
+	// set everything to the state we are delta'ing from
+	*to = *from;
+
+	VectorCopy3(from->origin, to->old_origin);
+	to->number = number;
+
+	if (bits & U_ORIGIN1)
+		to->origin[0] = (float)MSG_ReadDeltaCoord(msg_read, MSG_QuantizeCoord(from->origin[0])) / COORD_SCALE;
+	if (bits & U_ORIGIN2)
+		to->origin[1] = (float)MSG_ReadDeltaCoord(msg_read, MSG_QuantizeCoord(from->origin[1])) / COORD_SCALE;
+
+	if (bits & U_ANGLE2)
+		to->angles[1] = MSG_ReadDeltaAngle(msg_read, from->angles[1]);
+
+	if (bits & U_FRAME8)
+	{
+		if (MSG_ReadBits(msg_read, 1))
+			to->frame = from->frame + 1;
+		else if (!MSG_ReadBits(msg_read, 1))
+			to->frame = MSG_ReadBits(msg_read, 8);
+		else
+			to->frame = MSG_ReadBits(msg_read, 16);
+	}
+
+	if (bits & U_ORIGIN3)
+		to->origin[2] = (float)MSG_ReadDeltaCoord(msg_read, MSG_QuantizeCoord(from->origin[2])) / COORD_SCALE;
+
+	if (bits & U_EVENT)
+		to->event = MSG_ReadBits(msg_read, 8);
+	else
+		to->event = 0;
+
+	if (bits & U_ANGLE1)
+		to->angles[0] = MSG_ReadDeltaAngle(msg_read, from->angles[0]);
+	if (bits & U_ANGLE3)
+		to->angles[2] = MSG_ReadDeltaAngle(msg_read, from->angles[2]);
+
+	if (bits & U_OLDORIGIN)
+	{
+		for (i = 0; i < 3; i++)
+			to->old_origin[i] = (float)MSG_ReadDeltaCoord(msg_read, MSG_QuantizeCoord(to->origin[i])) / COORD_SCALE;
+	}
+
+	if (bits & U_EFFECTS8)
+		to->effects = MSG_ReadSizedBits(msg_read);
+
+	if (bits & U_MODEL)
+		to->modelindex = MSG_ReadBits(msg_read, 8);
+
+	if (bits & U_RENDERFX8)
+		to->renderfx = MSG_ReadSizedBits(msg_read);
+
+	if (bits & U_SKIN8)
+		to->skinnum = MSG_ReadSizedBits(msg_read);
+
+	if (bits & U_SOUND)
+		to->sound = MSG_ReadBits(msg_read, 8);
+
+	if (bits & U_SOLID)
+		to->solid = MSG_ReadSignedBits(msg_read, 16);
+
+	if (bits & U_MODEL2)
+		to->modelindex2 = MSG_ReadBits(msg_read, 8);
+	if (bits & U_MODEL3)
+		to->modelindex3 = MSG_ReadBits(msg_read, 8);
+	if (bits & U_MODEL4)
+		to->modelindex4 = MSG_ReadBits(msg_read, 8);
+}
+
+
 void MSG_ReadData(sizebuf_t* msg_read, void* data, int32_t len)
 {
 	int32_t i;
@@ -896,6 +1545,7 @@ void SZ_Init(sizebuf_t* buf, uint8_t* data, int32_t length)
 void SZ_Clear(sizebuf_t* buf)
 {
 	buf->cursize = 0;
+	buf->writebit = 0;
 	buf->overflowed = false;
 }
 
@@ -922,6 +1572,7 @@ void* SZ_GetSpace(sizebuf_t* buf, int32_t length)
 
 	data = buf->data + buf->cursize;
 	buf->cursize += length;
+	buf->writebit = 0;		// ends any run of MSG_WriteBits
 
 	return data;
 }
@@ -1080,6 +1731,9 @@ zhead_t	 z_chain;
 int32_t  z_count;
 int32_t	 z_bytes;
 
+// jobs allocate too, so the chain is protected by a lock
+std::recursive_mutex z_lock;
+
 /*
 ========================
 Z_Free
@@ -1094,6 +1748,8 @@ void Memory_ZoneFree(void* ptr)
 	if (z->magic != Z_MAGIC)
 		Com_Error(ERR_FATAL, "Z_Free: bad magic");
 
+	std::lock_guard<std::recursive_mutex> lock(z_lock);
+
 	z->prev->next = z->next;
 	z->next->prev = z->prev;
 
@@ -1122,6 +1778,8 @@ void Memory_ZoneFreeTags(int32_t tag)
 {
 	zhead_t* z, * next;
 
+	std::lock_guard<std::recursive_mutex> lock(z_lock);
+
 	for (z = z_chain.next; z != &z_chain; z = next)
 	{
 		next = z->next;
@@ -1132,18 +1790,25 @@ void Memory_ZoneFreeTags(int32_t tag)
 
 /*
 ========================
-Z_TagMalloc
+Memory_ZoneAllocate
+
+Returns NULL if the allocation fails
 ========================
 */
-void* Memory_ZoneMallocTagged(int32_t size, int32_t tag)
+static void* Memory_ZoneAllocate(int32_t size, int32_t tag)
 {
 	zhead_t* z;
 
+	if (size < 0)
+		return NULL;
+
 	size = size + sizeof(zhead_t);
 	z = (zhead_t*)calloc(1, size);
 
 	if (!z)
-		Com_Error(ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes", size);
+		return NULL;
+
+	z_lock.lock();
 
 	z_count++;
 	z_bytes += size;
@@ -1156,6 +1821,8 @@ void* Memory_ZoneMallocTagged(int32_t size, int32_t tag)
 	z_chain.next->prev = z;
 	z_chain.next = z;
 
+	z_lock.unlock();
+
 	if (log_memalloc
 		&& log_memalloc->value)
 	{
@@ -1165,6 +1832,23 @@ void* Memory_ZoneMallocTagged(int32_t size, int32_t tag)
 	return (void*)(z + 1);
 }
 
+/*
+========================
+Z_TagMalloc
+========================
+*/
+void* Memory_ZoneMallocTagged(int32_t size, int32_t tag)
+{
+	void* ptr;
+
+	ptr = Memory_ZoneAllocate(size, tag);
+
+	if (!ptr)
+		Com_Error(ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes", size);
+
+	return ptr;
+}
+
 /*
 ========================
 Z_Malloc
@@ -1175,6 +1859,18 @@ void* Memory_ZoneMalloc(int32_t size)
 	return Memory_ZoneMallocTagged(size, 0);
 }
 
+/*
+========================
+Memory_ZoneTryMalloc
+
+For jobs, which must not call Com_Error: returns NULL if the allocation fails
+========================
+*/
+void* Memory_ZoneTryMalloc(int32_t size)
+{
+	return Memory_ZoneAllocate(size, 0);
+}
+
 
 static uint8_t chktbl[1024] = {
 0x84, 0x47, 0x51, 0xc1, 0x93, 0x22, 0x21, 0x24, 0x2f, 0x66, 0x60, 0x4d, 0xb0, 0x7c, 0xda,
@@ -1410,6 +2106,10 @@ void Common_Init(int32_t argc, char** argv)
 
 	Localisation_Init();		// Initialise localisaiton system
 	CPUID_Init();				// Initialise CPUID
+	Bitset_Init();				// Pick the SIMD visibility routines
+	Map_Init();					// Pick the brush side routines, add the collision model commands
+	Pmove_Init();				// Player movement benchmark commands
+	Jobs_Init();				// Start the worker threads
 
 	if (!Netservices_Init())	// Initialise CURL/the game's network services
 	{
@@ -1516,15 +2216,21 @@ void Common_Frame(int32_t msec)
 
 	if (showtrace->value)
 	{
-		extern	int32_t c_traces, c_brush_traces;
-		extern	int32_t c_pointcontents;
+		extern	std::atomic<int32_t> c_traces, c_brush_traces;
+		extern	std::atomic<int32_t> c_pointcontents;
 
-		Com_Printf("%4i traces  %4i points\n", c_traces, c_pointcontents);
+		Com_Printf("%4i traces  %4i points\n", c_traces.load(), c_pointcontents.load());
 		c_traces = 0;
 		c_brush_traces = 0;
 		c_pointcontents = 0;
+
+		// showtrace 2 breaks them down
+		if (showtrace->value > 1)
+			Map_PrintTraceStats();
 	}
 
+	Map_SetTraceStats(showtrace->value > 1);
+
 	do
 	{
 		s = Sys_ConsoleInput();
@@ -1533,6 +2239,8 @@ void Common_Frame(int32_t msec)
 	} while (s);
 	Cbuf_Execute();
 
+	Com_FlushDeferredPrints();
+
 	// Poll for netservices transfers
 	Netservices_Frame();
 
@@ -1562,6 +2270,12 @@ void Common_Frame(int32_t msec)
 		cl -= rf;
 		Com_Printf("Server: %3f GameDLL: %3f Client: %3f Renderer: %3f Total: %3f\n",
 			sv, gm, cl, rf, all);
+
+		if (num_trace_batches)
+		{
+			Com_Printf("Trace batches: %i (%i traces) %3f\n", num_trace_batches, num_batched_traces,
+				time_trace_batches / 1000000.0f);
+		}
 	}
 }
 
@@ -30,6 +30,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "netservices/netservices.hpp" // hmm
 #include "pdjson.hpp"
 #include "version.hpp"
+#include <atomic>
 
 // Due to awk(wardness) we can't put this in version.h
 #define ENGINE_VERSION STR(ENGINE_VERSION_MAJOR) "." STR(ENGINE_VERSION_MINOR) "." STR(ENGINE_VERSION_REVISION) "." STR(ENGINE_VERSION_BUILD)
@@ -76,6 +77,8 @@ typedef struct sizebuf_s
 	int32_t 	maxsize;
 	int32_t 	cursize;
 	int32_t 	readcount;
+	int32_t 	writebit;		// bits MSG_WriteBits has used of the last byte, 0 once anything else is written
+	int32_t 	readbit;		// the next bit MSG_ReadBits reads, only used while it is in the last byte read
 } sizebuf_t;
 
 void SZ_Init(sizebuf_t* buf, uint8_t* data, int32_t length);
@@ -101,6 +104,9 @@ void MSG_WriteAngle(sizebuf_t* sb, float f);
 void MSG_WriteAngle16(sizebuf_t* sb, float f);
 void MSG_WriteDeltaUsercmd(sizebuf_t* buf, usercmd_t* from, usercmd_t* cmd);
 void MSG_WriteDeltaEntity(entity_state_t* from, entity_state_t* to, sizebuf_t* msg, bool force, bool newentity);
+void MSG_WriteDeltaEntityBytes(entity_state_t* from, entity_state_t* to, sizebuf_t* msg, bool force, bool newentity);
+void MSG_WriteEntityRemove(sizebuf_t* msg, int32_t number);
+void MSG_WriteEntityEnd(sizebuf_t* msg);
 void MSG_WriteDir(sizebuf_t* sb, vec3_t vector);
 void MSG_WriteColor(sizebuf_t* msg_read, color4_t color);
 
@@ -122,6 +128,13 @@ float MSG_ReadAngle16(sizebuf_t* msg_read);
 void MSG_ReadColor(sizebuf_t* msg_read, color4_t color);
 
 void MSG_ReadDeltaUsercmd(sizebuf_t* msg_read, usercmd_t* from, usercmd_t* move);
+int32_t MSG_ReadEntityBits(sizebuf_t* msg_read, uint32_t* bits);
+void MSG_ReadDeltaEntity(sizebuf_t* msg_read, entity_state_t* from, entity_state_t* to, int32_t number, uint32_t bits);
+
+// bits are packed from the lowest bit of each byte up. A run of them ends at the next byte sized write or read,
+// which starts at the following byte
+void MSG_WriteBits(sizebuf_t* sb, int32_t value, int32_t bits);
+int32_t MSG_ReadBits(sizebuf_t* sb, int32_t bits);		// -1 past the end of the message
 
 void MSG_ReadData(sizebuf_t* sb, void* buffer, int32_t size);
 
@@ -174,8 +187,10 @@ PROTOCOL
 
 // The game protocol version
 // reset to 1 9/27/2024
+// 2: netchan messages larger than NETCHAN_FRAGMENT_SIZE are sent as fragments
+// 3: entity deltas are bit packed, with quantized origins and angles
 
-#define	PROTOCOL_VERSION	1
+#define	PROTOCOL_VERSION	3
 
 //=========================================
 
@@ -296,6 +311,25 @@ typedef enum clc_ops_e
 //==============================================
 
 // entity_state_t communication
+//
+// Entity deltas are bit packed (see MSG_WriteDeltaEntity). Each one is the entity number, a remove bit, the number
+// of field bits that follow and one bit for each field, in the order of the most often changed first, so only the
+// fields up to the last one that changed cost anything. The U_ values are still what MSG_ReadEntityBits hands back.
+// U_FRAME8, U_SKIN8, U_EFFECTS8 and U_RENDERFX8 mean the field changed, the size is part of the value,
+// and U_NUMBER16, U_FRAME16, U_SKIN16, U_EFFECTS16, U_RENDERFX16 and U_MOREBITS are only used by
+// MSG_WriteDeltaEntityBytes, the byte aligned encoding of protocol 2.
+
+#define	ENTITY_NUMBER_BITS	11		// enough for MAX_EDICTS, 0 ends a packetentities
+#define	ENTITY_FIELD_BITS	5		// the number of field bits that follow
+
+// origins are sent in 1/8 units, as a delta from the last origin when it is small enough
+#define	COORD_SCALE			8
+#define	COORD_BITS			24		// +/- 1048576 units
+#define	COORD_DELTA_BITS	10		// +/- 64 units
+
+// angles are sent in 256ths of a turn, the same as MSG_WriteAngle
+#define	ANGLE_BITS			8
+#define	ANGLE_DELTA_BITS	4
 
 // try to pack the common update flags into the first byte
 #define	U_ORIGIN1	(1<<0)
@@ -546,15 +580,15 @@ typedef enum cpu_feature_e
 	cpu_feature_mmx = 0x1,				// Pentium MMX (1997)
 	cpu_feature_3dnow = 0x2,			// AMD K6-2 (1999), removed in Zen 1 (2017)
 	cpu_feature_sse1 = 0x4,				// Intel Pentium III 'Katmai' (1999)
-	cpu_feature_sse2 = 0x6,				// Intel Pentium 4 'Williamette' (2000)
-	cpu_feature_sse3 = 0x8,				// Intel Pentium 4 'Prescott' (2004)
-	cpu_feature_ssse3 = 0x10,			// Intel Core 2 'Merom' (2006) / Tejas (cancelled)
-	cpu_feature_sse4a = 0x20,			// AMD K10/Phenom II (2007)
-	cpu_feature_sse41 = 0x40,			// Intel Core 2 'Penryn' (2007)
-	cpu_feature_sse42 = 0x80,			// Intel Core i 'Nehalem' 1st gen (2008) / AMD K10/Phenom II (2007)
-	cpu_feature_avx1 = 0x100,			// Intel Core i 'Sandy Bridge' 2nd gen (2011) / AMD FX 'Bulldozer' (2011)
-	cpu_feature_fma3 = 0x200,			// AMD FX 'Piledriver' (2012) / Intel Core i 'Haswell' 4th gen (2013)
-	cpu_feature_avx2 = 0x400,			// Intel Core i 'Haswell' 4th gen (2013) / AMD FX 'Excavator' (2015)
+	cpu_feature_sse2 = 0x8,				// Intel Pentium 4 'Williamette' (2000)
+	cpu_feature_sse3 = 0x10,			// Intel Pentium 4 'Prescott' (2004)
+	cpu_feature_ssse3 = 0x20,			// Intel Core 2 'Merom' (2006) / Tejas (cancelled)
+	cpu_feature_sse4a = 0x40,			// AMD K10/Phenom II (2007)
+	cpu_feature_sse41 = 0x80,			// Intel Core 2 'Penryn' (2007)
+	cpu_feature_sse42 = 0x100,			// Intel Core i 'Nehalem' 1st gen (2008) / AMD K10/Phenom II (2007)
+	cpu_feature_avx1 = 0x200,			// Intel Core i 'Sandy Bridge' 2nd gen (2011) / AMD FX 'Bulldozer' (2011)
+	cpu_feature_fma3 = 0x400,			// AMD FX 'Piledriver' (2012) / Intel Core i 'Haswell' 4th gen (2013)
+	cpu_feature_avx2 = 0x800,			// Intel Core i 'Haswell' 4th gen (2013) / AMD FX 'Excavator' (2015)
 	// AVX 512 has a convoluted mess of support and 20 different feature flags
 	// Most other extensions are for virtualisation or security and can't be used for games. 
 	// The only one that isn't is Intel AMX, which is intended for AI and still slower than GPU
@@ -567,6 +601,61 @@ extern cvar_t* cpu_features;
 
 void CPUID_Init();
 bool CPUID_IsDefectiveIntelCPU(); // Intel Core 13th and 14th generation. These CPUs may fail due to a combination of manufacturing and microcode defects
+bool CPUID_HasFeature(cpu_feature feature);
+
+// x86 targets, where the SSE2 and AVX2 paths picked with CPUID_HasFeature can be built
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPUID_X86
+#endif
+
+// msvc lets any function use any intrinsic, gcc and clang have to be told per function
+#ifdef __GNUC__
+#define CPUID_TARGET_SSE2	__attribute__((target("sse2")))
+#define CPUID_TARGET_AVX2	__attribute__((target("avx2")))
+#else
+#define CPUID_TARGET_SSE2
+#define CPUID_TARGET_AVX2
+#endif
+
+/*
+==============================================================
+BITSETS
+==============================================================
+*/
+
+// bitset.cpp: SIMD bit vector operations for visibility, picked at startup from what CPUID_Init found
+
+extern cvar_t* bitset_simd;
+
+void	Bitset_Init();
+
+// dst |= src
+extern void (*Bitset_Or)(uint8_t* dst, const uint8_t* src, int32_t bytes);
+// true if any of the bits at indices are set. The indices must not be negative, and bits must be readable a whole 32-bit word past the highest
+extern bool (*Bitset_TestAny)(const uint8_t* bits, const int32_t* indices, int32_t count);
+
+inline bool Bitset_Test(const uint8_t* bits, int32_t index)
+{
+	return (bits[index >> 3] & (1 << (index & 7))) != 0;
+}
+
+/*
+==============================================================
+JOBS
+==============================================================
+*/
+
+// jobs.cpp: worker thread pool. Jobs must not call Com_Error, and their Com_Printf output is deferred to the main thread
+
+extern cvar_t* jobs_threads;
+
+void	Jobs_Init();
+void	Jobs_Shutdown();
+bool	Jobs_IsMainThread();
+int32_t Jobs_NumWorkers();
+void	Jobs_Submit(void (*func)(void* data), void* data);
+bool	Jobs_RunOne();		// run one queued job on this thread, returns false if there was nothing to run
+void	Jobs_ParallelFor(int32_t count, void (*func)(int32_t index, void* data), void* data);
 
 /*
 ==============================================================
@@ -611,10 +700,75 @@ void Net_Config(bool multiplayer);
 bool Net_GetPacket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message);
 void Net_SendPacket(netsrc_t sock, int32_t length, void* data, netadr_t to);
 
+// packets sent between these are held back and go out together, in one sendmmsg where the platform has it
+void Net_BeginSendBatch(netsrc_t sock);
+void Net_FlushSendBatch(netsrc_t sock);
+
+// transport counters for each socket, since the last Net_ResetStats. The atomic ones are counted by whichever thread
+// reads the sockets, so the receive thread can add to them while the main thread prints or clears them
+typedef struct net_stats_s
+{
+	std::atomic<uint64_t>	recv_calls;				// receive syscalls, including the ones that found nothing
+	std::atomic<uint64_t>	recv_packets;
+	std::atomic<uint64_t>	recv_bytes;
+	uint64_t				send_calls;				// send syscalls
+	uint64_t				send_packets;
+	uint64_t				send_bytes;
+	uint64_t				send_errors;			// packets the kernel didn't take
+	std::atomic<uint64_t>	largest_batch;			// most packets moved by one syscall, raised with Net_CountBatch
+
+	// with net_recvthread, how long packets waited between the receive thread picking them up and Net_GetPacket
+	uint64_t				queue_packets;
+	std::atomic<uint64_t>	queue_drops;			// read while the queue was full, so thrown away
+	uint64_t				queue_latency_ns;		// total
+	uint64_t				queue_latency_max_ns;
+	uint64_t				queue_jitter_ns;		// smoothed change in latency from one packet to the next (RFC 3550)
+
+	// netchan fragmentation
+	uint64_t				fragments_sent;
+	uint64_t				fragments_received;
+	uint64_t				fragments_reassembled;	// messages put back together
+	uint64_t				fragments_dropped;		// received, but thrown away because their message never completed or they were bad
+} net_stats_t;
+
+extern net_stats_t net_stats[NS_MAX + 1];
+
+// relaxed is enough, nothing is ordered by the counters
+inline void Net_CountStat(std::atomic<uint64_t>& stat, uint64_t amount)
+{
+	stat.fetch_add(amount, std::memory_order_relaxed);
+}
+
+// raises largest_batch to packets, from either thread
+inline void Net_CountBatch(netsrc_t sock, uint64_t packets)
+{
+	uint64_t largest = net_stats[sock].largest_batch.load(std::memory_order_relaxed);
+
+	while (packets > largest
+		&& !net_stats[sock].largest_batch.compare_exchange_weak(largest, packets, std::memory_order_relaxed))
+		;
+}
+
+void Net_ResetStats();
+void Net_PrintStats(netsrc_t sock);
+
+// the socket half of Net_GetPacket, implemented by each platform. Called by the receive thread when it is running,
+// in which case errors are only printed
+bool Net_ReadSocket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message);
+void Net_WaitForSockets(int32_t msec);		// returns early if either socket has a packet waiting
+
+// net_receive.cpp, an optional thread that reads the sockets as packets arrive and queues them for Net_GetPacket
+void Net_StartReceiveThread();		// the platforms call it once the sockets are open, it starts if net_recvthread is set
+void Net_StopReceiveThread();		// and this before they close
+bool Net_ReceiveThreadRunning();
+bool Net_DequeuePacket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message);
+void Net_WaitForQueue(int32_t msec);	// Net_Sleep while the thread is running
+
 bool Net_CompareAdr(netadr_t a, netadr_t b);
 bool Net_CompareBaseAdr(netadr_t a, netadr_t b);
 bool Net_IsLocalAddress(netadr_t adr);
 char* Net_AdrToString(netadr_t a);
+void Net_AdrToBuffer(netadr_t a, char* buffer, int32_t size);	// for threads other than the main one, Net_AdrToString's buffer is shared
 bool Net_StringToAdr(const char* s, netadr_t* a);
 void Net_Sleep(int32_t msec);
 
@@ -624,6 +778,10 @@ void Net_Sleep(int32_t msec);
 
 #define	MAX_LATENT	32
 
+// messages with more payload than this are split into fragments, so they don't depend on IP fragmentation
+#define	NETCHAN_FRAGMENT_SIZE	1300
+#define	NETCHAN_MAX_FRAGMENTS	((MAX_MSGLEN + NETCHAN_FRAGMENT_SIZE - 1) / NETCHAN_FRAGMENT_SIZE)
+
 typedef struct
 {
 	bool		fatal_error;
@@ -653,6 +811,13 @@ typedef struct
 	// message is copied to this buffer when it is first transfered
 	int32_t 	reliable_length;
 	uint8_t		reliable_buf[MAX_MSGLEN - 16];	// unacked reliable message
+
+	// the fragments of the message being reassembled
+	int32_t 	fragment_sequence;
+	uint32_t	fragment_bits;				// which fragments have arrived
+	int32_t 	fragment_count;
+	int32_t 	fragment_length;			// payload bytes so far
+	uint8_t		fragment_buf[MAX_MSGLEN];
 } netchan_t;
 
 extern	netadr_t	net_from;
@@ -680,6 +845,7 @@ Map Loader
 
 extern char	map_name[MAX_QPATH];
 
+void		Map_Init();		// picks the brush side tests, and adds map_tracerecord, map_tracebench and map_tracecheck
 cmodel_t*	Map_Load(const char* name, bool clientload, uint32_t* checksum);
 cmodel_t*	Map_LoadInlineModel(const char* name);	// *1, *2, etc
 
@@ -687,18 +853,53 @@ int32_t 	Map_GetNumClusters();
 int32_t 	Map_NumInlineModels();
 char*		Map_GetEntityString();
 
-// creates a clipping hull for an arbitrary box
+// lumps of the loaded map the renderer can copy instead of converting again, NULL if name isn't the loaded map
+const cplane_t*	Map_SharedPlanes(const char* name, int32_t* count);
+const dvis_t*	Map_SharedVisibility(const char* name, int32_t* length);
+
+// everything a trace needs besides the map, so traces can run on several threads at once.
+// the calls without a context use one that belongs to the calling thread
+typedef struct map_trace_context_s map_trace_context_t;
+
+map_trace_context_t*	Map_CreateTraceContext();
+void					Map_FreeTraceContext(map_trace_context_t* ctx);
+map_trace_context_t*	Map_ThreadTraceContext();
+
+// creates a clipping hull for an arbitrary box, which only traces using the same context can see
 int32_t 	Map_HeadnodeForBox(vec3_t mins, vec3_t maxs);
+int32_t 	Map_HeadnodeForBoxContext(map_trace_context_t* ctx, vec3_t mins, vec3_t maxs);
 
 // returns an ORed contents mask
 int32_t 	Map_PointContents(vec3_t p, int32_t headnode);
 int32_t 	Map_TransformedPointContents(vec3_t p, int32_t headnode, vec3_t origin, vec3_t angles);
+int32_t 	Map_PointContentsContext(map_trace_context_t* ctx, vec3_t p, int32_t headnode);
+int32_t 	Map_TransformedPointContentsContext(map_trace_context_t* ctx, vec3_t p, int32_t headnode, vec3_t origin, vec3_t angles);
 
 trace_t		Map_BoxTrace(vec3_t start, vec3_t end, vec3_t mins, vec3_t maxs, int32_t headnode, int32_t brushmask);
 trace_t		Map_TransformedBoxTrace(vec3_t start, vec3_t end, vec3_t mins, vec3_t maxs, int32_t headnode, int32_t brushmask, vec3_t origin, vec3_t angles);
+trace_t		Map_BoxTraceContext(map_trace_context_t* ctx, vec3_t start, vec3_t end, vec3_t mins, vec3_t maxs, int32_t headnode, int32_t brushmask);
+trace_t		Map_TransformedBoxTraceContext(map_trace_context_t* ctx, vec3_t start, vec3_t end, vec3_t mins, vec3_t maxs, int32_t headnode, int32_t brushmask,
+	vec3_t origin, vec3_t angles);
+
+// who traces are being made for, for showtrace 2
+typedef enum trace_caller_e
+{
+	trace_caller_other,
+	trace_caller_game,			// the game's trace and pointcontents imports
+	trace_caller_pmove,			// the server's player movement
+	trace_caller_prediction,	// the client's player movement
+	trace_caller_max
+} trace_caller_t;
+
+trace_caller_t	Map_PushTraceCaller(trace_caller_t caller);
+void			Map_PopTraceCaller(trace_caller_t previous);
+trace_caller_t	Map_TraceCaller();
+void			Map_SetTraceStats(bool enabled);
+void			Map_PrintTraceStats();
 
 uint8_t*	Map_ClusterPVS(int32_t cluster);
 uint8_t*	Map_ClusterPHS(int32_t cluster);
+bool		Map_HasVisCache();
 
 // call with topnode set to the headnode, returns with topnode
 // set to the first node that splits the box
@@ -729,6 +930,7 @@ Common between server and client so prediction matches
 */
 
 void Player_Move(pmove_t* pmove);
+void Pmove_Init();		// pmove_record and pmove_bench
 
 // physics parameters
 extern float phys_stopspeed;
@@ -772,6 +974,20 @@ void	FS_FreeFile(void* buffer);
 
 void	FS_CreatePath(char* path);
 
+// decodes a prefetched file on a job, returning Memory_ZoneMalloc'd memory or NULL. Must not call Com_Error
+typedef void* (*fs_decodefunc_t)(const char* path, uint8_t* data, int32_t length, int32_t* decoded_length);
+
+void	FS_PrefetchFile(const char* path, fs_decodefunc_t decode);
+
+// returns the decoded result of a prefetch, or NULL if it wasn't prefetched. free it with FS_FreeFile
+void*	FS_TakePrefetched(const char* path, int32_t* length);
+
+// waits for all prefetch jobs and frees anything unused
+void	FS_FlushPrefetch();
+
+void	FS_ResetStats();
+// clears the lookup counters reported by fs_stats, called on each map load
+
 
 /*
 ==============================================================
@@ -797,6 +1013,7 @@ void Com_BeginRedirect(int32_t target, char* buffer, int32_t buffersize, void(*f
 void Com_EndRedirect();
 void Com_Printf(const char* fmt, ...);
 void Com_DPrintf(const char* fmt, ...);
+void Com_FlushDeferredPrints();		// print anything jobs printed, main thread only
 void Com_Error(int32_t code, const char* fmt, ...);
 void Com_Quit();
 
@@ -806,12 +1023,15 @@ void	Com_SetServerState(int32_t state);
 uint32_t Com_BlockChecksum(void* buffer, int32_t length);
 uint8_t	Com_BlockSequenceCRCByte(uint8_t* base, int32_t length, int32_t sequence);
 
+int32_t LZ4_DecodeBlock(const uint8_t* src, int32_t src_length, uint8_t* dst, int32_t dst_length);	// lz4.cpp, returns -1 if malformed
+
 float frand();	// 0 to 1
 float crand();	// -1 to 1
 
 extern cvar_t* developer;
 extern cvar_t* dedicated;
 extern cvar_t* profile_all;
+extern cvar_t* showtrace;
 extern cvar_t* log_stats;
 extern cvar_t* debug_console;
 extern cvar_t* engine_version;
@@ -823,6 +1043,9 @@ extern int64_t time_before_game;
 extern int64_t time_after_game;
 extern int64_t time_before_ref;
 extern int64_t time_after_ref;
+extern int64_t time_trace_batches;		// spent in SV_TraceBatch, part of the game time
+extern int32_t num_trace_batches;
+extern int32_t num_batched_traces;
 
 // memalloc info
 extern int32_t z_count;
@@ -830,6 +1053,7 @@ extern int32_t z_bytes;
 
 void Memory_ZoneFree(void* ptr);
 void* Memory_ZoneMalloc(int32_t size);			// returns 0 filled memory
+void* Memory_ZoneTryMalloc(int32_t size);		// NULL instead of Com_Error if it fails, for jobs
 void* Memory_ZoneMallocTagged(int32_t size, int32_t tag);
 void Memory_ZoneFreeTags(int32_t tag);
 
@@ -927,6 +1151,7 @@ CLIENT / SERVER SYSTEMS
 
 void CL_Init();
 void CL_Drop();
+bool CL_IsConnected();		// true once the client has a server's map loaded or on the way
 void CL_Shutdown();
 void CL_Frame(int32_t msec);
 void Con_Print(char* text);
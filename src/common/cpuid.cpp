@@ -26,6 +26,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <cpuid.hpp>
 #endif
 
+#ifdef _MSC_VER
+#include <immintrin.h>		// _xgetbv
+#endif
+
 cvar_t* cpu_name;
 cvar_t* cpu_vendor; // "AuthenticAMD", "GenuineIntel",...
 cvar_t* cpu_features;
@@ -38,6 +42,20 @@ cvar_t* fake_defective_cpu;
 #define CPUID_VENDOR_LENGTH	13	// Length of the CPUID vendor string, plus one for a null terminator
 #define CPUID_NAME_LENGTH 0x31	// Length of the CPUID name/brand string (not available in some cases)
 
+// reads an extended control register, XCR0 says which register states the OS saves
+#ifdef _MSC_VER
+#define CPUID_XGetBV(index)	_xgetbv(index)
+#else
+static inline uint64_t CPUID_XGetBV(uint32_t index)
+{
+	uint32_t eax, edx;
+
+	// xgetbv by opcode, so it doesn't need -mxsave
+	__asm__ volatile (".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(index));
+	return ((uint64_t)edx << 32) | eax;
+}
+#endif
+
 #define EAX	regs[0]
 #define EBX regs[1]
 #define ECX regs[2]
@@ -56,8 +74,12 @@ cvar_t* fake_defective_cpu;
 #define BIT_FMA3 (1 << 12)
 #define BIT_SSE41 (1 << 19)
 #define BIT_SSE42 (1 << 20)
+#define BIT_OSXSAVE (1 << 27)
 #define BIT_AVX1 (1 << 28)
 
+// XGETBV XCR0: the OS saves the SSE and AVX registers on context switches
+#define XCR0_SSE_AVX 0x6
+
 //EAX=7h, EBX
 
 #define BIT_AVX2 (1 << 5)
@@ -70,6 +92,8 @@ cvar_t* fake_defective_cpu;
 
 #define BIT_SSE4A (1 << 6)
 
+static int32_t cpu_feature_flags;
+
 const char* cpu_known_defective_warning_title = "[STRING_WARNING_CPU_DEFECTIVE_TITLE]";
 const char* cpu_known_defective_warning_description =
 "[STRING_WARNING_CPU_DEFECTIVE_DESCRIPTION]";
@@ -195,9 +219,6 @@ void CPUID_Init()
 
 		if (ECX & BIT_SSSE3)
 			features |= cpu_feature_ssse3;
-		
-		if (ECX & BIT_FMA3)
-			features |= cpu_feature_fma3;
 
 		if (ECX & BIT_SSE41)
 			features |= cpu_feature_sse41;
@@ -205,12 +226,21 @@ void CPUID_Init()
 		if (ECX & BIT_SSE42)
 			features |= cpu_feature_sse42;
 
-		if (ECX & BIT_AVX1)
-			features |= cpu_feature_avx1;
+		// AVX instructions fault unless the OS has enabled the upper halves of the registers
+		if ((ECX & BIT_OSXSAVE)
+			&& (CPUID_XGetBV(0) & XCR0_SSE_AVX) == XCR0_SSE_AVX)
+		{
+			if (ECX & BIT_FMA3)
+				features |= cpu_feature_fma3;
+
+			if (ECX & BIT_AVX1)
+				features |= cpu_feature_avx1;
+		}
 	}
 
 	// Extended features
-	if (highest_basic_leaf >= 7)
+	if (highest_basic_leaf >= 7
+		&& (features & cpu_feature_avx1))
 	{
 		__cpuidex(regs, 0x7, 0x0);
 
@@ -235,6 +265,7 @@ void CPUID_Init()
 	snprintf(str_buf, 9, "%d", features);
 
 	Cvar_ForceSet("cpu_features", str_buf);
+	cpu_feature_flags = features;
 
 	Com_Printf("CPUID_Init: %s (%s, Feature Flags: 0x%2x)\n", cpu_name->string, cpu_vendor->string, (uint32_t)cpu_features->value);
 
@@ -249,6 +280,16 @@ void CPUID_Init()
 	}
 }
 
+/*
+===============
+CPUID_HasFeature
+===============
+*/
+bool CPUID_HasFeature(cpu_feature feature)
+{
+	return (cpu_feature_flags & feature) == feature;
+}
+
 bool CPUID_IsDefectiveIntelCPU()
 {
 	// Fuzzy match any Intel Core 13700/13900/14700/14900 to account for the multipicity of CPUIDs rather than using the family name.
@@ -20,6 +20,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "common.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 // define this to dissalow any data but the demo pak file
 //#define	NO_ADDONS
@@ -30,6 +33,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // This is for quake2, if you ship a game, change this...
 #define	PAK0_CHECKSUM	0x40e614e0
 
+// pak v2 file offsets are 64-bit
+#ifdef _WIN32
+#define FS_Seek64	_fseeki64
+#else
+#define FS_Seek64	fseeko
+#endif
+
 /*
 =============================================================================
 
@@ -39,6 +49,7 @@ GAME FILESYSTEM
 */
 
 cvar_t* game_basedir;
+cvar_t* fs_mmap;
 
 //
 // in memory
@@ -48,16 +59,39 @@ typedef struct
 {
 	char	name[MAX_QPATH];
 	int32_t filepos, filelen;
+	int32_t hashnext;		// next file in the same hash chain, -1 if none
 } packfile_t;
 
 typedef struct pack_s
 {
 	char		filename[MAX_OSPATH];
 	FILE* handle;
+	int32_t		version;	// 1 for id paks, or PAK2_VERSION
 	int32_t 	numfiles;
 	packfile_t* files;
+	int32_t		hashsize;	// always a power of two
+	int32_t*	hashtable;	// first file in each chain, -1 if empty
+	uint8_t*	mapbase;	// read-only mapping of the whole pak if fs_mmap is set, otherwise NULL
+	size_t		maplength;
+
+	// version 2 paks use their on-disk directory block directly instead of files and hashtable
+	uint8_t*		directory;	// either inside mapbase or a zone copy
+	int32_t*		dir_hash;	// these all point into directory, and are little endian
+	dpak2file_t*	dir_files;
+	const char*		dir_names;
+	int32_t			dir_nameslength;
 } pack_t;
 
+// where a file was found inside a pak
+typedef struct fs_pakentry_s
+{
+	pack_t*		pack;
+	int64_t		filepos;
+	int64_t		disklen;	// length as stored
+	int32_t		filelen;	// length once decompressed
+	int32_t		compression;
+} fs_pakentry_t;
+
 typedef struct filelink_s
 {
 	struct filelink_s* next;
@@ -78,6 +112,57 @@ typedef struct searchpath_s
 searchpath_t* fs_searchpaths;
 searchpath_t* fs_base_searchpaths;	// without gamedirs
 
+// lookup statistics, reset on every map load
+typedef struct fs_stats_s
+{
+	int32_t lookups;		// calls to FS_FOpenFile
+	int32_t pak_hits;		// found inside a pak
+	int32_t dir_hits;		// found on disk or through a link
+	int32_t misses;			// not found anywhere
+	int32_t compares;		// name compares done walking hash chains
+	int32_t mapped_loads;	// FS_LoadFile calls served straight out of a mapped pak
+	int32_t copied_loads;	// FS_LoadFile calls that had to read into a zone buffer
+	int32_t decompressed;	// compressed pak entries opened
+	int32_t prefetched;		// files queued by FS_PrefetchFile
+	int32_t prefetch_hits;	// loads served by a finished or in flight prefetch
+	int32_t prefetch_waits;	// ...of which had to wait for the job to finish
+} fs_stats_t;
+
+fs_stats_t fs_stats;
+
+// lookups can come from jobs as well as the main thread
+std::mutex fs_lock;
+
+//
+// asset prefetching
+//
+
+#define MAX_PREFETCH		2048
+#define PREFETCH_HASH_SIZE	4096
+
+#define PREFETCH_PENDING	0
+#define PREFETCH_READY		1
+#define PREFETCH_FAILED		2
+
+typedef struct fs_prefetch_s
+{
+	char				name[MAX_QPATH];
+	fs_decodefunc_t		decode;			// if not NULL, data is the decoded result and is handed over by FS_TakePrefetched
+	std::atomic<int32_t> state;
+	uint8_t*			data;
+	int32_t				length;
+	int32_t				hashnext;
+} fs_prefetch_t;
+
+cvar_t*			fs_prefetch;
+
+// entries are only added, looked up and freed on the main thread; a job only fills in its own entry
+fs_prefetch_t	fs_prefetches[MAX_PREFETCH];
+int32_t			fs_numprefetches;
+int32_t			fs_prefetchhash[PREFETCH_HASH_SIZE];
+
+int32_t FS_LoadPrefetched(const char* path, uint8_t** buffer);
+
 /*
 
 All of Quake's data access is through a hierarchal file system, but the contents of the file system can be transparently merged from several sources.
@@ -145,26 +230,252 @@ void FS_FCloseFile(FILE* f)
 
 /*
 ===========
-FS_FOpenFile
+FS_HashFileName
+
+Case-folded FNV-1a hash of a pak path, so that lookups match Q_strcasecmp
+===========
+*/
+uint32_t FS_HashFileName(const char* name)
+{
+	uint32_t	hash = 2166136261u;
+	int32_t		c;
+
+	while (*name)
+	{
+		c = *name++;
+
+		// fold the same way Q_strcasecmp does
+		if (c >= 'a' && c <= 'z')
+			c -= ('a' - 'A');
+
+		hash ^= (uint8_t)c;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+===========
+FS_FindInPack2
+
+Version 2 paks store each bucket's entries next to each other, so a lookup walks forward from the bucket's first entry
+until the bucket changes
+===========
+*/
+static bool FS_FindInPack2(pack_t* pak, const char* filename, fs_pakentry_t* entry)
+{
+	dpak2file_t*	file;
+	uint32_t		hash;
+	uint32_t		mask;
+	int32_t			i;
+	int32_t			nameofs;
+
+	hash = FS_HashFileName(filename);
+	mask = pak->hashsize - 1;
+
+	for (i = LittleInt(pak->dir_hash[hash & mask]); i >= 0 && i < pak->numfiles; i++)
+	{
+		file = &pak->dir_files[i];
+
+		if ((LittleIntUnsigned(file->hash) & mask) != (hash & mask))
+			break;
+
+		if (LittleIntUnsigned(file->hash) != hash)
+			continue;
+
+		fs_stats.compares++;
+		nameofs = LittleInt(file->nameofs);
+
+		if (nameofs < 0
+			|| nameofs >= pak->dir_nameslength
+			|| Q_strcasecmp(pak->dir_names + nameofs, filename))
+		{
+			continue;
+		}
+
+		entry->pack = pak;
+		entry->filepos = LittleInt64(file->filepos);
+		entry->disklen = LittleInt64(file->disklen);
+		entry->filelen = LittleInt(file->filelen);
+		entry->compression = LittleInt(file->compression);
+		return true;
+	}
+
+	return false;
+}
+
+/*
+===========
+FS_FindInPack
+
+Returns true and fills in entry if filename is in the pack
+===========
+*/
+bool FS_FindInPack(pack_t* pak, const char* filename, fs_pakentry_t* entry)
+{
+	int32_t i;
+
+	if (pak->version == PAK2_VERSION)
+		return FS_FindInPack2(pak, filename, entry);
+
+	if (!pak->hashtable)
+		return false;
+
+	for (i = pak->hashtable[FS_HashFileName(filename) & (pak->hashsize - 1)]; i != -1; i = pak->files[i].hashnext)
+	{
+		fs_stats.compares++;
+
+		if (!Q_strcasecmp(pak->files[i].name, filename))
+		{
+			entry->pack = pak;
+			entry->filepos = pak->files[i].filepos;
+			entry->disklen = pak->files[i].filelen;
+			entry->filelen = pak->files[i].filelen;
+			entry->compression = PAK2_COMPRESSION_NONE;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+===========
+FS_InMappedPak
+
+Returns true if buffer points into a memory mapped pak
+===========
+*/
+static bool FS_InMappedPak(void* buffer)
+{
+	searchpath_t*	search;
+	uint8_t*		buf = (uint8_t*)buffer;
+
+	for (search = fs_searchpaths; search; search = search->next)
+	{
+		if (search->pack
+			&& search->pack->mapbase
+			&& buf >= search->pack->mapbase
+			&& buf < search->pack->mapbase + search->pack->maplength)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+===========
+FS_DecompressEntry
+
+Reads a compressed pak entry and decodes it into a zone buffer. Returns NULL, without calling Com_Error,
+if the entry is corrupt since this runs on prefetch jobs too.
+===========
+*/
+static uint8_t* FS_DecompressEntry(fs_pakentry_t* entry, const char* filename)
+{
+	pack_t*		pak = entry->pack;
+	uint8_t*	packed;
+	uint8_t*	buf;
+	FILE*		h;
+
+	if (entry->compression != PAK2_COMPRESSION_LZ4
+		|| entry->disklen < 0
+		|| entry->disklen > INT32_MAX
+		|| entry->filelen < 0)
+	{
+		Com_Printf("FS_DecompressEntry: %s in %s has an unknown compression type\n", filename, pak->filename);
+		return NULL;
+	}
+
+	if (pak->mapbase)
+	{
+		if (entry->filepos < 0
+			|| entry->filepos + entry->disklen > (int64_t)pak->maplength)
+		{
+			Com_Printf("FS_DecompressEntry: %s in %s is past the end of the pak\n", filename, pak->filename);
+			return NULL;
+		}
+
+		packed = pak->mapbase + entry->filepos;
+	}
+	else
+	{
+		h = fopen(pak->filename, "rb");
+
+		if (!h)
+		{
+			Com_Printf("FS_DecompressEntry: couldn't reopen %s\n", pak->filename);
+			return NULL;
+		}
+
+		packed = (uint8_t*)Memory_ZoneTryMalloc((int32_t)entry->disklen);
+
+		if (!packed)
+		{
+			Com_Printf("FS_DecompressEntry: out of memory reading %s\n", filename);
+			fclose(h);
+			return NULL;
+		}
+
+		if (FS_Seek64(h, entry->filepos, SEEK_SET)
+			|| fread(packed, 1, (size_t)entry->disklen, h) != (size_t)entry->disklen)
+		{
+			Com_Printf("FS_DecompressEntry: %s in %s is past the end of the pak\n", filename, pak->filename);
+			Memory_ZoneFree(packed);
+			fclose(h);
+			return NULL;
+		}
+
+		fclose(h);
+	}
+
+	buf = (uint8_t*)Memory_ZoneTryMalloc(entry->filelen);
+
+	if (!buf)
+	{
+		Com_Printf("FS_DecompressEntry: out of memory decompressing %s\n", filename);
+	}
+	else if (LZ4_DecodeBlock(packed, (int32_t)entry->disklen, buf, entry->filelen) != entry->filelen)
+	{
+		Com_Printf("FS_DecompressEntry: %s in %s is corrupt\n", filename, pak->filename);
+		Memory_ZoneFree(buf);
+		buf = NULL;
+	}
+
+	if (!pak->mapbase)
+		Memory_ZoneFree(packed);
+
+	return buf;
+}
+
+/*
+===========
+FS_FindFile
 
 Finds the file in the search path.
 returns filesize and an open FILE *
-Used for streaming data out of either a pak file or
-a seperate file.
+
+If data is not NULL and the file is found in a memory mapped pak, or is compressed,
+no file is opened and *data points at the file's contents instead: either inside the
+mapping, or a zone buffer holding the decompressed file.
 ===========
 */
 int32_t file_from_pak = 0;
 
-
-int32_t FS_FOpenFile(const char* filename, FILE** file)
+static int32_t FS_FindFileLocked(const char* filename, FILE** file, uint8_t** data, fs_pakentry_t* compressed)
 {
 	searchpath_t* search;
 	char		netpath[MAX_OSPATH];
 	pack_t* pak;
-	int32_t 	 i;
+	fs_pakentry_t entry;
 	filelink_t* link;
 
 	file_from_pak = 0;
+	compressed->pack = NULL;
+	fs_stats.lookups++;
 
 	// check for links first
 	for (link = fs_links; link; link = link->next)
@@ -175,9 +486,11 @@ int32_t FS_FOpenFile(const char* filename, FILE** file)
 			*file = fopen(netpath, "rb");
 			if (*file)
 			{
+				fs_stats.dir_hits++;
 				Com_DPrintf("link file: %s\n", netpath);
 				return FS_filelength(*file);
 			}
+			fs_stats.misses++;
 			return -1;
 		}
 	}
@@ -190,20 +503,49 @@ int32_t FS_FOpenFile(const char* filename, FILE** file)
 		// is the element a pak file?
 		if (search->pack)
 		{
-			// look through all the pak file elements
+			// look the name up in the pak's hash index
 			pak = search->pack;
-			for (i = 0; i < pak->numfiles; i++)
-				if (!Q_strcasecmp(pak->files[i].name, filename))
-				{	// found it!
-					file_from_pak = 1;
-					Com_DPrintf("PackFile: %s : %s\n", pak->filename, filename);
-					// open a new file on the pakfile
-					*file = fopen(pak->filename, "rb");
-					if (!*file)
-						Com_Error(ERR_FATAL, "Couldn't reopen %s", pak->filename);
-					fseek(*file, pak->files[i].filepos, SEEK_SET);
-					return pak->files[i].filelen;
+
+			if (FS_FindInPack(pak, filename, &entry))
+			{	// found it!
+				file_from_pak = 1;
+				fs_stats.pak_hits++;
+				Com_DPrintf("PackFile: %s : %s\n", pak->filename, filename);
+
+				// decompressed by FS_FindFile, outside the lock
+				if (entry.compression != PAK2_COMPRESSION_NONE)
+				{
+					fs_stats.decompressed++;
+					*file = NULL;
+					*compressed = entry;
+					return entry.filelen;
+				}
+
+				if (data
+					&& pak->mapbase
+					&& entry.filepos + entry.filelen <= (int64_t)pak->maplength)
+				{
+					*file = NULL;
+					*data = pak->mapbase + entry.filepos;
+					return entry.filelen;
 				}
+
+				// open a new file on the pakfile
+				*file = fopen(pak->filename, "rb");
+				if (!*file)
+				{
+					// prefetch jobs can't Com_Error, to them it is just a missing file
+					if (!Jobs_IsMainThread())
+					{
+						Com_Printf("Couldn't reopen %s\n", pak->filename);
+						return -1;
+					}
+
+					Com_Error(ERR_FATAL, "Couldn't reopen %s", pak->filename);
+				}
+				FS_Seek64(*file, entry.filepos, SEEK_SET);
+				return entry.filelen;
+			}
 		}
 		else
 		{
@@ -219,6 +561,7 @@ int32_t FS_FOpenFile(const char* filename, FILE** file)
 			if (!*file)
 				continue;
 
+			fs_stats.dir_hits++;
 			Com_DPrintf("FindFile: %s\n", netpath);
 
 			return FS_filelength(*file);
@@ -226,12 +569,68 @@ int32_t FS_FOpenFile(const char* filename, FILE** file)
 
 	}
 
+	fs_stats.misses++;
 	Com_DPrintf("FindFile: can't find %s\n", filename);
 
 	*file = NULL;
 	return -1;
 }
 
+int32_t FS_FindFile(const char* filename, FILE** file, uint8_t** data)
+{
+	fs_pakentry_t	compressed;
+	uint8_t*		buf;
+	int32_t			len;
+
+	{
+		std::lock_guard<std::mutex> lock(fs_lock);
+
+		len = FS_FindFileLocked(filename, file, data, &compressed);
+	}
+
+	if (!compressed.pack)
+		return len;
+
+	// decompressing outside the lock lets prefetch jobs do it in parallel
+	buf = FS_DecompressEntry(&compressed, filename);
+
+	if (!buf)
+		return -1;
+
+	if (data)
+	{
+		*data = buf;
+		return len;
+	}
+
+	// anything that streams out of a FILE * gets the decompressed file through a temporary file
+	*file = tmpfile();
+
+	if (*file)
+	{
+		fwrite(buf, 1, len, *file);
+		rewind(*file);
+	}
+
+	Memory_ZoneFree(buf);
+	return (*file) ? len : -1;
+}
+
+/*
+===========
+FS_FOpenFile
+
+Finds the file in the search path.
+returns filesize and an open FILE *
+Used for streaming data out of either a pak file or
+a seperate file.
+===========
+*/
+int32_t FS_FOpenFile(const char* filename, FILE** file)
+{
+	return FS_FindFile(filename, file, NULL);
+}
+
 
 /*
 =================
@@ -273,12 +672,28 @@ void FS_Read(void* buffer, int32_t len, FILE* f)
 	}
 }
 
+/*
+=================
+FS_TryRead
+
+FS_Read for jobs, returns false instead of calling Com_Error
+=================
+*/
+static bool FS_TryRead(void* buffer, int32_t len, FILE* f)
+{
+	return fread(buffer, 1, len, f) == (size_t)len;
+}
+
 /*
 ============
 FS_LoadFile
 
 Filename are reletive to the quake search path
 a null buffer will just return the file length without loading
+
+If the file comes out of a memory mapped pak the buffer points straight into the
+mapping and is READ ONLY - callers must not modify it in place.
+Compressed pak entries are decompressed into a zone buffer.
 ============
 */
 int32_t FS_LoadFile(const char* path, void** buffer)
@@ -289,21 +704,53 @@ int32_t FS_LoadFile(const char* path, void** buffer)
 
 	buf = NULL;	// quiet compiler warning
 
-	// look for it in the filesystem or pack files
-	len = FS_FOpenFile(path, &h);
-	if (!h)
+	// already read by a prefetch job?
+	if (buffer
+		&& fs_numprefetches
+		&& Jobs_IsMainThread())
 	{
-		if (buffer)
-			*buffer = NULL;
-		return -1;
+		len = FS_LoadPrefetched(path, &buf);
+
+		if (buf)
+		{
+			*buffer = buf;
+			return len;
+		}
 	}
 
+	// just the length, which doesn't need compressed files decompressing
 	if (!buffer)
 	{
-		fclose(h);
+		fs_pakentry_t compressed;
+		std::lock_guard<std::mutex> lock(fs_lock);
+
+		len = FS_FindFileLocked(path, &h, NULL, &compressed);
+
+		if (h)
+			fclose(h);
+
+		return len;
+	}
+
+	// look for it in the filesystem or pack files
+	len = FS_FindFile(path, &h, &buf);
+
+	if (buf)
+	{
+		if (FS_InMappedPak(buf))
+			fs_stats.mapped_loads++;
+
+		*buffer = buf;
 		return len;
 	}
 
+	if (!h)
+	{
+		*buffer = NULL;
+		return -1;
+	}
+
+	fs_stats.copied_loads++;
 	buf = (uint8_t*)Memory_ZoneMalloc(len);
 	*buffer = buf;
 
@@ -318,13 +765,406 @@ int32_t FS_LoadFile(const char* path, void** buffer)
 /*
 =============
 FS_FreeFile
+
+Buffers that point into a mapped pak are owned by the pak, so there is nothing to free
 =============
 */
 void FS_FreeFile(void* buffer)
 {
+	uint8_t*		buf = (uint8_t*)buffer;
+
+	if (FS_InMappedPak(buf))
+		return;
+
 	Memory_ZoneFree(buffer);
 }
 
+/*
+=============================================================================
+
+ASSET PREFETCHING
+
+Files that are known to be needed soon (for instance everything named in the configstrings while
+connecting) are read, and optionally decoded, by jobs ahead of time. FS_LoadFile hands out copies of raw
+prefetched files, FS_TakePrefetched hands out decoded ones. Anything left over is freed by FS_FlushPrefetch.
+
+=============================================================================
+*/
+
+/*
+=============
+FS_FindPrefetch
+=============
+*/
+fs_prefetch_t* FS_FindPrefetch(const char* path)
+{
+	int32_t i;
+
+	for (i = fs_prefetchhash[FS_HashFileName(path) & (PREFETCH_HASH_SIZE - 1)]; i != -1; i = fs_prefetches[i].hashnext)
+	{
+		if (!Q_strcasecmp(fs_prefetches[i].name, path))
+			return &fs_prefetches[i];
+	}
+
+	return NULL;
+}
+
+/*
+=============
+FS_PrefetchJob
+=============
+*/
+void FS_PrefetchJob(void* data)
+{
+	fs_prefetch_t*	prefetch = (fs_prefetch_t*)data;
+	uint8_t*		buf;
+	int32_t			len;
+	FILE*			h;
+
+	buf = NULL;
+	h = NULL;
+	len = FS_FindFile(prefetch->name, &h, &buf);
+
+	if (!buf && h)
+	{
+		buf = (uint8_t*)Memory_ZoneTryMalloc(len);
+
+		if (buf
+			&& !FS_TryRead(buf, len, h))
+		{
+			Memory_ZoneFree(buf);
+			buf = NULL;
+		}
+
+		fclose(h);
+	}
+
+	if (!buf)
+	{
+		prefetch->state.store(PREFETCH_FAILED, std::memory_order_release);
+		return;
+	}
+
+	if (prefetch->decode)
+	{
+		prefetch->data = (uint8_t*)prefetch->decode(prefetch->name, buf, len, &prefetch->length);
+
+		// not FS_FreeFile, the prefetch table belongs to the main thread
+		if (!FS_InMappedPak(buf))
+			Memory_ZoneFree(buf);
+	}
+	else
+	{
+		prefetch->data = buf;
+		prefetch->length = len;
+	}
+
+	prefetch->state.store((prefetch->data) ? PREFETCH_READY : PREFETCH_FAILED, std::memory_order_release);
+}
+
+/*
+=============
+FS_WaitPrefetch
+
+Returns true if the prefetch succeeded
+=============
+*/
+bool FS_WaitPrefetch(fs_prefetch_t* prefetch)
+{
+	if (prefetch->state.load(std::memory_order_acquire) == PREFETCH_PENDING)
+	{
+		fs_stats.prefetch_waits++;
+
+		while (prefetch->state.load(std::memory_order_acquire) == PREFETCH_PENDING)
+		{
+			if (!Jobs_RunOne())
+				std::this_thread::yield();
+		}
+	}
+
+	return prefetch->state.load(std::memory_order_acquire) == PREFETCH_READY;
+}
+
+/*
+=============
+FS_PrefetchFile
+
+Starts reading path on a job. If decode is set it is run on the file's contents by the job as well,
+and must return Memory_ZoneMalloc'd memory (or NULL on failure) without calling Com_Error.
+=============
+*/
+void FS_PrefetchFile(const char* path, fs_decodefunc_t decode)
+{
+	fs_prefetch_t*	prefetch;
+	int32_t			bucket;
+
+	if (!fs_prefetch->value
+		|| !path
+		|| !path[0]
+		|| strlen(path) >= MAX_QPATH
+		|| fs_numprefetches >= MAX_PREFETCH)
+	{
+		return;
+	}
+
+	if (!fs_numprefetches)
+	{
+		for (bucket = 0; bucket < PREFETCH_HASH_SIZE; bucket++)
+			fs_prefetchhash[bucket] = -1;
+	}
+
+	if (FS_FindPrefetch(path))
+		return;
+
+	prefetch = &fs_prefetches[fs_numprefetches];
+	strcpy(prefetch->name, path);
+	prefetch->decode = decode;
+	prefetch->data = NULL;
+	prefetch->length = 0;
+	prefetch->state.store(PREFETCH_PENDING);
+
+	bucket = FS_HashFileName(path) & (PREFETCH_HASH_SIZE - 1);
+	prefetch->hashnext = fs_prefetchhash[bucket];
+	fs_prefetchhash[bucket] = fs_numprefetches;
+
+	fs_numprefetches++;
+	fs_stats.prefetched++;
+
+	Jobs_Submit(FS_PrefetchJob, prefetch);
+}
+
+/*
+=============
+FS_LoadPrefetched
+
+Returns a copy of a raw prefetched file, which the caller owns and frees with FS_FreeFile as usual.
+The cache keeps the original until FS_FlushPrefetch, so several loads of the same file (the client
+and renderer both load the map) still share one read.
+=============
+*/
+int32_t FS_LoadPrefetched(const char* path, uint8_t** buffer)
+{
+	fs_prefetch_t* prefetch;
+
+	*buffer = NULL;
+	prefetch = FS_FindPrefetch(path);
+
+	if (!prefetch
+		|| prefetch->decode
+		|| !FS_WaitPrefetch(prefetch))
+	{
+		return -1;
+	}
+
+	fs_stats.prefetch_hits++;
+
+	// the pak mapping outlives any caller
+	if (FS_InMappedPak(prefetch->data))
+	{
+		*buffer = prefetch->data;
+		return prefetch->length;
+	}
+
+	*buffer = (uint8_t*)Memory_ZoneMalloc(prefetch->length);
+	memcpy(*buffer, prefetch->data, prefetch->length);
+	return prefetch->length;
+}
+
+/*
+=============
+FS_TakePrefetched
+
+Returns the decoded result of a prefetch and hands ownership of it to the caller, who frees it with FS_FreeFile.
+Returns NULL if path was not prefetched with a decoder or it failed, in which case the caller should load it normally.
+=============
+*/
+void* FS_TakePrefetched(const char* path, int32_t* length)
+{
+	fs_prefetch_t*	prefetch;
+	uint8_t*		data;
+
+	if (!fs_numprefetches)
+		return NULL;
+
+	prefetch = FS_FindPrefetch(path);
+
+	if (!prefetch
+		|| !prefetch->decode
+		|| !FS_WaitPrefetch(prefetch)
+		|| !prefetch->data)
+	{
+		return NULL;
+	}
+
+	fs_stats.prefetch_hits++;
+	data = prefetch->data;
+	prefetch->data = NULL;
+
+	if (length)
+		*length = prefetch->length;
+
+	return data;
+}
+
+/*
+=============
+FS_FlushPrefetch
+
+Waits for every prefetch to finish and frees whatever was not used. Called at the end of registration,
+and before anything the jobs depend on (the search path, the renderer) changes.
+=============
+*/
+void FS_FlushPrefetch()
+{
+	int32_t i;
+	int32_t count;
+
+	count = fs_numprefetches;
+
+	for (i = 0; i < count; i++)
+		FS_WaitPrefetch(&fs_prefetches[i]);
+
+	fs_numprefetches = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		if (fs_prefetches[i].data)
+			FS_FreeFile(fs_prefetches[i].data);
+
+		fs_prefetches[i].data = NULL;
+	}
+
+	if (count)
+		Com_DPrintf("FS_FlushPrefetch: %i files prefetched\n", count);
+}
+
+/*
+=================
+FS_BuildPackHash
+
+Builds the case-folded hash index used by FS_FindInPack.
+Chains are built back to front so that if a pak contains the same name twice
+the first entry still wins, as it did with the old linear scan.
+=================
+*/
+void FS_BuildPackHash(pack_t* pack)
+{
+	int32_t i;
+	int32_t bucket;
+
+	pack->hashsize = 1;
+
+	// keep the load factor at or below 0.5
+	while (pack->hashsize < pack->numfiles * 2)
+		pack->hashsize <<= 1;
+
+	pack->hashtable = (int32_t*)Memory_ZoneMalloc(pack->hashsize * sizeof(int32_t));
+
+	for (i = 0; i < pack->hashsize; i++)
+		pack->hashtable[i] = -1;
+
+	for (i = pack->numfiles - 1; i >= 0; i--)
+	{
+		bucket = FS_HashFileName(pack->files[i].name) & (pack->hashsize - 1);
+		pack->files[i].hashnext = pack->hashtable[bucket];
+		pack->hashtable[bucket] = i;
+	}
+}
+
+/*
+=================
+FS_LoadPackFile2
+
+Version 2 paks need no parsing - the directory block is checked and then used as is,
+straight out of the mapping if fs_mmap is set, otherwise out of a single read.
+=================
+*/
+pack_t* FS_LoadPackFile2(char* packfile, FILE* packhandle)
+{
+	dpak2header_t	header;
+	pack_t*			pack;
+	uint8_t*		directory;
+	uint8_t*		mapbase;
+	size_t			maplength;
+	int64_t			numfiles, hashsize, hashofs, dirofs, namesofs, dirlen;
+
+	fseek(packhandle, 0, SEEK_SET);
+
+	if (fread(&header, 1, sizeof(header), packhandle) != sizeof(header))
+		Com_Error(ERR_FATAL, "%s is not a packfile", packfile);
+
+	if (LittleInt(header.version) != PAK2_VERSION)
+		Com_Error(ERR_FATAL, "%s has wrong version number (%i should be %i)", packfile, LittleInt(header.version), PAK2_VERSION);
+
+	numfiles = LittleInt(header.numfiles);
+	hashsize = LittleInt(header.hashsize);
+	hashofs = LittleInt(header.hashofs);
+	dirofs = LittleInt(header.dirofs);
+	namesofs = LittleInt(header.namesofs);
+	dirlen = LittleInt(header.dirlen);
+
+	// make sure every lookup stays inside the directory block
+	if (numfiles < 0
+		|| hashsize <= 0
+		|| (hashsize & (hashsize - 1))
+		|| hashofs < (int64_t)sizeof(header)
+		|| hashofs + hashsize * (int64_t)sizeof(int32_t) > dirlen
+		|| dirofs < (int64_t)sizeof(header)
+		|| dirofs + numfiles * (int64_t)sizeof(dpak2file_t) > dirlen
+		|| namesofs < (int64_t)sizeof(header)
+		|| namesofs >= dirlen)
+	{
+		Com_Error(ERR_FATAL, "%s has a bad directory", packfile);
+	}
+
+	mapbase = NULL;
+	maplength = 0;
+
+	if (fs_mmap->value)
+	{
+		mapbase = (uint8_t*)Sys_MapFile(packfile, &maplength);
+
+		if (!mapbase)
+			Com_Printf("Couldn't map %s, falling back to buffered reads\n", packfile);
+		else if ((int64_t)maplength < dirlen)
+			Com_Error(ERR_FATAL, "%s is truncated", packfile);
+	}
+
+	if (mapbase)
+	{
+		directory = mapbase;
+	}
+	else
+	{
+		directory = (uint8_t*)Memory_ZoneMalloc((int32_t)dirlen);
+		fseek(packhandle, 0, SEEK_SET);
+
+		if (fread(directory, 1, (size_t)dirlen, packhandle) != (size_t)dirlen)
+			Com_Error(ERR_FATAL, "%s is truncated", packfile);
+	}
+
+	// names are compared in place, so the last one has to be terminated
+	if (directory[dirlen - 1] != 0)
+		Com_Error(ERR_FATAL, "%s has a bad directory", packfile);
+
+	pack = (pack_t*)Memory_ZoneMalloc(sizeof(pack_t));
+	strcpy(pack->filename, packfile);
+	pack->handle = packhandle;
+	pack->version = PAK2_VERSION;
+	pack->numfiles = (int32_t)numfiles;
+	pack->hashsize = (int32_t)hashsize;
+	pack->mapbase = mapbase;
+	pack->maplength = maplength;
+	pack->directory = directory;
+	pack->dir_hash = (int32_t*)(directory + hashofs);
+	pack->dir_files = (dpak2file_t*)(directory + dirofs);
+	pack->dir_names = (const char*)(directory + namesofs);
+	pack->dir_nameslength = (int32_t)(dirlen - namesofs);
+
+	Com_Printf("Added packfile %s (%i files, version %i)\n", packfile, pack->numfiles, PAK2_VERSION);
+	return pack;
+}
+
 /*
 =================
 FS_LoadPackFile
@@ -351,6 +1191,10 @@ pack_t* FS_LoadPackFile(char* packfile)
 		return NULL;
 
 	fread(&header, 1, sizeof(header), packhandle);
+
+	if (LittleInt(header.ident) == IDPAK2HEADER)
+		return FS_LoadPackFile2(packfile, packhandle);
+
 	if (LittleInt(header.ident) != IDPAKHEADER)
 		Com_Error(ERR_FATAL, "%s is not a packfile", packfile);
 	header.dirofs = LittleInt(header.dirofs);
@@ -384,9 +1228,20 @@ pack_t* FS_LoadPackFile(char* packfile)
 	pack = (pack_t*)Memory_ZoneMalloc(sizeof(pack_t));
 	strcpy(pack->filename, packfile);
 	pack->handle = packhandle;
+	pack->version = 1;
 	pack->numfiles = numpackfiles;
 	pack->files = newfiles;
 
+	FS_BuildPackHash(pack);
+
+	if (fs_mmap->value)
+	{
+		pack->mapbase = (uint8_t*)Sys_MapFile(packfile, &pack->maplength);
+
+		if (!pack->mapbase)
+			Com_Printf("Couldn't map %s, falling back to buffered reads\n", packfile);
+	}
+
 	Com_Printf("Added packfile %s (%i files)\n", packfile, numpackfiles);
 	return pack;
 }
@@ -486,6 +1341,9 @@ void FS_SetGamedir(char* dir)
 		return;
 	}
 
+	// prefetch jobs walk the search path
+	FS_FlushPrefetch();
+
 	//
 	// free up any current game dir info
 	//
@@ -494,7 +1352,19 @@ void FS_SetGamedir(char* dir)
 		if (fs_searchpaths->pack)
 		{
 			fclose(fs_searchpaths->pack->handle);
-			Memory_ZoneFree(fs_searchpaths->pack->files);
+			Sys_UnmapFile(fs_searchpaths->pack->mapbase, fs_searchpaths->pack->maplength);
+
+			if (fs_searchpaths->pack->version == PAK2_VERSION)
+			{
+				if (fs_searchpaths->pack->directory != fs_searchpaths->pack->mapbase)
+					Memory_ZoneFree(fs_searchpaths->pack->directory);
+			}
+			else
+			{
+				Memory_ZoneFree(fs_searchpaths->pack->hashtable);
+				Memory_ZoneFree(fs_searchpaths->pack->files);
+			}
+
 			Memory_ZoneFree(fs_searchpaths->pack);
 		}
 		next = fs_searchpaths->next;
@@ -679,7 +1549,7 @@ void FS_Path_f()
 		if (s == fs_base_searchpaths)
 			Com_Printf("----------\n");
 		if (s->pack)
-			Com_Printf("%s (%i files)\n", s->pack->filename, s->pack->numfiles);
+			Com_Printf("%s (%i files%s)\n", s->pack->filename, s->pack->numfiles, (s->pack->mapbase) ? ", mapped" : "");
 		else
 			Com_Printf("%s\n", s->filename);
 	}
@@ -689,6 +1559,95 @@ void FS_Path_f()
 		Com_Printf("%s : %s\n", l->from, l->to);
 }
 
+/*
+============
+FS_ResetStats
+
+Called on each map load so fs_stats reports the lookups made while loading and registering that map
+============
+*/
+void FS_ResetStats()
+{
+	if (fs_stats.lookups)
+	{
+		Com_DPrintf("FS: %i lookups, %i pak hits, %i dir hits, %i misses, %i compares since last map load\n",
+			fs_stats.lookups, fs_stats.pak_hits, fs_stats.dir_hits, fs_stats.misses, fs_stats.compares);
+	}
+
+	memset(&fs_stats, 0, sizeof(fs_stats));
+}
+
+/*
+============
+FS_Stats_f
+
+============
+*/
+void FS_Stats_f()
+{
+	searchpath_t*	s;
+	int32_t			i, used, longest, length;
+
+	Com_Printf("Lookups since last map load:\n");
+	Com_Printf("%8i lookups\n", fs_stats.lookups);
+	Com_Printf("%8i pak hits\n", fs_stats.pak_hits);
+	Com_Printf("%8i dir hits\n", fs_stats.dir_hits);
+	Com_Printf("%8i misses\n", fs_stats.misses);
+	Com_Printf("%8i compares (%.2f per lookup)\n", fs_stats.compares,
+		fs_stats.lookups ? (float)fs_stats.compares / fs_stats.lookups : 0.0f);
+	Com_Printf("%8i loads from mapped paks\n", fs_stats.mapped_loads);
+	Com_Printf("%8i loads copied into zone memory\n", fs_stats.copied_loads);
+	Com_Printf("%8i compressed files decompressed\n", fs_stats.decompressed);
+	Com_Printf("%8i files prefetched, %i prefetch hits, %i waited on\n", fs_stats.prefetched, fs_stats.prefetch_hits, fs_stats.prefetch_waits);
+
+	Com_Printf("\nPak indices:\n");
+	for (s = fs_searchpaths; s; s = s->next)
+	{
+		if (!s->pack)
+			continue;
+
+		used = longest = 0;
+
+		for (i = 0; i < s->pack->hashsize; i++)
+		{
+			int32_t j;
+
+			if (s->pack->version == PAK2_VERSION)
+			{
+				// buckets are runs of entries
+				j = LittleInt(s->pack->dir_hash[i]);
+
+				if (j < 0)
+					continue;
+
+				for (length = 0; j < s->pack->numfiles
+					&& (LittleIntUnsigned(s->pack->dir_files[j].hash) & (s->pack->hashsize - 1)) == (uint32_t)i; j++)
+				{
+					length++;
+				}
+			}
+			else
+			{
+				if (s->pack->hashtable[i] == -1)
+					continue;
+
+				length = 0;
+
+				for (j = s->pack->hashtable[i]; j != -1; j = s->pack->files[j].hashnext)
+					length++;
+			}
+
+			used++;
+
+			if (length > longest)
+				longest = length;
+		}
+
+		Com_Printf("%s: version %i, %i files, %i/%i buckets, longest chain %i\n", s->pack->filename, s->pack->version,
+			s->pack->numfiles, used, s->pack->hashsize, longest);
+	}
+}
+
 /*
 ================
 FS_NextPath
@@ -728,10 +1687,18 @@ void FS_InitFilesystem()
 	Cmd_AddCommand("path", FS_Path_f);
 	Cmd_AddCommand("link", FS_Link_f);
 	Cmd_AddCommand("dir", FS_Dir_f);
+	Cmd_AddCommand("fs_stats", FS_Stats_f);
 
 	//todo: get current working directory
 	game_basedir = Cvar_Get("basedir", "", 0);
 
+	// map paks into memory and hand out pointers into them instead of reading each file
+	// only settable from the command line, since it has to be known before any pak is opened
+	fs_mmap = Cvar_Get("fs_mmap", "0", CVAR_NOSET);
+
+	// read assets named in the configstrings on worker threads while connecting
+	fs_prefetch = Cvar_Get("fs_prefetch", "1", 0);
+
 	//
 	// start up with zombonogame by default
 	//
@@ -50,4 +50,50 @@ typedef struct
 	int32_t 	dirlen;
 } dpackheader_t;
 
-#define	MAX_FILES_IN_PACK	4096
\ No newline at end of file
+#define	MAX_FILES_IN_PACK	4096
+
+/*
+========================================================================
+
+Version 2 paks put everything needed to find a file in one block at the start
+of the pak, so it can be used in place out of a memory mapping (or read with a
+single fread) without being parsed:
+
+	dpak2header_t
+	int32_t		hashtable[hashsize]		first entry in each bucket, -1 if empty
+	dpak2file_t	files[numfiles]			sorted by (hash & (hashsize - 1)), so every bucket is contiguous
+	char		names[]					null terminated paths, referenced by nameofs
+
+hash is FS_HashFileName (case-folded FNV-1a). Everything is little endian.
+File data follows the directory block, and may be compressed per entry.
+
+========================================================================
+*/
+
+#define IDPAK2HEADER	(('2'<<24)+('K'<<16)+('A'<<8)+'P')
+#define PAK2_VERSION	2
+
+#define PAK2_COMPRESSION_NONE	0
+#define PAK2_COMPRESSION_LZ4	1	// raw LZ4 block, no frame
+
+typedef struct
+{
+	uint32_t	hash;
+	int32_t		nameofs;		// relative to namesofs
+	int32_t		compression;	// PAK2_COMPRESSION_*
+	int32_t		filelen;		// uncompressed length
+	int64_t		filepos;		// from the start of the pak
+	int64_t		disklen;		// length of the data as stored
+} dpak2file_t;
+
+typedef struct
+{
+	int32_t		ident;			// == IDPAK2HEADER
+	int32_t		version;		// == PAK2_VERSION
+	int32_t		numfiles;
+	int32_t		hashsize;		// always a power of two
+	int32_t		hashofs;		// these are all from the start of the pak
+	int32_t		dirofs;
+	int32_t		namesofs;
+	int32_t		dirlen;			// length of the whole directory block, including this header
+} dpak2header_t;
@@ -0,0 +1,325 @@
+/*
+Copyright (C) 2023-2024 starfrost
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+// jobs.cpp: Worker thread pool
+//
+// Jobs run on a small pool of worker threads. A job must not call Com_Error (it longjmps on the wrong thread),
+// and anything it prints with Com_Printf is held back until the main thread next runs Common_Frame.
+// Everything else the engine does (cvars, commands, the console, the renderer) is main thread only.
+
+#include <common/common.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define MAX_JOB_WORKERS		16
+#define MAX_QUEUED_JOBS		4096
+
+typedef struct job_s
+{
+	void	(*func)(void* data);
+	void*	data;
+} job_t;
+
+// a Jobs_ParallelFor in flight. Refcounted, because helper jobs that start after the caller has finished
+// all the work still need to look at it before they leave
+typedef struct job_parallel_s
+{
+	void	(*func)(int32_t index, void* data);
+	void*	data;
+	int32_t count;
+	std::atomic<int32_t> next;		// next index to hand out
+	std::atomic<int32_t> done;		// indices finished
+	std::atomic<int32_t> refs;
+} job_parallel_t;
+
+cvar_t*			jobs_threads;
+
+std::thread*	job_workers[MAX_JOB_WORKERS];
+int32_t			job_numworkers;
+
+static std::thread::id job_mainthread = std::this_thread::get_id();
+
+job_t			job_queue[MAX_QUEUED_JOBS];
+int32_t			job_head;			// next job to run
+int32_t			job_count;			// jobs waiting in the queue
+std::mutex		job_lock;
+std::condition_variable job_wake;
+bool			job_quit;
+
+/*
+===============
+Jobs_IsMainThread
+===============
+*/
+bool Jobs_IsMainThread()
+{
+	return std::this_thread::get_id() == job_mainthread;
+}
+
+/*
+===============
+Jobs_NumWorkers
+
+Returns the number of worker threads, not counting the main thread
+===============
+*/
+int32_t Jobs_NumWorkers()
+{
+	return job_numworkers;
+}
+
+/*
+===============
+Jobs_Pop
+
+Takes the next job off the queue. job_lock must be held
+===============
+*/
+static bool Jobs_Pop(job_t* job)
+{
+	if (!job_count)
+		return false;
+
+	*job = job_queue[job_head];
+	job_head = (job_head + 1) % MAX_QUEUED_JOBS;
+	job_count--;
+	return true;
+}
+
+/*
+===============
+Jobs_Worker
+===============
+*/
+static void Jobs_Worker()
+{
+	job_t job;
+
+	while (1)
+	{
+		{
+			std::unique_lock<std::mutex> lock(job_lock);
+
+			job_wake.wait(lock, [] { return job_quit || job_count > 0; });
+
+			if (job_quit)
+				return;
+
+			Jobs_Pop(&job);
+		}
+
+		job.func(job.data);
+	}
+}
+
+/*
+===============
+Jobs_Submit
+
+Queues func to run on a worker thread. If there are no workers, or the queue is full, it runs right away on the calling thread.
+===============
+*/
+void Jobs_Submit(void (*func)(void* data), void* data)
+{
+	if (job_numworkers)
+	{
+		std::lock_guard<std::mutex> lock(job_lock);
+
+		if (job_count < MAX_QUEUED_JOBS)
+		{
+			job_queue[(job_head + job_count) % MAX_QUEUED_JOBS].func = func;
+			job_queue[(job_head + job_count) % MAX_QUEUED_JOBS].data = data;
+			job_count++;
+			job_wake.notify_one();
+			return;
+		}
+	}
+
+	func(data);
+}
+
+/*
+===============
+Jobs_RunOne
+
+Runs one queued job on the calling thread, if there is one. Used while waiting on a job, so that
+waiting never deadlocks even if every worker is busy.
+===============
+*/
+bool Jobs_RunOne()
+{
+	job_t job;
+
+	{
+		std::lock_guard<std::mutex> lock(job_lock);
+
+		if (!Jobs_Pop(&job))
+			return false;
+	}
+
+	job.func(job.data);
+	return true;
+}
+
+/*
+===============
+Jobs_ParallelWork
+
+Runs indices of a Jobs_ParallelFor until there are none left
+===============
+*/
+static void Jobs_ParallelWork(job_parallel_t* parallel)
+{
+	int32_t index;
+
+	while ((index = parallel->next.fetch_add(1)) < parallel->count)
+	{
+		parallel->func(index, parallel->data);
+		parallel->done.fetch_add(1, std::memory_order_release);
+	}
+}
+
+static void Jobs_ParallelRelease(job_parallel_t* parallel)
+{
+	if (parallel->refs.fetch_sub(1) == 1)
+		delete parallel;
+}
+
+static void Jobs_ParallelHelper(void* data)
+{
+	job_parallel_t* parallel = (job_parallel_t*)data;
+
+	Jobs_ParallelWork(parallel);
+	Jobs_ParallelRelease(parallel);
+}
+
+/*
+===============
+Jobs_ParallelFor
+
+Calls func(index, data) for every index in [0, count) spread across the workers and the calling thread,
+and returns once all of them have finished.
+===============
+*/
+void Jobs_ParallelFor(int32_t count, void (*func)(int32_t index, void* data), void* data)
+{
+	job_parallel_t* parallel;
+	int32_t			helpers;
+	int32_t			i;
+
+	if (count <= 0)
+		return;
+
+	helpers = job_numworkers;
+
+	if (helpers > count - 1)
+		helpers = count - 1;
+
+	if (!helpers)
+	{
+		for (i = 0; i < count; i++)
+			func(i, data);
+
+		return;
+	}
+
+	parallel = new job_parallel_t;
+	parallel->func = func;
+	parallel->data = data;
+	parallel->count = count;
+	parallel->next = 0;
+	parallel->done = 0;
+	parallel->refs = helpers + 1;
+
+	for (i = 0; i < helpers; i++)
+		Jobs_Submit(Jobs_ParallelHelper, parallel);
+
+	Jobs_ParallelWork(parallel);
+
+	// wait for indices other threads picked up, helping with anything else queued meanwhile
+	while (parallel->done.load(std::memory_order_acquire) < count)
+	{
+		if (!Jobs_RunOne())
+			std::this_thread::yield();
+	}
+
+	Jobs_ParallelRelease(parallel);
+}
+
+/*
+===============
+Jobs_Init
+===============
+*/
+void Jobs_Init()
+{
+	int32_t count;
+
+	// 0 picks one worker per hardware thread, leaving one for the main thread
+	jobs_threads = Cvar_Get("jobs_threads", "0", CVAR_NOSET);
+
+	count = (int32_t)jobs_threads->value;
+
+	if (count <= 0)
+		count = (int32_t)std::thread::hardware_concurrency() - 1;
+
+	if (count > MAX_JOB_WORKERS)
+		count = MAX_JOB_WORKERS;
+
+	job_quit = false;
+
+	for (job_numworkers = 0; job_numworkers < count; job_numworkers++)
+		job_workers[job_numworkers] = new std::thread(Jobs_Worker);
+
+	Com_Printf("Started %i worker threads\n", job_numworkers);
+}
+
+/*
+===============
+Jobs_Shutdown
+
+Runs whatever is still queued, then stops the workers
+===============
+*/
+void Jobs_Shutdown()
+{
+	int32_t i;
+
+	while (Jobs_RunOne())
+		;
+
+	{
+		std::lock_guard<std::mutex> lock(job_lock);
+		job_quit = true;
+	}
+
+	job_wake.notify_all();
+
+	for (i = 0; i < job_numworkers; i++)
+	{
+		job_workers[i]->join();
+		delete job_workers[i];
+		job_workers[i] = NULL;
+	}
+
+	job_numworkers = 0;
+}
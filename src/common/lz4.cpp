@@ -0,0 +1,144 @@
+/*
+Copyright (C) 2023-2024 starfrost
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+// lz4.cpp: Decoder for raw LZ4 blocks, as written by mkpak for compressed pak v2 entries
+//
+// A block is a series of sequences, each of which is a token byte (literal length in the high nibble, match length - 4 in
+// the low nibble, 15 meaning more length bytes follow), the literals, then a 16-bit little endian match offset and any extra
+// match length bytes. The last sequence has literals only.
+
+#include "common.hpp"
+
+/*
+=============
+LZ4_ReadLength
+
+Adds any extra length bytes to a 15 from a token
+=============
+*/
+static bool LZ4_ReadLength(const uint8_t** in, const uint8_t* in_end, int32_t* length)
+{
+	uint8_t	next;
+
+	do
+	{
+		if (*in >= in_end)
+			return false;
+
+		next = *(*in)++;
+		*length += next;
+
+		if (*length < 0)
+			return false;
+
+	} while (next == 255);
+
+	return true;
+}
+
+/*
+=============
+LZ4_DecodeBlock
+
+Decodes src into dst, returning the decoded length, or -1 if the block is malformed or would not fit.
+Never reads or writes out of bounds, so it is safe to run on untrusted paks, and on any thread.
+=============
+*/
+int32_t LZ4_DecodeBlock(const uint8_t* src, int32_t src_length, uint8_t* dst, int32_t dst_length)
+{
+	const uint8_t*	in = src;
+	const uint8_t*	in_end = src + src_length;
+	uint8_t*		out = dst;
+	uint8_t*		out_end = dst + dst_length;
+	const uint8_t*	match;
+	int32_t			token;
+	int32_t			length;
+	int32_t			offset;
+
+	while (in < in_end)
+	{
+		token = *in++;
+
+		// literals
+		length = token >> 4;
+
+		if (length == 15
+			&& !LZ4_ReadLength(&in, in_end, &length))
+		{
+			return -1;
+		}
+
+		if (length > in_end - in
+			|| length > out_end - out)
+		{
+			return -1;
+		}
+
+		memcpy(out, in, length);
+		in += length;
+		out += length;
+
+		// the last sequence stops after its literals
+		if (in == in_end)
+			break;
+
+		// match
+		if (in_end - in < 2)
+			return -1;
+
+		offset = in[0] | (in[1] << 8);
+		in += 2;
+
+		if (offset == 0
+			|| offset > out - dst)
+		{
+			return -1;
+		}
+
+		length = token & 15;
+
+		if (length == 15
+			&& !LZ4_ReadLength(&in, in_end, &length))
+		{
+			return -1;
+		}
+
+		length += 4;
+
+		if (length > out_end - out)
+			return -1;
+
+		match = out - offset;
+
+		// fast path when the match doesn't overlap what it is writing, otherwise it repeats a pattern and has to go byte by byte
+		if (offset >= length)
+		{
+			memcpy(out, match, length);
+			out += length;
+		}
+		else
+		{
+			while (length--)
+				*out++ = *match++;
+		}
+	}
+
+	return (int32_t)(out - dst);
+}
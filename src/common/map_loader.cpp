@@ -21,13 +21,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // cmodel.c -- model loading
 
 #include "common.hpp"
+#include <atomic>
+#include <cfloat>
 
+// the splitting plane is copied into the node, so walking the tree reads one 32 byte node per level
+// (two to a cache line) rather than the node and then a plane somewhere else
 typedef struct
 {
-	cplane_t		*plane;
+	cplane_t		plane;
 	int32_t 		children[2];		// negative numbers are leafs
+	int32_t 		pad;
 } cnode_t;
 
+static_assert(sizeof(cnode_t) == 32, "cnode_t should fill half a cache line");
+
 typedef struct
 {
 	cplane_t		*plane;
@@ -48,7 +55,7 @@ typedef struct
 	int32_t 		contents;
 	int32_t 		numsides;
 	int32_t 		firstbrushside;
-	int32_t 		checkcount;		// to avoid repeated testings
+	vec3_t			mins, maxs;		// from its axial sides, so traces that can't reach it skip the side tests
 } cbrush_t;
 
 typedef struct
@@ -59,8 +66,6 @@ typedef struct
 	int32_t 	floodvalid;
 } carea_t;
 
-int32_t 		checkcount;
-
 char			map_name[MAX_QPATH];
 
 int32_t 		numbrushsides;
@@ -73,7 +78,7 @@ int32_t 		numplanes;
 cplane_t		map_planes[MAX_MAP_PLANES+6];		// extra for box hull
 
 int32_t 		numnodes;
-cnode_t			map_nodes[MAX_MAP_NODES+6];		// extra for box hull
+alignas(64) cnode_t map_nodes[MAX_MAP_NODES+6];	// extra for box hull
 
 int32_t 		numleafs = 1;	// allow leaf funcs to be called without a map
 cleaf_t			map_leafs[MAX_MAP_LEAFS];
@@ -98,6 +103,12 @@ char			map_entitystring[MAX_MAP_ENTSTRING];
 int32_t 		numareas = 1;
 carea_t			map_areas[MAX_MAP_AREAS];
 
+// every area in each flood, so Map_WriteAreaBits is a copy, and how many there are
+uint8_t			map_floodbits[MAX_MAP_AREAS][MAX_MAP_AREAS/8];
+int32_t			map_floodsizes[MAX_MAP_AREAS];
+
+int32_t			map_portalareas[MAX_MAP_AREAPORTALS][2];	// the areas each portal joins, 0 if it doesn't
+
 int32_t 		numareaportals;
 dareaportal_t	map_areaportals[MAX_MAP_AREAPORTALS];
 
@@ -110,13 +121,56 @@ int32_t 		floodvalid;
 bool			portalopen[MAX_MAP_AREAPORTALS];
 
 cvar_t*			map_noareas;
+cvar_t*			map_viscache;
+
+// every cluster's PVS row followed by every cluster's PHS row, decompressed at load time.
+// NULL if map_viscache is off or the map is over budget, in which case rows are decompressed on demand
+uint8_t*		map_viscachedata;
+int32_t			map_visrowbytes;	// row stride, padded so rows can be merged a word at a time
 
 void	Map_InitBoxHull ();
 void	Map_FloodAreaConnections ();
+void	Map_BuildVisCache ();
+void	Map_FreeVisCache ();
+static void Map_StopTraceRecording ();
+
+
+#ifdef CPUID_X86
+#include <immintrin.h>
+#endif
+
+#define MAP_SIDE_CHUNK		16		// brush sides measured at a time, so a trace that misses early doesn't measure them all
+#define MAP_SIMD_MIN_SIDES	8		// fewer and the scalar version is as quick
+
+cvar_t*			map_simd;
+
+// how far two points are in front of some brush sides, set by Map_Init
+static void		(*Map_SideDistances)(cbrushside_t* sides, int32_t count, bool ispoint, vec3_t mins, vec3_t maxs,
+					vec3_t p1, vec3_t p2, float* d1, float* d2);
+
+// statistics for showtrace, added to from any thread
+std::atomic<int32_t> c_pointcontents;
+std::atomic<int32_t> c_traces, c_brush_traces;
+
+// the breakdown showtrace 2 prints, only gathered while it is on
+typedef struct
+{
+	std::atomic<int32_t>	traces;
+	std::atomic<int32_t>	nodes;		// nodes and leafs the traces walked
+	std::atomic<int32_t>	brushes;	// brushes the traces clipped against
+} map_trace_bucket_t;
+
+#define TRACE_HULL_SIZES	5		// point, and the largest extent up to 8, 16, 32 and above that
 
+static const char*			map_trace_caller_names[trace_caller_max] = { "other", "game", "pmove", "prediction" };
+static const char*			map_trace_hull_names[TRACE_HULL_SIZES] = { "point", "<= 8", "<= 16", "<= 32", "> 32" };
 
-int32_t 	c_pointcontents;
-int32_t 	c_traces, c_brush_traces;
+static bool					map_trace_stats;
+static map_trace_bucket_t	map_trace_callers[trace_caller_max];
+static map_trace_bucket_t	map_trace_hulls[TRACE_HULL_SIZES];
+
+// who the traces on this thread are being made for
+static thread_local trace_caller_t map_trace_caller;
 
 
 /*
@@ -129,12 +183,38 @@ int32_t 	c_traces, c_brush_traces;
 
 uint8_t* map_base;
 
+// the lumps are converted on the job workers, which can't Com_Error, so the first thing wrong with the map
+// is kept here and Map_Load drops to the console with it once the workers are done
+static std::atomic<bool>	map_loadfailed;
+static char					map_loaderror[MAX_STRING_CHARS];
+
+/*
+=================
+Map_LoadError
+
+Records why the map can't be loaded, and returns false for the loader to return
+=================
+*/
+static bool Map_LoadError (const char* fmt, ...)
+{
+	va_list		argptr;
+
+	if (map_loadfailed.exchange (true))
+		return false;		// only the first error is reported
+
+	va_start (argptr, fmt);
+	vsnprintf (map_loaderror, sizeof(map_loaderror), fmt, argptr);
+	va_end (argptr);
+
+	return false;
+}
+
 /*
 =================
 Map_LoadSubmodels
 =================
 */
-void Map_LoadSubmodels (lump_t *l)
+static bool Map_LoadSubmodels (lump_t *l)
 {
 	dmodel_t	*in;
 	cmodel_t	*out;
@@ -142,13 +222,13 @@ void Map_LoadSubmodels (lump_t *l)
 
 	in = (dmodel_t*)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadSubmodels: incorrect submodel lump size");
+		return Map_LoadError ("Map_LoadSubmodels: incorrect submodel lump size");
 	count = l->filelen / sizeof(*in);
 
 	if (count < 1)
-		Com_Error (ERR_DROP, "Map with no models");
+		return Map_LoadError ("Map with no models");
 	if (count > MAX_MAP_MODELS)
-		Com_Error (ERR_DROP, "Map has too many models");
+		return Map_LoadError ("Map has too many models");
 
 	numcmodels = count;
 
@@ -164,6 +244,8 @@ void Map_LoadSubmodels (lump_t *l)
 		}
 		out->headnode = LittleInt (in->headnode);
 	}
+
+	return true;
 }
 
 
@@ -172,7 +254,7 @@ void Map_LoadSubmodels (lump_t *l)
 Map_LoadSurfaces
 =================
 */
-void Map_LoadSurfaces (lump_t *l)
+static bool Map_LoadSurfaces (lump_t *l)
 {
 	texinfo_t*		in;
 	mapsurface_t*	out;
@@ -180,12 +262,12 @@ void Map_LoadSurfaces (lump_t *l)
 
 	in = (texinfo_t *)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadSurfaces: incorrect surface lump size");
+		return Map_LoadError ("Map_LoadSurfaces: incorrect surface lump size");
 	count = l->filelen / sizeof(*in);
 	if (count < 1)
-		Com_Error (ERR_DROP, "Map with no surfaces");
+		return Map_LoadError ("Map with no surfaces");
 	if (count > MAX_MAP_TEXINFO)
-		Com_Error (ERR_DROP, "Map has too many surfaces");
+		return Map_LoadError ("Map has too many surfaces");
 
 	numtexinfo = count;
 	out = map_surfaces;
@@ -197,6 +279,8 @@ void Map_LoadSurfaces (lump_t *l)
 		out->c.flags = LittleInt (in->flags);
 		out->c.value = LittleInt (in->value);
 	}
+
+	return true;
 }
 
 
@@ -206,22 +290,23 @@ Map_LoadNodes
 
 =================
 */
-void Map_LoadNodes (lump_t *l)
+static bool Map_LoadNodes (lump_t *l)
 {
 	dnode_t*	in;
 	int32_t		child;
 	cnode_t*	out;
 	int32_t 	i, j, count;
+	int32_t 	planenum;
 	
 	in = (dnode_t*)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadNodes: incorrect nodes lump size");
+		return Map_LoadError ("Map_LoadNodes: incorrect nodes lump size");
 	count = l->filelen / sizeof(*in);
 
 	if (count < 1)
-		Com_Error (ERR_DROP, "Map has no nodes");
+		return Map_LoadError ("Map has no nodes");
 	if (count > MAX_MAP_NODES)
-		Com_Error (ERR_DROP, "Map has too many nodes");
+		return Map_LoadError ("Map has too many nodes");
 
 	out = map_nodes;
 
@@ -229,7 +314,12 @@ void Map_LoadNodes (lump_t *l)
 
 	for (i=0 ; i<count ; i++, out++, in++)
 	{
-		out->plane = map_planes + LittleInt(in->planenum);
+		planenum = LittleInt (in->planenum);
+
+		if (planenum < 0 || planenum >= numplanes)
+			return Map_LoadError ("Map_LoadNodes: bad planenum %i", planenum);
+
+		out->plane = map_planes[planenum];
 		for (j=0 ; j<2 ; j++)
 		{
 			child = LittleInt (in->children[j]);
@@ -237,6 +327,41 @@ void Map_LoadNodes (lump_t *l)
 		}
 	}
 
+	return true;
+}
+
+/*
+=================
+Map_SetBrushBounds
+
+The compiler gives every brush a side facing each way along each axis, which are its bounds.
+An axis without both is left unbounded, so nothing is ever wrongly skipped
+=================
+*/
+static void Map_SetBrushBounds (cbrush_t* brush)
+{
+	cplane_t*	plane;
+	int32_t 	i, type;
+
+	VectorSet3 (brush->mins, -FLT_MAX, -FLT_MAX, -FLT_MAX);
+	VectorSet3 (brush->maxs, FLT_MAX, FLT_MAX, FLT_MAX);
+
+	for (i=0 ; i<brush->numsides ; i++)
+	{
+		plane = map_brushsides[brush->firstbrushside + i].plane;
+		type = plane->type;
+
+		if (type >= 3)
+			continue;
+
+		if (plane->normal[type] > 0)
+		{
+			if (plane->dist < brush->maxs[type])
+				brush->maxs[type] = plane->dist;
+		}
+		else if (-plane->dist > brush->mins[type])
+			brush->mins[type] = -plane->dist;
+	}
 }
 
 /*
@@ -245,7 +370,7 @@ Map_LoadBrushes
 
 =================
 */
-void Map_LoadBrushes (lump_t *l)
+static bool Map_LoadBrushes (lump_t *l)
 {
 	dbrush_t*	in;
 	cbrush_t*	out;
@@ -253,11 +378,11 @@ void Map_LoadBrushes (lump_t *l)
 	
 	in = (dbrush_t*)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadBrushes: incorrect brushes lump size");
+		return Map_LoadError ("Map_LoadBrushes: incorrect brushes lump size");
 	count = l->filelen / sizeof(*in);
 
 	if (count > MAX_MAP_BRUSHES)
-		Com_Error (ERR_DROP, "Map has too many brushes");
+		return Map_LoadError ("Map has too many brushes");
 
 	out = map_brushes;
 
@@ -268,8 +393,16 @@ void Map_LoadBrushes (lump_t *l)
 		out->firstbrushside = LittleInt(in->firstside);
 		out->numsides = LittleInt(in->numsides);
 		out->contents = LittleInt(in->contents);
+
+		if (out->firstbrushside < 0
+			|| out->numsides < 0
+			|| out->firstbrushside + out->numsides > numbrushsides)
+			return Map_LoadError ("Map_LoadBrushes: bad brushsides for brush %i", i);
+
+		Map_SetBrushBounds (out);
 	}
 
+	return true;
 }
 
 /*
@@ -277,7 +410,7 @@ void Map_LoadBrushes (lump_t *l)
 Map_LoadLeafs
 =================
 */
-void Map_LoadLeafs (lump_t *l)
+static bool Map_LoadLeafs (lump_t *l)
 {
 	int32_t i;
 	cleaf_t* out;
@@ -286,14 +419,14 @@ void Map_LoadLeafs (lump_t *l)
 	
 	in = (dleaf_t*)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadLeafs: incorrect leafs lump size");
+		return Map_LoadError ("Map_LoadLeafs: incorrect leafs lump size");
 	count = l->filelen / sizeof(*in);
 
 	if (count < 1)
-		Com_Error (ERR_DROP, "Map with no leafs");
+		return Map_LoadError ("Map with no leafs");
 	// need to save space for box planes
 	if (count > MAX_MAP_PLANES)
-		Com_Error (ERR_DROP, "Map has too many planes");
+		return Map_LoadError ("Map has too many planes");
 
 	out = map_leafs;	
 	numleafs = count;
@@ -312,7 +445,7 @@ void Map_LoadLeafs (lump_t *l)
 	}
 
 	if (map_leafs[0].contents != CONTENTS_SOLID)
-		Com_Error (ERR_DROP, "Map leaf 0 is not CONTENTS_SOLID");
+		return Map_LoadError ("Map leaf 0 is not CONTENTS_SOLID");
 	solidleaf = 0;
 	emptyleaf = -1;
 	for (i=1 ; i<numleafs ; i++)
@@ -324,7 +457,9 @@ void Map_LoadLeafs (lump_t *l)
 		}
 	}
 	if (emptyleaf == -1)
-		Com_Error (ERR_DROP, "Map does not have an empty leaf");
+		return Map_LoadError ("Map does not have an empty leaf");
+
+	return true;
 }
 
 /*
@@ -332,7 +467,7 @@ void Map_LoadLeafs (lump_t *l)
 Map_LoadPlanes
 =================
 */
-void Map_LoadPlanes (lump_t *l)
+static bool Map_LoadPlanes (lump_t *l)
 {
 	int32_t		i, j;
 	cplane_t*	out;
@@ -342,14 +477,14 @@ void Map_LoadPlanes (lump_t *l)
 	
 	in = (dplane_t*)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadPlanes: incorrect planes lump size");
+		return Map_LoadError ("Map_LoadPlanes: incorrect planes lump size");
 	count = l->filelen / sizeof(*in);
 
 	if (count < 1)
-		Com_Error (ERR_DROP, "Map with no planes");
+		return Map_LoadError ("Map with no planes");
 	// need to save space for box planes
 	if (count > MAX_MAP_PLANES)
-		Com_Error (ERR_DROP, "Map has too many planes");
+		return Map_LoadError ("Map has too many planes");
 
 	out = map_planes;	
 	numplanes = count;
@@ -368,6 +503,8 @@ void Map_LoadPlanes (lump_t *l)
 		out->type = LittleInt (in->type);
 		out->signbits = bits;
 	}
+
+	return true;
 }
 
 /*
@@ -375,7 +512,7 @@ void Map_LoadPlanes (lump_t *l)
 Map_LoadLeafBrushes
 =================
 */
-void Map_LoadLeafBrushes (lump_t *l)
+static bool Map_LoadLeafBrushes (lump_t *l)
 {
 	int32_t 		i;
 	uint32_t	*out;
@@ -384,20 +521,22 @@ void Map_LoadLeafBrushes (lump_t *l)
 	
 	in = (uint32_t*)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadLeafBrushes: incorrect leafbrushes lump size");
+		return Map_LoadError ("Map_LoadLeafBrushes: incorrect leafbrushes lump size");
 	count = l->filelen / sizeof(*in);
 
 	if (count < 1)
-		Com_Error (ERR_DROP, "Map with no planes");
+		return Map_LoadError ("Map with no planes");
 	// need to save space for box planes
 	if (count > MAX_MAP_LEAFBRUSHES)
-		Com_Error (ERR_DROP, "Map has too many leafbrushes");
+		return Map_LoadError ("Map has too many leafbrushes");
 
 	out = map_leafbrushes;
 	numleafbrushes = count;
 
 	for ( i=0 ; i<count ; i++, in++, out++)
 		*out = LittleInt (*in);
+
+	return true;
 }
 
 /*
@@ -405,7 +544,7 @@ void Map_LoadLeafBrushes (lump_t *l)
 Map_LoadBrushSides
 =================
 */
-void Map_LoadBrushSides (lump_t *l)
+static bool Map_LoadBrushSides (lump_t *l)
 {
 	int32_t 		i, j;
 	cbrushside_t	*out;
@@ -415,12 +554,12 @@ void Map_LoadBrushSides (lump_t *l)
 
 	in = (dbrushside_t*)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadBrushSides: incorrect brushsides lump size");
+		return Map_LoadError ("Map_LoadBrushSides: incorrect brushsides lump size");
 	count = l->filelen / sizeof(*in);
 
 	// need to save space for box planes
 	if (count > MAX_MAP_BRUSHSIDES)
-		Com_Error (ERR_DROP, "Map has too many planes");
+		return Map_LoadError ("Map has too many planes");
 
 	out = map_brushsides;	
 	numbrushsides = count;
@@ -428,12 +567,16 @@ void Map_LoadBrushSides (lump_t *l)
 	for ( i=0 ; i<count ; i++, in++, out++)
 	{
 		num = LittleIntUnsigned (in->planenum);
+		if (num >= (uint32_t)numplanes)
+			return Map_LoadError ("Bad brushside planenum");
 		out->plane = &map_planes[num];
 		j = LittleInt (in->texinfo);
 		if (j >= numtexinfo)
-			Com_Error (ERR_DROP, "Bad brushside texinfo");
+			return Map_LoadError ("Bad brushside texinfo");
 		out->surface = &map_surfaces[j];
 	}
+
+	return true;
 }
 
 /*
@@ -441,7 +584,7 @@ void Map_LoadBrushSides (lump_t *l)
 Map_LoadAreas
 =================
 */
-void Map_LoadAreas (lump_t *l)
+static bool Map_LoadAreas (lump_t *l)
 {
 	int32_t i;
 	carea_t* out;
@@ -450,11 +593,11 @@ void Map_LoadAreas (lump_t *l)
 
 	in = (darea_t*)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadAreas: incorrect areas lump size");
+		return Map_LoadError ("Map_LoadAreas: incorrect areas lump size");
 	count = l->filelen / sizeof(*in);
 
 	if (count > MAX_MAP_AREAS)
-		Com_Error (ERR_DROP, "Map has too many areas");
+		return Map_LoadError ("Map has too many areas");
 
 	out = map_areas;
 	numareas = count;
@@ -466,6 +609,8 @@ void Map_LoadAreas (lump_t *l)
 		out->floodvalid = 0;
 		out->floodnum = 0;
 	}
+
+	return true;
 }
 
 /*
@@ -473,7 +618,7 @@ void Map_LoadAreas (lump_t *l)
 Map_LoadAreaPortals
 =================
 */
-void Map_LoadAreaPortals (lump_t *l)
+static bool Map_LoadAreaPortals (lump_t *l)
 {
 	int32_t 		i;
 	dareaportal_t*	out;
@@ -482,11 +627,11 @@ void Map_LoadAreaPortals (lump_t *l)
 
 	in = (dareaportal_t*)(void *)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
-		Com_Error (ERR_DROP, "Map_LoadAreaPortals: incorrect areaportals lump size");
+		return Map_LoadError ("Map_LoadAreaPortals: incorrect areaportals lump size");
 	count = l->filelen / sizeof(*in);
 
 	if (count > MAX_MAP_AREAS)
-		Com_Error (ERR_DROP, "Map has too many areas");
+		return Map_LoadError ("Map has too many areas");
 
 	out = map_areaportals;
 	numareaportals = count;
@@ -496,6 +641,8 @@ void Map_LoadAreaPortals (lump_t *l)
 		out->portalnum = LittleInt (in->portalnum);
 		out->otherarea = LittleInt (in->otherarea);
 	}
+
+	return true;
 }
 
 /*
@@ -503,13 +650,13 @@ void Map_LoadAreaPortals (lump_t *l)
 Map_LoadVisibility
 =================
 */
-void Map_LoadVisibility (lump_t *l)
+static bool Map_LoadVisibility (lump_t *l)
 {
 	int32_t 	i;
 
 	numvisibility = l->filelen;
 	if (l->filelen > MAX_MAP_VISIBILITY)
-		Com_Error (ERR_DROP, "Map has too large visibility lump (add more detail brushes)");
+		return Map_LoadError ("Map has too large visibility lump (add more detail brushes)");
 
 	if (l->filelen > MAX_MAP_VIS_WARNING)
 	{
@@ -524,6 +671,8 @@ void Map_LoadVisibility (lump_t *l)
 		map_vis->bitofs[i][0] = LittleInt (map_vis->bitofs[i][0]);
 		map_vis->bitofs[i][1] = LittleInt (map_vis->bitofs[i][1]);
 	}
+
+	return true;
 }
 
 
@@ -532,16 +681,132 @@ void Map_LoadVisibility (lump_t *l)
 Map_LoadEntityString
 =================
 */
-void Map_LoadEntityString (lump_t *l)
+static bool Map_LoadEntityString (lump_t *l)
 {
 	numentitychars = l->filelen;
 	if (l->filelen > MAX_MAP_ENTSTRING)
-		Com_Error (ERR_DROP, "Map has too large entity lump");
+		return Map_LoadError ("Map has too large entity lump");
 
 	memcpy (map_entitystring, map_base + l->fileofs, l->filelen);
+
+	return true;
+}
+
+
+
+typedef struct
+{
+	const char*	name;
+	bool		(*load)(lump_t* l);
+	int32_t		lump;
+	int32_t		stage;			// lumps in a stage only depend on lumps in earlier stages
+} map_lumploader_t;
+
+static map_lumploader_t map_lumploaders[] =
+{
+	{ "surfaces",		Map_LoadSurfaces,		LUMP_TEXINFO,		0 },
+	{ "leafs",			Map_LoadLeafs,			LUMP_LEAFS,			0 },
+	{ "leafbrushes",	Map_LoadLeafBrushes,	LUMP_LEAFBRUSHES,	0 },
+	{ "planes",			Map_LoadPlanes,			LUMP_PLANES,		0 },
+	{ "submodels",		Map_LoadSubmodels,		LUMP_MODELS,		0 },
+	{ "areas",			Map_LoadAreas,			LUMP_AREAS,			0 },
+	{ "areaportals",	Map_LoadAreaPortals,	LUMP_AREAPORTALS,	0 },
+	{ "visibility",		Map_LoadVisibility,		LUMP_VISIBILITY,	0 },
+	{ "entities",		Map_LoadEntityString,	LUMP_ENTITIES,		0 },
+	{ "brushsides",		Map_LoadBrushSides,		LUMP_BRUSHSIDES,	1 },	// planes and surfaces
+	{ "nodes",			Map_LoadNodes,			LUMP_NODES,			1 },	// planes
+	{ "brushes",		Map_LoadBrushes,		LUMP_BRUSHES,		2 },	// brush sides, for the bounds
+};
+
+#define NUM_LUMPLOADERS	(int32_t)(sizeof(map_lumploaders) / sizeof(map_lumploaders[0]))
+
+typedef struct
+{
+	dheader_t*	header;
+	int32_t		first;			// the stage's first loader
+	uint64_t	times[NUM_LUMPLOADERS];
+} map_loadjob_t;
+
+cvar_t*			map_parallelload;
+
+/*
+==================
+Map_LoadLumpJob
+
+Converts one lump of the stage Map_Load is on
+==================
+*/
+static void Map_LoadLumpJob (int32_t index, void* data)
+{
+	map_loadjob_t*		job = (map_loadjob_t*)data;
+	map_lumploader_t*	loader;
+	uint64_t			time_start;
+
+	index += job->first;
+	loader = &map_lumploaders[index];
+
+	time_start = Sys_Nanoseconds ();
+
+	// a lump an earlier stage failed on may be missing, and this one may depend on it
+	if (!map_loadfailed.load ())
+		loader->load (&job->header->lumps[loader->lump]);
+
+	job->times[index] = Sys_Nanoseconds () - time_start;
 }
 
+/*
+==================
+Map_LoadLumps
+
+Converts every lump, a stage at a time, with the lumps in each stage split across the workers
+==================
+*/
+static void Map_LoadLumps (dheader_t* header)
+{
+	map_loadjob_t	job;
+	int32_t 		i, count;
+	uint64_t		time_start;
+
+	memset (&job, 0, sizeof(job));
+	job.header = header;
+	map_loadfailed = false;
+	map_loaderror[0] = 0;
+
+	time_start = Sys_Nanoseconds ();
+
+	for (job.first=0 ; job.first<NUM_LUMPLOADERS ; job.first+=count)
+	{
+		for (count=1 ; job.first+count<NUM_LUMPLOADERS ; count++)
+		{
+			if (map_lumploaders[job.first+count].stage != map_lumploaders[job.first].stage)
+				break;
+		}
+
+		if (map_parallelload->value)
+		{
+			Jobs_ParallelFor (count, Map_LoadLumpJob, &job);
+		}
+		else
+		{
+			for (i=0 ; i<count ; i++)
+				Map_LoadLumpJob (i, &job);
+		}
+	}
+
+	time_start = Sys_Nanoseconds () - time_start;
+
+	if (!developer->value)
+		return;
+
+	for (i=0 ; i<NUM_LUMPLOADERS ; i++)
+	{
+		Com_Printf ("%-12s %8i bytes %8.3f ms\n", map_lumploaders[i].name,
+			header->lumps[map_lumploaders[i].lump].filelen, job.times[i] / 1000000.0);
+	}
 
+	Com_Printf ("%-12s %23.3f ms (%s)\n", "total", time_start / 1000000.0,
+		map_parallelload->value && Jobs_NumWorkers () ? "parallel" : "serial");
+}
 
 /*
 ==================
@@ -559,6 +824,10 @@ cmodel_t* Map_Load(const char *name, bool clientload, uint32_t *checksum)
 	static uint32_t	last_checksum;
 
 	map_noareas = Cvar_Get ("map_noareas", "0", 0);
+	// megabytes the decompressed PVS/PHS may use, 0 to always decompress on demand. Takes effect on the next map load
+	map_viscache = Cvar_Get ("map_viscache", "64", CVAR_ARCHIVE);
+	// convert the lumps on the job workers
+	map_parallelload = Cvar_Get ("map_parallelload", "1", 0);
 
 	if (  !strcmp (map_name, name) && (clientload || !Cvar_VariableValue ("flushmap")) )
 	{
@@ -571,6 +840,11 @@ cmodel_t* Map_Load(const char *name, bool clientload, uint32_t *checksum)
 		return &map_cmodels[0];		// still have the right version
 	}
 
+	FS_ResetStats();
+
+	// a recording only makes sense on the map it was made on
+	Map_StopTraceRecording ();
+
 	// free old stuff
 	numplanes = 0;
 	numnodes = 0;
@@ -580,6 +854,7 @@ cmodel_t* Map_Load(const char *name, bool clientload, uint32_t *checksum)
 	numentitychars = 0;
 	map_entitystring[0] = 0;
 	map_name[0] = 0;
+	Map_FreeVisCache ();
 
 	if (!name || !name[0])
 	{
@@ -611,22 +886,20 @@ cmodel_t* Map_Load(const char *name, bool clientload, uint32_t *checksum)
 	map_base = (uint8_t *)buf;
 
 	// load into heap
-	Map_LoadSurfaces (&header.lumps[LUMP_TEXINFO]);
-	Map_LoadLeafs (&header.lumps[LUMP_LEAFS]);
-	Map_LoadLeafBrushes (&header.lumps[LUMP_LEAFBRUSHES]);
-	Map_LoadPlanes (&header.lumps[LUMP_PLANES]);
-	Map_LoadBrushes (&header.lumps[LUMP_BRUSHES]);
-	Map_LoadBrushSides (&header.lumps[LUMP_BRUSHSIDES]);
-	Map_LoadSubmodels (&header.lumps[LUMP_MODELS]);
-	Map_LoadNodes (&header.lumps[LUMP_NODES]);
-	Map_LoadAreas (&header.lumps[LUMP_AREAS]);
-	Map_LoadAreaPortals (&header.lumps[LUMP_AREAPORTALS]);
-	Map_LoadVisibility (&header.lumps[LUMP_VISIBILITY]);
-	Map_LoadEntityString (&header.lumps[LUMP_ENTITIES]);
+	Map_LoadLumps (&header);
 
 	FS_FreeFile (buf);
 
+	if (map_loadfailed)
+	{
+		numleafs = 1;
+		numclusters = 1;
+		numareas = 1;
+		Com_Error (ERR_DROP, "%s: %s", name, map_loaderror);
+	}
+
 	Map_InitBoxHull ();
+	Map_BuildVisCache ();
 
 	memset (portalopen, 0, sizeof(portalopen));
 	Map_FloodAreaConnections ();
@@ -669,6 +942,39 @@ char* Map_GetEntityString()
 	return map_entitystring;
 }
 
+/*
+==================
+Map_SharedPlanes
+
+The planes of the loaded map, already swapped and checked, so the renderer doesn't convert them again.
+NULL if name isn't the map that is loaded
+==================
+*/
+const cplane_t* Map_SharedPlanes (const char* name, int32_t* count)
+{
+	if (!map_name[0] || strcmp (map_name, name))
+		return NULL;
+
+	*count = numplanes;
+	return map_planes;
+}
+
+/*
+==================
+Map_SharedVisibility
+
+The swapped visibility lump of the loaded map, NULL if name isn't the map that is loaded
+==================
+*/
+const dvis_t* Map_SharedVisibility (const char* name, int32_t* length)
+{
+	if (!map_name[0] || strcmp (map_name, name))
+		return NULL;
+
+	*length = numvisibility;
+	return map_vis;
+}
+
 int32_t Map_GetLeafContents (int32_t leafnum)
 {
 	if (leafnum < 0 || leafnum >= numleafs)
@@ -696,29 +1002,49 @@ int32_t Map_LeafArea (int32_t leafnum)
 //=======================================================================
 
 
-cplane_t*	box_planes;
 int32_t 	box_headnode;
 cbrush_t*	box_brush;
 cleaf_t*	box_leaf;
 
+// Everything a trace works with that isn't the map itself. Map_BoxTrace and the other calls without a context use
+// one per thread, so traces can run on any thread as long as no one loads a map meanwhile.
+struct map_trace_context_s
+{
+	// the box Map_HeadnodeForBoxContext last set up, traced when box_headnode is passed in
+	vec3_t			box_mins, box_maxs;
+	cplane_t		box_planes[12];
+	cbrushside_t	box_sides[6];
+
+	// brushes are often in more than one leaf, this makes sure each is only clipped against once per trace
+	int32_t 		checkcount;
+	int32_t*		brush_checkcounts;		// [num_brush_checkcounts]
+	int32_t 		num_brush_checkcounts;
+
+	// the trace in progress
+	vec3_t			start, end;
+	vec3_t			mins, maxs;
+	vec3_t			extents;
+	trace_t			trace;
+	int32_t 		contents;
+	bool			ispoint;		// optimized case
+	int32_t 		brush_traces;	// added to c_brush_traces once the trace is done
+	int32_t 		nodes_visited;	// for showtrace 2
+	vec3_t			absmins, absmaxs;	// everything the trace sweeps through, for skipping brushes
+	bool			reference;		// clip the plain way, without bounds or SIMD, for map_tracecheck
+};
+
+static thread_local map_trace_context_t* map_threadtrace;
+
 /*
 ===================
 Map_InitBoxHull
 
-Set up the planes and nodes so that the six floats of a bounding box
-can just be stored out and get a proper clipping hull structure.
+Reserves the brush and leaf that box traces clip against. The planes are per trace context
 ===================
 */
 void Map_InitBoxHull ()
 {
-	int32_t 		i;
-	int32_t 		side;
-	cnode_t		*c;
-	cplane_t	*p;
-	cbrushside_t	*s;
-
 	box_headnode = numnodes;
-	box_planes = &map_planes[numplanes];
 	if (numnodes+6 > MAX_MAP_NODES
 		|| numbrushes+1 > MAX_MAP_BRUSHES
 		|| numleafbrushes+1 > MAX_MAP_LEAFBRUSHES
@@ -737,40 +1063,76 @@ void Map_InitBoxHull ()
 	box_leaf->numleafbrushes = 1;
 
 	map_leafbrushes[numleafbrushes] = numbrushes;
+}
+
+/*
+===================
+Map_CreateTraceContext
+===================
+*/
+map_trace_context_t* Map_CreateTraceContext ()
+{
+	map_trace_context_t*	ctx;
+	cplane_t*				p;
+	int32_t 				i, side;
 
+	ctx = (map_trace_context_t*)Memory_ZoneMalloc (sizeof(map_trace_context_t));
+
+	// the box is a brush with a side facing each way along each axis
 	for (i=0 ; i<6 ; i++)
 	{
 		side = i&1;
 
-		// brush sides
-		s = &map_brushsides[numbrushsides+i];
-		s->plane = 	map_planes + (numplanes+i*2+side);
-		s->surface = &nullsurface;
-
-		// nodes
-		c = &map_nodes[box_headnode+i];
-		c->plane = map_planes + (numplanes+i*2);
-		c->children[side] = -1 - emptyleaf;
-		if (i != 5)
-			c->children[side^1] = box_headnode+i + 1;
-		else
-			c->children[side^1] = -1 - numleafs;
+		ctx->box_sides[i].plane = &ctx->box_planes[i*2+side];
+		ctx->box_sides[i].surface = &nullsurface;
 
-		// planes
-		p = &box_planes[i*2];
+		p = &ctx->box_planes[i*2];
 		p->type = i>>1;
 		p->signbits = 0;
 		VectorClear3 (p->normal);
 		p->normal[i>>1] = 1;
 
-		p = &box_planes[i*2+1];
+		p = &ctx->box_planes[i*2+1];
 		p->type = 3 + (i>>1);
 		p->signbits = 0;
 		VectorClear3 (p->normal);
 		p->normal[i>>1] = -1;
-	}	
+	}
+
+	return ctx;
+}
+
+/*
+===================
+Map_FreeTraceContext
+===================
+*/
+void Map_FreeTraceContext (map_trace_context_t* ctx)
+{
+	if (!ctx)
+		return;
+
+	if (ctx->brush_checkcounts)
+		Memory_ZoneFree (ctx->brush_checkcounts);
+
+	Memory_ZoneFree (ctx);
 }
 
+/*
+===================
+Map_ThreadTraceContext
+
+The calling thread's context, made the first time it's needed. Worker threads live as long as the engine,
+so these are never freed
+===================
+*/
+map_trace_context_t* Map_ThreadTraceContext ()
+{
+	if (!map_threadtrace)
+		map_threadtrace = Map_CreateTraceContext ();
+
+	return map_threadtrace;
+}
 
 /*
 ===================
@@ -778,10 +1140,17 @@ Map_HeadnodeForBox
 
 To keep everything totally uniform, bounding boxes are turned into small
 BSP trees instead of being compared directly.
+
+The box belongs to the context, so it has to be traced with the same one.
 ===================
 */
-int32_t Map_HeadnodeForBox (vec3_t mins, vec3_t maxs)
+int32_t Map_HeadnodeForBoxContext (map_trace_context_t* ctx, vec3_t mins, vec3_t maxs)
 {
+	cplane_t* box_planes = ctx->box_planes;
+
+	VectorCopy3 (mins, ctx->box_mins);
+	VectorCopy3 (maxs, ctx->box_maxs);
+
 	box_planes[0].dist = maxs[0];
 	box_planes[1].dist = -maxs[0];
 	box_planes[2].dist = mins[0];
@@ -798,6 +1167,11 @@ int32_t Map_HeadnodeForBox (vec3_t mins, vec3_t maxs)
 	return box_headnode;
 }
 
+int32_t Map_HeadnodeForBox (vec3_t mins, vec3_t maxs)
+{
+	return Map_HeadnodeForBoxContext (Map_ThreadTraceContext (), mins, maxs);
+}
+
 
 /*
 ==================
@@ -814,8 +1188,8 @@ int32_t Map_PointLeafnum_r (vec3_t p, int32_t num)
 	while (num >= 0)
 	{
 		node = map_nodes + num;
-		plane = node->plane;
-		
+		plane = &node->plane;
+
 		if (plane->type < 3)
 			d = p[plane->type] - plane->dist;
 		else
@@ -826,7 +1200,7 @@ int32_t Map_PointLeafnum_r (vec3_t p, int32_t num)
 			num = node->children[0];
 	}
 
-	c_pointcontents++;		// optimize counter
+	c_pointcontents.fetch_add (1, std::memory_order_relaxed);		// optimize counter
 
 	return -1 - num;
 }
@@ -838,6 +1212,31 @@ int32_t Map_PointLeafnum (vec3_t p)
 	return Map_PointLeafnum_r (p, 0);
 }
 
+/*
+==================
+Map_PointLeafnumContext
+
+Same as Map_PointLeafnum_r, but knows about the context's box
+==================
+*/
+static int32_t Map_PointLeafnumContext (map_trace_context_t* ctx, vec3_t p, int32_t headnode)
+{
+	int32_t i;
+
+	if (headnode != box_headnode)
+		return Map_PointLeafnum_r (p, headnode);
+
+	// the same test walking the box's nodes would make
+	for (i=0 ; i<3 ; i++)
+	{
+		if (p[i] < ctx->box_mins[i]
+			|| p[i] >= ctx->box_maxs[i])
+			return emptyleaf;
+	}
+
+	return (int32_t)(box_leaf - map_leafs);
+}
+
 /*
 =============
 Map_BoxLeafnums
@@ -845,14 +1244,17 @@ Map_BoxLeafnums
 Fills in a list of all the leafs touched
 =============
 */
-int32_t 	leaf_count;
-int32_t		leaf_maxcount;
-int32_t* 	leaf_list;
-float*		map_mins;
-float*		map_maxs;
-int32_t 	leaf_topnode;
-
-void MapRenderer_BoxLeafnums_r (int32_t nodenum)
+typedef struct
+{
+	int32_t 	count;
+	int32_t		maxcount;
+	int32_t* 	list;
+	float*		mins;
+	float*		maxs;
+	int32_t 	topnode;
+} map_leafquery_t;
+
+static void MapRenderer_BoxLeafnums_r (map_leafquery_t* query, int32_t nodenum)
 {
 	cplane_t	*plane;
 	cnode_t		*node;
@@ -862,27 +1264,27 @@ void MapRenderer_BoxLeafnums_r (int32_t nodenum)
 	{
 		if (nodenum < 0)
 		{
-			if (leaf_count >= leaf_maxcount)
+			if (query->count >= query->maxcount)
 			{
 				Com_DPrintf ("Map_BoxLeafnums_r: overflow\n");
 				return;
 			}
-			leaf_list[leaf_count++] = -1 - nodenum;
+			query->list[query->count++] = -1 - nodenum;
 			return;
 		}
-	
+
 		node = &map_nodes[nodenum];
-		plane = node->plane;
-		s = BOX_ON_PLANE_SIDE(map_mins, map_maxs, plane);
+		plane = &node->plane;
+		s = BOX_ON_PLANE_SIDE(query->mins, query->maxs, plane);
 		if (s == 1)
 			nodenum = node->children[0];
 		else if (s == 2)
 			nodenum = node->children[1];
 		else
 		{	// go down both
-			if (leaf_topnode == -1)
-				leaf_topnode = nodenum;
-			MapRenderer_BoxLeafnums_r (node->children[0]);
+			if (query->topnode == -1)
+				query->topnode = nodenum;
+			MapRenderer_BoxLeafnums_r (query, node->children[0]);
 			nodenum = node->children[1];
 		}
 
@@ -894,20 +1296,22 @@ void MapRenderer_BoxLeafnums_r (int32_t nodenum)
 // ============================
 int32_t MapRenderer_BoxLeafnums_headnode (vec3_t mins, vec3_t maxs, int32_t *list, int32_t listsize, int32_t headnode, int32_t *topnode)
 {
-	leaf_list = list;
-	leaf_count = 0;
-	leaf_maxcount = listsize;
-	map_mins = mins;
-	map_maxs = maxs;
+	map_leafquery_t query;
 
-	leaf_topnode = -1;
+	query.list = list;
+	query.count = 0;
+	query.maxcount = listsize;
+	query.mins = mins;
+	query.maxs = maxs;
 
-	MapRenderer_BoxLeafnums_r (headnode);
+	query.topnode = -1;
+
+	MapRenderer_BoxLeafnums_r (&query, headnode);
 
 	if (topnode)
-		*topnode = leaf_topnode;
+		*topnode = query.topnode;
 
-	return leaf_count;
+	return query.count;
 }
 
 int32_t Map_BoxLeafnums (vec3_t mins, vec3_t maxs, int32_t *list, int32_t listsize, int32_t *topnode)
@@ -921,18 +1325,23 @@ int32_t Map_BoxLeafnums (vec3_t mins, vec3_t maxs, int32_t *list, int32_t listsi
 Map_PointContents
 ==================
 */
-int32_t Map_PointContents (vec3_t p, int32_t headnode)
+int32_t Map_PointContentsContext (map_trace_context_t* ctx, vec3_t p, int32_t headnode)
 {
 	int32_t 	l;
 
 	if (!numnodes)	// map not loaded
 		return 0;
 
-	l = Map_PointLeafnum_r (p, headnode);
+	l = Map_PointLeafnumContext (ctx, p, headnode);
 
 	return map_leafs[l].contents;
 }
 
+int32_t Map_PointContents (vec3_t p, int32_t headnode)
+{
+	return Map_PointContentsContext (Map_ThreadTraceContext (), p, headnode);
+}
+
 /*
 ==================
 Map_TransformedPointContents
@@ -941,7 +1350,7 @@ Handles offseting and rotation of the end points for moving and
 rotating entities
 ==================
 */
-int32_t Map_TransformedPointContents (vec3_t p, int32_t headnode, vec3_t origin, vec3_t angles)
+int32_t Map_TransformedPointContentsContext (map_trace_context_t* ctx, vec3_t p, int32_t headnode, vec3_t origin, vec3_t angles)
 {
 	vec3_t		p_l;
 	vec3_t		temp;
@@ -952,7 +1361,7 @@ int32_t Map_TransformedPointContents (vec3_t p, int32_t headnode, vec3_t origin,
 	VectorSubtract3 (p, origin, p_l);
 
 	// rotate start and end into the models frame of reference
-	if (headnode != box_headnode && 
+	if (headnode != box_headnode &&
 	(angles[0] || angles[1] || angles[2]) )
 	{
 		AngleVectors (angles, forward, right, up);
@@ -963,11 +1372,16 @@ int32_t Map_TransformedPointContents (vec3_t p, int32_t headnode, vec3_t origin,
 		p_l[2] = DotProduct3 (temp, up);
 	}
 
-	l = Map_PointLeafnum_r (p_l, headnode);
+	l = Map_PointLeafnumContext (ctx, p_l, headnode);
 
 	return map_leafs[l].contents;
 }
 
+int32_t Map_TransformedPointContents (vec3_t p, int32_t headnode, vec3_t origin, vec3_t angles)
+{
+	return Map_TransformedPointContentsContext (Map_ThreadTraceContext (), p, headnode, origin, angles);
+}
+
 
 /*
 ===============================================================================
@@ -980,58 +1394,44 @@ BOX TRACING
 // 1/32 epsilon to keep floating point happy
 #define	DIST_EPSILON	0.03125f
 
-vec3_t	trace_start, trace_end;
-vec3_t	trace_mins, trace_maxs;
-vec3_t	trace_extents;
+/*
+================
+Map_BrushSides
+
+The box brush's sides are in the context, every other brush's are in the map
+================
+*/
+static inline cbrushside_t* Map_BrushSides (map_trace_context_t* ctx, cbrush_t* brush)
+{
+	if (brush == box_brush)
+		return ctx->box_sides;
 
-trace_t	trace_trace;
-int32_t 	trace_contents;
-bool	trace_ispoint;		// optimized case
+	return &map_brushsides[brush->firstbrushside];
+}
 
 /*
 ================
-Map_ClipBoxToBrush
+Map_SideDistancesScalar
+
+Fills in how far p1 and p2 are in front of each side, once the side is pushed out for the box
 ================
 */
-void Map_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
-					  trace_t *trace, cbrush_t *brush)
+static void Map_SideDistancesScalar (cbrushside_t* sides, int32_t count, bool ispoint, vec3_t mins, vec3_t maxs,
+						vec3_t p1, vec3_t p2, float* d1, float* d2)
 {
-	int32_t 		i, j;
-	cplane_t	*plane, *clipplane;
+	int32_t 	i, j;
+	cplane_t	*plane;
 	float		dist;
-	float		enterfrac, leavefrac;
 	vec3_t		ofs;
-	float		d1, d2;
-	bool	getout, startout;
-	float		f;
-	cbrushside_t	*side, *leadside;
-
-	enterfrac = -1;
-	leavefrac = 1;
-	clipplane = NULL;
-
-	if (!brush->numsides)
-		return;
-
-	c_brush_traces++;
 
-	getout = false;
-	startout = false;
-	leadside = NULL;
-
-	for (i=0 ; i<brush->numsides ; i++)
+	for (i=0 ; i<count ; i++)
 	{
-		side = &map_brushsides[brush->firstbrushside+i];
-		plane = side->plane;
-
-		// FIXME: special case for axial
+		plane = sides[i].plane;
 
-		if (!trace_ispoint)
+		if (!ispoint)
 		{	// general box case
 
 			// push the plane out apropriately for mins/maxs
-
-			// FIXME: use signbits into 8 way lookup for each mins/maxs
 			for (j=0 ; j<3 ; j++)
 			{
 				if (plane->normal[j] < 0)
@@ -1047,37 +1447,157 @@ void Map_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 			dist = plane->dist;
 		}
 
-		d1 = DotProduct3 (p1, plane->normal) - dist;
-		d2 = DotProduct3 (p2, plane->normal) - dist;
-
-		if (d2 > 0)
-			getout = true;	// endpoint is not in solid
-		if (d1 > 0)
-			startout = true;
+		d1[i] = DotProduct3 (p1, plane->normal) - dist;
+		d2[i] = DotProduct3 (p2, plane->normal) - dist;
+	}
+}
 
-		// if completely in front of face, no intersection
-		if (d1 > 0 && d2 >= d1)
-			return;
+#ifdef CPUID_X86
 
-		if (d1 <= 0 && d2 <= 0)
-			continue;
+/*
+================
+Map_SideDistancesSSE2
 
-		// crosses face
-		if (d1 > d2)
-		{	// enter
-			f = (d1-DIST_EPSILON) / (d1-d2);
-			if (f > enterfrac)
-			{
-				enterfrac = f;
-				clipplane = plane;
-				leadside = side;
-			}
+Four sides at a time. Does the same operations in the same order as the scalar version, so gives exactly the same results
+================
+*/
+CPUID_TARGET_SSE2 static void Map_SideDistancesSSE2 (cbrushside_t* sides, int32_t count, bool ispoint, vec3_t mins, vec3_t maxs,
+						vec3_t p1, vec3_t p2, float* d1, float* d2)
+{
+	cplane_t	*a, *b, *c, *d;
+	__m128		nx, ny, nz, dist, mask;
+	__m128		ox, oy, oz;
+	__m128		zero = _mm_setzero_ps ();
+	int32_t 	i;
+
+	for (i=0 ; i+4<=count ; i+=4)
+	{
+		a = sides[i].plane;
+		b = sides[i+1].plane;
+		c = sides[i+2].plane;
+		d = sides[i+3].plane;
+
+		nx = _mm_setr_ps (a->normal[0], b->normal[0], c->normal[0], d->normal[0]);
+		ny = _mm_setr_ps (a->normal[1], b->normal[1], c->normal[1], d->normal[1]);
+		nz = _mm_setr_ps (a->normal[2], b->normal[2], c->normal[2], d->normal[2]);
+		dist = _mm_setr_ps (a->dist, b->dist, c->dist, d->dist);
+
+		if (!ispoint)
+		{
+			// maxs where the normal is negative, otherwise mins
+			mask = _mm_cmplt_ps (nx, zero);
+			ox = _mm_or_ps (_mm_and_ps (mask, _mm_set1_ps (maxs[0])), _mm_andnot_ps (mask, _mm_set1_ps (mins[0])));
+			mask = _mm_cmplt_ps (ny, zero);
+			oy = _mm_or_ps (_mm_and_ps (mask, _mm_set1_ps (maxs[1])), _mm_andnot_ps (mask, _mm_set1_ps (mins[1])));
+			mask = _mm_cmplt_ps (nz, zero);
+			oz = _mm_or_ps (_mm_and_ps (mask, _mm_set1_ps (maxs[2])), _mm_andnot_ps (mask, _mm_set1_ps (mins[2])));
+
+			dist = _mm_sub_ps (dist, _mm_add_ps (_mm_add_ps (_mm_mul_ps (ox, nx), _mm_mul_ps (oy, ny)), _mm_mul_ps (oz, nz)));
 		}
-		else
-		{	// leave
-			f = (d1+DIST_EPSILON) / (d1-d2);
-			if (f < leavefrac)
-				leavefrac = f;
+
+		_mm_storeu_ps (d1 + i, _mm_sub_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (_mm_set1_ps (p1[0]), nx),
+			_mm_mul_ps (_mm_set1_ps (p1[1]), ny)), _mm_mul_ps (_mm_set1_ps (p1[2]), nz)), dist));
+		_mm_storeu_ps (d2 + i, _mm_sub_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (_mm_set1_ps (p2[0]), nx),
+			_mm_mul_ps (_mm_set1_ps (p2[1]), ny)), _mm_mul_ps (_mm_set1_ps (p2[2]), nz)), dist));
+	}
+
+	Map_SideDistancesScalar (sides + i, count - i, ispoint, mins, maxs, p1, p2, d1 + i, d2 + i);
+}
+
+#endif
+
+/*
+================
+Map_BrushSideDistances
+
+Uses the SIMD version for brushes with enough sides to be worth it
+================
+*/
+static inline void Map_BrushSideDistances (map_trace_context_t* ctx, cbrush_t* brush, cbrushside_t* sides, int32_t count, bool ispoint,
+						vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2, float* d1, float* d2)
+{
+	if (ctx->reference
+		|| brush->numsides < MAP_SIMD_MIN_SIDES)
+		Map_SideDistancesScalar (sides, count, ispoint, mins, maxs, p1, p2, d1, d2);
+	else
+		Map_SideDistances (sides, count, ispoint, mins, maxs, p1, p2, d1, d2);
+}
+
+/*
+================
+Map_ClipBoxToBrush
+================
+*/
+void Map_ClipBoxToBrush (map_trace_context_t* ctx, vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
+					  trace_t *trace, cbrush_t *brush)
+{
+	int32_t 		i, first, count;
+	cplane_t	*plane, *clipplane;
+	float		enterfrac, leavefrac;
+	float		d1, d2;
+	float		d1s[MAP_SIDE_CHUNK], d2s[MAP_SIDE_CHUNK];
+	bool	getout, startout;
+	float		f;
+	cbrushside_t	*sides, *side, *leadside;
+
+	enterfrac = -1;
+	leavefrac = 1;
+	clipplane = NULL;
+
+	if (!brush->numsides)
+		return;
+
+	ctx->brush_traces++;
+
+	getout = false;
+	startout = false;
+	leadside = NULL;
+	sides = Map_BrushSides (ctx, brush);
+
+	for (first=0 ; first<brush->numsides ; first+=MAP_SIDE_CHUNK)
+	{
+		count = brush->numsides - first;
+		if (count > MAP_SIDE_CHUNK)
+			count = MAP_SIDE_CHUNK;
+
+		Map_BrushSideDistances (ctx, brush, sides + first, count, ctx->ispoint, mins, maxs, p1, p2, d1s, d2s);
+
+		for (i=0 ; i<count ; i++)
+		{
+			side = &sides[first + i];
+			plane = side->plane;
+			d1 = d1s[i];
+			d2 = d2s[i];
+
+			if (d2 > 0)
+				getout = true;	// endpoint is not in solid
+			if (d1 > 0)
+				startout = true;
+
+			// if completely in front of face, no intersection
+			if (d1 > 0 && d2 >= d1)
+				return;
+
+			if (d1 <= 0 && d2 <= 0)
+				continue;
+
+			// crosses face
+			if (d1 > d2)
+			{	// enter
+				f = (d1-DIST_EPSILON) / (d1-d2);
+				if (f > enterfrac)
+				{
+					enterfrac = f;
+					clipplane = plane;
+					leadside = side;
+				}
+			}
+			else
+			{	// leave
+				f = (d1+DIST_EPSILON) / (d1-d2);
+				if (f < leavefrac)
+					leavefrac = f;
+			}
 		}
 	}
 
@@ -1107,47 +1627,33 @@ void Map_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 Map_TestBoxInBrush
 ================
 */
-void Map_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
+void Map_TestBoxInBrush (map_trace_context_t* ctx, vec3_t mins, vec3_t maxs, vec3_t p1,
 					  trace_t *trace, cbrush_t *brush)
 {
-	int32_t 		i, j;
-	cplane_t	*plane;
-	float		dist;
-	vec3_t		ofs;
-	float		d1;
-	cbrushside_t	*side;
+	int32_t 		i, first, count;
+	float		d1s[MAP_SIDE_CHUNK], d2s[MAP_SIDE_CHUNK];
+	cbrushside_t	*sides;
 
 	if (!brush->numsides)
 		return;
 
-	for (i=0 ; i<brush->numsides ; i++)
-	{
-		side = &map_brushsides[brush->firstbrushside+i];
-		plane = side->plane;
-
-		// FIXME: special case for axial
+	sides = Map_BrushSides (ctx, brush);
 
-		// general box case
+	for (first=0 ; first<brush->numsides ; first+=MAP_SIDE_CHUNK)
+	{
+		count = brush->numsides - first;
+		if (count > MAP_SIDE_CHUNK)
+			count = MAP_SIDE_CHUNK;
 
-		// push the plane out apropriately for mins/maxs
+		// always the box case, a point is a box with no size
+		Map_BrushSideDistances (ctx, brush, sides + first, count, false, mins, maxs, p1, p1, d1s, d2s);
 
-		// FIXME: use signbits into 8 way lookup for each mins/maxs
-		for (j=0 ; j<3 ; j++)
+		for (i=0 ; i<count ; i++)
 		{
-			if (plane->normal[j] < 0)
-				ofs[j] = maxs[j];
-			else
-				ofs[j] = mins[j];
+			// if completely in front of face, no intersection
+			if (d1s[i] > 0)
+				return;
 		}
-		dist = DotProduct3 (ofs, plane->normal);
-		dist = plane->dist - dist;
-
-		d1 = DotProduct3 (p1, plane->normal) - dist;
-
-		// if completely in front of face, no intersection
-		if (d1 > 0)
-			return;
-
 	}
 
 	// inside this brush
@@ -1156,13 +1662,60 @@ void Map_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 	trace->contents = brush->contents;
 }
 
+/*
+================
+Map_TraceTouchesBrush
+
+False if the brush is out of reach of everything the trace sweeps through, when clipping against it
+can't change the trace. The brush bounds are exact, the slack is in the trace's absmins/absmaxs
+================
+*/
+static inline bool Map_TraceTouchesBrush (map_trace_context_t* ctx, cbrush_t* brush)
+{
+	float	*mins, *maxs;
+
+	if (ctx->reference)
+		return true;
+
+	if (brush == box_brush)
+	{
+		mins = ctx->box_mins;
+		maxs = ctx->box_maxs;
+	}
+	else
+	{
+		mins = brush->mins;
+		maxs = brush->maxs;
+	}
+
+	return ctx->absmins[0] <= maxs[0] && ctx->absmaxs[0] >= mins[0]
+		&& ctx->absmins[1] <= maxs[1] && ctx->absmaxs[1] >= mins[1]
+		&& ctx->absmins[2] <= maxs[2] && ctx->absmaxs[2] >= mins[2];
+}
+
+/*
+================
+Map_CheckBrush
+
+Returns false if the trace has already looked at this brush
+================
+*/
+static inline bool Map_CheckBrush (map_trace_context_t* ctx, int32_t brushnum)
+{
+	if (ctx->brush_checkcounts[brushnum] == ctx->checkcount)
+		return false;	// already checked this brush in another leaf
+
+	ctx->brush_checkcounts[brushnum] = ctx->checkcount;
+	return true;
+}
+
 
 /*
 ================
 Map_TraceToLeaf
 ================
 */
-void Map_TraceToLeaf (int32_t leafnum)
+void Map_TraceToLeaf (map_trace_context_t* ctx, int32_t leafnum)
 {
 	int32_t 		k;
 	int32_t 		brushnum;
@@ -1170,21 +1723,22 @@ void Map_TraceToLeaf (int32_t leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & ctx->contents))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
 		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
-			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
+		if (!Map_CheckBrush (ctx, brushnum))
+			continue;
 
-		if ( !(b->contents & trace_contents))
+		if ( !(b->contents & ctx->contents))
 			continue;
-		Map_ClipBoxToBrush (trace_mins, trace_maxs, trace_start, trace_end, &trace_trace, b);
-		if (!trace_trace.fraction)
+		if (!Map_TraceTouchesBrush (ctx, b))
+			continue;
+		Map_ClipBoxToBrush (ctx, ctx->mins, ctx->maxs, ctx->start, ctx->end, &ctx->trace, b);
+		if (!ctx->trace.fraction)
 			return;
 	}
 
@@ -1196,7 +1750,7 @@ void Map_TraceToLeaf (int32_t leafnum)
 Map_TestInLeaf
 ================
 */
-void Map_TestInLeaf (int32_t leafnum)
+void Map_TestInLeaf (map_trace_context_t* ctx, int32_t leafnum)
 {
 	int32_t 	k;
 	int32_t 	brushnum;
@@ -1204,21 +1758,22 @@ void Map_TestInLeaf (int32_t leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & ctx->contents))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
 		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
-			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
+		if (!Map_CheckBrush (ctx, brushnum))
+			continue;
 
-		if ( !(b->contents & trace_contents))
+		if ( !(b->contents & ctx->contents))
 			continue;
-		Map_TestBoxInBrush (trace_mins, trace_maxs, trace_start, &trace_trace, b);
-		if (!trace_trace.fraction)
+		if (!Map_TraceTouchesBrush (ctx, b))
+			continue;
+		Map_TestBoxInBrush (ctx, ctx->mins, ctx->maxs, ctx->start, &ctx->trace, b);
+		if (!ctx->trace.fraction)
 			return;
 	}
 
@@ -1230,7 +1785,7 @@ void Map_TestInLeaf (int32_t leafnum)
 Map_RecursiveHullCheck
 ==================
 */
-void Map_RecursiveHullCheck (int32_t num, float p1f, float p2f, vec3_t p1, vec3_t p2)
+void Map_RecursiveHullCheck (map_trace_context_t* ctx, int32_t num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 {
 	cnode_t		*node;
 	cplane_t	*plane;
@@ -1242,131 +1797,702 @@ void Map_RecursiveHullCheck (int32_t num, float p1f, float p2f, vec3_t p1, vec3_
 	int32_t 	side;
 	float		midf;
 
-	if (trace_trace.fraction <= p1f)
-		return;		// already hit something nearer
+	if (ctx->trace.fraction <= p1f)
+		return;		// already hit something nearer
+
+	ctx->nodes_visited++;
+
+	// if < 0, we are in a leaf node
+	if (num < 0)
+	{
+		Map_TraceToLeaf (ctx, -1-num);
+		return;
+	}
+
+	//
+	// find the point distances to the seperating plane
+	// and the offset for the size of the box
+	//
+	node = map_nodes + num;
+	plane = &node->plane;
+
+	if (plane->type < 3)
+	{
+		t1 = p1[plane->type] - plane->dist;
+		t2 = p2[plane->type] - plane->dist;
+		offset = ctx->extents[plane->type];
+	}
+	else
+	{
+		t1 = DotProduct3 (plane->normal, p1) - plane->dist;
+		t2 = DotProduct3 (plane->normal, p2) - plane->dist;
+		if (ctx->ispoint)
+			offset = 0;
+		else
+			offset = fabsf(ctx->extents[0]*plane->normal[0]) +
+				fabsf(ctx->extents[1]*plane->normal[1]) +
+				fabsf(ctx->extents[2]*plane->normal[2]);
+	}
+
+	// see which sides we need to consider
+	if (t1 >= offset && t2 >= offset)
+	{
+		Map_RecursiveHullCheck (ctx, node->children[0], p1f, p2f, p1, p2);
+		return;
+	}
+	if (t1 < -offset && t2 < -offset)
+	{
+		Map_RecursiveHullCheck (ctx, node->children[1], p1f, p2f, p1, p2);
+		return;
+	}
+
+	// put the crosspoint DIST_EPSILON pixels on the near side
+	if (t1 < t2)
+	{
+		idist = 1.0f/(t1-t2);
+		side = 1;
+		frac2 = (t1 + offset + DIST_EPSILON)*idist;
+		frac = (t1 - offset + DIST_EPSILON)*idist;
+	}
+	else if (t1 > t2)
+	{
+		idist = 1.0f/(t1-t2);
+		side = 0;
+		frac2 = (t1 - offset - DIST_EPSILON)*idist;
+		frac = (t1 + offset + DIST_EPSILON)*idist;
+	}
+	else
+	{
+		side = 0;
+		frac = 1;
+		frac2 = 0;
+	}
+
+	// move up to the node
+	if (frac < 0)
+		frac = 0;
+	if (frac > 1)
+		frac = 1;
+
+	midf = p1f + (p2f - p1f)*frac;
+	for (i=0 ; i<3 ; i++)
+		mid[i] = p1[i] + frac*(p2[i] - p1[i]);
+
+	Map_RecursiveHullCheck (ctx, node->children[side], p1f, midf, p1, mid);
+
+
+	// go past the node
+	if (frac2 < 0)
+		frac2 = 0;
+	if (frac2 > 1)
+		frac2 = 1;
+
+	midf = p1f + (p2f - p1f)*frac2;
+	for (i=0 ; i<3 ; i++)
+		mid[i] = p1[i] + frac2*(p2[i] - p1[i]);
+
+	Map_RecursiveHullCheck (ctx, node->children[side^1], midf, p2f, mid, p2);
+}
+
+//======================================================================
+
+/*
+===============================================================================
+
+TRACE RECORDING AND BENCHMARK
+
+map_tracerecord saves the world traces the main thread makes, so map_tracebench can replay the
+same stream against another build or layout of the collision tree.
+===============================================================================
+*/
+
+#define TRACE_RECORD_MAGIC		(('C'<<24)+('R'<<16)+('T'<<8)+'Z')	// ZTRC
+#define TRACE_RECORD_VERSION	1
+
+typedef struct
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	int32_t 	brushmask;
+} map_tracerecord_t;
+
+typedef struct
+{
+	int32_t 	magic;
+	int32_t 	version;
+	char		map[MAX_QPATH];
+	int32_t 	count;
+} map_tracerecord_header_t;
+
+static map_tracerecord_t*	map_recorded_traces;	// NULL when not recording
+static int32_t				map_numrecorded, map_maxrecorded;
+static char 				map_recordname[MAX_OSPATH];
+
+/*
+==================
+Map_StopTraceRecording
+
+Writes out what has been recorded so far
+==================
+*/
+static void Map_StopTraceRecording ()
+{
+	map_tracerecord_header_t	header;
+	FILE*						f;
+
+	if (!map_recorded_traces)
+		return;
+
+	f = fopen (map_recordname, "wb");
+
+	if (!f)
+		Com_Printf ("map_tracerecord: couldn't write %s\n", map_recordname);
+	else
+	{
+		memset (&header, 0, sizeof(header));
+		header.magic = TRACE_RECORD_MAGIC;
+		header.version = TRACE_RECORD_VERSION;
+		strncpy (header.map, map_name, sizeof(header.map) - 1);
+		header.count = map_numrecorded;
+
+		fwrite (&header, sizeof(header), 1, f);
+		fwrite (map_recorded_traces, sizeof(map_tracerecord_t), map_numrecorded, f);
+		fclose (f);
+
+		Com_Printf ("Wrote %i traces to %s\n", map_numrecorded, map_recordname);
+	}
+
+	Memory_ZoneFree (map_recorded_traces);
+	map_recorded_traces = NULL;
+}
+
+/*
+==================
+Map_RecordTrace
+==================
+*/
+static void Map_RecordTrace (vec3_t start, vec3_t end, vec3_t mins, vec3_t maxs, int32_t brushmask)
+{
+	map_tracerecord_t* record = &map_recorded_traces[map_numrecorded++];
+
+	VectorCopy3 (start, record->start);
+	VectorCopy3 (end, record->end);
+	VectorCopy3 (mins, record->mins);
+	VectorCopy3 (maxs, record->maxs);
+	record->brushmask = brushmask;
+
+	if (map_numrecorded == map_maxrecorded)
+		Map_StopTraceRecording ();
+}
+
+/*
+==================
+Map_TraceRecord_f
+
+map_tracerecord <file> [traces]
+map_tracerecord stop
+==================
+*/
+static void Map_TraceRecord_f ()
+{
+	if (Cmd_Argc () < 2)
+	{
+		Com_Printf ("Usage: map_tracerecord <file> [traces] or map_tracerecord stop\n");
+		return;
+	}
+
+	if (!strcmp (Cmd_Argv (1), "stop"))
+	{
+		Map_StopTraceRecording ();
+		return;
+	}
+
+	if (!numnodes)
+	{
+		Com_Printf ("map_tracerecord: no map loaded\n");
+		return;
+	}
+
+	Map_StopTraceRecording ();
+
+	map_maxrecorded = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 100000;
+
+	if (map_maxrecorded < 1)
+		map_maxrecorded = 1;
+
+	snprintf (map_recordname, sizeof(map_recordname), "%s/%s", FS_Gamedir (), Cmd_Argv (1));
+	map_numrecorded = 0;
+	map_recorded_traces = (map_tracerecord_t*)Memory_ZoneMalloc (sizeof(map_tracerecord_t) * map_maxrecorded);
+
+	Com_Printf ("Recording %i world traces to %s\n", map_maxrecorded, map_recordname);
+}
+
+/*
+==================
+Map_LoadTraceRecording
+
+Returns the traces in a recording, or NULL if it can't be read
+==================
+*/
+static map_tracerecord_t* Map_LoadTraceRecording (const char* name, int32_t* count)
+{
+	map_tracerecord_header_t	header;
+	map_tracerecord_t*			records;
+	char						path[MAX_OSPATH];
+	FILE*						f;
+
+	snprintf (path, sizeof(path), "%s/%s", FS_Gamedir (), name);
+	f = fopen (path, "rb");
+
+	if (!f)
+	{
+		Com_Printf ("map_tracebench: couldn't open %s\n", path);
+		return NULL;
+	}
+
+	if (fread (&header, sizeof(header), 1, f) != 1
+		|| header.magic != TRACE_RECORD_MAGIC
+		|| header.version != TRACE_RECORD_VERSION
+		|| header.count < 1)
+	{
+		Com_Printf ("map_tracebench: %s isn't a trace recording\n", path);
+		fclose (f);
+		return NULL;
+	}
+
+	header.map[sizeof(header.map) - 1] = 0;
+
+	if (strcmp (header.map, map_name))
+		Com_Printf ("map_tracebench: %s was recorded on %s, not %s\n", path, header.map, map_name);
+
+	records = (map_tracerecord_t*)Memory_ZoneMalloc (sizeof(map_tracerecord_t) * header.count);
+
+	if (fread (records, sizeof(map_tracerecord_t), header.count, f) != (size_t)header.count)
+	{
+		Com_Printf ("map_tracebench: %s is truncated\n", path);
+		Memory_ZoneFree (records);
+		fclose (f);
+		return NULL;
+	}
+
+	fclose (f);
+	*count = header.count;
+	return records;
+}
+
+/*
+==================
+Map_RandomTraces
+
+Random point and player sized traces through the world, the same ones every time
+==================
+*/
+static map_tracerecord_t* Map_RandomTraces (int32_t count, bool position_tests)
+{
+	map_tracerecord_t*	records;
+	map_tracerecord_t*	record;
+	cmodel_t*			world = &map_cmodels[0];
+	uint32_t			seed;
+	int32_t 			i, j;
+
+	records = (map_tracerecord_t*)Memory_ZoneMalloc (sizeof(map_tracerecord_t) * count);
+	seed = 1;
+
+	for (i = 0 ; i < count ; i++)
+	{
+		record = &records[i];
+
+		for (j = 0 ; j < 3 ; j++)
+		{
+			seed = seed * 1664525 + 1013904223;
+			record->start[j] = world->mins[j] + (seed >> 8) / 16777216.0f * (world->maxs[j] - world->mins[j]);
+			seed = seed * 1664525 + 1013904223;
+			record->end[j] = record->start[j] + ((seed >> 8) / 16777216.0f - 0.5f) * 1024;
+		}
+
+		// every fourth one staying put, if asked for
+		if (position_tests && (i & 3) == 3)
+			VectorCopy3 (record->start, record->end);
+
+		// half of them player sized
+		if (i & 1)
+		{
+			VectorSet3 (record->mins, -16, -16, -24);
+			VectorSet3 (record->maxs, 16, 16, 32);
+		}
+
+		record->brushmask = MASK_PLAYERSOLID;
+	}
+
+	return records;
+}
+
+/*
+==================
+Map_TraceBench_f
+
+map_tracebench [file] [passes]
+
+Replays a recording from map_tracerecord, or without one, random point and player sized traces through the world.
+The checksum only depends on the results, so it should match between builds
+==================
+*/
+static void Map_TraceBench_f ()
+{
+	map_trace_context_t*	ctx;
+	map_tracerecord_t*		records;
+	map_tracerecord_t*		record;
+	trace_t 				trace;
+	int32_t 				count, passes;
+	int32_t 				pass, i;
+	int64_t 				nodes, brushes;
+	int64_t 				time_start, time_best;
+	uint32_t				checksum;
+
+	if (!numnodes)
+	{
+		Com_Printf ("map_tracebench: no map loaded\n");
+		return;
+	}
+
+	if (Cmd_Argc () > 1)
+	{
+		records = Map_LoadTraceRecording (Cmd_Argv (1), &count);
+
+		if (!records)
+			return;
+	}
+	else
+	{
+		count = 100000;
+		records = Map_RandomTraces (count, false);
+	}
+
+	passes = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 5;
+
+	if (passes < 1)
+		passes = 1;
+
+	ctx = Map_CreateTraceContext ();
+	time_best = 0;
+	checksum = 0;
+	nodes = brushes = 0;
+
+	for (pass = 0 ; pass < passes ; pass++)
+	{
+		checksum = 0;
+		nodes = brushes = 0;
+		time_start = Sys_Nanoseconds ();
+
+		for (i = 0 ; i < count ; i++)
+		{
+			record = &records[i];
+			trace = Map_BoxTraceContext (ctx, record->start, record->end, record->mins, record->maxs, 0, record->brushmask);
+
+			nodes += ctx->nodes_visited;
+			brushes += ctx->brush_traces;
+			checksum = (checksum << 5 | checksum >> 27) ^ (uint32_t)(trace.fraction * 65536) ^ (uint32_t)trace.contents;
+		}
+
+		time_start = Sys_Nanoseconds () - time_start;
+
+		if (!pass || time_start < time_best)
+			time_best = time_start;
+	}
+
+	Com_Printf ("%i traces on a %i node tree, best of %i: %.3f us per trace, %.1f nodes and %.1f brushes per trace, checksum %08x\n",
+		count, numnodes, passes, time_best / 1000.0f / count, nodes / (float)count, brushes / (float)count, checksum);
+
+	Map_FreeTraceContext (ctx);
+	Memory_ZoneFree (records);
+}
+
+/*
+==================
+Map_TraceCheck_f
+
+map_tracecheck [traces]
+
+Runs random traces both the plain way and with the brush bounds and SIMD side tests, and reports any result that differs
+==================
+*/
+static void Map_TraceCheck_f ()
+{
+	map_trace_context_t*	ctx, *reference_ctx;
+	map_tracerecord_t*		records;
+	map_tracerecord_t*		record;
+	trace_t 				trace, reference;
+	int32_t 				count, mismatches;
+	int32_t 				i;
+
+	if (!numnodes)
+	{
+		Com_Printf ("map_tracecheck: no map loaded\n");
+		return;
+	}
+
+	count = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 100000;
+
+	if (count < 1)
+		count = 1;
+
+	records = Map_RandomTraces (count, true);
+	ctx = Map_CreateTraceContext ();
+	reference_ctx = Map_CreateTraceContext ();
+	reference_ctx->reference = true;
+	mismatches = 0;
+
+	for (i = 0 ; i < count ; i++)
+	{
+		record = &records[i];
+		trace = Map_BoxTraceContext (ctx, record->start, record->end, record->mins, record->maxs, 0, record->brushmask);
+		reference = Map_BoxTraceContext (reference_ctx, record->start, record->end, record->mins, record->maxs, 0, record->brushmask);
+
+		if (trace.fraction == reference.fraction
+			&& trace.allsolid == reference.allsolid
+			&& trace.startsolid == reference.startsolid
+			&& trace.contents == reference.contents
+			&& trace.surface == reference.surface
+			&& VectorCompare3 (trace.endpos, reference.endpos)
+			&& VectorCompare3 (trace.plane.normal, reference.plane.normal)
+			&& trace.plane.dist == reference.plane.dist)
+			continue;
+
+		if (++mismatches <= 10)
+		{
+			Com_Printf ("trace %i from (%g %g %g) to (%g %g %g): fraction %g, should be %g\n", i,
+				record->start[0], record->start[1], record->start[2], record->end[0], record->end[1], record->end[2],
+				trace.fraction, reference.fraction);
+		}
+	}
+
+	Com_Printf ("map_tracecheck: %i of %i traces differ (%s side tests)\n", mismatches, count,
+		(Map_SideDistances == Map_SideDistancesScalar) ? "scalar" : "SSE2");
+
+	Map_FreeTraceContext (ctx);
+	Map_FreeTraceContext (reference_ctx);
+	Memory_ZoneFree (records);
+}
+
+/*
+==================
+Map_Init
+==================
+*/
+void Map_Init ()
+{
+	// 0 = scalar brush side tests, 1 = SSE2 when the CPU has it
+	map_simd = Cvar_Get ("map_simd", "1", CVAR_NOSET);
+
+	Map_SideDistances = Map_SideDistancesScalar;
+
+#ifdef CPUID_X86
+	if (map_simd->value
+		&& CPUID_HasFeature (cpu_feature_sse2))
+		Map_SideDistances = Map_SideDistancesSSE2;
+#endif
+
+	Cmd_AddCommand ("map_tracerecord", Map_TraceRecord_f);
+	Cmd_AddCommand ("map_tracebench", Map_TraceBench_f);
+	Cmd_AddCommand ("map_tracecheck", Map_TraceCheck_f);
+}
+
+//======================================================================
+
+/*
+==================
+Map_PushTraceCaller
+
+Says who the traces on this thread are for, unless an outer caller already has, so the server's pmove
+is counted as pmove rather than as the game traces it goes through. Returns what to pass to Map_PopTraceCaller
+==================
+*/
+trace_caller_t Map_PushTraceCaller (trace_caller_t caller)
+{
+	trace_caller_t	previous = map_trace_caller;
+
+	if (previous == trace_caller_other)
+		map_trace_caller = caller;
+
+	return previous;
+}
+
+void Map_PopTraceCaller (trace_caller_t previous)
+{
+	map_trace_caller = previous;
+}
+
+trace_caller_t Map_TraceCaller ()
+{
+	return map_trace_caller;
+}
+
+/*
+==================
+Map_SetTraceStats
+
+Turns the per caller and hull size breakdown on or off
+==================
+*/
+void Map_SetTraceStats (bool enabled)
+{
+	map_trace_stats = enabled;
+}
+
+/*
+==================
+Map_CountTrace
+
+Adds a finished trace to the statistics
+==================
+*/
+static void Map_CountTrace (map_trace_context_t* ctx, vec3_t mins, vec3_t maxs)
+{
+	map_trace_bucket_t* buckets[2];
+	float				extent;
+	int32_t 			i, hull;
+
+	c_brush_traces.fetch_add (ctx->brush_traces, std::memory_order_relaxed);
 
-	// if < 0, we are in a leaf node
-	if (num < 0)
-	{
-		Map_TraceToLeaf (-1-num);
+	if (!map_trace_stats)
 		return;
-	}
 
-	//
-	// find the point distances to the seperating plane
-	// and the offset for the size of the box
-	//
-	node = map_nodes + num;
-	plane = node->plane;
+	extent = 0;
 
-	if (plane->type < 3)
+	for (i=0 ; i<3 ; i++)
 	{
-		t1 = p1[plane->type] - plane->dist;
-		t2 = p2[plane->type] - plane->dist;
-		offset = trace_extents[plane->type];
+		if (-mins[i] > extent)
+			extent = -mins[i];
+		if (maxs[i] > extent)
+			extent = maxs[i];
 	}
+
+	if (extent <= 0)
+		hull = 0;
+	else if (extent <= 8)
+		hull = 1;
+	else if (extent <= 16)
+		hull = 2;
+	else if (extent <= 32)
+		hull = 3;
 	else
-	{
-		t1 = DotProduct3 (plane->normal, p1) - plane->dist;
-		t2 = DotProduct3 (plane->normal, p2) - plane->dist;
-		if (trace_ispoint)
-			offset = 0;
-		else
-			offset = fabsf(trace_extents[0]*plane->normal[0]) +
-				fabsf(trace_extents[1]*plane->normal[1]) +
-				fabsf(trace_extents[2]*plane->normal[2]);
-	}
+		hull = 4;
 
-	// see which sides we need to consider
-	if (t1 >= offset && t2 >= offset)
-	{
-		Map_RecursiveHullCheck (node->children[0], p1f, p2f, p1, p2);
-		return;
-	}
-	if (t1 < -offset && t2 < -offset)
-	{
-		Map_RecursiveHullCheck (node->children[1], p1f, p2f, p1, p2);
-		return;
-	}
+	buckets[0] = &map_trace_callers[map_trace_caller];
+	buckets[1] = &map_trace_hulls[hull];
 
-	// put the crosspoint DIST_EPSILON pixels on the near side
-	if (t1 < t2)
-	{
-		idist = 1.0f/(t1-t2);
-		side = 1;
-		frac2 = (t1 + offset + DIST_EPSILON)*idist;
-		frac = (t1 - offset + DIST_EPSILON)*idist;
-	}
-	else if (t1 > t2)
+	for (i=0 ; i<2 ; i++)
 	{
-		idist = 1.0f/(t1-t2);
-		side = 0;
-		frac2 = (t1 - offset - DIST_EPSILON)*idist;
-		frac = (t1 + offset + DIST_EPSILON)*idist;
-	}
-	else
-	{
-		side = 0;
-		frac = 1;
-		frac2 = 0;
+		buckets[i]->traces.fetch_add (1, std::memory_order_relaxed);
+		buckets[i]->nodes.fetch_add (ctx->nodes_visited, std::memory_order_relaxed);
+		buckets[i]->brushes.fetch_add (ctx->brush_traces, std::memory_order_relaxed);
 	}
+}
 
-	// move up to the node
-	if (frac < 0)
-		frac = 0;
-	if (frac > 1)
-		frac = 1;
-		
-	midf = p1f + (p2f - p1f)*frac;
-	for (i=0 ; i<3 ; i++)
-		mid[i] = p1[i] + frac*(p2[i] - p1[i]);
-
-	Map_RecursiveHullCheck (node->children[side], p1f, midf, p1, mid);
+/*
+==================
+Map_PrintTraceBuckets
+==================
+*/
+static void Map_PrintTraceBuckets (map_trace_bucket_t* buckets, const char** names, int32_t count)
+{
+	int32_t traces;
+	int32_t i;
 
+	for (i=0 ; i<count ; i++)
+	{
+		traces = buckets[i].traces.exchange (0, std::memory_order_relaxed);
 
-	// go past the node
-	if (frac2 < 0)
-		frac2 = 0;
-	if (frac2 > 1)
-		frac2 = 1;
-		
-	midf = p1f + (p2f - p1f)*frac2;
-	for (i=0 ; i<3 ; i++)
-		mid[i] = p1[i] + frac2*(p2[i] - p1[i]);
+		if (traces)
+		{
+			Com_Printf ("%-12s %6i %8.1f %8.1f\n", names[i], traces,
+				buckets[i].nodes.load (std::memory_order_relaxed) / (float)traces,
+				buckets[i].brushes.load (std::memory_order_relaxed) / (float)traces);
+		}
 
-	Map_RecursiveHullCheck (node->children[side^1], midf, p2f, mid, p2);
+		buckets[i].nodes = 0;
+		buckets[i].brushes = 0;
+	}
 }
 
-//======================================================================
+/*
+==================
+Map_PrintTraceStats
+
+Prints and clears the traces since the last call, with the average nodes and brushes each visited
+==================
+*/
+void Map_PrintTraceStats ()
+{
+	Com_Printf ("caller       traces    nodes  brushes\n");
+	Map_PrintTraceBuckets (map_trace_callers, map_trace_caller_names, trace_caller_max);
+	Com_Printf ("hull         traces    nodes  brushes\n");
+	Map_PrintTraceBuckets (map_trace_hulls, map_trace_hull_names, TRACE_HULL_SIZES);
+}
 
 /*
 ==================
 Map_BoxTrace
 ==================
 */
-trace_t		Map_BoxTrace (vec3_t start, vec3_t end,
+trace_t		Map_BoxTraceContext (map_trace_context_t* ctx,
+						  vec3_t start, vec3_t end,
 						  vec3_t mins, vec3_t maxs,
 						  int32_t headnode, int32_t brushmask)
 {
 	int32_t 	i;
 
-	checkcount++;		// for multi-check avoidance
-
-	c_traces++;			// for statistics, may be zeroed
-
 	// fill in a default trace
-	memset (&trace_trace, 0, sizeof(trace_trace));
-	trace_trace.fraction = 1;
-	trace_trace.surface = &(nullsurface.c);
+	memset (&ctx->trace, 0, sizeof(ctx->trace));
+	ctx->trace.fraction = 1;
+	ctx->trace.surface = &(nullsurface.c);
 
 	if (!numnodes)	// map not loaded
-		return trace_trace;
+		return ctx->trace;
+
+	if (map_recorded_traces
+		&& headnode == 0
+		&& Jobs_IsMainThread ())
+		Map_RecordTrace (start, end, mins, maxs, brushmask);
+
+	// brush numbers only go up to the box brush
+	if (ctx->num_brush_checkcounts < numbrushes + 1)
+	{
+		if (ctx->brush_checkcounts)
+			Memory_ZoneFree (ctx->brush_checkcounts);
+
+		ctx->num_brush_checkcounts = numbrushes + 1;
+		ctx->brush_checkcounts = (int32_t*)Memory_ZoneMalloc (sizeof(int32_t) * ctx->num_brush_checkcounts);
+		ctx->checkcount = 0;
+	}
+
+	ctx->checkcount++;		// for multi-check avoidance
+
+	c_traces.fetch_add (1, std::memory_order_relaxed);			// for statistics, may be zeroed
+	ctx->brush_traces = 0;
+	ctx->nodes_visited = 0;
 
-	trace_contents = brushmask;
-	VectorCopy3 (start, trace_start);
-	VectorCopy3 (end, trace_end);
-	VectorCopy3 (mins, trace_mins);
-	VectorCopy3 (maxs, trace_maxs);
+	ctx->contents = brushmask;
+	VectorCopy3 (start, ctx->start);
+	VectorCopy3 (end, ctx->end);
+	VectorCopy3 (mins, ctx->mins);
+	VectorCopy3 (maxs, ctx->maxs);
+
+	// a unit wider than the sweep, which is more than the DIST_EPSILON a near miss
+	// can still clip from, so Map_TraceTouchesBrush never skips a brush that matters
+	for (i=0 ; i<3 ; i++)
+	{
+		if (start[i] < end[i])
+		{
+			ctx->absmins[i] = start[i] + mins[i] - 1;
+			ctx->absmaxs[i] = end[i] + maxs[i] + 1;
+		}
+		else
+		{
+			ctx->absmins[i] = end[i] + mins[i] - 1;
+			ctx->absmaxs[i] = start[i] + maxs[i] + 1;
+		}
+	}
 
 	//
 	// check for position test special case
@@ -1378,23 +2504,31 @@ trace_t		Map_BoxTrace (vec3_t start, vec3_t end,
 		vec3_t	c1, c2;
 		int32_t 	topnode;
 
-		VectorAdd3 (start, mins, c1);
-		VectorAdd3 (start, maxs, c2);
-		for (i=0 ; i<3 ; i++)
-		{
-			c1[i] -= 1;
-			c2[i] += 1;
+		if (headnode == box_headnode)
+		{	// the box's nodes aren't set up, only the context knows where it is
+			Map_TestInLeaf (ctx, (int32_t)(box_leaf - map_leafs));
 		}
-
-		numleafs = MapRenderer_BoxLeafnums_headnode (c1, c2, leafs, 1024, headnode, &topnode);
-		for (i=0 ; i<numleafs ; i++)
+		else
 		{
-			Map_TestInLeaf (leafs[i]);
-			if (trace_trace.allsolid)
-				break;
+			VectorAdd3 (start, mins, c1);
+			VectorAdd3 (start, maxs, c2);
+			for (i=0 ; i<3 ; i++)
+			{
+				c1[i] -= 1;
+				c2[i] += 1;
+			}
+
+			numleafs = MapRenderer_BoxLeafnums_headnode (c1, c2, leafs, 1024, headnode, &topnode);
+			for (i=0 ; i<numleafs ; i++)
+			{
+				Map_TestInLeaf (ctx, leafs[i]);
+				if (ctx->trace.allsolid)
+					break;
+			}
 		}
-		VectorCopy3 (start, trace_trace.endpos);
-		return trace_trace;
+		VectorCopy3 (start, ctx->trace.endpos);
+		Map_CountTrace (ctx, mins, maxs);
+		return ctx->trace;
 	}
 
 	//
@@ -1403,32 +2537,48 @@ trace_t		Map_BoxTrace (vec3_t start, vec3_t end,
 	if (mins[0] == 0 && mins[1] == 0 && mins[2] == 0
 		&& maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0)
 	{
-		trace_ispoint = true;
-		VectorClear3 (trace_extents);
+		ctx->ispoint = true;
+		VectorClear3 (ctx->extents);
 	}
 	else
 	{
-		trace_ispoint = false;
-		trace_extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
-		trace_extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
-		trace_extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+		ctx->ispoint = false;
+		ctx->extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
+		ctx->extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
+		ctx->extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
 	}
 
 	//
 	// general sweeping through world
 	//
-	Map_RecursiveHullCheck (headnode, 0, 1, start, end);
+	if (headnode == box_headnode)
+	{
+		// walking the box's nodes would only decide whether to clip against its one brush, and the brush clip
+		// gives the same answer on its own
+		Map_TraceToLeaf (ctx, (int32_t)(box_leaf - map_leafs));
+	}
+	else
+		Map_RecursiveHullCheck (ctx, headnode, 0, 1, start, end);
 
-	if (trace_trace.fraction == 1)
+	if (ctx->trace.fraction == 1)
 	{
-		VectorCopy3 (end, trace_trace.endpos);
+		VectorCopy3 (end, ctx->trace.endpos);
 	}
 	else
 	{
 		for (i=0 ; i<3 ; i++)
-			trace_trace.endpos[i] = start[i] + trace_trace.fraction * (end[i] - start[i]);
+			ctx->trace.endpos[i] = start[i] + ctx->trace.fraction * (end[i] - start[i]);
 	}
-	return trace_trace;
+
+	Map_CountTrace (ctx, mins, maxs);
+	return ctx->trace;
+}
+
+trace_t		Map_BoxTrace (vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int32_t headnode, int32_t brushmask)
+{
+	return Map_BoxTraceContext (Map_ThreadTraceContext (), start, end, mins, maxs, headnode, brushmask);
 }
 
 
@@ -1445,7 +2595,8 @@ rotating entities
 //#endif
 
 
-trace_t		Map_TransformedBoxTrace (vec3_t start, vec3_t end,
+trace_t		Map_TransformedBoxTraceContext (map_trace_context_t* ctx,
+						  vec3_t start, vec3_t end,
 						  vec3_t mins, vec3_t maxs,
 						  int32_t headnode, int32_t brushmask,
 						  vec3_t origin, vec3_t angles)
@@ -1462,7 +2613,7 @@ trace_t		Map_TransformedBoxTrace (vec3_t start, vec3_t end,
 	VectorSubtract3 (end, origin, end_l);
 
 	// rotate start and end into the models frame of reference
-	if (headnode != box_headnode && 
+	if (headnode != box_headnode &&
 	(angles[0] || angles[1] || angles[2]) )
 		rotated = true;
 	else
@@ -1484,7 +2635,7 @@ trace_t		Map_TransformedBoxTrace (vec3_t start, vec3_t end,
 	}
 
 	// sweep the box through the model
-	trace = Map_BoxTrace (start_l, end_l, mins, maxs, headnode, brushmask);
+	trace = Map_BoxTraceContext (ctx, start_l, end_l, mins, maxs, headnode, brushmask);
 
 	if (rotated && trace.fraction != 1.0)
 	{
@@ -1505,6 +2656,14 @@ trace_t		Map_TransformedBoxTrace (vec3_t start, vec3_t end,
 	return trace;
 }
 
+trace_t		Map_TransformedBoxTrace (vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int32_t headnode, int32_t brushmask,
+						  vec3_t origin, vec3_t angles)
+{
+	return Map_TransformedBoxTraceContext (Map_ThreadTraceContext (), start, end, mins, maxs, headnode, brushmask, origin, angles);
+}
+
 //#ifdef _WIN32
 //#pragma optimize( "", on )
 //#endif
@@ -1564,14 +2723,93 @@ void Map_DecompressVis (uint8_t *in, uint8_t *out)
 	} while (out_p - out < row);
 }
 
+/*
+===================
+Map_FreeVisCache
+===================
+*/
+void Map_FreeVisCache ()
+{
+	if (map_viscachedata)
+		Memory_ZoneFree (map_viscachedata);
+
+	map_viscachedata = NULL;
+	map_visrowbytes = 0;
+}
+
+/*
+===================
+Map_BuildVisCache
+
+Decompresses the PVS and PHS of every cluster once, so Map_ClusterPVS and Map_ClusterPHS
+are just lookups. The rows are never written after this, so they are safe to read from any thread.
+An extra row of zeroes on the end stands in for cluster -1.
+===================
+*/
+void Map_BuildVisCache ()
+{
+	int64_t		size, budget;
+	int32_t		rowbytes;
+	int32_t		i;
+
+	Map_FreeVisCache ();
+
+	if (numclusters <= 0)
+		return;
+
+	rowbytes = (((numclusters + 7) >> 3) + 31) & ~31;
+	size = (int64_t)rowbytes * (numclusters * 2 + 1);
+	budget = (int64_t)(map_viscache->value * 1024 * 1024);
+
+	if (size > budget
+		|| size > INT32_MAX)
+	{
+		if (map_viscache->value)
+		{
+			Com_Printf ("PVS/PHS cache needs %lld KB for %i clusters, over the map_viscache budget of %i MB. Decompressing on demand\n",
+				size / 1024, numclusters, (int32_t)map_viscache->value);
+		}
+
+		return;
+	}
+
+	map_visrowbytes = rowbytes;
+	map_viscachedata = (uint8_t*)Memory_ZoneMalloc ((int32_t)size);
+
+	for (i = 0; i < numclusters; i++)
+	{
+		Map_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PVS], map_viscachedata + i * rowbytes);
+		Map_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PHS], map_viscachedata + (numclusters + i) * rowbytes);
+	}
+
+	Com_Printf ("PVS/PHS cache: %i clusters, %lld KB of %i MB budget\n", numclusters, size / 1024, (int32_t)map_viscache->value);
+}
+
 uint8_t	pvsrow[MAX_MAP_LEAFS/8];
 
 uint8_t	phsrow[MAX_MAP_LEAFS/8];
 
+/*
+===================
+Map_HasVisCache
+
+True if Map_ClusterPVS and Map_ClusterPHS return cached rows, and can be called from any thread
+===================
+*/
+bool Map_HasVisCache ()
+{
+	return map_viscachedata != NULL;
+}
+
+// callers must not modify the returned rows, they may be the cached ones
 uint8_t* Map_ClusterPVS (int32_t cluster)
 {
-	if (cluster == -1)
+	if (cluster == -1 && map_viscachedata)
+		return map_viscachedata + numclusters * 2 * map_visrowbytes;
+	else if (cluster == -1)
 		memset (pvsrow, 0, (numclusters+7)>>3);
+	else if (map_viscachedata && cluster < numclusters)
+		return map_viscachedata + cluster * map_visrowbytes;
 	else
 		Map_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PVS], pvsrow);
 	return pvsrow;
@@ -1579,8 +2817,12 @@ uint8_t* Map_ClusterPVS (int32_t cluster)
 
 uint8_t* Map_ClusterPHS (int32_t cluster)
 {
-	if (cluster == -1)
+	if (cluster == -1 && map_viscachedata)
+		return map_viscachedata + numclusters * 2 * map_visrowbytes;
+	else if (cluster == -1)
 		memset (phsrow, 0, (numclusters+7)>>3);
+	else if (map_viscachedata && cluster < numclusters)
+		return map_viscachedata + (numclusters + cluster) * map_visrowbytes;
 	else
 		Map_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PHS], phsrow);
 	return phsrow;
@@ -1626,8 +2868,9 @@ Flood fills connections between map areas
 */
 void	Map_FloodAreaConnections ()
 {
-	int32_t i;
+	int32_t i, j;
 	carea_t	*area;
+	dareaportal_t	*p;
 	int32_t floodnum;
 
 	// all current floods are now invalid
@@ -1644,15 +2887,147 @@ void	Map_FloodAreaConnections ()
 		Map_FloodArea_r (area, floodnum);
 	}
 
+	memset (map_floodbits, 0, sizeof(map_floodbits));
+	memset (map_floodsizes, 0, sizeof(map_floodsizes));
+
+	for (i=0 ; i<numareas ; i++)
+	{
+		floodnum = map_areas[i].floodnum;
+		map_floodbits[floodnum][i>>3] |= 1<<(i&7);
+		map_floodsizes[floodnum]++;
+	}
+
+	// each portal is listed by both the areas it joins
+	memset (map_portalareas, 0, sizeof(map_portalareas));
+
+	for (i=1 ; i<numareas ; i++)
+	{
+		area = &map_areas[i];
+		p = &map_areaportals[area->firstareaportal];
+
+		for (j=0 ; j<area->numareaportals ; j++, p++)
+		{
+			if (p->portalnum < 0 || p->portalnum >= MAX_MAP_AREAPORTALS)
+				continue;
+
+			map_portalareas[p->portalnum][0] = i;
+			map_portalareas[p->portalnum][1] = p->otherarea;
+		}
+	}
+}
+
+/*
+====================
+Map_MoveAreaToFlood
+====================
+*/
+static void Map_MoveAreaToFlood (int32_t areanum, int32_t floodnum)
+{
+	int32_t oldflood = map_areas[areanum].floodnum;
+
+	map_floodbits[oldflood][areanum>>3] &= ~(1<<(areanum&7));
+	map_floodsizes[oldflood]--;
+
+	map_floodbits[floodnum][areanum>>3] |= 1<<(areanum&7);
+	map_floodsizes[floodnum]++;
+
+	map_areas[areanum].floodnum = floodnum;
+}
+
+/*
+====================
+Map_MarkArea_r
+
+Marks everything still connected to an area, without changing any floods
+====================
+*/
+static void Map_MarkArea_r (carea_t *area)
+{
+	int32_t 	i;
+	dareaportal_t	*p;
+
+	if (area->floodvalid == floodvalid)
+		return;
+
+	area->floodvalid = floodvalid;
+	p = &map_areaportals[area->firstareaportal];
+	for (i=0 ; i<area->numareaportals ; i++, p++)
+	{
+		if (portalopen[p->portalnum])
+			Map_MarkArea_r (&map_areas[p->otherarea]);
+	}
 }
 
+/*
+====================
+Map_SetAreaPortalState
+
+Opening a portal joins its two floods into one. Closing one only has to look at the flood it was in, which
+splits in two if one side can no longer reach the other
+====================
+*/
 void	Map_SetAreaPortalState (int32_t portalnum, bool open)
 {
+	int32_t area1, area2;
+	int32_t flood1, flood2;
+	int32_t i, newflood;
+
 	if (portalnum > numareaportals)
 		Com_Error (ERR_DROP, "areaportal > numareaportals");
 
+	if (portalopen[portalnum] == open)
+		return;
+
 	portalopen[portalnum] = open;
-	Map_FloodAreaConnections ();
+
+	area1 = map_portalareas[portalnum][0];
+	area2 = map_portalareas[portalnum][1];
+
+	if (!area1 || !area2)
+		return;		// not in any area
+
+	flood1 = map_areas[area1].floodnum;
+	flood2 = map_areas[area2].floodnum;
+
+	if (open)
+	{
+		if (flood1 == flood2)
+			return;		// already connected another way
+
+		// the smaller flood joins the bigger one
+		if (map_floodsizes[flood1] < map_floodsizes[flood2])
+		{
+			flood1 = flood2;
+			flood2 = map_areas[area1].floodnum;
+		}
+
+		for (i=1 ; i<numareas ; i++)
+		{
+			if (map_areas[i].floodnum == flood2)
+				Map_MoveAreaToFlood (i, flood1);
+		}
+		return;
+	}
+
+	// closing, see what the first side can still reach
+	floodvalid++;
+	Map_MarkArea_r (&map_areas[area1]);
+
+	if (map_areas[area2].floodvalid == floodvalid)
+		return;		// still connected another way
+
+	// there are never more floods than areas, so there is always a free number
+	for (newflood=1 ; newflood<numareas ; newflood++)
+	{
+		if (!map_floodsizes[newflood])
+			break;
+	}
+
+	for (i=1 ; i<numareas ; i++)
+	{
+		if (map_areas[i].floodvalid == floodvalid)
+			Map_MoveAreaToFlood (i, newflood);
+	}
 }
 
 bool	Map_AreasConnected (int32_t area1, int32_t area2)
@@ -1681,7 +3056,6 @@ This is used by the client refreshes to cull visibility
 */
 int32_t Map_WriteAreaBits (uint8_t *buffer, int32_t area)
 {
-	int32_t 	i;
 	int32_t 	floodnum;
 	int32_t 	bytes;
 
@@ -1691,16 +3065,16 @@ int32_t Map_WriteAreaBits (uint8_t *buffer, int32_t area)
 	{	// for debugging, send everything
 		memset (buffer, 255, bytes);
 	}
+	else if (!area)
+	{	// outside the world, every area
+		memset (buffer, 255, numareas>>3);
+		if (numareas & 7)
+			buffer[numareas>>3] = (1 << (numareas & 7)) - 1;
+	}
 	else
 	{
-		memset (buffer, 0, bytes);
-
 		floodnum = map_areas[area].floodnum;
-		for (i=0 ; i<numareas ; i++)
-		{
-			if (map_areas[i].floodnum == floodnum || !area)
-				buffer[i>>3] |= 1<<(i&7);
-		}
+		memcpy (buffer, map_floodbits[floodnum], bytes);
 	}
 
 	return bytes;
@@ -60,6 +60,18 @@ not kill the connection.  This, combined with the tight window of valid
 reliable acknowledgement numbers provides protection against malicious
 address spoofing.
 
+If the payload after the header is larger than NETCHAN_FRAGMENT_SIZE, the
+message is sent as several packets with the fragment bit (1<<30) set in the
+sequence. Each fragment repeats the header and adds
+
+8	fragment index
+8	fragment count
+
+followed by NETCHAN_FRAGMENT_SIZE bytes of the payload (the last one gets
+what is left). The receiver puts them back together in any order and only
+processes the message once all of them have arrived; if a fragment is lost
+the whole message is, just like a lost packet.
+
 The qport field is a workaround for bad address translating routers that
 sometimes remap the client's source port on a packet during gameplay.
 
@@ -76,6 +88,9 @@ unacknowledged reliable
 cvar_t*	showpackets;
 cvar_t*	showdrop;
 cvar_t*	qport;
+cvar_t*	net_fragment;
+
+#define	FRAGMENT_BIT	(1<<30)
 
 netadr_t	net_from;
 sizebuf_t	net_message;
@@ -97,6 +112,7 @@ void Netchan_Init()
 	showpackets = Cvar_Get ("showpackets", "0", 0);
 	showdrop = Cvar_Get ("showdrop", "0", 0);
 	qport = Cvar_Get ("qport", va("%i", port), CVAR_NOSET);
+	net_fragment = Cvar_Get ("net_fragment", "1", 0);
 }
 
 /*
@@ -199,6 +215,45 @@ bool Netchan_NeedReliable (netchan_t *chan)
 	return send_reliable;
 }
 
+/*
+===============
+Netchan_TransmitFragments
+
+Sends the payload after the header in NETCHAN_FRAGMENT_SIZE pieces, each with a copy of the header
+================
+*/
+static void Netchan_TransmitFragments (netchan_t *chan, uint8_t *data, int32_t header_length, int32_t length)
+{
+	sizebuf_t	send;
+	uint8_t		send_buf[NETCHAN_FRAGMENT_SIZE + 16];
+	int32_t 	count, index, offset, size;
+
+	count = (length + NETCHAN_FRAGMENT_SIZE - 1) / NETCHAN_FRAGMENT_SIZE;
+
+	for (index = 0; index < count; index++)
+	{
+		offset = index * NETCHAN_FRAGMENT_SIZE;
+		size = length - offset;
+
+		if (size > NETCHAN_FRAGMENT_SIZE)
+			size = NETCHAN_FRAGMENT_SIZE;
+
+		SZ_Init (&send, send_buf, sizeof(send_buf));
+		SZ_Write (&send, data, header_length);
+		send.data[3] |= FRAGMENT_BIT >> 24;		// the sequence is written low byte first
+		MSG_WriteByte (&send, index);
+		MSG_WriteByte (&send, count);
+		SZ_Write (&send, data + header_length + offset, size);
+
+		Net_SendPacket (chan->sock, send.cursize, send.data, chan->remote_address);
+	}
+
+	net_stats[chan->sock].fragments_sent += count;
+
+	if (showpackets->value)
+		Com_Printf ("send %4i : %i fragments\n", length, count);
+}
+
 /*
 ===============
 Netchan_Transmit
@@ -215,6 +270,7 @@ void Netchan_Transmit (netchan_t *chan, int32_t length, uint8_t *data)
 	uint8_t		send_buf[MAX_MSGLEN];
 	bool	send_reliable;
 	uint32_t	w1, w2;
+	int32_t 	header_length;
 
 // check for message overflow
 	if (chan->message.overflowed)
@@ -239,7 +295,7 @@ void Netchan_Transmit (netchan_t *chan, int32_t length, uint8_t *data)
 // write the packet header
 	SZ_Init (&send, send_buf, sizeof(send_buf));
 
-	w1 = ( chan->outgoing_sequence & ~(1<<31) ) | (send_reliable<<31);
+	w1 = ( chan->outgoing_sequence & ~(3<<30) ) | (send_reliable<<31);
 	w2 = ( chan->incoming_sequence & ~(1<<31) ) | (chan->incoming_reliable_sequence<<31);
 
 	chan->outgoing_sequence++;
@@ -252,6 +308,8 @@ void Netchan_Transmit (netchan_t *chan, int32_t length, uint8_t *data)
 	if (chan->sock == NS_CLIENT)
 		MSG_WriteShort (&send, qport->value);
 
+	header_length = send.cursize;
+
 // copy the reliable message to the packet first
 	if (send_reliable)
 	{
@@ -265,8 +323,13 @@ void Netchan_Transmit (netchan_t *chan, int32_t length, uint8_t *data)
 	else
 		Com_Printf ("Netchan_Transmit: dumped unreliable\n");
 
-// send the datagram
-	Net_SendPacket (chan->sock, send.cursize, send.data, chan->remote_address);
+// send the datagram, or the fragments if it is too big for one
+	if (send.cursize - header_length > NETCHAN_FRAGMENT_SIZE
+		&& chan->remote_address.type != NA_LOOPBACK
+		&& net_fragment->value)
+		Netchan_TransmitFragments (chan, send.data, header_length, send.cursize - header_length);
+	else
+		Net_SendPacket (chan->sock, send.cursize, send.data, chan->remote_address);
 
 	if (showpackets->value)
 	{
@@ -286,6 +349,125 @@ void Netchan_Transmit (netchan_t *chan, int32_t length, uint8_t *data)
 	}
 }
 
+/*
+=================
+Netchan_DropFragments
+
+Throws away a partly reassembled message
+=================
+*/
+static void Netchan_DropFragments (netchan_t *chan)
+{
+	uint32_t	bits;
+	int32_t 	count;
+
+	for (bits = chan->fragment_bits, count = 0; bits; bits &= bits - 1)
+		count++;
+
+	if (count && showdrop->value)
+		Com_Printf ("%s:Dropped %i of %i fragments of %i\n"
+			, Net_AdrToString (chan->remote_address)
+			, count
+			, chan->fragment_count
+			, chan->fragment_sequence);
+
+	net_stats[chan->sock].fragments_dropped += count;
+
+	chan->fragment_bits = 0;
+	chan->fragment_count = 0;
+	chan->fragment_length = 0;
+}
+
+/*
+=================
+Netchan_ProcessFragment
+
+Adds the fragment in msg, which has been read up to the fragment index, to the message being reassembled.
+Returns true once all of the fragments have arrived, with msg rebuilt as an ordinary packet holding the
+whole message and read up to its payload
+=================
+*/
+static bool Netchan_ProcessFragment (netchan_t *chan, sizebuf_t *msg, int32_t sequence)
+{
+	int32_t 	header_length, index, count, size;
+
+	header_length = msg->readcount;
+	index = MSG_ReadByte (msg);
+	count = MSG_ReadByte (msg);
+	size = msg->cursize - msg->readcount;
+
+	net_stats[chan->sock].fragments_received++;
+
+	// every fragment but the last is full, so the sender can't make one land outside the buffer
+	if (msg->readcount > msg->cursize
+		|| count < 2
+		|| count > NETCHAN_MAX_FRAGMENTS
+		|| index < 0
+		|| index >= count
+		|| size <= 0
+		|| size > NETCHAN_FRAGMENT_SIZE
+		|| (index < count - 1 && size != NETCHAN_FRAGMENT_SIZE)
+		|| header_length + index * NETCHAN_FRAGMENT_SIZE + size > msg->maxsize)
+	{
+		if (showdrop->value)
+			Com_Printf ("%s:Bad fragment %i of %i\n"
+				, Net_AdrToString (chan->remote_address)
+				, index
+				, count);
+
+		net_stats[chan->sock].fragments_dropped++;
+		return false;
+	}
+
+	// late fragment of a message older than the one being put together, which would be dropped anyway
+	if (sequence < chan->fragment_sequence)
+	{
+		if (showdrop->value)
+			Com_Printf ("%s:Out of order fragment %i of %i (sequence %i, reassembling %i)\n"
+				, Net_AdrToString (chan->remote_address)
+				, index
+				, count
+				, sequence
+				, chan->fragment_sequence);
+
+		net_stats[chan->sock].fragments_dropped++;
+		return false;
+	}
+
+	// the first fragment of a new message means the last one isn't going to be finished
+	if (sequence != chan->fragment_sequence
+		|| count != chan->fragment_count)
+	{
+		Netchan_DropFragments (chan);
+		chan->fragment_sequence = sequence;
+		chan->fragment_count = count;
+	}
+
+	// duplicated
+	if (chan->fragment_bits & (1 << index))
+		return false;
+
+	memcpy (chan->fragment_buf + index * NETCHAN_FRAGMENT_SIZE, msg->data + msg->readcount, size);
+	chan->fragment_bits |= 1 << index;
+	chan->fragment_length += size;
+
+	if (chan->fragment_bits != (1u << count) - 1)
+		return false;
+
+	// put the header back in front of the whole payload, so the message looks like it arrived in one packet
+	memcpy (msg->data + header_length, chan->fragment_buf, chan->fragment_length);
+	msg->data[3] &= ~(FRAGMENT_BIT >> 24);
+	msg->cursize = header_length + chan->fragment_length;
+	msg->readcount = header_length;
+
+	net_stats[chan->sock].fragments_reassembled++;
+
+	chan->fragment_bits = 0;
+	chan->fragment_count = 0;
+	chan->fragment_length = 0;
+	return true;
+}
+
 /*
 =================
 Netchan_Process
@@ -297,7 +479,7 @@ modifies net_message so that it points to the packet payload
 bool Netchan_Process(netchan_t *chan, sizebuf_t *msg)
 {
 	uint32_t	sequence, sequence_ack;
-	uint32_t	reliable_ack, reliable_message;
+	uint32_t	reliable_ack, reliable_message, fragment;
 	int32_t 		qport;
 
 // get sequence numbers		
@@ -311,8 +493,9 @@ bool Netchan_Process(netchan_t *chan, sizebuf_t *msg)
 
 	reliable_message = sequence >> 31;
 	reliable_ack = sequence_ack >> 31;
+	fragment = sequence & FRAGMENT_BIT;
 
-	sequence &= ~(1<<31);
+	sequence &= ~(3<<30);
 	sequence_ack &= ~(1<<31);	
 
 	if (showpackets->value)
@@ -345,6 +528,20 @@ bool Netchan_Process(netchan_t *chan, sizebuf_t *msg)
 		return false;
 	}
 
+//
+// hold on to fragments until the whole message is here
+//
+	if (fragment)
+	{
+		if (!Netchan_ProcessFragment (chan, msg, sequence))
+			return false;
+	}
+	else if (chan->fragment_bits)
+	{
+		// a newer message got through, so the one being reassembled is never going to be used
+		Netchan_DropFragments (chan);
+	}
+
 //
 // if the current outgoing reliable message has been acknowledged
 // clear the buffer to make way for the next
@@ -0,0 +1,360 @@
+/*
+Copyright (C) 2023-2024 starfrost
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+// net_receive.cpp: Network receive thread
+//
+// With net_recvthread set, a thread reads the sockets as soon as packets arrive, timestamps them, and puts them
+// in a queue per socket, so the kernel buffer is emptied even while a frame is running and the time packets
+// spend waiting for the frame can be measured. Each queue has one producer (the thread) and one consumer
+// (Net_GetPacket on the main thread), so it is a plain ring with an atomic head and tail.
+
+#include <common/common.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define NET_QUEUE_SIZE		256		// packets per socket, must be a power of two. Only allocated while the thread runs
+#define NET_RECV_POLL_MSEC	50		// how often the thread checks whether it should stop when nothing arrives
+
+typedef struct net_queuedpacket_s
+{
+	netadr_t	from;
+	int64_t 	time;				// Sys_Nanoseconds when it was read
+	int32_t 	length;
+	uint8_t		data[MAX_MSGLEN];
+} net_queuedpacket_t;
+
+typedef struct net_queue_s
+{
+	net_queuedpacket_t*		packets;			// [NET_QUEUE_SIZE]
+	alignas(64) std::atomic<uint32_t> head;		// next slot the thread fills
+	alignas(64) std::atomic<uint32_t> tail;		// next slot Net_DequeuePacket empties
+	int64_t 				last_latency;		// for the jitter
+} net_queue_t;
+
+cvar_t*				net_recvthread;
+
+static net_queue_t	net_queues[NS_MAX + 1];
+static std::thread*	net_recvthread_handle;
+static std::atomic<bool> net_recvquit;
+
+// woken when packets are queued, so Net_Sleep can return as soon as there is something to read
+static std::mutex				net_recvlock;
+static std::condition_variable	net_recvwake;
+
+/*
+===============
+Net_QueueEmpty
+===============
+*/
+static bool Net_QueueEmpty(net_queue_t* queue)
+{
+	return queue->tail.load(std::memory_order_relaxed) == queue->head.load(std::memory_order_acquire);
+}
+
+/*
+===============
+Net_ReceiveThread
+
+Moves packets from the sockets into the queues until Net_StopReceiveThread
+===============
+*/
+static void Net_ReceiveThread()
+{
+	static uint8_t		overflow[MAX_MSGLEN];
+	net_queue_t*		queue;
+	net_queuedpacket_t*	packet;
+	sizebuf_t			msg;
+	netadr_t			from;
+	uint32_t			head;
+	int32_t 			sock;
+	bool				queued;
+
+	while (!net_recvquit.load())
+	{
+		Net_WaitForSockets(NET_RECV_POLL_MSEC);
+
+		queued = false;
+
+		for (sock = 0; sock <= NS_MAX; sock++)
+		{
+			queue = &net_queues[sock];
+
+			while (1)
+			{
+				head = queue->head.load(std::memory_order_relaxed);
+
+				// when the queue is full the packet is still read, so the kernel buffer keeps draining, but dropped
+				if (head - queue->tail.load(std::memory_order_acquire) >= NET_QUEUE_SIZE)
+				{
+					SZ_Init(&msg, overflow, sizeof(overflow));
+
+					if (!Net_ReadSocket((netsrc_t)sock, &from, &msg))
+						break;
+
+					Net_CountStat(net_stats[sock].queue_drops, 1);
+					continue;
+				}
+
+				packet = &queue->packets[head & (NET_QUEUE_SIZE - 1)];
+				SZ_Init(&msg, packet->data, sizeof(packet->data));
+
+				if (!Net_ReadSocket((netsrc_t)sock, &packet->from, &msg))
+					break;
+
+				packet->time = Sys_Nanoseconds();
+				packet->length = msg.cursize;
+
+				queue->head.store(head + 1, std::memory_order_release);
+				queued = true;
+			}
+		}
+
+		if (queued)
+		{
+			// take the lock so a Net_WaitForQueue that just found the queues empty is already waiting
+			{
+				std::lock_guard<std::mutex> lock(net_recvlock);
+			}
+
+			net_recvwake.notify_all();
+		}
+	}
+}
+
+/*
+===============
+Net_StartReceiveThread
+===============
+*/
+void Net_StartReceiveThread()
+{
+	int32_t 	sock;
+
+	// read the sockets on their own thread. Takes effect the next time the sockets are opened
+	net_recvthread = Cvar_Get("net_recvthread", "0", CVAR_ARCHIVE);
+
+	if (!net_recvthread->value
+		|| net_recvthread_handle)
+		return;
+
+	for (sock = 0; sock <= NS_MAX; sock++)
+	{
+		if (!net_queues[sock].packets)
+			net_queues[sock].packets = (net_queuedpacket_t*)Memory_ZoneMalloc(sizeof(net_queuedpacket_t) * NET_QUEUE_SIZE);
+
+		net_queues[sock].head = 0;
+		net_queues[sock].tail = 0;
+		net_queues[sock].last_latency = 0;
+	}
+
+	net_recvquit = false;
+	net_recvthread_handle = new std::thread(Net_ReceiveThread);
+
+	Com_DPrintf("Started the network receive thread\n");
+}
+
+/*
+===============
+Net_StopReceiveThread
+
+Anything still queued is thrown away with the sockets
+===============
+*/
+void Net_StopReceiveThread()
+{
+	int32_t 	sock;
+
+	if (!net_recvthread_handle)
+		return;
+
+	net_recvquit = true;
+	net_recvthread_handle->join();
+	delete net_recvthread_handle;
+	net_recvthread_handle = NULL;
+
+	for (sock = 0; sock <= NS_MAX; sock++)
+	{
+		if (net_queues[sock].packets)
+		{
+			Memory_ZoneFree(net_queues[sock].packets);
+			net_queues[sock].packets = NULL;
+		}
+	}
+}
+
+/*
+===============
+Net_ReceiveThreadRunning
+===============
+*/
+bool Net_ReceiveThreadRunning()
+{
+	return net_recvthread_handle != NULL;
+}
+
+/*
+===============
+Net_DequeuePacket
+
+The oldest packet the receive thread has queued for this socket, false if there are none
+===============
+*/
+bool Net_DequeuePacket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message)
+{
+	net_queue_t*		queue = &net_queues[sock];
+	net_queuedpacket_t*	packet;
+	net_stats_t*		stats = &net_stats[sock];
+	uint32_t			tail;
+	int64_t 			latency, change, jitter;
+
+	while (!Net_QueueEmpty(queue))
+	{
+		tail = queue->tail.load(std::memory_order_relaxed);
+		packet = &queue->packets[tail & (NET_QUEUE_SIZE - 1)];
+
+		if (packet->length > net_message->maxsize)
+		{
+			Com_Printf("Oversize packet from %s\n", Net_AdrToString(packet->from));
+			queue->tail.store(tail + 1, std::memory_order_release);
+			continue;
+		}
+
+		memcpy(net_message->data, packet->data, packet->length);
+		net_message->cursize = packet->length;
+		*net_from = packet->from;
+
+		latency = Sys_Nanoseconds() - packet->time;
+
+		// the slot can be filled again from here
+		queue->tail.store(tail + 1, std::memory_order_release);
+
+		if (latency < 0)
+			latency = 0;
+
+		change = latency - queue->last_latency;
+
+		if (change < 0)
+			change = -change;
+
+		queue->last_latency = latency;
+
+		stats->queue_packets++;
+		stats->queue_latency_ns += latency;
+
+		if ((uint64_t)latency > stats->queue_latency_max_ns)
+			stats->queue_latency_max_ns = latency;
+
+		jitter = (int64_t)stats->queue_jitter_ns;
+		jitter += (change - jitter) / 16;
+		stats->queue_jitter_ns = jitter;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+===============
+Net_WaitForQueue
+
+Sleeps for up to msec, or until the receive thread has queued something for the server
+===============
+*/
+void Net_WaitForQueue(int32_t msec)
+{
+	std::unique_lock<std::mutex> lock(net_recvlock);
+
+	net_recvwake.wait_for(lock, std::chrono::milliseconds(msec), []
+		{
+			return !Net_QueueEmpty(&net_queues[NS_SERVER]);
+		});
+}
+
+/*
+===============
+Net_ResetStats
+===============
+*/
+void Net_ResetStats()
+{
+	net_stats_t*	stats;
+	int32_t 		sock;
+
+	for (sock = 0; sock <= NS_MAX; sock++)
+	{
+		stats = &net_stats[sock];
+
+		// the receive thread may be counting into these
+		stats->recv_calls.store(0, std::memory_order_relaxed);
+		stats->recv_packets.store(0, std::memory_order_relaxed);
+		stats->recv_bytes.store(0, std::memory_order_relaxed);
+		stats->largest_batch.store(0, std::memory_order_relaxed);
+		stats->queue_drops.store(0, std::memory_order_relaxed);
+
+		stats->send_calls = stats->send_packets = stats->send_bytes = stats->send_errors = 0;
+		stats->queue_packets = stats->queue_latency_ns = stats->queue_latency_max_ns = stats->queue_jitter_ns = 0;
+		stats->fragments_sent = stats->fragments_received = stats->fragments_reassembled = stats->fragments_dropped = 0;
+	}
+}
+
+/*
+===============
+Net_PrintStats
+===============
+*/
+void Net_PrintStats(netsrc_t sock)
+{
+	net_stats_t*	stats = &net_stats[sock];
+	uint64_t		recv_calls, recv_packets, recv_bytes, largest_batch, queue_drops;
+
+	// taken once, the receive thread may still be counting
+	recv_calls = stats->recv_calls.load(std::memory_order_relaxed);
+	recv_packets = stats->recv_packets.load(std::memory_order_relaxed);
+	recv_bytes = stats->recv_bytes.load(std::memory_order_relaxed);
+	largest_batch = stats->largest_batch.load(std::memory_order_relaxed);
+	queue_drops = stats->queue_drops.load(std::memory_order_relaxed);
+
+	Com_Printf("         syscalls    packets        bytes  packets/call\n");
+	Com_Printf("receive %9llu  %9llu  %11llu  %12.2f\n", (unsigned long long)recv_calls,
+		(unsigned long long)recv_packets, (unsigned long long)recv_bytes,
+		recv_calls ? (double)recv_packets / recv_calls : 0.0);
+	Com_Printf("send    %9llu  %9llu  %11llu  %12.2f\n", (unsigned long long)stats->send_calls,
+		(unsigned long long)stats->send_packets, (unsigned long long)stats->send_bytes,
+		stats->send_calls ? (double)stats->send_packets / stats->send_calls : 0.0);
+	Com_Printf("%llu send errors, at most %llu packets in one call\n",
+		(unsigned long long)stats->send_errors, (unsigned long long)largest_batch);
+
+	if (stats->fragments_sent || stats->fragments_received)
+	{
+		Com_Printf("fragments: %llu sent, %llu received, %llu messages reassembled, %llu dropped\n",
+			(unsigned long long)stats->fragments_sent, (unsigned long long)stats->fragments_received,
+			(unsigned long long)stats->fragments_reassembled, (unsigned long long)stats->fragments_dropped);
+	}
+
+	if (!stats->queue_packets && !queue_drops)
+		return;
+
+	Com_Printf("receive thread: %llu packets, %llu dropped, waited %.3f ms average, %.3f ms most, %.3f ms jitter\n",
+		(unsigned long long)stats->queue_packets, (unsigned long long)queue_drops,
+		stats->queue_packets ? stats->queue_latency_ns / (double)stats->queue_packets / 1000000.0 : 0.0,
+		stats->queue_latency_max_ns / 1000000.0, stats->queue_jitter_ns / 1000000.0);
+}
@@ -65,6 +65,12 @@ float phys_waterspeed = 400;
   walking up a step should kill some velocity
 */
 
+static void Pmove_RecordMove(pmove_t* pmove);
+
+// set while pmove_record is running
+typedef struct pmove_record_s pmove_record_t;
+static pmove_record_t* pmove_recorded;
+
 /*
 ==================
 PM_ClipVelocity
@@ -1141,6 +1147,10 @@ Can be called by either the server or the client
 */
 void Player_Move(pmove_t* pmove)
 {
+	if (pmove_recorded
+		&& Jobs_IsMainThread())
+		Pmove_RecordMove(pmove);
+
 	pm = pmove;
 
 	// clear results
@@ -1259,3 +1269,388 @@ void Player_Move(pmove_t* pmove)
 
 	PM_SnapPosition();
 }
+
+/*
+===============================================================================
+
+PMOVE RECORDING AND BENCHMARK
+
+pmove_record saves the state and command going into every move on the main thread, from the
+server and prediction alike. pmove_bench runs each of them again on their own against the world
+alone, so a change to the movement code can be timed, and checked to give the same results, without a game running.
+It loads the map the moves were made on when no server is running, so works from a dedicated server's command line.
+===============================================================================
+*/
+
+#define PMOVE_RECORD_MAGIC		(('M'<<24)+('P'<<16)+('M'<<8)+'Z')	// ZMPM
+#define PMOVE_RECORD_VERSION	1
+
+typedef struct
+{
+	pmove_state_t	s;
+	usercmd_t		cmd;
+	int32_t 		snapinitial;
+} pmove_move_t;
+
+typedef struct
+{
+	int32_t 		magic;
+	int32_t 		version;
+	char			map[MAX_QPATH];
+	int32_t 		count;
+
+	// the physics the moves were made with
+	float			stopspeed, maxspeed_player, maxspeed_director, duckspeed;
+	float			accelerate_player, accelerate_director, airaccelerate, wateraccelerate;
+	float			friction, waterfriction, waterspeed;
+} pmove_record_header_t;
+
+struct pmove_record_s
+{
+	pmove_record_header_t	header;
+	pmove_move_t*			moves;
+	int32_t 				maxmoves;
+	char					path[MAX_OSPATH];
+};
+
+static int32_t	pmove_bench_traces;		// made by the move being benchmarked
+
+/*
+==================
+Pmove_StopRecording
+==================
+*/
+static void Pmove_StopRecording()
+{
+	pmove_record_t* record = pmove_recorded;
+	FILE*			f;
+
+	if (!record)
+		return;
+
+	pmove_recorded = NULL;
+	f = fopen(record->path, "wb");
+
+	if (!f)
+		Com_Printf("pmove_record: couldn't write %s\n", record->path);
+	else
+	{
+		fwrite(&record->header, sizeof(record->header), 1, f);
+		fwrite(record->moves, sizeof(pmove_move_t), record->header.count, f);
+		fclose(f);
+
+		Com_Printf("Wrote %i moves to %s\n", record->header.count, record->path);
+	}
+
+	Memory_ZoneFree(record->moves);
+	Memory_ZoneFree(record);
+}
+
+/*
+==================
+Pmove_RecordMove
+==================
+*/
+static void Pmove_RecordMove(pmove_t* pmove)
+{
+	pmove_record_t* record = pmove_recorded;
+	pmove_move_t*	move;
+
+	// the physics the first move was made with are the ones saved
+	if (!record->header.count)
+	{
+		record->header.stopspeed = phys_stopspeed;
+		record->header.maxspeed_player = phys_maxspeed_player;
+		record->header.maxspeed_director = phys_maxspeed_director;
+		record->header.duckspeed = phys_duckspeed;
+		record->header.accelerate_player = phys_accelerate_player;
+		record->header.accelerate_director = phys_accelerate_director;
+		record->header.airaccelerate = phys_airaccelerate;
+		record->header.wateraccelerate = phys_wateraccelerate;
+		record->header.friction = phys_friction;
+		record->header.waterfriction = phys_waterfriction;
+		record->header.waterspeed = phys_waterspeed;
+	}
+
+	move = &record->moves[record->header.count++];
+	move->s = pmove->s;
+	move->cmd = pmove->cmd;
+	move->snapinitial = pmove->snapinitial;
+
+	if (record->header.count == record->maxmoves)
+		Pmove_StopRecording();
+}
+
+/*
+==================
+Pmove_Record_f
+
+pmove_record <file> [moves]
+pmove_record stop
+==================
+*/
+static void Pmove_Record_f()
+{
+	pmove_record_t* record;
+
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf("Usage: pmove_record <file> [moves] or pmove_record stop\n");
+		return;
+	}
+
+	if (!strcmp(Cmd_Argv(1), "stop"))
+	{
+		Pmove_StopRecording();
+		return;
+	}
+
+	if (!map_name[0])
+	{
+		Com_Printf("pmove_record: no map loaded\n");
+		return;
+	}
+
+	Pmove_StopRecording();
+
+	record = (pmove_record_t*)Memory_ZoneMalloc(sizeof(pmove_record_t));
+	record->maxmoves = (Cmd_Argc() > 2) ? atoi(Cmd_Argv(2)) : 10000;
+
+	if (record->maxmoves < 1)
+		record->maxmoves = 1;
+
+	record->header.magic = PMOVE_RECORD_MAGIC;
+	record->header.version = PMOVE_RECORD_VERSION;
+	strncpy(record->header.map, map_name, sizeof(record->header.map) - 1);
+	snprintf(record->path, sizeof(record->path), "%s/%s", FS_Gamedir(), Cmd_Argv(1));
+	record->moves = (pmove_move_t*)Memory_ZoneMalloc(sizeof(pmove_move_t) * record->maxmoves);
+
+	pmove_recorded = record;
+
+	Com_Printf("Recording %i moves to %s\n", record->maxmoves, record->path);
+}
+
+/*
+==================
+Pmove_BenchTrace
+
+The world without any entities in it
+==================
+*/
+static trace_t Pmove_BenchTrace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end)
+{
+	trace_t trace;
+
+	pmove_bench_traces++;
+	trace = Map_BoxTrace(start, end, mins, maxs, 0, MASK_PLAYERSOLID);
+
+	if (trace.fraction < 1.0)
+		trace.ent = (struct edict_s*)1;		// the same stand in for the world prediction uses
+
+	return trace;
+}
+
+static int32_t Pmove_BenchPointContents(vec3_t point)
+{
+	return Map_PointContents(point, 0);
+}
+
+/*
+==================
+Pmove_Checksum
+==================
+*/
+static uint32_t Pmove_Checksum(uint32_t checksum, void* data, int32_t size)
+{
+	uint8_t*	bytes = (uint8_t*)data;
+	int32_t 	i;
+
+	for (i = 0; i < size; i++)
+	{
+		checksum ^= bytes[i];
+		checksum *= 16777619u;
+	}
+
+	return checksum;
+}
+
+/*
+==================
+Pmove_Bench_f
+
+pmove_bench <file> [passes]
+==================
+*/
+static void Pmove_Bench_f()
+{
+	pmove_record_header_t	header;
+	pmove_move_t*			moves;
+	pmove_t 				pmove;
+	char					path[MAX_OSPATH];
+	FILE*					f;
+	uint32_t				map_checksum, checksum;
+	uint8_t 				onground;
+	int32_t 				passes, pass, i;
+	int32_t 				traces;
+	int64_t 				time_start, time_move, time_total, time_best, time_worst;
+	float					saved[11];
+
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf("Usage: pmove_bench <file> [passes]\n");
+		return;
+	}
+
+	// don't record the benchmark
+	Pmove_StopRecording();
+
+	snprintf(path, sizeof(path), "%s/%s", FS_Gamedir(), Cmd_Argv(1));
+	f = fopen(path, "rb");
+
+	if (!f)
+	{
+		Com_Printf("pmove_bench: couldn't open %s\n", path);
+		return;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1
+		|| header.magic != PMOVE_RECORD_MAGIC
+		|| header.version != PMOVE_RECORD_VERSION
+		|| header.count < 1)
+	{
+		Com_Printf("pmove_bench: %s isn't a pmove recording\n", path);
+		fclose(f);
+		return;
+	}
+
+	header.map[sizeof(header.map) - 1] = 0;
+	moves = (pmove_move_t*)Memory_ZoneMalloc(sizeof(pmove_move_t) * header.count);
+
+	if (fread(moves, sizeof(pmove_move_t), header.count, f) != (size_t)header.count)
+	{
+		Com_Printf("pmove_bench: %s is truncated\n", path);
+		Memory_ZoneFree(moves);
+		fclose(f);
+		return;
+	}
+
+	fclose(f);
+
+	if (strcmp(map_name, header.map))
+	{
+		// a running server's map, or the one a connected client is playing on, can't be swapped out from under it
+		if (Com_GetServerState() || CL_IsConnected())
+		{
+			Com_Printf("pmove_bench: %s was recorded on %s, which isn't the map loaded\n", path, header.map);
+			Memory_ZoneFree(moves);
+			return;
+		}
+
+		Map_Load(header.map, false, &map_checksum);
+	}
+
+	passes = (Cmd_Argc() > 2) ? atoi(Cmd_Argv(2)) : 5;
+
+	if (passes < 1)
+		passes = 1;
+
+	// the globals belong to whoever moves next, so put them back afterwards
+	saved[0] = phys_stopspeed;
+	saved[1] = phys_maxspeed_player;
+	saved[2] = phys_maxspeed_director;
+	saved[3] = phys_duckspeed;
+	saved[4] = phys_accelerate_player;
+	saved[5] = phys_accelerate_director;
+	saved[6] = phys_airaccelerate;
+	saved[7] = phys_wateraccelerate;
+	saved[8] = phys_friction;
+	saved[9] = phys_waterfriction;
+	saved[10] = phys_waterspeed;
+
+	phys_stopspeed = header.stopspeed;
+	phys_maxspeed_player = header.maxspeed_player;
+	phys_maxspeed_director = header.maxspeed_director;
+	phys_duckspeed = header.duckspeed;
+	phys_accelerate_player = header.accelerate_player;
+	phys_accelerate_director = header.accelerate_director;
+	phys_airaccelerate = header.airaccelerate;
+	phys_wateraccelerate = header.wateraccelerate;
+	phys_friction = header.friction;
+	phys_waterfriction = header.waterfriction;
+	phys_waterspeed = header.waterspeed;
+
+	time_best = time_worst = 0;
+	checksum = 0;
+	traces = 0;
+
+	for (pass = 0; pass < passes; pass++)
+	{
+		checksum = 2166136261u;
+		pmove_bench_traces = 0;
+		time_total = 0;
+
+		for (i = 0; i < header.count; i++)
+		{
+			memset(&pmove, 0, sizeof(pmove));
+			pmove.s = moves[i].s;
+			pmove.cmd = moves[i].cmd;
+			pmove.snapinitial = moves[i].snapinitial;
+			pmove.trace = Pmove_BenchTrace;
+			pmove.pointcontents = Pmove_BenchPointContents;
+
+			time_start = Sys_Nanoseconds();
+			Player_Move(&pmove);
+			time_move = Sys_Nanoseconds() - time_start;
+
+			time_total += time_move;
+
+			if (time_move > time_worst)
+				time_worst = time_move;
+
+			// field by field, so padding doesn't get in
+			checksum = Pmove_Checksum(checksum, pmove.s.origin, sizeof(pmove.s.origin));
+			checksum = Pmove_Checksum(checksum, pmove.s.velocity, sizeof(pmove.s.velocity));
+			checksum = Pmove_Checksum(checksum, &pmove.s.pm_flags, sizeof(pmove.s.pm_flags));
+			checksum = Pmove_Checksum(checksum, &pmove.s.pm_time, sizeof(pmove.s.pm_time));
+			checksum = Pmove_Checksum(checksum, pmove.viewangles, sizeof(pmove.viewangles));
+			checksum = Pmove_Checksum(checksum, &pmove.viewheight, sizeof(pmove.viewheight));
+			checksum = Pmove_Checksum(checksum, &pmove.waterlevel, sizeof(pmove.waterlevel));
+			onground = (pmove.groundentity != NULL);
+			checksum = Pmove_Checksum(checksum, &onground, sizeof(onground));
+		}
+
+		traces = pmove_bench_traces;
+
+		if (!pass || time_total < time_best)
+			time_best = time_total;
+	}
+
+	phys_stopspeed = saved[0];
+	phys_maxspeed_player = saved[1];
+	phys_maxspeed_director = saved[2];
+	phys_duckspeed = saved[3];
+	phys_accelerate_player = saved[4];
+	phys_accelerate_director = saved[5];
+	phys_airaccelerate = saved[6];
+	phys_wateraccelerate = saved[7];
+	phys_friction = saved[8];
+	phys_waterfriction = saved[9];
+	phys_waterspeed = saved[10];
+
+	Com_Printf("%i moves on %s, best of %i: %.3f us per move (worst %.3f us), %.1f traces per move, checksum %08x\n",
+		header.count, header.map, passes, time_best / 1000.0f / header.count, time_worst / 1000.0f,
+		traces / (float)header.count, checksum);
+
+	Memory_ZoneFree(moves);
+}
+
+/*
+==================
+Pmove_Init
+==================
+*/
+void Pmove_Init()
+{
+	Cmd_AddCommand("pmove_record", Pmove_Record_f);
+	Cmd_AddCommand("pmove_bench", Pmove_Bench_f);
+}
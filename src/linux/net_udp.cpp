@@ -8,7 +8,7 @@ of the License, or (at your option) any later version.
 
 This program is distributed in the hope that it will be useful,
 but WITHOUT ANY WARRANTY; without even the implied warranty of
-MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
 
 See the GNU General Public License for more details.
 
@@ -17,84 +17,128 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
-// net_wins.c
+// net_udp.cpp -- the socket backend on linux. The socket is drained with recvmmsg and
+// batched sends go out with sendmmsg, so a busy server makes a few syscalls a frame rather than one per packet
 
-#include "../qcommon/qcommon.h"
+#include <common/common.hpp>
 
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/select.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/param.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <poll.h>
 #include <errno.h>
 
-#ifdef NeXT
-#include <libc.h>
-#endif
-
-netadr_t	net_local_adr;
-
-#define	LOOPBACK	0x7f000001
-
 #define	MAX_LOOPBACK	4
 
-typedef struct
+typedef struct loopmsg_s
 {
 	uint8_t	data[MAX_MSGLEN];
-	int		datalen;
+	int32_t datalen;
 } loopmsg_t;
 
-typedef struct
+typedef struct loopback_s
 {
 	loopmsg_t	msgs[MAX_LOOPBACK];
-	int			get, send;
+	int32_t 	get, send;
 } loopback_t;
 
+#define NET_RECV_BATCH		32				// packets one recvmmsg can pick up
+#define NET_SEND_BATCH		64				// packets one sendmmsg can send
+#define NET_SEND_POOL		(256 * 1024)	// bytes of queued packets, sent early if they don't fit
+
+// what the last recvmmsg picked up, handed out one at a time by Net_GetPacket
+typedef struct net_recvring_s
+{
+	uint8_t				data[NET_RECV_BATCH][MAX_MSGLEN];
+	struct sockaddr_in	from[NET_RECV_BATCH];
+	struct mmsghdr		msgs[NET_RECV_BATCH];
+	struct iovec		iovecs[NET_RECV_BATCH];
+	int32_t 			count;		// packets in the ring
+	int32_t 			next;		// the next one Net_GetPacket returns
+} net_recvring_t;
+
+// packets sent while batching, waiting for Net_FlushSendBatch
+typedef struct net_sendqueue_s
+{
+	bool				batching;
+	uint8_t				pool[NET_SEND_POOL];
+	int32_t 			poolsize;
+	struct sockaddr_in	to[NET_SEND_BATCH];
+	netadr_t			toadr[NET_SEND_BATCH];	// for the error messages
+	struct mmsghdr		msgs[NET_SEND_BATCH];
+	struct iovec		iovecs[NET_SEND_BATCH];
+	int32_t 			count;
+} net_sendqueue_t;
+
+cvar_t* net_shownet;
+static cvar_t* noudp;
+
 loopback_t	loopbacks[2];
-int			ip_sockets[2];
+int32_t 	ip_sockets[2];
+
+net_stats_t	net_stats[NS_MAX + 1];
+
+static net_recvring_t	net_recvrings[2];
+static net_sendqueue_t	net_sendqueues[2];
 
-int NET_Socket (char *net_interface, int port);
-char *NET_ErrorString (void);
+const char* Net_ErrorString();
 
 //=============================================================================
 
-void NetadrToSockadr (netadr_t *a, struct sockaddr_in *s)
+void NetadrToSockadr(netadr_t* a, struct sockaddr_in* s)
 {
-	memset (s, 0, sizeof(*s));
+	memset(s, 0, sizeof(*s));
 
 	if (a->type == NA_BROADCAST)
 	{
 		s->sin_family = AF_INET;
-
 		s->sin_port = a->port;
-		*(int *)&s->sin_addr = -1;
+		s->sin_addr.s_addr = INADDR_BROADCAST;
 	}
 	else if (a->type == NA_IP)
 	{
 		s->sin_family = AF_INET;
-
-		*(int *)&s->sin_addr = *(int *)&a->ip;
+		memcpy(&s->sin_addr.s_addr, a->ip, sizeof(a->ip));
 		s->sin_port = a->port;
 	}
 }
 
-void SockadrToNetadr (struct sockaddr_in *s, netadr_t *a)
+void SockadrToNetadr(struct sockaddr_in* s, netadr_t* a)
 {
-	*(int *)&a->ip = *(int *)&s->sin_addr;
-	a->port = s->sin_port;
-	a->type = NA_IP;
+	memset(a, 0, sizeof(*a));
+
+	if (s->sin_family == AF_INET)
+	{
+		a->type = NA_IP;
+		memcpy(a->ip, &s->sin_addr.s_addr, sizeof(a->ip));
+		a->port = s->sin_port;
+	}
 }
 
 
-bool	NET_CompareAdr (netadr_t a, netadr_t b)
+bool Net_CompareAdr(netadr_t a, netadr_t b)
 {
-	if (a.ip[0] == b.ip[0] && a.ip[1] == b.ip[1] && a.ip[2] == b.ip[2] && a.ip[3] == b.ip[3] && a.port == b.port)
+	if (a.type != b.type)
+		return false;
+
+	if (a.type == NA_LOOPBACK)
 		return true;
-	return false;
+
+	if (a.type == NA_IP)
+	{
+		if (a.ip[0] == b.ip[0] && a.ip[1] == b.ip[1] && a.ip[2] == b.ip[2] && a.ip[3] == b.ip[3] && a.port == b.port)
+			return true;
+		return false;
+	}
+
+	return true;
 }
 
 /*
@@ -104,7 +148,7 @@ NET_CompareBaseAdr
 Compares without the port
 ===================
 */
-bool	NET_CompareBaseAdr (netadr_t a, netadr_t b)
+bool Net_CompareBaseAdr(netadr_t a, netadr_t b)
 {
 	if (a.type != b.type)
 		return false;
@@ -119,24 +163,22 @@ bool	NET_CompareBaseAdr (netadr_t a, netadr_t b)
 		return false;
 	}
 
-    return false;
+	return true;
 }
 
-char	*NET_AdrToString (netadr_t a)
+void Net_AdrToBuffer(netadr_t a, char* buffer, int32_t size)
 {
-	static	char	s[64];
-	
-	Com_sprintf (s, sizeof(s), "%i.%i.%i.%i:%i", a.ip[0], a.ip[1], a.ip[2], a.ip[3], ntohs(a.port));
-
-	return s;
+	if (a.type == NA_LOOPBACK)
+		snprintf(buffer, size, "loopback");
+	else
+		snprintf(buffer, size, "%i.%i.%i.%i:%i", a.ip[0], a.ip[1], a.ip[2], a.ip[3], ntohs(a.port));
 }
 
-char	*NET_BaseAdrToString (netadr_t a)
+char* Net_AdrToString(netadr_t a)
 {
-	static	char	s[64];
-	
-	Com_sprintf (s, sizeof(s), "%i.%i.%i.%i", a.ip[0], a.ip[1], a.ip[2], a.ip[3]);
+	static char s[64];
 
+	Net_AdrToBuffer(a, s, sizeof(s));
 	return s;
 }
 
@@ -151,37 +193,41 @@ idnewt:28000
 192.246.40.70:28000
 =============
 */
-bool	NET_StringToSockaddr (char *s, struct sockaddr *sadr)
+bool Net_StringToSockaddr(const char* s, struct sockaddr_in* sadr)
 {
-	struct hostent	*h;
-	char	*colon;
+	struct hostent* h;
+	char* colon;
 	char	copy[128];
-	
-	memset (sadr, 0, sizeof(*sadr));
-	((struct sockaddr_in *)sadr)->sin_family = AF_INET;
-	
-	((struct sockaddr_in *)sadr)->sin_port = 0;
 
-	strcpy (copy, s);
+	memset(sadr, 0, sizeof(*sadr));
+
+	sadr->sin_family = AF_INET;
+	sadr->sin_port = 0;
+
+	strncpy(copy, s, sizeof(copy) - 1);
+	copy[sizeof(copy) - 1] = 0;
+
 	// strip off a trailing :port if present
-	for (colon = copy ; *colon ; colon++)
+	for (colon = copy; *colon; colon++)
+	{
 		if (*colon == ':')
 		{
 			*colon = 0;
-			((struct sockaddr_in *)sadr)->sin_port = htons((short)atoi(colon+1));	
+			sadr->sin_port = htons((int16_t)atoi(colon + 1));
 		}
-	
+	}
+
 	if (copy[0] >= '0' && copy[0] <= '9')
 	{
-		*(int *)&((struct sockaddr_in *)sadr)->sin_addr = inet_addr(copy);
+		sadr->sin_addr.s_addr = inet_addr(copy);
 	}
 	else
 	{
-		if (! (h = gethostbyname(copy)) )
-			return 0;
-		*(int *)&((struct sockaddr_in *)sadr)->sin_addr = *(int *)h->h_addr_list[0];
+		if (!(h = gethostbyname(copy)))
+			return false;
+		memcpy(&sadr->sin_addr.s_addr, h->h_addr_list[0], sizeof(sadr->sin_addr.s_addr));
 	}
-	
+
 	return true;
 }
 
@@ -196,29 +242,29 @@ idnewt:28000
 192.246.40.70:28000
 =============
 */
-bool	NET_StringToAdr (char *s, netadr_t *a)
+bool Net_StringToAdr(const char* s, netadr_t* a)
 {
 	struct sockaddr_in sadr;
-	
-	if (!strcmp (s, "localhost"))
+
+	if (!strcmp(s, "localhost"))
 	{
-		memset (a, 0, sizeof(*a));
+		memset(a, 0, sizeof(*a));
 		a->type = NA_LOOPBACK;
 		return true;
 	}
 
-	if (!NET_StringToSockaddr (s, (struct sockaddr *)&sadr))
+	if (!Net_StringToSockaddr(s, &sadr))
 		return false;
-	
-	SockadrToNetadr (&sadr, a);
+
+	SockadrToNetadr(&sadr, a);
 
 	return true;
 }
 
 
-bool	NET_IsLocalAddress (netadr_t adr)
+bool Net_IsLocalAddress(netadr_t adr)
 {
-	return NET_CompareAdr (adr, net_local_adr);
+	return adr.type == NA_LOOPBACK;
 }
 
 /*
@@ -229,10 +275,10 @@ LOOPBACK BUFFERS FOR LOCAL PLAYER
 =============================================================================
 */
 
-bool	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
+bool Net_GetLoopPacket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message)
 {
-	int		i;
-	loopback_t	*loop;
+	int32_t 	i;
+	loopback_t* loop;
 
 	loop = &loopbacks[sock];
 
@@ -242,300 +288,587 @@ bool	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_messag
 	if (loop->get >= loop->send)
 		return false;
 
-	i = loop->get & (MAX_LOOPBACK-1);
+	i = loop->get & (MAX_LOOPBACK - 1);
 	loop->get++;
 
-	memcpy (net_message->data, loop->msgs[i].data, loop->msgs[i].datalen);
+	memcpy(net_message->data, loop->msgs[i].data, loop->msgs[i].datalen);
 	net_message->cursize = loop->msgs[i].datalen;
-	*net_from = net_local_adr;
+	memset(net_from, 0, sizeof(*net_from));
+	net_from->type = NA_LOOPBACK;
 	return true;
 
 }
 
 
-void NET_SendLoopPacket (netsrc_t sock, int length, void *data, netadr_t to)
+void Net_SendLoopPacket(netsrc_t sock, int32_t length, void* data, netadr_t to)
 {
-	int		i;
-	loopback_t	*loop;
+	int32_t 	i;
+	loopback_t* loop;
 
-	loop = &loopbacks[sock^1];
+	loop = &loopbacks[sock ^ 1];
 
-	i = loop->send & (MAX_LOOPBACK-1);
+	i = loop->send & (MAX_LOOPBACK - 1);
 	loop->send++;
 
-	memcpy (loop->msgs[i].data, data, length);
+	memcpy(loop->msgs[i].data, data, length);
 	loop->msgs[i].datalen = length;
 }
 
 //=============================================================================
 
-bool	NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
+/*
+====================
+Net_FillRecvRing
+
+Picks up everything waiting on the socket, up to NET_RECV_BATCH packets, with one syscall.
+Returns false if there was nothing
+====================
+*/
+static bool Net_FillRecvRing(netsrc_t sock)
 {
-	int 	ret;
-	struct sockaddr_in	from;
-	int		fromlen;
-	int		net_socket;
-	int		protocol;
-	int		err;
-
-	if (NET_GetLoopPacket (sock, net_from, net_message))
-		return true;
-		
-	if (!net_socket)
+	net_recvring_t* ring = &net_recvrings[sock];
+	int32_t 		i;
+	int32_t 		ret;
+
+	for (i = 0; i < NET_RECV_BATCH; i++)
 	{
-		return false;
+		ring->iovecs[i].iov_base = ring->data[i];
+		ring->iovecs[i].iov_len = sizeof(ring->data[i]);
+
+		memset(&ring->msgs[i], 0, sizeof(ring->msgs[i]));
+		ring->msgs[i].msg_hdr.msg_name = &ring->from[i];
+		ring->msgs[i].msg_hdr.msg_namelen = sizeof(ring->from[i]);
+		ring->msgs[i].msg_hdr.msg_iov = &ring->iovecs[i];
+		ring->msgs[i].msg_hdr.msg_iovlen = 1;
 	}
 
-	fromlen = sizeof(from);
-	ret = recvfrom (net_socket, net_message->data, net_message->maxsize
-		, 0, (struct sockaddr *)&from, &fromlen);
+	ring->count = ring->next = 0;
+
+	ret = recvmmsg(ip_sockets[sock], ring->msgs, NET_RECV_BATCH, MSG_DONTWAIT, NULL);
 
-	SockadrToNetadr (&from, net_from);
+	Net_CountStat(net_stats[sock].recv_calls, 1);
 
 	if (ret == -1)
 	{
-		err = errno;
-
-		if (err == EWOULDBLOCK || err == ECONNREFUSED)
+		// ECONNREFUSED is the ICMP for a packet we sent earlier not arriving, nothing to do with what's waiting
+		if (errno == EWOULDBLOCK || errno == EAGAIN || errno == ECONNREFUSED || errno == EINTR)
 			return false;
 
-		Com_Printf ("NET_GetPacket: %s from %s\n", NET_ErrorString(),
-					NET_AdrToString(*net_from));
-		return false;
-	}
+		// let dedicated servers and the receive thread continue after errors
+		if (dedicated->value || !Jobs_IsMainThread())
+			Com_Printf("Net_GetPacket: %s\n", Net_ErrorString());
+		else
+			Com_Error(ERR_DROP, "Net_GetPacket: %s", Net_ErrorString());
 
-	if (ret == net_message->maxsize)
-	{
-		Com_Printf ("Oversize packet from %s\n", NET_AdrToString (*net_from));
 		return false;
 	}
 
-	net_message->cursize = ret;
-	
-	return true;
-}
+	ring->count = ret;
 
-//=============================================================================
+	Net_CountBatch(sock, ret);
 
-void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
+	return ret > 0;
+}
+
+/*
+====================
+Net_ReadSocket
+====================
+*/
+bool Net_ReadSocket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message)
 {
-	int		ret;
-	struct sockaddr_in	addr;
-	int		net_socket = 0;
+	net_recvring_t* ring;
+	struct mmsghdr* msg;
+	int32_t 		length;
+	char			from[64];
 
-	if ( to.type == NA_LOOPBACK )
-	{
-		NET_SendLoopPacket (sock, length, data, to);
-		return;
-	}
+	if (!ip_sockets[sock])
+		return false;
 
-	if (to.type == NA_BROADCAST)
+	ring = &net_recvrings[sock];
+
+	while (1)
 	{
-		net_socket = ip_sockets[sock];
-		if (!net_socket)
-			return;
+		if (ring->next >= ring->count
+			&& !Net_FillRecvRing(sock))
+			return false;
+
+		msg = &ring->msgs[ring->next];
+		SockadrToNetadr(&ring->from[ring->next], net_from);
+		length = msg->msg_len;
+
+		ring->next++;
+
+		if ((msg->msg_hdr.msg_flags & MSG_TRUNC)
+			|| length >= net_message->maxsize)
+		{
+			Net_AdrToBuffer(*net_from, from, sizeof(from));
+			Com_Printf("Oversize packet from %s\n", from);
+			continue;
+		}
+
+		memcpy(net_message->data, ring->data[ring->next - 1], length);
+		net_message->cursize = length;
+
+		Net_CountStat(net_stats[sock].recv_packets, 1);
+		Net_CountStat(net_stats[sock].recv_bytes, length);
+		return true;
 	}
-	else if (to.type == NA_IP)
+}
+
+bool Net_GetPacket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message)
+{
+	if (Net_GetLoopPacket(sock, net_from, net_message))
+		return true;
+
+	if (Net_ReceiveThreadRunning())
+		return Net_DequeuePacket(sock, net_from, net_message);
+
+	return Net_ReadSocket(sock, net_from, net_message);
+}
+
+/*
+====================
+Net_WaitForSockets
+====================
+*/
+void Net_WaitForSockets(int32_t msec)
+{
+	struct pollfd	fds[2];
+	int32_t 		i, count;
+
+	count = 0;
+
+	for (i = 0; i < 2; i++)
 	{
-		net_socket = ip_sockets[sock];
-		if (!net_socket)
+		if (!ip_sockets[i])
+			continue;
+
+		// the last recvmmsg may have picked up more than was taken
+		if (net_recvrings[i].next < net_recvrings[i].count)
 			return;
-	}
-	else
-		Com_Error (ERR_FATAL, "NET_SendPacket: bad address type");
 
-	NetadrToSockadr (&to, &addr);
+		fds[count].fd = ip_sockets[i];
+		fds[count].events = POLLIN;
+		fds[count].revents = 0;
+		count++;
+	}
 
-	ret = sendto (net_socket, data, length, 0, (struct sockaddr *)&addr, sizeof(addr) );
-	if (ret == -1)
+	if (!count)
 	{
-		Com_Printf ("NET_SendPacket ERROR: %s to %s\n", NET_ErrorString(),
-				NET_AdrToString (to));
+		usleep(msec * 1000);
+		return;
 	}
-}
 
+	poll(fds, count, msec);
+}
 
 //=============================================================================
 
-
-
-
 /*
 ====================
-NET_OpenIP
+Net_SendError
 ====================
 */
-void NET_OpenIP (void)
+static void Net_SendError(netsrc_t sock, int32_t err, netadr_t to)
 {
-	cvar_t	*port, *client_port, *ip;
+	net_stats[sock].send_errors++;
 
-	port = Cvar_Get ("port", va("%i", PORT_SERVER), CVAR_NOSET);
-	client_port = Cvar_Get("clientport", va("%i", PORT_CLIENT), CVAR_NOSET);
-	ip = Cvar_Get ("ip", "localhost", CVAR_NOSET);
-
-	if (!ip_sockets[NS_SERVER])
-		ip_sockets[NS_SERVER] = NET_Socket (ip->string, port->value);
+	// wouldblock is silent
+	if (err == EWOULDBLOCK || err == EAGAIN)
+		return;
 
-	// we don't need client port on dedi
-	if (dedicated)
+	// some links don't allow broadcasts
+	if (err == EADDRNOTAVAIL && to.type == NA_BROADCAST)
 		return;
 
-	if (!ip_sockets[NS_CLIENT])
+	if (dedicated->value)	// let dedicated servers continue after errors
 	{
-		// try any port 
-		if (!client_port->value)
-		{
-			ip_sockets[NS_CLIENT] = NET_Socket (ip->string, PORT_ANY);
-		}
+		Com_Printf("Net_SendPacket ERROR: %s to %s\n", strerror(err), Net_AdrToString(to));
+	}
+	else
+	{
+		if (err == EADDRNOTAVAIL)
+			Com_DPrintf("Net_SendPacket Warning: %s : %s\n", strerror(err), Net_AdrToString(to));
 		else
-		{
-			ip_sockets[NS_CLIENT] = NET_Socket (ip->string, client_port->value);
-		}
+			Com_Error(ERR_DROP, "Net_SendPacket ERROR: %s to %s\n", strerror(err), Net_AdrToString(to));
 	}
-
 }
 
-
 /*
 ====================
-NET_Config
+Net_FlushSendBatch
 
-A single player game will only use the loopback code
+Sends everything queued since Net_BeginSendBatch and stops batching
 ====================
 */
-void	NET_Config (bool multiplayer)
+void Net_FlushSendBatch(netsrc_t sock)
 {
-	int		i;
+	net_sendqueue_t*	queue = &net_sendqueues[sock];
+	int32_t 			sent, ret, i, count;
 
-	if (!multiplayer)
-	{	// shut down any existing sockets
-		for (i=0 ; i<2 ; i++)
+	// emptied first, so an error that drops to the console can't leave the packets to be sent twice
+	count = queue->count;
+	queue->count = 0;
+	queue->poolsize = 0;
+	queue->batching = false;
+
+	for (sent = 0; sent < count; )
+	{
+		if (!ip_sockets[sock])
+			break;
+
+		ret = sendmmsg(ip_sockets[sock], &queue->msgs[sent], count - sent, 0);
+
+		net_stats[sock].send_calls++;
+
+		if (ret == -1)
 		{
-			if (ip_sockets[i])
-			{
-				close (ip_sockets[i]);
-				ip_sockets[i] = 0;
-			}
+			if (errno == EINTR)
+				continue;
+
+			// sendmmsg only fails if the first packet couldn't be sent, so skip it and carry on with the rest
+			Net_SendError(sock, errno, queue->toadr[sent]);
+			sent++;
+			continue;
 		}
-	}
-	else
-	{	// open sockets
-		NET_OpenIP ();
+
+		for (i = 0; i < ret; i++)
+		{
+			net_stats[sock].send_packets++;
+			net_stats[sock].send_bytes += queue->msgs[sent + i].msg_len;
+		}
+
+		Net_CountBatch(sock, ret);
+
+		sent += ret;
 	}
 }
 
+/*
+====================
+Net_BeginSendBatch
 
-//===================================================================
-
+Until Net_FlushSendBatch, packets to remote addresses are queued instead of sent
+====================
+*/
+void Net_BeginSendBatch(netsrc_t sock)
+{
+	net_sendqueues[sock].batching = true;
+}
 
 /*
 ====================
-NET_Init
+Net_QueuePacket
 ====================
 */
-void NET_Init (void)
+static void Net_QueuePacket(netsrc_t sock, int32_t length, void* data, netadr_t to)
+{
+	net_sendqueue_t*	queue = &net_sendqueues[sock];
+	struct mmsghdr* 	msg;
+	int32_t 			i;
+
+	// send what there is to make room, then carry on batching
+	if (queue->count == NET_SEND_BATCH
+		|| queue->poolsize + length > NET_SEND_POOL)
+	{
+		Net_FlushSendBatch(sock);
+		queue->batching = true;
+	}
+
+	i = queue->count++;
+
+	memcpy(queue->pool + queue->poolsize, data, length);
+	queue->iovecs[i].iov_base = queue->pool + queue->poolsize;
+	queue->iovecs[i].iov_len = length;
+	queue->poolsize += length;
+
+	NetadrToSockadr(&to, &queue->to[i]);
+	queue->toadr[i] = to;
+
+	msg = &queue->msgs[i];
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_hdr.msg_name = &queue->to[i];
+	msg->msg_hdr.msg_namelen = sizeof(queue->to[i]);
+	msg->msg_hdr.msg_iov = &queue->iovecs[i];
+	msg->msg_hdr.msg_iovlen = 1;
+}
+
+void Net_SendPacket(netsrc_t sock, int32_t length, void* data, netadr_t to)
 {
+	int32_t 	ret;
+	struct sockaddr_in	addr;
+	int32_t 	net_socket;
+
+	if (to.type == NA_LOOPBACK)
+	{
+		Net_SendLoopPacket(sock, length, data, to);
+		return;
+	}
+
+	if (to.type == NA_BROADCAST)
+	{
+		net_socket = ip_sockets[sock];
+		if (!net_socket)
+			return;
+	}
+	else if (to.type == NA_IP)
+	{
+		net_socket = ip_sockets[sock];
+		if (!net_socket)
+			return;
+	}
+	else
+		Com_Error(ERR_FATAL, "Net_SendPacket: bad address type");
+
+	if (net_sendqueues[sock].batching)
+	{
+		Net_QueuePacket(sock, length, data, to);
+		return;
+	}
+
+	NetadrToSockadr(&to, &addr);
+
+	ret = sendto(net_socket, data, length, 0, (struct sockaddr*)&addr, sizeof(addr));
+
+	net_stats[sock].send_calls++;
+
+	if (ret == -1)
+	{
+		Net_SendError(sock, errno, to);
+		return;
+	}
+
+	net_stats[sock].send_packets++;
+	net_stats[sock].send_bytes += length;
 }
 
+//=============================================================================
+
 
 /*
 ====================
 NET_Socket
 ====================
 */
-int NET_Socket (char *net_interface, int port)
+int32_t Net_IPSocket(char* net_interface, int32_t port)
 {
-	int newsocket;
-	struct sockaddr_in address;
-	bool _true = true;
-	int	i = 1;
+	int32_t 			newsocket;
+	struct sockaddr_in	address;
+	int32_t 			_true = 1;
+	int32_t 			i = 1;
 
-	if ((newsocket = socket (PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+	if ((newsocket = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
 	{
-		Com_Printf ("ERROR: UDP_OpenSocket: socket: %s", NET_ErrorString());
+		if (errno != EAFNOSUPPORT)
+			Com_Printf("WARNING: UDP_OpenSocket: socket: %s", Net_ErrorString());
 		return 0;
 	}
 
 	// make it non-blocking
-	if (ioctl (newsocket, FIONBIO, &_true) == -1)
+	if (ioctl(newsocket, FIONBIO, &_true) == -1)
 	{
-		Com_Printf ("ERROR: UDP_OpenSocket: ioctl FIONBIO:%s\n", NET_ErrorString());
+		Com_Printf("WARNING: UDP_OpenSocket: ioctl FIONBIO: %s\n", Net_ErrorString());
+		close(newsocket);
 		return 0;
 	}
 
 	// make it broadcast capable
-	if (setsockopt(newsocket, SOL_SOCKET, SO_BROADCAST, (char *)&i, sizeof(i)) == -1)
+	if (setsockopt(newsocket, SOL_SOCKET, SO_BROADCAST, (char*)&i, sizeof(i)) == -1)
 	{
-		Com_Printf ("ERROR: UDP_OpenSocket: setsockopt SO_BROADCAST:%s\n", NET_ErrorString());
+		Com_Printf("WARNING: UDP_OpenSocket: setsockopt SO_BROADCAST: %s\n", Net_ErrorString());
+		close(newsocket);
 		return 0;
 	}
 
 	if (!net_interface || !net_interface[0] || !Q_stricmp(net_interface, "localhost"))
+	{
+		memset(&address, 0, sizeof(address));
 		address.sin_addr.s_addr = INADDR_ANY;
+	}
 	else
-		NET_StringToSockaddr (net_interface, (struct sockaddr *)&address);
+		Net_StringToSockaddr(net_interface, &address);
 
 	if (port == PORT_ANY)
 		address.sin_port = 0;
 	else
-		address.sin_port = htons((short)port);
+		address.sin_port = htons((int16_t)port);
 
 	address.sin_family = AF_INET;
 
-	if( bind (newsocket, (void *)&address, sizeof(address)) == -1)
+	if (bind(newsocket, (const struct sockaddr*)&address, sizeof(address)) == -1)
 	{
-		Com_Printf ("ERROR: UDP_OpenSocket: bind: %s\n", NET_ErrorString());
-		close (newsocket);
+		Com_Printf("WARNING: UDP_OpenSocket: bind: %s\n", Net_ErrorString());
+		close(newsocket);
 		return 0;
 	}
 
-	Com_Printf("Bound socket on port %d\n", port);
-
 	return newsocket;
 }
 
 
 /*
 ====================
-NET_Shutdown
+NET_OpenIP
 ====================
 */
-void	NET_Shutdown (void)
+void Net_OpenIP()
 {
-	NET_Config (false);	// close sockets
-}
+	cvar_t* ip;
+	int32_t port;
+	int32_t dedicated;
+
+	ip = Cvar_Get("ip", "localhost", CVAR_NOSET);
 
+	dedicated = Cvar_VariableValue("dedicated");
+
+	if (!ip_sockets[NS_SERVER])
+	{
+		port = Cvar_Get("ip_hostport", "0", CVAR_NOSET)->value;
+		if (!port)
+		{
+			port = Cvar_Get("hostport", "0", CVAR_NOSET)->value;
+			if (!port)
+			{
+				port = Cvar_Get("port", va("%i", PORT_SERVER), CVAR_NOSET)->value;
+			}
+		}
+		ip_sockets[NS_SERVER] = Net_IPSocket(ip->string, port);
+		if (!ip_sockets[NS_SERVER] && dedicated)
+			Com_Error(ERR_FATAL, "Couldn't allocate dedicated server IP port");
+	}
+
+
+	// dedicated servers don't need client ports
+	if (dedicated)
+		return;
+
+	if (!ip_sockets[NS_CLIENT])
+	{
+		port = Cvar_Get("ip_clientport", "0", CVAR_NOSET)->value;
+		if (!port)
+		{
+			port = Cvar_Get("clientport", va("%i", PORT_CLIENT), CVAR_NOSET)->value;
+			if (!port)
+				port = PORT_ANY;
+		}
+		ip_sockets[NS_CLIENT] = Net_IPSocket(ip->string, port);
+		if (!ip_sockets[NS_CLIENT])
+			ip_sockets[NS_CLIENT] = Net_IPSocket(ip->string, PORT_ANY);
+	}
+}
 
 /*
 ====================
-NET_ErrorString
+NET_Config
+
+A single player game will only use the loopback code
 ====================
 */
-char *NET_ErrorString (void)
+void Net_Config(bool multiplayer)
 {
-	int		code;
+	int32_t 	i;
+	static	bool	old_config;
+
+	if (old_config == multiplayer)
+		return;
 
-	code = errno;
-	return strerror (code);
+	old_config = multiplayer;
+
+	if (!multiplayer)
+	{	// shut down any existing sockets
+		Net_StopReceiveThread();
+
+		for (i = 0; i < 2; i++)
+		{
+			if (ip_sockets[i])
+			{
+				close(ip_sockets[i]);
+				ip_sockets[i] = 0;
+			}
+
+			// anything still queued or picked up was for the old socket
+			net_recvrings[i].count = net_recvrings[i].next = 0;
+			net_sendqueues[i].count = net_sendqueues[i].poolsize = 0;
+			net_sendqueues[i].batching = false;
+		}
+	}
+	else
+	{	// open sockets
+		if (!noudp->value)
+		{
+			Net_OpenIP();
+			Net_StartReceiveThread();
+		}
+	}
 }
 
 // sleeps msec or until net socket is ready
-void NET_Sleep(int msec)
+void Net_Sleep(int32_t msec)
 {
-    struct timeval timeout;
+	struct timeval timeout;
 	fd_set	fdset;
-	extern cvar_t *dedicated;
-	extern bool stdin_active;
+	extern cvar_t* dedicated;
+	int32_t i;
 
-	if (!ip_sockets[NS_SERVER] || (dedicated && !dedicated->value))
+	if (!dedicated || !dedicated->value)
 		return; // we're not a server, just run full speed
 
+	// the receive thread is the one reading the socket
+	if (Net_ReceiveThreadRunning())
+	{
+		Net_WaitForQueue(msec);
+		return;
+	}
+
+	// packets the last recvmmsg picked up are already waiting
+	if (net_recvrings[NS_SERVER].next < net_recvrings[NS_SERVER].count)
+		return;
+
 	FD_ZERO(&fdset);
-	if (stdin_active)
-		FD_SET(0, &fdset); // stdin is processed too
-	FD_SET(ip_sockets[NS_SERVER], &fdset); // network socket
-	timeout.tv_sec = msec/1000;
-	timeout.tv_usec = (msec%1000)*1000;
-	select(ip_sockets[NS_SERVER]+1, &fdset, NULL, NULL, &timeout);
+	i = 0;
+	if (ip_sockets[NS_SERVER]) {
+		FD_SET(ip_sockets[NS_SERVER], &fdset); // network socket
+		i = ip_sockets[NS_SERVER];
+	}
+
+	timeout.tv_sec = msec / 1000;
+	timeout.tv_usec = (msec % 1000) * 1000;
+	select(i + 1, &fdset, NULL, NULL, &timeout);
+}
+
+//===================================================================
+
+/*
+====================
+NET_Init
+====================
+*/
+void Net_Init()
+{
+	noudp = Cvar_Get("noudp", "0", CVAR_NOSET);
+
+	net_shownet = Cvar_Get("net_shownet", "0", 0);
 }
 
+
+/*
+====================
+NET_Shutdown
+====================
+*/
+void Net_Shutdown()
+{
+	Net_Config(false);	// close sockets
+}
+
+
+/*
+====================
+NET_ErrorString
+====================
+*/
+const char* Net_ErrorString()
+{
+	return strerror(errno);
+}
@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <fcntl.h>
 #include <sys/time.h>
 
 #include "../linux/glob.h"
@@ -128,6 +129,39 @@ void Sys_Mkdir (char *path)
     mkdir (path, 0777);
 }
 
+void *Sys_MapFile (const char *path, size_t *length)
+{
+	struct stat	st;
+	void		*base;
+	int			fd;
+
+	fd = open (path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat (fd, &st) == -1 || st.st_size <= 0)
+	{
+		close (fd);
+		return NULL;
+	}
+
+	// MAP_PRIVATE + PROT_READ, so every server instance on the box shares the same page cache pages
+	base = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+
+	if (base == MAP_FAILED)
+		return NULL;
+
+	*length = st.st_size;
+	return base;
+}
+
+void Sys_UnmapFile (void *base, size_t length)
+{
+	if (base)
+		munmap (base, length);
+}
+
 char *strlwr (char *s)
 {
 	while (*s) {
@@ -205,6 +205,9 @@ void VID_NewWindow ( int width, int height)
 
 void VID_FreeReflib (void)
 {
+	// prefetch jobs may be decoding with the old library's code
+	FS_FlushPrefetch();
+
 	if (reflib_library) {
 		if (KBD_Close_fp)
 			KBD_Close_fp();
@@ -293,6 +296,7 @@ bool VID_LoadRefresh( char *name )
 	ri.Sys_Error = VID_Error;
 	ri.FS_LoadFile = FS_LoadFile;
 	ri.FS_FreeFile = FS_FreeFile;
+	ri.FS_TakePrefetched = FS_TakePrefetched;
 	ri.FS_Gamedir = FS_Gamedir;
 	ri.Cvar_Get = Cvar_Get;
 	ri.Cvar_Set = Cvar_Set;
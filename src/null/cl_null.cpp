@@ -36,6 +36,11 @@ void CL_Drop (void)
 {
 }
 
+bool CL_IsConnected (void)
+{
+	return false;
+}
+
 void CL_Shutdown (void)
 {
 }
@@ -319,41 +319,28 @@ typedef struct targa_header_s
 
 /*
 =============
-LoadTGA
+R_DecodeTGA
+
+Decodes an uncompressed or run length encoded 24 or 32 bit targa into RGBA.
+If pic is NULL, only the size is returned so the caller can allocate it.
+This doesn't touch any renderer state, so the engine also calls it from its prefetch jobs.
+Returns false if the buffer isn't a targa we can read.
 =============
 */
-void LoadTGA(const char* name, uint8_t** pic, int32_t* width, int32_t* height)
+bool R_DecodeTGA(uint8_t* buffer, int32_t length, uint8_t* pic, int32_t* width, int32_t* height)
 {
-	int32_t			columns, rows, numPixels;
-	uint8_t* pixbuf;
+	int32_t			columns, rows;
+	uint8_t*		pixbuf;
 	int32_t			row, column;
-	uint8_t* buf_p;
-	uint8_t* buffer;
-	int32_t			length;
+	uint8_t*		buf_p;
 	targa_header_t	targa_header;
-	uint8_t* targa_rgba;
+	uint8_t*		targa_rgba;
 	uint8_t			tmp[2] = { 0 };
 
-	*pic = NULL;
-
-	//
-	// load the file
-	//
-	length = ri.FS_LoadFile(name, (void**)&buffer);
-
-	if (!buffer)
+	if (!buffer
+		|| length < 18)
 	{
-		// try the missing texture texture
-		length = ri.FS_LoadFile("textures/missing_texture.tga", (void**)&buffer);
-
-		// nope
-		if (!buffer)
-		{
-			ri.Con_Printf(PRINT_DEVELOPER, "Bad tga file %s\n (and also couldn't find missing_texture.tga)\n", name);
-			return;
-		}
-
-		ri.Con_Printf(PRINT_DEVELOPER, "TGA file %s not found (using placeholder texture)\n", name);
+		return false;
 	}
 
 	buf_p = buffer;
@@ -384,23 +371,24 @@ void LoadTGA(const char* name, uint8_t** pic, int32_t* width, int32_t* height)
 
 	if (targa_header.image_type != 2
 		&& targa_header.image_type != 10)
-		ri.Sys_Error(ERR_DROP, "LoadTGA: Only type 2 and 10 targa RGB images supported\n");
+		return false;
 
 	if (targa_header.colormap_type != 0
 		|| (targa_header.pixel_size != 32 && targa_header.pixel_size != 24))
-		ri.Sys_Error(ERR_DROP, "LoadTGA: Only 32 or 24 bit images supported (no colormaps)\n");
+		return false;
 
 	columns = targa_header.width;
 	rows = targa_header.height;
-	numPixels = columns * rows;
 
 	if (width)
 		*width = columns;
 	if (height)
 		*height = rows;
 
-	targa_rgba = (uint8_t*)malloc(numPixels * 4);
-	*pic = targa_rgba;
+	if (!pic)
+		return true;
+
+	targa_rgba = pic;
 
 	if (targa_header.id_length != 0)
 		buf_p += targa_header.id_length;  // skip TARGA image comment
@@ -533,6 +521,54 @@ void LoadTGA(const char* name, uint8_t** pic, int32_t* width, int32_t* height)
 		}
 	}
 
+
+	return true;
+}
+
+/*
+=============
+LoadTGA
+=============
+*/
+void LoadTGA(const char* name, uint8_t** pic, int32_t* width, int32_t* height)
+{
+	uint8_t*	buffer;
+	int32_t		length;
+	int32_t		columns, rows;
+
+	*pic = NULL;
+
+	//
+	// load the file
+	//
+	length = ri.FS_LoadFile(name, (void**)&buffer);
+
+	if (!buffer)
+	{
+		// try the missing texture texture
+		length = ri.FS_LoadFile("textures/missing_texture.tga", (void**)&buffer);
+
+		// nope
+		if (!buffer)
+		{
+			ri.Con_Printf(PRINT_DEVELOPER, "Bad tga file %s\n (and also couldn't find missing_texture.tga)\n", name);
+			return;
+		}
+
+		ri.Con_Printf(PRINT_DEVELOPER, "TGA file %s not found (using placeholder texture)\n", name);
+	}
+
+	if (!R_DecodeTGA(buffer, length, NULL, &columns, &rows))
+		ri.Sys_Error(ERR_DROP, "LoadTGA: %s is not a supported targa (only type 2 and 10, 24 or 32 bit RGB images, no colormaps)\n", name);
+
+	*pic = (uint8_t*)malloc(columns * rows * 4);
+	R_DecodeTGA(buffer, length, *pic, &columns, &rows);
+
+	if (width)
+		*width = columns;
+	if (height)
+		*height = rows;
+
 	ri.FS_FreeFile(buffer);
 }
 
@@ -846,6 +882,7 @@ image_t* GL_FindImage(const char* name, imagetype_t type)
 	int32_t		i, len;
 	uint8_t* pic, * palette;
 	int32_t		width, height;
+	prefetched_image_t* prefetched;
 
 	if (!name)
 		return NULL;	//	ri.Sys_Error (ERR_DROP, "GL_FindImage: NULL name");
@@ -871,6 +908,16 @@ image_t* GL_FindImage(const char* name, imagetype_t type)
 
 	if (!strcmp(name + len - 4, ".tga"))
 	{
+		// already decoded by the engine's prefetch jobs?
+		prefetched = (prefetched_image_t*)ri.FS_TakePrefetched(name, NULL);
+
+		if (prefetched)
+		{
+			image = GL_LoadPic(name, (uint8_t*)(prefetched + 1), prefetched->width, prefetched->height, type);
+			ri.FS_FreeFile(prefetched);
+			return image;
+		}
+
 		LoadTGA(name, &pic, &width, &height);
 		if (!pic)
 			return NULL; // ri.Sys_Error (ERR_DROP, "GL_FindImage: can't load %s", name);
@@ -308,6 +308,7 @@ struct image_s* R_RegisterSkin(char* name);
 
 image_t* GL_LoadPic(const char* name, uint8_t* pic, int32_t width, int32_t height, imagetype_t type);
 image_t* GL_FindImage(const char* name, imagetype_t type);
+bool R_DecodeTGA(uint8_t* buffer, int32_t length, uint8_t* pic, int32_t* width, int32_t* height);
 void GL_SetTextureMode(const char* value);
 void GL_ImageList_f();
 
@@ -304,12 +304,25 @@ Mod_LoadVisibility
 void MapRenderer_LoadVisibility(lump_t* l)
 {
 	int32_t	i;
+	const dvis_t* shared;
+	int32_t	length;
 
 	if (!l->filelen)
 	{
 		loadmodel->vis = NULL;
 		return;
 	}
+
+	// the engine loaded the same map for collision first, so take its swapped copy
+	shared = ri.Map_SharedVisibility(loadmodel->name, &length);
+
+	if (shared && length == l->filelen)
+	{
+		loadmodel->vis = (dvis_t*)Memory_HunkAlloc(length);
+		memcpy(loadmodel->vis, shared, length);
+		return;
+	}
+
 	loadmodel->vis = (dvis_t*)Memory_HunkAlloc(l->filelen);
 	memcpy(loadmodel->vis, map_base + l->fileofs, l->filelen);
 
@@ -801,6 +814,8 @@ void MapRenderer_LoadPlanes(lump_t* l)
 	dplane_t*	in;
 	int32_t		count;
 	int32_t		bits;
+	const cplane_t* shared;
+	int32_t		sharedcount;
 
 	in = (dplane_t*)(map_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
@@ -811,6 +826,15 @@ void MapRenderer_LoadPlanes(lump_t* l)
 	loadmodel->planes = out;
 	loadmodel->numplanes = count;
 
+	// the engine loaded the same map for collision first, so take its converted copy
+	shared = ri.Map_SharedPlanes(loadmodel->name, &sharedcount);
+
+	if (shared && sharedcount == count)
+	{
+		memcpy(out, shared, count * sizeof(*out));
+		return;
+	}
+
 	for (i = 0; i < count; i++, in++, out++)
 	{
 		bits = 0;
@@ -835,39 +859,40 @@ Mod_LoadBrushModel
 void MapRenderer_Load(model_t* mod, void* buffer)
 {
 	int32_t		i;
-	dheader_t* header;
+	dheader_t	header;
 	mmodel_t* bm;
 
 	loadmodel->type = mod_brush;
 	if (loadmodel != mod_known)
 		ri.Sys_Error(ERR_DROP, "Loaded a brush model after the world");
 
-	header = (dheader_t*)buffer;
+	// swap a copy of the header, the file buffer may be a read-only pak mapping
+	header = *(dheader_t*)buffer;
 
-	i = LittleInt(header->version);
+	i = LittleInt(header.version);
 	if (i != ZBSP_VERSION)
 		ri.Sys_Error(ERR_DROP, "MapRenderer_Load: BSP %s has wrong version number (%i should be %i)", mod->name, i, ZBSP_VERSION);
 
 	// swap all the lumps
-	map_base = (uint8_t*)header;
+	map_base = (uint8_t*)buffer;
 
 	for (i = 0; i < sizeof(dheader_t) / 4; i++)
-		((int32_t*)header)[i] = LittleInt(((int32_t*)header)[i]);
+		((int32_t*)&header)[i] = LittleInt(((int32_t*)&header)[i]);
 
 	// load into heap
 
-	MapRenderer_LoadVertexes(&header->lumps[LUMP_VERTEXES]);
-	MapRenderer_LoadEdges(&header->lumps[LUMP_EDGES]);
-	MapRenderer_LoadSurfedges(&header->lumps[LUMP_SURFEDGES]);
-	MapRenderer_LoadLighting(&header->lumps[LUMP_LIGHTING]);
-	MapRenderer_LoadPlanes(&header->lumps[LUMP_PLANES]);
-	MapRenderer_LoadTexinfo(&header->lumps[LUMP_TEXINFO]);
-	MapRenderer_LoadFaces(&header->lumps[LUMP_FACES]);
-	MapRenderer_LoadMarksurfaces(&header->lumps[LUMP_LEAFFACES]);
-	MapRenderer_LoadVisibility(&header->lumps[LUMP_VISIBILITY]);
-	MapRenderer_LoadLeafs(&header->lumps[LUMP_LEAFS]);
-	MapRenderer_LoadNodes(&header->lumps[LUMP_NODES]);
-	MapRenderer_LoadSubmodels(&header->lumps[LUMP_MODELS]);
+	MapRenderer_LoadVertexes(&header.lumps[LUMP_VERTEXES]);
+	MapRenderer_LoadEdges(&header.lumps[LUMP_EDGES]);
+	MapRenderer_LoadSurfedges(&header.lumps[LUMP_SURFEDGES]);
+	MapRenderer_LoadLighting(&header.lumps[LUMP_LIGHTING]);
+	MapRenderer_LoadPlanes(&header.lumps[LUMP_PLANES]);
+	MapRenderer_LoadTexinfo(&header.lumps[LUMP_TEXINFO]);
+	MapRenderer_LoadFaces(&header.lumps[LUMP_FACES]);
+	MapRenderer_LoadMarksurfaces(&header.lumps[LUMP_LEAFFACES]);
+	MapRenderer_LoadVisibility(&header.lumps[LUMP_VISIBILITY]);
+	MapRenderer_LoadLeafs(&header.lumps[LUMP_LEAFS]);
+	MapRenderer_LoadNodes(&header.lumps[LUMP_NODES]);
+	MapRenderer_LoadSubmodels(&header.lumps[LUMP_MODELS]);
 	mod->numframes = 2;		// regular and alternate animation
 
 	//
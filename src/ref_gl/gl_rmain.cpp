@@ -1164,6 +1164,7 @@ refexport_t GetRefAPI(refimport_t rimp)
 	re.GetCursorPosition = GL_GetCursorPosition;
 	re.SetCursorPosition = GL_SetCursorPosition;
 	re.SetWindowPosition = GL_SetWindowPosition;
+	re.DecodeTGA = R_DecodeTGA;
 
 	Swap_Init();
 
@@ -89,11 +89,14 @@ typedef struct
 	uint8_t			areabits[MAX_MAP_AREAS / 8];		// portalarea visibility bits
 	player_state_t	ps;
 	int32_t 		num_entities;
-	int32_t 		first_entity;		// into the circular sv_packet_entities[]
+	int32_t 		first_entity;		// into the client's slice of svs.client_entities, see SV_ClientEntity
 	int32_t 		senttime;			// for ping calculations
 } client_frame_t;
 
 #define	LATENCY_COUNTS		16
+// entity_state_t ring entries each client owns in svs.client_entities, enough for one frame of every edict.
+// Must be a power of two
+#define CLIENT_ENTITY_SLICE	(UPDATE_BACKUP * 128)
 #define	RATE_MESSAGES		10
 #define PLAYER_NAME_LENGTH	80
 
@@ -124,6 +127,25 @@ typedef struct client_s
 	uint8_t			datagram_buf[MAX_MSGLEN];
 
 	client_frame_t	frames[UPDATE_BACKUP];	// updates can be delta'd from here
+	int32_t 		next_entity;		// next entity_state_t to use in this client's slice of svs.client_entities
+
+	// where the client is seeing from this frame, worked out by SV_SetupClientFrame
+	vec3_t			view_origin;
+	int32_t 		view_area;
+	int32_t 		view_cluster;
+	uint8_t			fatpvs[65536 / 8];	// 65536 clusters, the most SV_FatPVS can merge
+
+	// where the client's edict is, for SV_Multicast. Only looked up again when the edict moves, see SV_ClientLeaf
+	bool			leaf_cached;
+	int32_t 		leaf_spawncount;	// svs.spawncount when it was looked up
+	vec3_t			leaf_origin;
+	int32_t 		leafnum;
+	int32_t 		leaf_cluster;
+	int32_t 		leaf_area;
+
+	// the frame message, built by SV_WriteClientDatagram and sent by SV_TransmitClientDatagram
+	sizebuf_t		frame_msg;
+	uint8_t			frame_msg_buf[MAX_MSGLEN];
 
 	uint8_t*		download;			// file being downloaded
 	int32_t 		downloadsize;		// total bytes (can't use EOF because of paks)
@@ -135,6 +157,10 @@ typedef struct client_s
 	int32_t 		challenge;			// challenge of this user, randomly generated
 
 	netchan_t		netchan;
+
+	// svs.clienthash chain for the netchan's address and qport, from connecting until the slot is free again
+	bool			hashed;
+	int32_t 		hashnext;			// next client in the same bucket, -1 if none
 } client_t;
 
 // a client can leave the server in one of four ways:
@@ -155,8 +181,24 @@ typedef struct
 	netadr_t		adr;
 	int32_t 		challenge;
 	int32_t 		time;
+	int32_t 		hashnext;			// next challenge in the same svs.challengehash bucket, -1 if none
 } challenge_t;
 
+// buckets for finding a client by address and qport, and a challenge by address, without scanning them all
+#define CLIENT_HASH_SIZE		512
+#define CHALLENGE_HASH_SIZE		2048
+
+// what multicasting has cost this frame, cleared at the start of each SV_Frame
+typedef struct multicast_stats_s
+{
+	int32_t 		calls;
+	int32_t 		clients_checked;	// clients whose leaf was tested against the mask
+	int32_t 		clients_sent;
+	int32_t 		leaf_lookups;		// client leafs that had to be found again, the rest were cached
+	int32_t 		bytes;				// total written into client buffers
+	int64_t 		time_ns;
+} multicast_stats_t;
+
 typedef struct
 {
 	bool			initialized;				// sv_init has completed
@@ -168,13 +210,17 @@ typedef struct
 	// used to check late spawns
 
 	client_t*		clients;					// [maxclients->value];
-	int32_t 		num_client_entities;		// maxclients->value*UPDATE_BACKUP*MAX_PACKET_ENTITIES
-	int32_t 		next_client_entities;		// next client_entity to use
-	entity_state_t* client_entities;		// [num_client_entities]
+	int32_t 		num_client_entities;		// maxclients->value*CLIENT_ENTITY_SLICE
+	entity_state_t* client_entities;		// [num_client_entities], a ring per client
 
 	int32_t 		last_heartbeat;
 
 	challenge_t		challenges[MAX_CHALLENGES];	// to prevent invalid IPs from connecting
+	int32_t 		numchallenges;				// slots used so far, the rest are free
+	int32_t 		nextchallenge;				// once they're all used, the oldest, which is replaced next
+
+	int32_t 		clienthash[CLIENT_HASH_SIZE];		// first client in each bucket, -1 if none
+	int32_t 		challengehash[CHALLENGE_HASH_SIZE];	// first challenge in each bucket, -1 if none
 
 	// serverrecord values
 	FILE*			demofile;
@@ -198,6 +244,12 @@ extern cvar_t* hostname;
 extern cvar_t* sv_paused;
 extern cvar_t* sv_maxclients;
 extern cvar_t* sv_noreload;			// don't reload level state when reentering
+extern cvar_t* sv_parallel_frames;		// build and encode client frames on the job workers
+extern cvar_t* sv_entity_index;			// find the entities each client can see through a per frame cluster index
+extern cvar_t* sv_showmulticast;		// print what multicasting cost each frame
+extern cvar_t* sv_area_split;			// edicts in an area tree leaf before it is split, 0 for a fixed uniform tree
+extern cvar_t* sv_parallel_traces;		// run SV_TraceBatch on the job workers
+extern cvar_t* sv_trace_cache;			// 1 reuses repeated traces within a frame, 2 only counts them
 
 // physics parameters (override client default to prevent cheating)
 extern cvar_t* sv_stopspeed;
@@ -231,6 +283,11 @@ extern edict_t* sv_player;
 void SV_FinalMessage(const char* message, bool reconnect);
 void SV_DropClient(client_t* drop);
 
+void SV_ClearAddressHashes();
+void SV_HashClient(client_t* cl);
+void SV_UnhashClient(client_t* cl);
+client_t* SV_FindClient(netadr_t adr, int32_t qport);
+
 int32_t SV_ModelIndex(const char* name);
 int32_t SV_SoundIndex(const char* name);
 int32_t SV_ImageIndex(const char* name);
@@ -287,7 +344,11 @@ void SV_FlushRedirect(int32_t sv_redirected, char* outputbuf);
 void SV_DemoCompleted();
 void SV_SendClientMessages();
 
+extern multicast_stats_t sv_multicast_stats;
+
+void SV_ClientLeaf(client_t* client);
 void SV_Multicast(vec3_t origin, multicast_t to);
+void SV_PrintMulticastStats();
 void SV_StartSound(vec3_t origin, edict_t* entity, int32_t channel, int32_t soundindex, float volume, float attenuation, float timeofs);
 void SV_ClientPrintf(client_t* cl, int32_t level, const char* fmt, ...);
 void SV_BroadcastPrintf(int32_t level, const char* fmt, ...);
@@ -310,6 +371,9 @@ void SV_Status_f();
 //
 void SV_WriteFrameToClient(client_t* client, sizebuf_t* msg);
 void SV_RecordDemoMessage();
+void SV_FixEntityNumbers();
+void SV_BuildEntityIndex();
+void SV_SetupClientFrame(client_t* client);
 void SV_BuildClientFrame(client_t* client);
 
 //
@@ -348,6 +412,9 @@ int32_t SV_AreaEdicts(vec3_t mins, vec3_t maxs, edict_t** list, int32_t maxcount
 // returns the number of pointers filled in
 // ??? does this always return the world?
 
+void SV_AreaBench_f();
+// traces around the current entities with the uniform and adaptive area trees and prints what each cost
+
 //===================================================================
 
 //
@@ -368,6 +435,13 @@ int32_t SV_PointContents(vec3_t p);
 // passedict is explicitly excluded from clipping checks (normally NULL)
 trace_t SV_Trace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t* passedict, int32_t contentmask);
 
+// runs count independent traces, in parallel when there are job workers, and fills in a result for each
+void SV_TraceBatch(trace_request_t* requests, trace_t* results, int32_t count);
+
+// sv_trace_cache
+void SV_ClearTraceCache();
+void SV_PrintTraceCacheStats();
+
 //
 // HACK PROTECTION
 //
\ No newline at end of file
@@ -1064,6 +1064,26 @@ void SV_ServerCommand_f()
 	game->Server_Command();
 }
 
+/*
+===============
+SV_NetStats_f
+
+Prints how many syscalls the server socket has made for its packets, and with net_recvthread, how long they waited
+to be read. "sv_netstats reset" starts counting again
+===============
+*/
+void SV_NetStats_f()
+{
+	if (Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "reset"))
+	{
+		Net_ResetStats();
+		Com_Printf("Network counters reset.\n");
+		return;
+	}
+
+	Net_PrintStats(NS_SERVER);
+}
+
 //===========================================================
 
 /*
@@ -1097,5 +1117,8 @@ void SV_InitOperatorCommands()
 	Cmd_AddCommand("killserver", SV_KillServer_f);
 
 	Cmd_AddCommand("sv", SV_ServerCommand_f);
+
+	Cmd_AddCommand("sv_areabench", SV_AreaBench_f);
+	Cmd_AddCommand("sv_netstats", SV_NetStats_f);
 }
 
@@ -29,6 +29,19 @@ Encode a client frame onto the network channel
 =============================================================================
 */
 
+/*
+=============
+SV_ClientEntity
+
+Returns an entry in the client's ring in svs.client_entities. Each client has a slice of its own
+so that frames for different clients can be built at the same time.
+=============
+*/
+entity_state_t* SV_ClientEntity (client_t *client, int32_t index)
+{
+	return &svs.client_entities[(client - svs.clients) * CLIENT_ENTITY_SLICE + (index & (CLIENT_ENTITY_SLICE - 1))];
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -36,13 +49,12 @@ SV_EmitPacketEntities
 Writes a delta update of an entity_state_t list to the message.
 =============
 */
-void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+void SV_EmitPacketEntities (client_t *client, client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
 {
 	entity_state_t	*oldent = NULL, *newent = NULL;
 	int32_t 	oldindex, newindex;
 	int32_t 	oldnum, newnum;
 	int32_t 	from_num_entities;
-	int32_t 	bits;
 
 	MSG_WriteByte (msg, svc_packetentities);
 
@@ -59,7 +71,7 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 			newnum = 9999;
 		else
 		{
-			newent = &svs.client_entities[(to->first_entity+newindex)%svs.num_client_entities];
+			newent = SV_ClientEntity (client, to->first_entity+newindex);
 			newnum = newent->number;
 		}
 
@@ -67,7 +79,7 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 			oldnum = 9999;
 		else
 		{
-			oldent = &svs.client_entities[(from->first_entity+oldindex)%svs.num_client_entities];
+			oldent = SV_ClientEntity (client, from->first_entity+oldindex);
 			oldnum = oldent->number;
 		}
 
@@ -92,25 +104,13 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 
 		if (newnum > oldnum)
 		{	// the old entity isn't present in the new message
-			bits = U_REMOVE;
-			if (oldnum >= 256)
-				bits |= U_NUMBER16 | U_MOREBITS1;
-
-			MSG_WriteByte (msg,	bits&255 );
-			if (bits & 0x0000ff00)
-				MSG_WriteByte (msg,	(bits>>8)&255 );
-
-			if (bits & U_NUMBER16)
-				MSG_WriteShort (msg, oldnum);
-			else
-				MSG_WriteByte (msg, oldnum);
-
+			MSG_WriteEntityRemove (msg, oldnum);
 			oldindex++;
 			continue;
 		}
 	}
 
-	MSG_WriteShort (msg, 0);	// end of packetentities
+	MSG_WriteEntityEnd (msg);	// end of packetentities
 }
 
 
@@ -340,6 +340,11 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 		oldframe = NULL;
 		lastframe = -1;
 	}
+	else if (client->frames[client->lastframe & UPDATE_MASK].first_entity < client->next_entity - CLIENT_ENTITY_SLICE)
+	{	// the frame's entities have been overwritten in the client's ring
+		oldframe = NULL;
+		lastframe = -1;
+	}
 	else
 	{	// we have a valid message to delta from
 		oldframe = &client->frames[client->lastframe & UPDATE_MASK];
@@ -358,7 +363,7 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 	SV_WritePlayerstateToClient (oldframe, frame, msg);
 
 	// delta encode the entities
-	SV_EmitPacketEntities (oldframe, frame, msg);
+	SV_EmitPacketEntities (client, oldframe, frame, msg);
 }
 
 
@@ -370,8 +375,6 @@ Build a client frame structure
 =============================================================================
 */
 
-uint8_t		fatpvs[65536/8];	// 32767 is MAX_MAP_LEAFS
-
 /*
 ============
 SV_FatPVS
@@ -380,12 +383,11 @@ The client will interpolate the view position,
 so we can't use a single PVS point
 ===========
 */
-void SV_FatPVS (vec3_t org)
+void SV_FatPVS (vec3_t org, uint8_t *fatpvs, int32_t fatpvs_size)
 {
 	int32_t 	leafs[64];
 	int32_t 	i, j, count;
-	int32_t 	longs;
-	uint8_t	*src;
+	int32_t 	bytes;
 	vec3_t	mins, maxs;
 
 	for (i=0 ; i<3 ; i++)
@@ -397,13 +399,17 @@ void SV_FatPVS (vec3_t org)
 	count = Map_BoxLeafnums (mins, maxs, leafs, 64, NULL);
 	if (count < 1)
 		Com_Error (ERR_FATAL, "SV_FatPVS: count < 1");
-	longs = (Map_GetNumClusters()+31)>>5;
+	// whole 32-bit words, so Bitset_TestAny can read the row a word at a time
+	bytes = ((Map_GetNumClusters()+31)>>5)<<2;
+
+	if (bytes > fatpvs_size)
+		Com_Error (ERR_DROP, "SV_FatPVS: map has too many clusters");
 
 	// convert leafs to clusters
 	for (i=0 ; i<count ; i++)
 		leafs[i] = Map_GetLeafCluster(leafs[i]);
 
-	memcpy (fatpvs, Map_ClusterPVS(leafs[0]), longs<<2);
+	memcpy (fatpvs, Map_ClusterPVS(leafs[0]), bytes);
 	// or in all the other leaf bits
 	for (i=1 ; i<count ; i++)
 	{
@@ -412,35 +418,335 @@ void SV_FatPVS (vec3_t org)
 				break;
 		if (j != i)
 			continue;		// already have the cluster we want
-		src = Map_ClusterPVS(leafs[i]);
-		for (j=0 ; j<longs ; j++)
-			((long *)fatpvs)[j] |= ((long *)src)[j];
+		Bitset_Or (fatpvs, Map_ClusterPVS(leafs[i]), bytes);
+	}
+}
+
+
+/*
+=============
+SV_FixEntityNumbers
+
+Done once a frame before any client frames are built, so building them never has to write to the edicts
+=============
+*/
+void SV_FixEntityNumbers ()
+{
+	int32_t 	e;
+	edict_t*	ent;
+
+	for (e=1 ; e<game->num_edicts ; e++)
+	{
+		ent = EDICT_NUM(e);
+
+		if (ent->s.number != e)
+		{
+			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
+			ent->s.number = e;
+		}
 	}
 }
 
 
+/*
+=============
+SV_SetupClientFrame
+
+Finds the client's view point and fat PVS, before SV_BuildClientFrame. Like it, this only touches the client,
+so frames for different clients can be set up on different threads.
+=============
+*/
+void SV_SetupClientFrame (client_t *client)
+{
+	int32_t 		i;
+	edict_t*		clent;
+	int32_t 		leafnum;
+
+	clent = client->edict;
+
+	if (!clent->client)
+		return;		// not in game yet
+
+	// find the client's PVS
+	for (i=0 ; i<3 ; i++)
+		client->view_origin[i] = clent->client->ps.pmove.origin[i] + clent->client->ps.viewoffset[i];
+
+	leafnum = Map_PointLeafnum (client->view_origin);
+	client->view_area = Map_LeafArea (leafnum);
+	client->view_cluster = Map_GetLeafCluster (leafnum);
+
+	SV_FatPVS (client->view_origin, client->fatpvs, sizeof(client->fatpvs));
+}
+
+
+/*
+=============================================================================
+
+Entity index
+
+Which entities are touching each cluster, built once a frame so a client only has to look at
+the entities in the clusters its fat PVS can see, instead of every edict.
+Entities that can't be found that way (beams, which go by PHS, and anything touching too many
+clusters, which goes by headnode) are kept on a list every client checks.
+
+=============================================================================
+*/
+
+#define ENTITY_INDEX_MAX_CLUSTERS	65536	// same as SV_FatPVS
+
+int32_t 	entindex_numclusters;			// 0 if the index wasn't built this frame
+int32_t 	entindex_first[ENTITY_INDEX_MAX_CLUSTERS + 1];	// into entindex_list
+int16_t 	entindex_list[MAX_EDICTS * MAX_ENT_CLUSTERS];
+int16_t 	entindex_always[MAX_EDICTS];
+int32_t 	entindex_numalways;
+
+/*
+=============
+SV_EntityCanBeSent
+
+Checks that don't depend on who is looking
+=============
+*/
+static bool SV_EntityCanBeSent (edict_t *ent)
+{
+	// ignore ents without visible models
+	if (ent->svflags & SVF_NOCLIENT)
+		return false;
+
+	// ignore ents without visible models unless they have an effect
+	if (!ent->s.modelindex && !ent->s.effects && !ent->s.sound
+		&& !ent->s.event)
+		return false;
+
+	return true;
+}
+
+/*
+=============
+SV_BuildEntityIndex
+
+Buckets the sendable entities by cluster. Called once a frame, after the game has run and before
+any client frames are built
+=============
+*/
+void SV_BuildEntityIndex ()
+{
+	int32_t 	e, i;
+	int32_t 	numclusters;
+	edict_t*	ent;
+
+	entindex_numclusters = 0;
+	entindex_numalways = 0;
+
+	if (!sv_entity_index->value)
+		return;
+
+	numclusters = Map_GetNumClusters ();
+
+	if (numclusters <= 0
+		|| numclusters > ENTITY_INDEX_MAX_CLUSTERS)
+		return;
+
+	// count the entities in each cluster, then turn the counts into offsets and fill them in
+	memset (entindex_first, 0, sizeof(int32_t) * (numclusters + 1));
+
+	for (e=1 ; e<game->num_edicts ; e++)
+	{
+		ent = EDICT_NUM(e);
+
+		if (!SV_EntityCanBeSent (ent))
+			continue;
+
+		if ((ent->s.renderfx & RF_BEAM)
+			|| ent->num_clusters == -1)
+		{
+			entindex_always[entindex_numalways++] = e;
+			continue;
+		}
+
+		for (i=0 ; i<ent->num_clusters ; i++)
+			entindex_first[ent->clusternums[i] + 1]++;
+	}
+
+	for (i=0 ; i<numclusters ; i++)
+		entindex_first[i + 1] += entindex_first[i];
+
+	for (e=1 ; e<game->num_edicts ; e++)
+	{
+		ent = EDICT_NUM(e);
+
+		if (!SV_EntityCanBeSent (ent)
+			|| (ent->s.renderfx & RF_BEAM)
+			|| ent->num_clusters == -1)
+			continue;
+
+		for (i=0 ; i<ent->num_clusters ; i++)
+			entindex_list[entindex_first[ent->clusternums[i]]++] = e;
+	}
+
+	// filling in moved each offset on to the start of the next cluster
+	for (i=numclusters ; i>0 ; i--)
+		entindex_first[i] = entindex_first[i - 1];
+
+	entindex_first[0] = 0;
+
+	entindex_numclusters = numclusters;
+}
+
+/*
+=============
+SV_EntityIndexCandidates
+
+Marks the entities the client might see in candidates, one bit per edict number
+=============
+*/
+static void SV_EntityIndexCandidates (client_t *client, uint32_t *candidates)
+{
+	int32_t 	i, j, bit, cluster;
+	int32_t 	words;
+	uint32_t	word;
+	uint32_t*	pvs = (uint32_t*)client->fatpvs;
+	int32_t 	e;
+
+	memset (candidates, 0, MAX_EDICTS / 8);
+
+	// the client's own entity is always sent
+	e = NUM_FOR_EDICT(client->edict);
+	candidates[e >> 5] |= 1u << (e & 31);
+
+	for (i=0 ; i<entindex_numalways ; i++)
+		candidates[entindex_always[i] >> 5] |= 1u << (entindex_always[i] & 31);
+
+	words = (entindex_numclusters + 31) >> 5;
+
+	for (i=0 ; i<words ; i++)
+	{
+		word = pvs[i];
+
+		for (bit = 0; word; bit++, word >>= 1)
+		{
+			if (!(word & 1))
+				continue;
+
+			cluster = (i << 5) + bit;
+
+			if (cluster >= entindex_numclusters)
+				break;
+
+			for (j=entindex_first[cluster] ; j<entindex_first[cluster + 1] ; j++)
+				candidates[entindex_list[j] >> 5] |= 1u << (entindex_list[j] & 31);
+		}
+	}
+}
+
+/*
+=============
+SV_EntityVisibleToClient
+
+The per client checks: areas, PVS and PHS, and sound distance
+=============
+*/
+static bool SV_EntityVisibleToClient (client_t *client, edict_t *ent, uint8_t *clientphs)
+{
+	uint8_t*	bitvector;
+	int32_t 	clientarea = client->view_area;
+
+	if (ent == client->edict)
+		return true;
+
+	// check area
+	if (!Map_AreasConnected (clientarea, ent->areanum))
+	{	// doors can legally straddle two areas, so
+		// we may need to check another one
+		if (!ent->areanum2
+			|| !Map_AreasConnected (clientarea, ent->areanum2))
+			return false;		// blocked by a door
+	}
+
+	// beams just check one point for PHS
+	if (ent->s.renderfx & RF_BEAM)
+	{
+		if (!Bitset_Test (clientphs, ent->clusternums[0]))
+			return false;
+	}
+	else
+	{
+		// FIXME: if an ent has a model and a sound, but isn't
+		// in the PVS, only the PHS, clear the model
+		if (ent->s.sound)
+		{
+			bitvector = client->fatpvs;	//clientphs;
+		}
+		else
+			bitvector = client->fatpvs;
+
+		if (ent->num_clusters == -1)
+		{	// too many leafs for individual check, go by headnode
+			if (!Map_HeadnodeVisible (ent->headnode, bitvector))
+				return false;
+		}
+		else
+		{	// check individual leafs
+			if (!Bitset_TestAny (bitvector, ent->clusternums, ent->num_clusters))
+				return false;		// not visible
+		}
+
+		if (!ent->s.modelindex)
+		{	// don't send sounds if they will be attenuated away
+			vec3_t	delta;
+			float	len;
+
+			VectorSubtract3 (client->view_origin, ent->s.origin, delta);
+			len = VectorLength3 (delta);
+			if (len > 400)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+=============
+SV_AddFrameEntity
+=============
+*/
+static void SV_AddFrameEntity (client_t *client, client_frame_t *frame, edict_t *ent)
+{
+	entity_state_t* state;
+
+	// add it to the client's circular slice of client_entities
+	state = SV_ClientEntity (client, client->next_entity);
+	*state = ent->s;
+
+	// don't mark players missiles as solid
+	if (ent->owner == client->edict)
+		state->solid = 0;
+
+	client->next_entity++;
+	frame->num_entities++;
+}
+
 /*
 =============
 SV_BuildClientFrame
 
 Decides which entities are going to be visible to the client, and
 copies off the playerstat and areabits.
+
+Only touches the client and its slice of svs.client_entities, so frames for different clients
+can be built on different threads once SV_SetupClientFrame has been called for them.
 =============
 */
 void SV_BuildClientFrame (client_t *client)
 {
 	int32_t 		e, i;
-	vec3_t			org;
+	uint32_t		word;
 	edict_t*		ent;
 	edict_t*		clent;
 	client_frame_t* frame;
-	entity_state_t* state;
-	int32_t 		l;
-	int32_t 		clientarea, clientcluster;
-	int32_t 		leafnum;
-	int32_t 		c_fullsend;
 	uint8_t*		clientphs;
-	uint8_t*		bitvector;
+	uint32_t		candidates[MAX_EDICTS / 32];
 
 	clent = client->edict;
 
@@ -452,118 +758,48 @@ void SV_BuildClientFrame (client_t *client)
 
 	frame->senttime = svs.realtime; // save it for ping calc later
 
-	// find the client's PVS
-	for (i=0 ; i<3 ; i++)
-		org[i] = clent->client->ps.pmove.origin[i] + clent->client->ps.viewoffset[i];
-
-	leafnum = Map_PointLeafnum (org);
-	clientarea = Map_LeafArea (leafnum);
-	clientcluster = Map_GetLeafCluster (leafnum);
-
 	// calculate the visible areas
-	frame->areabytes = Map_WriteAreaBits (frame->areabits, clientarea);
+	frame->areabytes = Map_WriteAreaBits (frame->areabits, client->view_area);
 
 	// grab the current player_state_t
 	frame->ps = clent->client->ps;
 
-	SV_FatPVS (org);
-	clientphs = Map_ClusterPHS (clientcluster);
+	clientphs = Map_ClusterPHS (client->view_cluster);
 
 	// build up the list of visible entities
 	frame->num_entities = 0;
-	frame->first_entity = svs.next_client_entities;
-
-	c_fullsend = 0;
+	frame->first_entity = client->next_entity;
 
-	for (e=1 ; e<game->num_edicts ; e++)
+	if (entindex_numclusters)
 	{
-		ent = EDICT_NUM(e);
+		// only look at entities in clusters the client can see, in edict order like the full scan
+		SV_EntityIndexCandidates (client, candidates);
 
-		// ignore ents without visible models
-		if (ent->svflags & SVF_NOCLIENT)
-			continue;
-
-		// ignore ents without visible models unless they have an effect
-		if (!ent->s.modelindex && !ent->s.effects && !ent->s.sound
-			&& !ent->s.event)
-			continue;
-
-		// ignore if not touching a PV leaf
-		if (ent != clent)
+		for (i=0 ; i<MAX_EDICTS / 32 ; i++)
 		{
-			// check area
-			if (!Map_AreasConnected (clientarea, ent->areanum))
-			{	// doors can legally straddle two areas, so
-				// we may need to check another one
-				if (!ent->areanum2
-					|| !Map_AreasConnected (clientarea, ent->areanum2))
-					continue;		// blocked by a door
-			}
-
-			// beams just check one point for PHS
-			if (ent->s.renderfx & RF_BEAM)
+			for (e = i << 5, word = candidates[i]; word; e++, word >>= 1)
 			{
-				l = ent->clusternums[0];
-				if ( !(clientphs[l >> 3] & (1 << (l&7) )) )
+				if (!(word & 1))
 					continue;
-			}
-			else
-			{
-				// FIXME: if an ent has a model and a sound, but isn't
-				// in the PVS, only the PHS, clear the model
-				if (ent->s.sound)
-				{
-					bitvector = fatpvs;	//clientphs;
-				}
-				else
-					bitvector = fatpvs;
-
-				if (ent->num_clusters == -1)
-				{	// too many leafs for individual check, go by headnode
-					if (!Map_HeadnodeVisible (ent->headnode, bitvector))
-						continue;
-					c_fullsend++;
-				}
-				else
-				{	// check individual leafs
-					for (i=0 ; i < ent->num_clusters ; i++)
-					{
-						l = ent->clusternums[i];
-						if (bitvector[l >> 3] & (1 << (l&7) ))
-							break;
-					}
-					if (i == ent->num_clusters)
-						continue;		// not visible
-				}
-
-				if (!ent->s.modelindex)
-				{	// don't send sounds if they will be attenuated away
-					vec3_t	delta;
-					float	len;
-
-					VectorSubtract3 (org, ent->s.origin, delta);
-					len = VectorLength3 (delta);
-					if (len > 400)
-						continue;
-				}
+
+				ent = EDICT_NUM(e);
+
+				if (SV_EntityCanBeSent (ent)
+					&& SV_EntityVisibleToClient (client, ent, clientphs))
+					SV_AddFrameEntity (client, frame, ent);
 			}
 		}
 
-		// add it to the circular client_entities array
-		state = &svs.client_entities[svs.next_client_entities%svs.num_client_entities];
-		if (ent->s.number != e)
-		{
-			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
-			ent->s.number = e;
-		}
-		*state = ent->s;
+		return;
+	}
 
-		// don't mark players missiles as solid
-		if (ent->owner == client->edict)
-			state->solid = 0;
+	for (e=1 ; e<game->num_edicts ; e++)
+	{
+		ent = EDICT_NUM(e);
 
-		svs.next_client_entities++;
-		frame->num_entities++;
+		if (SV_EntityCanBeSent (ent)
+			&& SV_EntityVisibleToClient (client, ent, clientphs))
+			SV_AddFrameEntity (client, frame, ent);
 	}
 }
 
@@ -612,7 +848,7 @@ void SV_RecordDemoMessage ()
 		ent = EDICT_NUM(e);
 	}
 
-	MSG_WriteShort (&buf, 0);		// end of packetentities
+	MSG_WriteEntityEnd (&buf);		// end of packetentities
 
 	// now add the accumulated multicast information
 	SZ_Write (&buf, svs.demo_multicast.data, svs.demo_multicast.cursize);
@@ -23,6 +23,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "server.hpp"
 
+// engine_api_t has trace_batch from game api version 2 on
+static_assert(GAME_API_VERSION >= 2, "the game submodule is older than the engine and has no trace_batch import, update it");
+
 game_api_t* game;		// Game server DLL interface object
 
 /*
@@ -254,6 +257,41 @@ void PF_WriteDir(vec3_t dir) { MSG_WriteDir(&sv.multicast, dir); }
 void PF_WriteColor(color4_t color) { MSG_WriteColor(&sv.multicast, color); }
 void PF_WriteAngle(float f) { MSG_WriteAngle(&sv.multicast, f); }
 
+/*
+=================
+PF_trace
+
+The game's traces, counted as such for showtrace 2
+=================
+*/
+trace_t PF_trace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t* passedict, int32_t contentmask)
+{
+	trace_caller_t	previous = Map_PushTraceCaller(trace_caller_game);
+	trace_t 		trace;
+
+	trace = SV_Trace(start, mins, maxs, end, passedict, contentmask);
+	Map_PopTraceCaller(previous);
+	return trace;
+}
+
+int32_t PF_pointcontents(vec3_t p)
+{
+	trace_caller_t	previous = Map_PushTraceCaller(trace_caller_game);
+	int32_t 		contents;
+
+	contents = SV_PointContents(p);
+	Map_PopTraceCaller(previous);
+	return contents;
+}
+
+void PF_Player_Move(pmove_t* pmove)
+{
+	trace_caller_t	previous = Map_PushTraceCaller(trace_caller_pmove);
+
+	Player_Move(pmove);
+	Map_PopTraceCaller(previous);
+}
+
 /*
 =================
 PF_inPVS
@@ -371,12 +409,13 @@ void SV_InitGameLibraries()
 	import.Edict_Link = SV_LinkEdict;
 	import.Edict_Unlink = SV_UnlinkEdict;
 	import.BoxEdicts = SV_AreaEdicts;
-	import.trace = SV_Trace;
-	import.pointcontents = SV_PointContents;
+	import.trace = PF_trace;
+	import.trace_batch = SV_TraceBatch;
+	import.pointcontents = PF_pointcontents;
 	import.setmodel = PF_setmodel;
 	import.inPVS = PF_inPVS;
 	import.inPHS = PF_inPHS;
-	import.Player_Move = Player_Move;
+	import.Player_Move = PF_Player_Move;
 
 	import.modelindex = SV_ModelIndex;
 	import.soundindex = SV_SoundIndex;
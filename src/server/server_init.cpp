@@ -356,8 +356,9 @@ void SV_InitGame()
 
 	svs.spawncount = rand();
 	svs.clients = (client_t*)Memory_ZoneMalloc(sizeof(client_t) * sv_maxclients->value);
-	svs.num_client_entities = sv_maxclients->value * UPDATE_BACKUP * 64;
+	svs.num_client_entities = sv_maxclients->value * CLIENT_ENTITY_SLICE;
 	svs.client_entities = (entity_state_t*)Memory_ZoneMalloc(sizeof(entity_state_t) * svs.num_client_entities);
+	SV_ClearAddressHashes();
 
 	// init network stuff
 	Net_Config((sv_maxclients->value > 1));
@@ -65,6 +65,13 @@ cvar_t* public_server;			// should heartbeats be sent?
 
 cvar_t* sv_reconnect_limit;	// minimum seconds between connect messages
 
+cvar_t* sv_parallel_frames;		// build and encode client frames on the job workers
+cvar_t* sv_entity_index;		// find the entities each client can see through a per frame cluster index
+cvar_t* sv_showmulticast;		// print what multicasting cost each frame
+cvar_t* sv_area_split;			// edicts in an area tree leaf before it is split, 0 for a fixed uniform tree
+cvar_t* sv_parallel_traces;		// run SV_TraceBatch on the job workers
+cvar_t* sv_trace_cache;			// 1 reuses repeated traces within a frame, 2 only counts them
+
 void Master_Shutdown();
 
 
@@ -98,12 +105,228 @@ void SV_DropClient(client_t* drop)
 		drop->download = NULL;
 	}
 
+	// a zombie stays in svs.clienthash, so its packets still ack the disconnect, until SV_CheckTimeouts frees it
 	drop->state = cs_zombie;		// become free in a few seconds
 	drop->name[0] = 0;
 }
 
 
 
+/*
+==============================================================================
+
+ADDRESS LOOKUPS
+
+==============================================================================
+*/
+
+/*
+=================
+SV_HashAddress
+
+FNV-1a of the parts of an address Net_CompareBaseAdr looks at, and the qport
+=================
+*/
+static uint32_t SV_HashAddress(netadr_t adr, int32_t qport)
+{
+	uint32_t	hash = 2166136261u;
+	int32_t 	i;
+
+	hash ^= (uint8_t)adr.type;
+	hash *= 16777619u;
+
+	if (adr.type == NA_IP)
+	{
+		for (i = 0; i < 4; i++)
+		{
+			hash ^= adr.ip[i];
+			hash *= 16777619u;
+		}
+	}
+
+	hash ^= qport & 0xff;
+	hash *= 16777619u;
+	hash ^= (qport >> 8) & 0xff;
+	hash *= 16777619u;
+
+	return hash;
+}
+
+/*
+=================
+SV_ClearAddressHashes
+
+Empties the client and challenge tables, for a new svs
+=================
+*/
+void SV_ClearAddressHashes()
+{
+	int32_t 	i;
+
+	for (i = 0; i < CLIENT_HASH_SIZE; i++)
+		svs.clienthash[i] = -1;
+
+	for (i = 0; i < CHALLENGE_HASH_SIZE; i++)
+		svs.challengehash[i] = -1;
+
+	svs.numchallenges = 0;
+	svs.nextchallenge = 0;
+}
+
+/*
+=================
+SV_HashClient
+
+Adds a client under its netchan's address and qport, once Netchan_Setup has been called
+=================
+*/
+void SV_HashClient(client_t* cl)
+{
+	int32_t 	bucket;
+
+	if (cl->hashed)
+		SV_UnhashClient(cl);
+
+	bucket = SV_HashAddress(cl->netchan.remote_address, cl->netchan.qport) & (CLIENT_HASH_SIZE - 1);
+
+	cl->hashnext = svs.clienthash[bucket];
+	svs.clienthash[bucket] = cl - svs.clients;
+	cl->hashed = true;
+}
+
+/*
+=================
+SV_UnhashClient
+
+Called before a client's slot is freed or reused for another connection
+=================
+*/
+void SV_UnhashClient(client_t* cl)
+{
+	int32_t* 	link;
+	int32_t 	clientnum;
+
+	if (!cl->hashed)
+		return;
+
+	clientnum = cl - svs.clients;
+
+	link = &svs.clienthash[SV_HashAddress(cl->netchan.remote_address, cl->netchan.qport) & (CLIENT_HASH_SIZE - 1)];
+
+	while (*link != -1)
+	{
+		if (*link == clientnum)
+		{
+			*link = cl->hashnext;
+			break;
+		}
+
+		link = &svs.clients[*link].hashnext;
+	}
+
+	cl->hashed = false;
+	cl->hashnext = -1;
+}
+
+/*
+=================
+SV_FindClient
+
+The client a packet from adr with this qport belongs to, or NULL.
+The port isn't compared, so clients behind address translating routers are still found
+=================
+*/
+client_t* SV_FindClient(netadr_t adr, int32_t qport)
+{
+	client_t*	cl;
+	int32_t 	i;
+
+	for (i = svs.clienthash[SV_HashAddress(adr, qport) & (CLIENT_HASH_SIZE - 1)]; i != -1; i = cl->hashnext)
+	{
+		cl = &svs.clients[i];
+
+		if (cl->state == cs_free)
+			continue;
+		if (cl->netchan.qport != qport)
+			continue;
+		if (!Net_CompareBaseAdr(adr, cl->netchan.remote_address))
+			continue;
+
+		return cl;
+	}
+
+	return NULL;
+}
+
+/*
+=================
+SV_FindChallenge
+
+The challenge given to adr, or -1
+=================
+*/
+static int32_t SV_FindChallenge(netadr_t adr)
+{
+	int32_t 	i;
+
+	for (i = svs.challengehash[SV_HashAddress(adr, 0) & (CHALLENGE_HASH_SIZE - 1)]; i != -1; i = svs.challenges[i].hashnext)
+	{
+		if (Net_CompareBaseAdr(adr, svs.challenges[i].adr))
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+=================
+SV_NewChallenge
+
+Gives adr a challenge, in a free slot or in place of the oldest one
+=================
+*/
+static int32_t SV_NewChallenge(netadr_t adr)
+{
+	challenge_t*	challenge;
+	int32_t* 		link;
+	int32_t 		i;
+
+	if (svs.numchallenges < MAX_CHALLENGES)
+	{
+		i = svs.numchallenges++;
+	}
+	else
+	{
+		// slots are handed out in order, so the next one round is the oldest
+		i = svs.nextchallenge;
+		svs.nextchallenge = (svs.nextchallenge + 1) % MAX_CHALLENGES;
+
+		link = &svs.challengehash[SV_HashAddress(svs.challenges[i].adr, 0) & (CHALLENGE_HASH_SIZE - 1)];
+
+		while (*link != -1)
+		{
+			if (*link == i)
+			{
+				*link = svs.challenges[i].hashnext;
+				break;
+			}
+
+			link = &svs.challenges[*link].hashnext;
+		}
+	}
+
+	challenge = &svs.challenges[i];
+	challenge->challenge = rand() & 0x7fff;
+	challenge->adr = adr;
+	challenge->time = curtime;
+
+	link = &svs.challengehash[SV_HashAddress(adr, 0) & (CHALLENGE_HASH_SIZE - 1)];
+	challenge->hashnext = *link;
+	*link = i;
+
+	return i;
+}
+
 /*
 ==============================================================================
 
@@ -127,32 +350,13 @@ challenge, they must give a valid IP address.
 void SVC_GetChallenge()
 {
 	int32_t 	i;
-	int32_t 	oldest;
-	int32_t 	oldestTime;
-
-	oldest = 0;
-	oldestTime = 0x7fffffff;
 
 	// see if we already have a challenge for this ip
-	for (i = 0; i < MAX_CHALLENGES; i++)
-	{
-		if (Net_CompareBaseAdr(net_from, svs.challenges[i].adr))
-			break;
-		if (svs.challenges[i].time < oldestTime)
-		{
-			oldestTime = svs.challenges[i].time;
-			oldest = i;
-		}
-	}
+	i = SV_FindChallenge(net_from);
 
-	if (i == MAX_CHALLENGES)
-	{
-		// overwrite the oldest
-		svs.challenges[oldest].challenge = rand() & 0x7fff;
-		svs.challenges[oldest].adr = net_from;
-		svs.challenges[oldest].time = curtime;
-		i = oldest;
-	}
+	// if not, overwrite the oldest
+	if (i == -1)
+		i = SV_NewChallenge(net_from);
 
 	// send it back
 	Netchan_OutOfBandPrint(NS_SERVER, net_from, "challenge %i", svs.challenges[i].challenge);
@@ -214,19 +418,17 @@ void SVC_DirectConnect()
 	// see if the challenge is valid
 	if (!Net_IsLocalAddress(adr))
 	{
-		for (i = 0; i < MAX_CHALLENGES; i++)
+		i = SV_FindChallenge(net_from);
+
+		if (i == -1)
 		{
-			if (Net_CompareBaseAdr(net_from, svs.challenges[i].adr))
-			{
-				if (challenge == svs.challenges[i].challenge)
-					break;		// good
-				Netchan_OutOfBandPrint(NS_SERVER, adr, "print\nBad challenge.\n");
-				return;
-			}
+			Netchan_OutOfBandPrint(NS_SERVER, adr, "print\nNo challenge for address.\n");
+			return;
 		}
-		if (i == MAX_CHALLENGES)
+
+		if (challenge != svs.challenges[i].challenge)
 		{
-			Netchan_OutOfBandPrint(NS_SERVER, adr, "print\nNo challenge for address.\n");
+			Netchan_OutOfBandPrint(NS_SERVER, adr, "print\nBad challenge.\n");
 			return;
 		}
 	}
@@ -272,6 +474,9 @@ void SVC_DirectConnect()
 	}
 
 gotnewcl:
+	// a reused slot may have been found under another qport
+	SV_UnhashClient(newcl);
+
 	// build a new connection
 	// accept the new client
 	// this is the only place a client_t is ever initialized
@@ -302,6 +507,7 @@ gotnewcl:
 	Netchan_OutOfBandPrint(NS_SERVER, adr, "client_connect");
 
 	Netchan_Setup(NS_SERVER, &newcl->netchan, adr, qport);
+	SV_HashClient(newcl);
 
 	newcl->state = cs_connected;
 
@@ -492,7 +698,6 @@ SV_ReadPackets
 */
 void SV_ReadPackets()
 {
-	int32_t 		i;
 	client_t* cl;
 	int32_t 		qport;
 
@@ -513,33 +718,25 @@ void SV_ReadPackets()
 		qport = MSG_ReadShort(&net_message) & 0xffff;
 
 		// check for packets from connected clients
-		for (i = 0, cl = svs.clients; i < sv_maxclients->value; i++, cl++)
+		cl = SV_FindClient(net_from, qport);
+
+		if (!cl)
+			continue;
+
+		if (cl->netchan.remote_address.port != net_from.port)
 		{
-			if (cl->state == cs_free)
-				continue;
-			if (!Net_CompareBaseAdr(net_from, cl->netchan.remote_address))
-				continue;
-			if (cl->netchan.qport != qport)
-				continue;
-			if (cl->netchan.remote_address.port != net_from.port)
-			{
-				Com_Printf("SV_ReadPackets: fixing up a translated port\n");
-				cl->netchan.remote_address.port = net_from.port;
-			}
+			Com_Printf("SV_ReadPackets: fixing up a translated port\n");
+			cl->netchan.remote_address.port = net_from.port;	// not part of the hash, so it stays where it is
+		}
 
-			if (Netchan_Process(&cl->netchan, &net_message))
-			{	// this is a valid, sequenced packet, so process it
-				if (cl->state != cs_zombie)
-				{
-					cl->lastmessage = svs.realtime;	// don't timeout
-					SV_ExecuteClientMessage(cl);
-				}
+		if (Netchan_Process(&cl->netchan, &net_message))
+		{	// this is a valid, sequenced packet, so process it
+			if (cl->state != cs_zombie)
+			{
+				cl->lastmessage = svs.realtime;	// don't timeout
+				SV_ExecuteClientMessage(cl);
 			}
-			break;
 		}
-
-		if (i != sv_maxclients->value)
-			continue;
 	}
 }
 
@@ -575,6 +772,7 @@ void SV_CheckTimeouts()
 		if (cl->state == cs_zombie
 			&& cl->lastmessage < zombiepoint)
 		{
+			SV_UnhashClient(cl);
 			cl->state = cs_free;	// can now be reused
 			continue;
 		}
@@ -583,6 +781,7 @@ void SV_CheckTimeouts()
 		{
 			SV_BroadcastPrintf(PRINT_HIGH, "%s timed out\n", cl->name);
 			SV_DropClient(cl);
+			SV_UnhashClient(cl);
 			cl->state = cs_free;	// don't bother with zombie state
 		}
 	}
@@ -655,6 +854,11 @@ SV_Frame
 void SV_Frame(int32_t msec)
 {
 	time_before_game = time_after_game = 0;
+	time_trace_batches = 0;
+	num_trace_batches = num_batched_traces = 0;
+
+	// so sv_showmulticast only ever prints this frame's cost
+	memset(&sv_multicast_stats, 0, sizeof(sv_multicast_stats));
 
 	// if server is not active, do nothing
 	if (!svs.initialized)
@@ -692,11 +896,18 @@ void SV_Frame(int32_t msec)
 	SV_GiveMsec();
 
 	// let everything in the world think and move
+	SV_ClearTraceCache();
 	SV_RunGameFrame();
 
+	if (sv_trace_cache->value && showtrace->value > 1)
+		SV_PrintTraceCacheStats();
+
 	// send messages back to the clients that had packets read this frame
 	SV_SendClientMessages();
 
+	if (sv_showmulticast->value)
+		SV_PrintMulticastStats();
+
 	// save the entire world state if recording a serverdemo
 	SV_RecordDemoMessage();
 
@@ -804,6 +1015,13 @@ void SV_Init()
 
 	sv_reconnect_limit = Cvar_Get("sv_reconnect_limit", "3", CVAR_ARCHIVE);
 
+	sv_parallel_frames = Cvar_Get("sv_parallel_frames", "1", 0);
+	sv_entity_index = Cvar_Get("sv_entity_index", "1", 0);
+	sv_showmulticast = Cvar_Get("sv_showmulticast", "0", 0);
+	sv_area_split = Cvar_Get("sv_area_split", "8", 0);
+	sv_parallel_traces = Cvar_Get("sv_parallel_traces", "1", 0);
+	sv_trace_cache = Cvar_Get("sv_trace_cache", "0", 0);
+
 	SZ_Init(&net_message, net_message_buffer, sizeof(net_message_buffer));
 }
 
@@ -147,6 +147,37 @@ void SV_BroadcastCommand (const char *fmt, ...)
 }
 
 
+multicast_stats_t sv_multicast_stats;
+
+/*
+=================
+SV_ClientLeaf
+
+Finds the leaf, cluster and area the client's edict is in. The game multicasts many times a frame,
+but clients only move a few times a frame at most, so the last lookup is kept until the edict moves
+or the map changes.
+=================
+*/
+void SV_ClientLeaf (client_t *client)
+{
+	vec_t* origin = client->edict->s.origin;
+
+	if (client->leaf_cached
+		&& client->leaf_spawncount == svs.spawncount
+		&& VectorCompare3 (origin, client->leaf_origin))
+		return;
+
+	client->leafnum = Map_PointLeafnum (origin);
+	client->leaf_cluster = Map_GetLeafCluster (client->leafnum);
+	client->leaf_area = Map_LeafArea (client->leafnum);
+
+	VectorCopy3 (origin, client->leaf_origin);
+	client->leaf_spawncount = svs.spawncount;
+	client->leaf_cached = true;
+
+	sv_multicast_stats.leaf_lookups++;
+}
+
 /*
 =================
 SV_Multicast
@@ -166,7 +197,13 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	int32_t 	leafnum, cluster;
 	int32_t 	j;
 	bool		reliable;
-	int32_t 	area1, area2;
+	int32_t 	area1;
+	int64_t 	time_start = 0;
+
+	if (sv_showmulticast->value)
+		time_start = Sys_Nanoseconds ();
+
+	sv_multicast_stats.calls++;
 
 	reliable = false;
 
@@ -198,7 +235,6 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	case MULTICAST_PHS_R:
 		reliable = true;	// intentional fallthrough
 	case MULTICAST_PHS:
-		leafnum = Map_PointLeafnum (origin);
 		cluster = Map_GetLeafCluster (leafnum);
 		mask = Map_ClusterPHS (cluster);
 		break;
@@ -206,7 +242,6 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	case MULTICAST_PVS_R:
 		reliable = true;	// intentional fallthrough
 	case MULTICAST_PVS:
-		leafnum = Map_PointLeafnum (origin);
 		cluster = Map_GetLeafCluster (leafnum);
 		mask = Map_ClusterPVS (cluster);
 		break;
@@ -226,10 +261,11 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 
 		if (mask)
 		{
-			leafnum = Map_PointLeafnum (client->edict->s.origin);
-			cluster = Map_GetLeafCluster (leafnum);
-			area2 = Map_LeafArea (leafnum);
-			if (!Map_AreasConnected (area1, area2))
+			sv_multicast_stats.clients_checked++;
+
+			SV_ClientLeaf (client);
+			cluster = client->leaf_cluster;
+			if (!Map_AreasConnected (area1, client->leaf_area))
 				continue;
 			if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
 				continue;
@@ -239,9 +275,30 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 			SZ_Write (&client->netchan.message, sv.multicast.data, sv.multicast.cursize);
 		else
 			SZ_Write (&client->datagram, sv.multicast.data, sv.multicast.cursize);
+
+		sv_multicast_stats.clients_sent++;
+		sv_multicast_stats.bytes += sv.multicast.cursize;
 	}
 
 	SZ_Clear (&sv.multicast);
+
+	if (sv_showmulticast->value)
+		sv_multicast_stats.time_ns += Sys_Nanoseconds () - time_start;
+}
+
+/*
+=================
+SV_PrintMulticastStats
+
+Prints what multicasting cost this frame, for sv_showmulticast
+=================
+*/
+void SV_PrintMulticastStats ()
+{
+	multicast_stats_t* stats = &sv_multicast_stats;
+
+	Com_Printf ("multicast: %i calls, %i clients checked, %i sent, %i leaf lookups, %i bytes, %.3f ms\n",
+		stats->calls, stats->clients_checked, stats->clients_sent, stats->leaf_lookups, stats->bytes, stats->time_ns / 1000000.0f);
 }
 
 
@@ -391,22 +448,25 @@ FRAME UPDATES
 
 /*
 =======================
-SV_SendClientDatagram
+SV_WriteClientDatagram
+
+Builds the client's frame and writes it, and the accumulated datagram, into client->frame_msg.
+SV_SetupClientFrame must have been called for the client first. Safe to call for different clients
+at the same time on the job workers.
 =======================
 */
-bool SV_SendClientDatagram(client_t *client)
+void SV_WriteClientDatagram(client_t *client)
 {
-	uint8_t		msg_buf[MAX_MSGLEN];
-	sizebuf_t	msg;
+	sizebuf_t*	msg = &client->frame_msg;
 
 	SV_BuildClientFrame (client);
 
-	SZ_Init (&msg, msg_buf, sizeof(msg_buf));
-	msg.allowoverflow = true;
+	SZ_Init (msg, client->frame_msg_buf, sizeof(client->frame_msg_buf));
+	msg->allowoverflow = true;
 
 	// send over all the relevant entity_state_t
 	// and the player_state_t
-	SV_WriteFrameToClient (client, &msg);
+	SV_WriteFrameToClient (client, msg);
 
 	// copy the accumulated multicast datagram
 	// for this client out to the message
@@ -415,24 +475,96 @@ bool SV_SendClientDatagram(client_t *client)
 	if (client->datagram.overflowed)
 		Com_Printf ("WARNING: datagram overflowed for %s\n", client->name);
 	else
-		SZ_Write (&msg, client->datagram.data, client->datagram.cursize);
+		SZ_Write (msg, client->datagram.data, client->datagram.cursize);
 	SZ_Clear (&client->datagram);
 
-	if (msg.overflowed)
+	if (msg->overflowed)
 	{	// must have room left for the packet header
 		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
-		SZ_Clear (&msg);
+		SZ_Clear (msg);
 	}
+}
+
+/*
+=======================
+SV_TransmitClientDatagram
 
+Sends what SV_WriteClientDatagram wrote. Main thread only
+=======================
+*/
+void SV_TransmitClientDatagram(client_t *client)
+{
 	// send the datagram
-	Netchan_Transmit (&client->netchan, msg.cursize, msg.data);
+	Netchan_Transmit (&client->netchan, client->frame_msg.cursize, client->frame_msg.data);
 
 	// record the size for rate estimation
-	client->message_size[sv.framenum % RATE_MESSAGES] = msg.cursize;
+	client->message_size[sv.framenum % RATE_MESSAGES] = client->frame_msg.cursize;
+}
+
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+bool SV_SendClientDatagram(client_t *client)
+{
+	SV_SetupClientFrame (client);
+	SV_WriteClientDatagram (client);
+	SV_TransmitClientDatagram (client);
 
 	return true;
 }
 
+/*
+=======================
+SV_WriteClientDatagramJob
+=======================
+*/
+static void SV_WriteClientDatagramJob(int32_t index, void* data)
+{
+	client_t** clients = (client_t**)data;
+
+	SV_SetupClientFrame (clients[index]);
+	SV_WriteClientDatagram (clients[index]);
+}
+
+/*
+=======================
+SV_SendClientDatagrams
+
+Sends a frame to every spawned client. When there are job workers, the frames are built and delta encoded
+in parallel, and only the netchan work stays on the main thread.
+=======================
+*/
+void SV_SendClientDatagrams(client_t** clients, int32_t count)
+{
+	int32_t i;
+
+	if (!count)
+		return;
+
+	SV_FixEntityNumbers ();
+	SV_BuildEntityIndex ();
+
+	// Map_ClusterPHS writes to a static row unless the vis cache is in use, and SV_FatPVS
+	// errors out on maps with more clusters than it can hold, which has to happen on this thread
+	if (!sv_parallel_frames->value
+		|| !Jobs_NumWorkers()
+		|| !Map_HasVisCache()
+		|| Map_GetNumClusters() > (int32_t)sizeof(clients[0]->fatpvs) * 8)
+	{
+		for (i = 0; i < count; i++)
+			SV_SendClientDatagram (clients[i]);
+
+		return;
+	}
+
+	Jobs_ParallelFor (count, SV_WriteClientDatagramJob, clients);
+
+	for (i = 0; i < count; i++)
+		SV_TransmitClientDatagram (clients[i]);
+}
+
 
 /*
 ==================
@@ -461,6 +593,8 @@ void SV_SendClientMessages ()
 	int32_t 	msglen;
 	uint8_t		msgbuf[MAX_MSGLEN];
 	size_t		r;
+	client_t*	spawned[MAX_CLIENTS];
+	int32_t 	spawned_count;
 
 	msglen = 0;
 
@@ -495,7 +629,12 @@ void SV_SendClientMessages ()
 		}
 	}
 
+	// everything sent from here goes out together at the end
+	Net_BeginSendBatch (NS_SERVER);
+
 	// send a message to each connected client
+	spawned_count = 0;
+
 	for (i=0, c = svs.clients ; i<sv_maxclients->value; i++, c++)
 	{
 		if (!c->state)
@@ -516,7 +655,8 @@ void SV_SendClientMessages ()
 		}
 		else if (c->state == cs_spawned)
 		{
-			SV_SendClientDatagram (c);
+			// sent all together afterwards
+			spawned[spawned_count++] = c;
 		}
 		else
 		{
@@ -525,5 +665,9 @@ void SV_SendClientMessages ()
 				Netchan_Transmit (&c->netchan, 0, NULL);
 		}
 	}
+
+	SV_SendClientDatagrams (spawned, spawned_count);
+
+	Net_FlushSendBatch (NS_SERVER);
 }
 
@@ -39,27 +39,44 @@ FIXME: this use of "area" is different from the bsp file use
 
 #define	EDICT_FROM_AREA(l) STRUCT_FROM_LINK(l,edict_t,area)
 
+// The area tree is a loose quadtree over the world's x/y bounds. It starts as a single node, and a leaf is split
+// into four once more than sv_area_split edicts are linked into it, so it only gets deep where entities crowd together.
+// Each node's loose bounds are its cell grown by half a cell on every side, so an edict goes in the deepest node
+// whose cell holds its center and is at least as big as it is, and never has to be linked into more than one node.
 typedef struct areanode_s
 {
-	int32_t 	axis;		// -1 = leaf node
-	float	dist;
-	struct areanode_s* children[2];
-	link_t	trigger_edicts;
-	link_t	solid_edicts;
+	float		center[2];	// of the cell, x/y only. Maps are flat enough that splitting on z doesn't pay
+	float		half[2];	// half the cell size, the loose bounds are center +/- half * 2
+	int32_t 	depth;
+	int32_t 	count;		// edicts linked into this node, not counting the children
+	struct areanode_s* children;	// [4], NULL for a leaf
+	link_t		trigger_edicts;
+	link_t		solid_edicts;
 } areanode_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	32
+#define	AREA_NODES			4096
+#define AREA_MAX_DEPTH		8		// cells get no smaller than 1/256th of the world across
+#define AREA_UNIFORM_DEPTH	2		// sv_area_split 0 builds a fixed tree this deep, 16 cells, like the old uniform split
 
 areanode_t	sv_areanodes[AREA_NODES];
 int32_t 	sv_numareanodes;
 
-float*		area_mins;
-float*		area_maxs;
-edict_t**	area_list;
-int32_t 	area_count;
-int32_t		area_maxcount;
-int32_t 	area_type;
+areanode_t*	sv_edictareanodes[MAX_EDICTS];	// node each edict is linked into, for keeping count
+
+// an SV_AreaEdicts in progress, on the stack so it can be called from several threads at once
+typedef struct
+{
+	float*		mins;
+	float*		maxs;
+	edict_t**	list;
+	int32_t 	count;
+	int32_t		maxcount;
+	int32_t 	type;
+} areaquery_t;
+
+// what queries have cost on this thread, for sv_areabench
+thread_local int32_t area_nodes_visited;
+thread_local int32_t area_edicts_tested;
 
 int32_t SV_HullForEntity(edict_t* ent);
 
@@ -86,48 +103,155 @@ void InsertLinkBefore(link_t* l, link_t* before)
 
 /*
 ===============
-SV_CreateAreaNode
-
-Builds a uniformly subdivided tree for the given world size
+SV_InitAreaNode
 ===============
 */
-areanode_t* SV_CreateAreaNode(int32_t depth, vec3_t mins, vec3_t maxs)
+static void SV_InitAreaNode(areanode_t* anode, float center_x, float center_y, float half_x, float half_y, int32_t depth)
 {
-	areanode_t* anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
-
-	anode = &sv_areanodes[sv_numareanodes];
-	sv_numareanodes++;
+	anode->center[0] = center_x;
+	anode->center[1] = center_y;
+	anode->half[0] = half_x;
+	anode->half[1] = half_y;
+	anode->depth = depth;
+	anode->count = 0;
+	anode->children = NULL;
 
 	ClearLink(&anode->trigger_edicts);
 	ClearLink(&anode->solid_edicts);
+}
 
-	if (depth == AREA_DEPTH)
+/*
+===============
+SV_AreaChildForBox
+
+Returns the child of node whose loose bounds hold the box, or NULL if the box has to stay in node
+===============
+*/
+static areanode_t* SV_AreaChildForBox(areanode_t* node, vec3_t absmin, vec3_t absmax)
+{
+	areanode_t* child;
+	float		center, half;
+	int32_t 	i, index;
+
+	if (!node->children)
+		return NULL;
+
+	index = 0;
+
+	for (i = 0; i < 2; i++)
 	{
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+		center = 0.5f * (absmin[i] + absmax[i]);
+		half = 0.5f * (absmax[i] - absmin[i]);
+
+		// children are half the size of their parent
+		if (half > node->half[i] * 0.5f)
+			return NULL;
+
+		if (center >= node->center[i])
+			index |= 1 << i;
 	}
 
-	VectorSubtract3(maxs, mins, size);
-	if (size[0] > size[1])
-		anode->axis = 0;
+	child = &node->children[index];
+
+	// things off the edge of the world stay at the top
+	for (i = 0; i < 2; i++)
+	{
+		center = 0.5f * (absmin[i] + absmax[i]);
+
+		if (fabsf(center - child->center[i]) > child->half[i])
+			return NULL;
+	}
+
+	return child;
+}
+
+/*
+===============
+SV_AreaLinkToNode
+===============
+*/
+static void SV_AreaLinkToNode(edict_t* ent, areanode_t* node)
+{
+	if (ent->solid == SOLID_TRIGGER)
+		InsertLinkBefore(&ent->area, &node->trigger_edicts);
 	else
-		anode->axis = 1;
+		InsertLinkBefore(&ent->area, &node->solid_edicts);
 
-	anode->dist = 0.5f * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy3(mins, mins1);
-	VectorCopy3(mins, mins2);
-	VectorCopy3(maxs, maxs1);
-	VectorCopy3(maxs, maxs2);
+	sv_edictareanodes[NUM_FOR_EDICT(ent)] = node;
+	node->count++;
+}
 
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+/*
+===============
+SV_SplitAreaNode
 
-	anode->children[0] = SV_CreateAreaNode(depth + 1, mins2, maxs2);
-	anode->children[1] = SV_CreateAreaNode(depth + 1, mins1, maxs1);
+Gives a leaf its four children, and moves down whatever fits in them. Returns false if there are no nodes left
+===============
+*/
+static bool SV_SplitAreaNode(areanode_t* node)
+{
+	link_t*		lists[2] = { &node->solid_edicts, &node->trigger_edicts };
+	link_t*		l, * next;
+	areanode_t* child;
+	edict_t*	check;
+	float		half_x, half_y;
+	int32_t 	i;
+
+	if (sv_numareanodes + 4 > AREA_NODES)
+		return false;
+
+	node->children = &sv_areanodes[sv_numareanodes];
+	sv_numareanodes += 4;
 
-	return anode;
+	half_x = node->half[0] * 0.5f;
+	half_y = node->half[1] * 0.5f;
+
+	// bit 0 of the index is the x side, bit 1 the y side, same as SV_AreaChildForBox
+	for (i = 0; i < 4; i++)
+	{
+		SV_InitAreaNode(&node->children[i],
+			node->center[0] + ((i & 1) ? half_x : -half_x),
+			node->center[1] + ((i & 2) ? half_y : -half_y),
+			half_x, half_y, node->depth + 1);
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		for (l = lists[i]->next; l != lists[i]; l = next)
+		{
+			next = l->next;
+			check = EDICT_FROM_AREA(l);
+			child = SV_AreaChildForBox(node, check->absmin, check->absmax);
+
+			if (!child)
+				continue;
+
+			RemoveLink(l);
+			node->count--;
+			SV_AreaLinkToNode(check, child);
+		}
+	}
+
+	return true;
+}
+
+/*
+===============
+SV_BuildUniformAreaNodes
+
+Splits everything down to depth, for sv_area_split 0
+===============
+*/
+static void SV_BuildUniformAreaNodes(areanode_t* node, int32_t depth)
+{
+	int32_t i;
+
+	if (node->depth >= depth
+		|| !SV_SplitAreaNode(node))
+		return;
+
+	for (i = 0; i < 4; i++)
+		SV_BuildUniformAreaNodes(&node->children[i], depth);
 }
 
 /*
@@ -138,9 +262,20 @@ SV_ClearWorld
 */
 void SV_ClearWorld()
 {
+	vec_t*	mins = sv.models[1]->mins;
+	vec_t*	maxs = sv.models[1]->maxs;
+
+	SV_ClearTraceCache();
+
 	memset(sv_areanodes, 0, sizeof(sv_areanodes));
-	sv_numareanodes = 0;
-	SV_CreateAreaNode(0, sv.models[1]->mins, sv.models[1]->maxs);
+	memset(sv_edictareanodes, 0, sizeof(sv_edictareanodes));
+	sv_numareanodes = 1;
+
+	SV_InitAreaNode(&sv_areanodes[0], 0.5f * (mins[0] + maxs[0]), 0.5f * (mins[1] + maxs[1]),
+		0.5f * (maxs[0] - mins[0]), 0.5f * (maxs[1] - mins[1]), 0);
+
+	if (sv_area_split->value <= 0)
+		SV_BuildUniformAreaNodes(sv_areanodes, AREA_UNIFORM_DEPTH);
 }
 
 
@@ -152,10 +287,22 @@ SV_UnlinkEdict
 */
 void SV_UnlinkEdict(edict_t* ent)
 {
+	areanode_t** node;
+
+	SV_ClearTraceCache();
+
 	if (!ent->area.prev)
 		return;		// not linked in anywhere
 	RemoveLink(&ent->area);
 	ent->area.prev = ent->area.next = NULL;
+
+	node = &sv_edictareanodes[NUM_FOR_EDICT(ent)];
+
+	if (*node)
+	{
+		(*node)->count--;
+		*node = NULL;
+	}
 }
 
 
@@ -170,7 +317,7 @@ Links an edict into the chain so it can be acutally used
 
 void SV_LinkEdict(edict_t* ent)
 {
-	areanode_t* node;
+	areanode_t* node, * child;
 	int32_t 	leafs[MAX_TOTAL_ENT_LEAFS];
 	int32_t 	clusters[MAX_TOTAL_ENT_LEAFS];
 	int32_t 	num_leafs;
@@ -178,6 +325,8 @@ void SV_LinkEdict(edict_t* ent)
 	int32_t 	area;
 	int32_t 	topnode;
 
+	SV_ClearTraceCache();
+
 	if (ent->area.prev)
 		SV_UnlinkEdict(ent);	// unlink from old position
 
@@ -330,26 +479,28 @@ void SV_LinkEdict(edict_t* ent)
 	if (ent->solid == SOLID_NOT)
 		return;
 
-	// find the first node that the ent's box crosses
+	// find the deepest node that holds the ent's box, splitting any crowded leaf on the way
 	node = sv_areanodes;
 	while (1)
 	{
-		if (node->axis == -1)
+		if (!node->children
+			&& sv_area_split->value > 0
+			&& node->count >= sv_area_split->value
+			&& node->depth < AREA_MAX_DEPTH)
+		{
+			SV_SplitAreaNode(node);
+		}
+
+		child = SV_AreaChildForBox(node, ent->absmin, ent->absmax);
+
+		if (!child)
 			break;
-		if (ent->absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if (ent->absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
+
+		node = child;
 	}
 
 	// link it in	
-	if (ent->solid == SOLID_TRIGGER)
-		InsertLinkBefore(&ent->area, &node->trigger_edicts);
-	else
-		InsertLinkBefore(&ent->area, &node->solid_edicts);
-
+	SV_AreaLinkToNode(ent, node);
 }
 
 
@@ -359,16 +510,17 @@ SV_AreaEdicts_r
 
 ====================
 */
-void SV_AreaEdicts_r(areanode_t* node)
+void SV_AreaEdicts_r(areaquery_t* query, areanode_t* node)
 {
 	link_t* l, * next, * start;
 	edict_t* check;
-	int32_t 		count;
+	areanode_t* child;
+	int32_t 		i;
 
-	count = 0;
+	area_nodes_visited++;
 
 	// touch linked edicts
-	if (area_type == AREA_SOLID)
+	if (query->type == AREA_SOLID)
 		start = &node->solid_edicts;
 	else
 		start = &node->trigger_edicts;
@@ -378,34 +530,44 @@ void SV_AreaEdicts_r(areanode_t* node)
 		next = l->next;
 		check = EDICT_FROM_AREA(l);
 
+		area_edicts_tested++;
+
 		if (check->solid == SOLID_NOT)
 			continue;		// deactivated
-		if (check->absmin[0] > area_maxs[0]
-			|| check->absmin[1] > area_maxs[1]
-			|| check->absmin[2] > area_maxs[2]
-			|| check->absmax[0] < area_mins[0]
-			|| check->absmax[1] < area_mins[1]
-			|| check->absmax[2] < area_mins[2])
+		if (check->absmin[0] > query->maxs[0]
+			|| check->absmin[1] > query->maxs[1]
+			|| check->absmin[2] > query->maxs[2]
+			|| check->absmax[0] < query->mins[0]
+			|| check->absmax[1] < query->mins[1]
+			|| check->absmax[2] < query->mins[2])
 			continue;		// not touching
 
-		if (area_count == area_maxcount)
+		if (query->count == query->maxcount)
 		{
 			Com_Printf("SV_AreaEdicts: MAXCOUNT\n");
 			return;
 		}
 
-		area_list[area_count] = check;
-		area_count++;
+		query->list[query->count] = check;
+		query->count++;
 	}
 
-	if (node->axis == -1)
+	if (!node->children)
 		return;		// terminal node
 
-	// recurse down both sides
-	if (area_maxs[node->axis] > node->dist)
-		SV_AreaEdicts_r(node->children[0]);
-	if (area_mins[node->axis] < node->dist)
-		SV_AreaEdicts_r(node->children[1]);
+	// recurse into the children whose loose bounds touch the area
+	for (i = 0; i < 4; i++)
+	{
+		child = &node->children[i];
+
+		if (query->maxs[0] < child->center[0] - child->half[0] * 2
+			|| query->mins[0] > child->center[0] + child->half[0] * 2
+			|| query->maxs[1] < child->center[1] - child->half[1] * 2
+			|| query->mins[1] > child->center[1] + child->half[1] * 2)
+			continue;
+
+		SV_AreaEdicts_r(query, child);
+	}
 }
 
 /*
@@ -416,27 +578,228 @@ SV_AreaEdicts
 int32_t SV_AreaEdicts(vec3_t mins, vec3_t maxs, edict_t** list,
 	int32_t maxcount, int32_t areatype)
 {
-	area_mins = mins;
-	area_maxs = maxs;
-	area_list = list;
-	area_count = 0;
-	area_maxcount = maxcount;
-	area_type = areatype;
+	areaquery_t query;
 
-	SV_AreaEdicts_r(sv_areanodes);
+	query.mins = mins;
+	query.maxs = maxs;
+	query.list = list;
+	query.count = 0;
+	query.maxcount = maxcount;
+	query.type = areatype;
 
-	return area_count;
+	SV_AreaEdicts_r(&query, sv_areanodes);
+
+	return query.count;
 }
 
 
 //===========================================================================
 
+/*
+===============================================================================
+
+SAME FRAME TRACE CACHE
+
+The game often asks the same question several times in a frame (monsters checking the same
+spot, or each other). Answers are kept until anything is linked or unlinked, or the frame ends,
+so it is only correct while the game relinks what it moves, which the area tree needs anyway.
+The game also changes solid, owner and the monster flags without relinking (a monster dying, a
+missile losing its owner), so each answer remembers those for the entities it was worked out
+from, and is only reused while they are the same.
+===============================================================================
+*/
+
+#define TRACE_CACHE_SIZE	1024		// must be a power of two
+#define POINT_CACHE_SIZE	512
+#define TRACE_CACHE_DEPS	8			// answers that depend on more entities than this aren't kept
+
+#define TRACE_DEP_SVFLAGS	(SVF_MONSTER | SVF_DEADMONSTER)
+
+// what a cached answer assumed about one of the entities it was worked out from
+typedef struct
+{
+	edict_t*	ent;
+	edict_t*	owner;
+	int32_t 	solid;
+	int32_t 	svflags;
+} tracedep_t;
+
+typedef struct
+{
+	int32_t 	count;			// -1 if there were too many to keep the answer
+	tracedep_t	ents[TRACE_CACHE_DEPS];
+} tracedeps_t;
+
+typedef struct
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	edict_t*	passedict;
+	int32_t 	contentmask;
+} tracekey_t;
+
+typedef struct
+{
+	tracekey_t	key;
+	uint32_t	generation;		// valid while this matches sv_trace_generation
+	edict_t*	passowner;		// the passedict's owner isn't clipped against either
+	tracedeps_t	deps;
+	trace_t		trace;
+} tracecache_t;
+
+typedef struct
+{
+	vec3_t		point;
+	uint32_t	generation;
+	tracedeps_t	deps;
+	int32_t 	contents;
+} pointcache_t;
+
+static tracecache_t sv_tracecache[TRACE_CACHE_SIZE];
+static pointcache_t sv_pointcache[POINT_CACHE_SIZE];
+static uint32_t 	sv_trace_generation = 1;
+
+// cleared by SV_PrintTraceCacheStats
+static int32_t		sv_cached_traces, sv_repeated_traces;
+static int32_t		sv_cached_points, sv_repeated_points;
+
+/*
+===============
+SV_ClearTraceCache
+
+Forgets every cached answer
+===============
+*/
+void SV_ClearTraceCache()
+{
+	sv_trace_generation++;
+
+	// only after four billion links
+	if (!sv_trace_generation)
+	{
+		memset(sv_tracecache, 0, sizeof(sv_tracecache));
+		memset(sv_pointcache, 0, sizeof(sv_pointcache));
+		sv_trace_generation = 1;
+	}
+}
+
+/*
+===============
+SV_TraceCacheHash
+===============
+*/
+static uint32_t SV_TraceCacheHash(void* key, int32_t size)
+{
+	uint8_t*	bytes = (uint8_t*)key;
+	uint32_t	hash = 2166136261u;
+	int32_t 	i;
+
+	for (i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+===============
+SV_RecordTraceDeps
+
+Remembers what the entities an answer is about to be worked out from look like now
+===============
+*/
+static void SV_RecordTraceDeps(tracedeps_t* deps, edict_t** ents, int32_t count)
+{
+	int32_t 	i;
+
+	if (!deps)
+		return;
+
+	if (count > TRACE_CACHE_DEPS)
+	{
+		deps->count = -1;
+		return;
+	}
+
+	deps->count = count;
+
+	for (i = 0; i < count; i++)
+	{
+		deps->ents[i].ent = ents[i];
+		deps->ents[i].owner = ents[i]->owner;
+		deps->ents[i].solid = ents[i]->solid;
+		deps->ents[i].svflags = ents[i]->svflags & TRACE_DEP_SVFLAGS;
+	}
+}
+
+/*
+===============
+SV_TraceDepsValid
+
+True if none of the entities a cached answer was worked out from has changed in a way that
+could change the answer without being relinked
+===============
+*/
+static bool SV_TraceDepsValid(tracedeps_t* deps)
+{
+	tracedep_t*	dep;
+	int32_t 	i;
+
+	if (deps->count < 0)
+		return false;
+
+	for (i = 0; i < deps->count; i++)
+	{
+		dep = &deps->ents[i];
+
+		if (dep->ent->owner != dep->owner
+			|| dep->ent->solid != dep->solid
+			|| (dep->ent->svflags & TRACE_DEP_SVFLAGS) != dep->svflags)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+===============
+SV_UseTraceCache
+
+Only the main thread uses the cache, so SV_TraceBatch's workers don't have to lock it
+===============
+*/
+static bool SV_UseTraceCache()
+{
+	return sv_trace_cache->value && Jobs_IsMainThread();
+}
+
+/*
+===============
+SV_PrintTraceCacheStats
+
+Prints how many of the frame's traces and point contents checks repeated one already made
+===============
+*/
+void SV_PrintTraceCacheStats()
+{
+	Com_Printf("trace cache: %i/%i traces repeated, %i/%i points repeated%s\n",
+		sv_repeated_traces, sv_cached_traces, sv_repeated_points, sv_cached_points,
+		sv_trace_cache->value == 1 ? "" : " (not reused)");
+
+	sv_cached_traces = sv_repeated_traces = 0;
+	sv_cached_points = sv_repeated_points = 0;
+}
+
 /*
 =============
-SV_PointContents
+SV_PointContentsUncached
 =============
 */
-int32_t SV_PointContents(vec3_t p)
+static int32_t SV_PointContentsUncached(vec3_t p, tracedeps_t* deps)
 {
 	edict_t* touch[MAX_EDICTS], * hit;
 	int32_t 		i, num;
@@ -449,6 +812,7 @@ int32_t SV_PointContents(vec3_t p)
 
 	// or in contents from all the other entities
 	num = SV_AreaEdicts(p, p, touch, MAX_EDICTS, AREA_SOLID);
+	SV_RecordTraceDeps(deps, touch, num);
 
 	for (i = 0; i < num; i++)
 	{
@@ -468,6 +832,41 @@ int32_t SV_PointContents(vec3_t p)
 	return contents;
 }
 
+/*
+=============
+SV_PointContents
+=============
+*/
+int32_t SV_PointContents(vec3_t p)
+{
+	pointcache_t*	entry;
+	int32_t 		contents;
+
+	if (!SV_UseTraceCache())
+		return SV_PointContentsUncached(p, NULL);
+
+	entry = &sv_pointcache[SV_TraceCacheHash(p, sizeof(vec3_t)) & (POINT_CACHE_SIZE - 1)];
+	sv_cached_points++;
+
+	if (entry->generation == sv_trace_generation
+		&& VectorCompare3(entry->point, p)
+		&& SV_TraceDepsValid(&entry->deps))
+	{
+		sv_repeated_points++;
+
+		// sv_trace_cache 2 only counts them
+		if (sv_trace_cache->value == 1)
+			return entry->contents;
+	}
+
+	contents = SV_PointContentsUncached(p, &entry->deps);
+
+	VectorCopy3(p, entry->point);
+	entry->generation = sv_trace_generation;
+	entry->contents = contents;
+	return contents;
+}
+
 
 
 typedef struct
@@ -479,6 +878,7 @@ typedef struct
 	trace_t		trace;
 	edict_t* passedict;
 	int32_t 		contentmask;
+	tracedeps_t*	deps;		// filled in for the trace cache
 } moveclip_t;
 
 
@@ -532,6 +932,7 @@ void SV_ClipMoveToEntities(moveclip_t* clip)
 
 	num = SV_AreaEdicts(clip->boxmins, clip->boxmaxs, touchlist
 		, MAX_EDICTS, AREA_SOLID);
+	SV_RecordTraceDeps(clip->deps, touchlist, num);
 
 	// be careful, it is possible to have an entity in this
 	// list removed before we get to it (killtriggered)
@@ -615,25 +1016,19 @@ void SV_TraceBounds(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, vec3_t b
 
 /*
 ==================
-SV_Trace
-
-Moves the given mins/maxs volume through the world from start to end.
-
-Passedict and edicts owned by passedict are explicitly not checked.
-
+SV_TraceUncached
 ==================
 */
-trace_t SV_Trace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t* passedict, int32_t contentmask)
+static trace_t SV_TraceUncached(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t* passedict, int32_t contentmask, tracedeps_t* deps)
 {
 	moveclip_t	clip;
 
-	if (!mins)
-		mins = vec3_origin;
-	if (!maxs)
-		maxs = vec3_origin;
-
 	memset(&clip, 0, sizeof(moveclip_t));
 
+	// blocked by the world depends on no entities
+	if (deps)
+		deps->count = 0;
+
 	// clip to world
 	clip.trace = Map_BoxTrace(start, end, mins, maxs, 0, contentmask);
 	clip.trace.ent = game->edicts;
@@ -646,6 +1041,7 @@ trace_t SV_Trace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t* pa
 	clip.mins = mins;
 	clip.maxs = maxs;
 	clip.passedict = passedict;
+	clip.deps = deps;
 
 	VectorCopy3(mins, clip.mins2);
 	VectorCopy3(maxs, clip.maxs2);
@@ -659,3 +1055,290 @@ trace_t SV_Trace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t* pa
 	return clip.trace;
 }
 
+/*
+==================
+SV_Trace
+
+Moves the given mins/maxs volume through the world from start to end.
+
+Passedict and edicts owned by passedict are explicitly not checked.
+
+==================
+*/
+trace_t SV_Trace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t* passedict, int32_t contentmask)
+{
+	tracekey_t		key;
+	tracecache_t*	entry;
+
+	if (!mins)
+		mins = vec3_origin;
+	if (!maxs)
+		maxs = vec3_origin;
+
+	if (!SV_UseTraceCache())
+		return SV_TraceUncached(start, mins, maxs, end, passedict, contentmask, NULL);
+
+	// cleared first so the padding hashes and compares the same every time
+	memset(&key, 0, sizeof(key));
+	VectorCopy3(start, key.start);
+	VectorCopy3(end, key.end);
+	VectorCopy3(mins, key.mins);
+	VectorCopy3(maxs, key.maxs);
+	key.passedict = passedict;
+	key.contentmask = contentmask;
+
+	entry = &sv_tracecache[SV_TraceCacheHash(&key, sizeof(key)) & (TRACE_CACHE_SIZE - 1)];
+	sv_cached_traces++;
+
+	if (entry->generation == sv_trace_generation
+		&& !memcmp(&entry->key, &key, sizeof(key))
+		&& (!passedict || passedict->owner == entry->passowner)
+		&& SV_TraceDepsValid(&entry->deps))
+	{
+		sv_repeated_traces++;
+
+		// sv_trace_cache 2 only counts them
+		if (sv_trace_cache->value == 1)
+			return entry->trace;
+	}
+
+	entry->trace = SV_TraceUncached(start, mins, maxs, end, passedict, contentmask, &entry->deps);
+	entry->passowner = passedict ? passedict->owner : NULL;
+	entry->key = key;
+	entry->generation = sv_trace_generation;
+	return entry->trace;
+}
+
+
+#define TRACE_BATCH_CHUNK		16		// traces per job, so small traces aren't swamped by handing out work
+
+typedef struct
+{
+	trace_request_t*	requests;
+	trace_t*			results;
+	int32_t 			count;
+} tracebatch_t;
+
+/*
+==================
+SV_TraceBatchJob
+==================
+*/
+static void SV_TraceBatchJob(int32_t index, void* data)
+{
+	tracebatch_t*		batch = (tracebatch_t*)data;
+	trace_request_t*	request;
+	trace_caller_t		previous;
+	int32_t 			i, last;
+
+	last = (index + 1) * TRACE_BATCH_CHUNK;
+
+	if (last > batch->count)
+		last = batch->count;
+
+	previous = Map_PushTraceCaller(trace_caller_game);
+
+	for (i = index * TRACE_BATCH_CHUNK; i < last; i++)
+	{
+		request = &batch->requests[i];
+		batch->results[i] = SV_TraceUncached(request->start, request->mins, request->maxs, request->end, request->passent, request->contentmask, NULL);
+	}
+
+	Map_PopTraceCaller(previous);
+}
+
+/*
+==================
+SV_TraceBatch
+
+Runs a set of independent traces, spread across the job workers, and fills in a result for each request.
+Gives the same results as calling SV_Trace for each in turn; nothing may link, unlink or free edicts
+while it runs, which holds as long as the game is waiting on it.
+==================
+*/
+void SV_TraceBatch(trace_request_t* requests, trace_t* results, int32_t count)
+{
+	tracebatch_t	batch;
+	int64_t 		time_start = 0;
+	int32_t 		i, chunks;
+
+	if (count <= 0)
+		return;
+
+	if (profile_all->value)
+		time_start = Sys_Nanoseconds();
+
+	batch.requests = requests;
+	batch.results = results;
+	batch.count = count;
+	chunks = (count + TRACE_BATCH_CHUNK - 1) / TRACE_BATCH_CHUNK;
+
+	if (!sv_parallel_traces->value
+		|| !Jobs_NumWorkers()
+		|| chunks == 1)
+	{
+		for (i = 0; i < chunks; i++)
+			SV_TraceBatchJob(i, &batch);
+	}
+	else
+		Jobs_ParallelFor(chunks, SV_TraceBatchJob, &batch);
+
+	if (profile_all->value)
+	{
+		time_trace_batches += Sys_Nanoseconds() - time_start;
+		num_trace_batches++;
+		num_batched_traces += count;
+	}
+}
+
+/*
+===============================================================================
+
+AREA TREE BENCHMARK
+
+===============================================================================
+*/
+
+/*
+==================
+SV_AreaBenchRandom
+
+Its own generator, so running the benchmark doesn't disturb rand() for the game, and every pass traces the same lines
+==================
+*/
+static float SV_AreaBenchRandom(uint32_t* seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return ((*seed >> 16) & 0x7fff) / (float)0x7fff;
+}
+
+/*
+==================
+SV_AreaRelink
+
+Rebuilds the area tree with the current sv_area_split and links the edicts back in
+==================
+*/
+static void SV_AreaRelink(edict_t** edicts, int32_t count)
+{
+	int32_t i;
+
+	SV_ClearWorld();
+
+	for (i = 0; i < count; i++)
+	{
+		edicts[i]->area.prev = edicts[i]->area.next = NULL;
+		SV_LinkEdict(edicts[i]);
+	}
+}
+
+/*
+==================
+SV_AreaBench_f
+
+sv_areabench [traces]
+
+Takes the entities in the level as they are right now, and traces player sized boxes from random points around them,
+once with the area tree at a fixed uniform depth and once splitting adaptively. The same traces are run both times,
+so the checksums should match unless two entities tie for the nearest hit.
+==================
+*/
+void SV_AreaBench_f()
+{
+	vec3_t		mins = { -16, -16, -24 };
+	vec3_t		maxs = { 16, 16, 32 };
+	vec3_t		start, end;
+	edict_t**	linked;
+	edict_t*	ent;
+	trace_t		trace;
+	char		split[16];
+	int32_t 	numlinked, traces, queries;
+	int32_t 	pass, i, j;
+	uint32_t	seed, checksum;
+	int64_t 	time_start, time_end;
+
+	if (sv.state != ss_game
+		|| !game)
+	{
+		Com_Printf("sv_areabench: no level running\n");
+		return;
+	}
+
+	traces = (Cmd_Argc() > 1) ? atoi(Cmd_Argv(1)) : 10000;
+
+	if (traces < 1)
+		traces = 1;
+
+	// record the distribution
+	linked = (edict_t**)Memory_ZoneMalloc(sizeof(edict_t*) * game->num_edicts);
+	numlinked = 0;
+
+	for (i = 1; i < game->num_edicts; i++)
+	{
+		ent = EDICT_NUM(i);
+
+		if (ent->area.prev)
+			linked[numlinked++] = ent;
+	}
+
+	if (!numlinked)
+	{
+		Com_Printf("sv_areabench: no entities linked\n");
+		Memory_ZoneFree(linked);
+		return;
+	}
+
+	strncpy(split, sv_area_split->string, sizeof(split) - 1);
+	split[sizeof(split) - 1] = 0;
+
+	Com_Printf("Tracing %i boxes around %i entities\n", traces, numlinked);
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		if (pass == 0)
+			Cvar_Set("sv_area_split", "0");
+		else
+			Cvar_Set("sv_area_split", (atoi(split) > 0) ? split : "8");
+
+		SV_AreaRelink(linked, numlinked);
+
+		seed = 1;
+		checksum = 0;
+		queries = 0;
+		area_nodes_visited = 0;
+		area_edicts_tested = 0;
+
+		time_start = Sys_Nanoseconds();
+
+		for (i = 0; i < traces; i++)
+		{
+			ent = linked[(int32_t)(SV_AreaBenchRandom(&seed) * (numlinked - 1))];
+
+			for (j = 0; j < 3; j++)
+			{
+				start[j] = 0.5f * (ent->absmin[j] + ent->absmax[j]) + (SV_AreaBenchRandom(&seed) - 0.5f) * 256;
+				end[j] = start[j] + (SV_AreaBenchRandom(&seed) - 0.5f) * 512;
+			}
+
+			trace = SV_Trace(start, mins, maxs, end, NULL, MASK_PLAYERSOLID);
+
+			// world traces that start solid never query the tree
+			if (trace.fraction != 0 || trace.ent != game->edicts)
+				queries++;
+
+			checksum = (checksum << 5 | checksum >> 27) ^ (uint32_t)(trace.fraction * 65536) ^ (uint32_t)NUM_FOR_EDICT(trace.ent);
+		}
+
+		time_end = Sys_Nanoseconds();
+
+		Com_Printf("%s: %i nodes, %.1f nodes and %.1f edicts per query, %.3f us per trace, checksum %08x\n",
+			pass ? "adaptive" : "uniform", sv_numareanodes,
+			queries ? area_nodes_visited / (float)queries : 0, queries ? area_edicts_tested / (float)queries : 0,
+			(time_end - time_start) / 1000.0f / traces, checksum);
+	}
+
+	Cvar_Set("sv_area_split", split);
+	SV_AreaRelink(linked, numlinked);
+
+	Memory_ZoneFree(linked);
+}
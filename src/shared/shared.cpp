@@ -525,6 +525,8 @@ int32_t		(*_BigInt) (int32_t l);
 int32_t		(*_LittleInt) (int32_t l);
 uint32_t	(*_BigIntUnsigned) (int32_t l);
 uint32_t	(*_LittleIntUnsigned) (int32_t l);
+int64_t		(*_BigInt64) (int64_t l);
+int64_t		(*_LittleInt64) (int64_t l);
 float (*_BigFloat) (float l);
 float (*_LittleFloat) (float l);
 
@@ -536,6 +538,8 @@ int32_t  BigInt(int32_t l) { return _BigInt(l); }
 int32_t  LittleInt(int32_t l) { return _LittleInt(l); }
 uint32_t BigIntUnsigned(int32_t l) { return _BigIntUnsigned(l); }
 uint32_t LittleIntUnsigned(int32_t l) { return _LittleIntUnsigned(l); }
+int64_t BigInt64(int64_t l) { return _BigInt64(l); }
+int64_t LittleInt64(int64_t l) { return _LittleInt64(l); }
 float BigFloat(float l) { return _BigFloat(l); }
 float LittleFloat(float l) { return _LittleFloat(l); }
 
@@ -603,6 +607,16 @@ uint32_t IntNoSwapUnsigned(int32_t l)
 	return l;
 }
 
+int64_t Int64Swap(int64_t l)
+{
+	return ((int64_t)IntSwapUnsigned((int32_t)l) << 32) + IntSwapUnsigned((int32_t)(l >> 32));
+}
+
+int64_t Int64NoSwap(int64_t l)
+{
+	return l;
+}
+
 float FloatSwap(float f)
 {
 	union
@@ -646,6 +660,8 @@ void Swap_Init()
 		_LittleInt = IntNoSwap;
 		_BigIntUnsigned = IntSwapUnsigned;
 		_LittleIntUnsigned = IntNoSwapUnsigned;
+		_BigInt64 = Int64Swap;
+		_LittleInt64 = Int64NoSwap;
 		_BigFloat = FloatSwap;
 		_LittleFloat = FloatNoSwap;
 	}
@@ -658,6 +674,8 @@ void Swap_Init()
 		_LittleShortUnsigned = ShortSwapUnsigned;
 		_BigInt = IntNoSwap;
 		_LittleInt = IntSwap;
+		_BigInt64 = Int64NoSwap;
+		_LittleInt64 = Int64Swap;
 		_BigFloat = FloatNoSwap;
 		_LittleFloat = FloatSwap;
 	}
@@ -237,6 +237,8 @@ int32_t BigInt(int32_t l);
 int32_t LittleInt(int32_t l);
 uint32_t BigIntUnsigned(int32_t l);
 uint32_t LittleIntUnsigned(int32_t l);
+int64_t BigInt64(int64_t l);
+int64_t LittleInt64(int64_t l);
 float	BigFloat(float l);
 float	LittleFloat(float l);
 
@@ -271,6 +273,10 @@ int32_t Sys_Milliseconds();
 int64_t Sys_Nanoseconds(); // should be platform independent
 void Sys_Mkdir(char* path);
 
+// read-only memory mapping of a whole file, returns NULL on failure
+void* Sys_MapFile(const char* path, size_t* length);
+void Sys_UnmapFile(void* base, size_t length);
+
 // large block stack allocation routines
 void* Memory_HunkBegin(int32_t maxsize);
 void* Memory_HunkAlloc(int32_t size);
@@ -451,6 +457,17 @@ typedef struct
 	struct edict_s* ent;		// not set by CM_*() functions
 } trace_t;
 
+// one trace of a batch, the same arguments as a single trace takes
+typedef struct trace_request_s
+{
+	vec3_t			start;
+	vec3_t			end;
+	vec3_t			mins;		// zero for a point trace
+	vec3_t			maxs;
+	struct edict_s* passent;	// not clipped against, nor anything it owns, or its owner
+	int32_t 		contentmask;
+} trace_request_t;
+
 // pmove_state_t is the information necessary for client side movement
 // prediction
 typedef enum 
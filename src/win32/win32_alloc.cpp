@@ -135,7 +135,7 @@ int32_t Sys_Milliseconds()
 int64_t Sys_Nanoseconds()
 {
 	static int64_t base;
-	static struct timespec timespec;
+	struct timespec timespec;	// not static, this is called from the network receive thread too
 	static bool initialized = true;
 
 	if (!initialized)
@@ -165,6 +165,55 @@ void Sys_Mkdir(char* path)
 	_mkdir(path);
 }
 
+/*
+================
+Sys_MapFile
+
+Maps an entire file read-only. The file and mapping handles can be closed straight away,
+the view keeps the mapping alive until Sys_UnmapFile.
+================
+*/
+void* Sys_MapFile(const char* path, size_t* length)
+{
+	HANDLE			file, mapping;
+	LARGE_INTEGER	size;
+	void*			base;
+
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (!GetFileSizeEx(file, &size)
+		|| size.QuadPart == 0
+		|| (uint64_t)size.QuadPart > SIZE_MAX)
+	{
+		CloseHandle(file);
+		return NULL;
+	}
+
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+
+	if (!mapping)
+		return NULL;
+
+	base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+
+	if (!base)
+		return NULL;
+
+	*length = (size_t)size.QuadPart;
+	return base;
+}
+
+void Sys_UnmapFile(void* base, size_t length)
+{
+	if (base)
+		UnmapViewOfFile(base);
+}
+
 //============================================
 
 char		findbase[MAX_OSPATH];
@@ -44,6 +44,8 @@ static cvar_t* noudp;
 loopback_t	loopbacks[2];
 int32_t 	ip_sockets[2];
 
+net_stats_t	net_stats[NS_MAX + 1];
+
 const char* Net_ErrorString();
 
 //=============================================================================
@@ -120,14 +122,21 @@ bool Net_CompareBaseAdr(netadr_t a, netadr_t b)
 	return TRUE;
 }
 
+void Net_AdrToBuffer(netadr_t a, char* buffer, int32_t size)
+{
+	if (a.type == NA_LOOPBACK)
+		snprintf(buffer, size, "loopback");
+	else if (a.type == NA_IP)
+		snprintf(buffer, size, "%i.%i.%i.%i:%i", a.ip[0], a.ip[1], a.ip[2], a.ip[3], ntohs(a.port));
+	else
+		buffer[0] = 0;
+}
+
 char* Net_AdrToString(netadr_t a)
 {
 	static char s[64];
 
-	if (a.type == NA_LOOPBACK)
-		snprintf(s, sizeof(s), "loopback");
-	else if (a.type == NA_IP)
-		snprintf(s, sizeof(s), "%i.%i.%i.%i:%i", a.ip[0], a.ip[1], a.ip[2], a.ip[3], ntohs(a.port));
+	Net_AdrToBuffer(a, s, sizeof(s));
 	return s;
 }
 
@@ -268,16 +277,19 @@ void Net_SendLoopPacket(netsrc_t sock, int32_t length, void* data, netadr_t to)
 
 //=============================================================================
 
-bool Net_GetPacket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message)
+/*
+====================
+Net_ReadSocket
+====================
+*/
+bool Net_ReadSocket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message)
 {
 	int32_t 	ret;
 	struct sockaddr from;
 	int32_t 	fromlen;
 	int32_t 	net_socket;
 	int32_t 	err;
-
-	if (Net_GetLoopPacket(sock, net_from, net_message))
-		return true;
+	char		fromstring[64];		// Net_AdrToString's buffer is shared with the main thread
 
 	net_socket = ip_sockets[sock];
 
@@ -288,6 +300,8 @@ bool Net_GetPacket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message)
 	ret = recvfrom(net_socket, (char*)net_message->data, net_message->maxsize
 		, 0, (struct sockaddr*)&from, &fromlen);
 
+	Net_CountStat(net_stats[sock].recv_calls, 1);
+
 	SockadrToNetadr(&from, net_from);
 
 	if (ret == -1)
@@ -296,31 +310,85 @@ bool Net_GetPacket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message)
 
 		if (err == WSAEWOULDBLOCK)
 			return false;
+
+		Net_AdrToBuffer(*net_from, fromstring, sizeof(fromstring));
+
 		if (err == WSAEMSGSIZE) {
 			Com_Printf("Warning:  Oversize packet from %s\n",
-				Net_AdrToString(*net_from));
+				fromstring);
 			return false;
 		}
 
-		if (dedicated->value)	// let dedicated servers continue after errors
+		// let dedicated servers and the receive thread continue after errors
+		if (dedicated->value || !Jobs_IsMainThread())
 			Com_Printf("NET_GetPacket: %s from %s\n", Net_ErrorString(),
-				Net_AdrToString(*net_from));
+				fromstring);
 		else
-			Com_Error(ERR_DROP, "NET_GetPacket: %s from %s", Net_ErrorString(), Net_AdrToString(*net_from));
+			Com_Error(ERR_DROP, "NET_GetPacket: %s from %s", Net_ErrorString(), fromstring);
 
 		return false;
 	}
 
 	if (ret == net_message->maxsize)
 	{
-		Com_Printf("Oversize packet from %s\n", Net_AdrToString(*net_from));
+		Net_AdrToBuffer(*net_from, fromstring, sizeof(fromstring));
+		Com_Printf("Oversize packet from %s\n", fromstring);
 		return false;
 	}
 
 	net_message->cursize = ret;
+
+	Net_CountStat(net_stats[sock].recv_packets, 1);
+	Net_CountStat(net_stats[sock].recv_bytes, ret);
 	return true;
 }
 
+bool Net_GetPacket(netsrc_t sock, netadr_t* net_from, sizebuf_t* net_message)
+{
+	if (Net_GetLoopPacket(sock, net_from, net_message))
+		return true;
+
+	if (Net_ReceiveThreadRunning())
+		return Net_DequeuePacket(sock, net_from, net_message);
+
+	return Net_ReadSocket(sock, net_from, net_message);
+}
+
+/*
+====================
+Net_WaitForSockets
+====================
+*/
+void Net_WaitForSockets(int32_t msec)
+{
+	struct timeval timeout;
+	fd_set	fdset;
+	int32_t i;
+	bool	any;
+
+	FD_ZERO(&fdset);
+	any = false;
+
+	for (i = 0; i < 2; i++)
+	{
+		if (ip_sockets[i])
+		{
+			FD_SET(ip_sockets[i], &fdset);
+			any = true;
+		}
+	}
+
+	if (!any)
+	{
+		Sleep(msec);
+		return;
+	}
+
+	timeout.tv_sec = msec / 1000;
+	timeout.tv_usec = (msec % 1000) * 1000;
+	select(0, &fdset, NULL, NULL, &timeout);		// winsock ignores the first argument
+}
+
 //=============================================================================
 
 void Net_SendPacket(netsrc_t sock, int32_t length, void* data, netadr_t to)
@@ -354,10 +422,19 @@ void Net_SendPacket(netsrc_t sock, int32_t length, void* data, netadr_t to)
 
 	ret = sendto(net_socket, (const char*)data, length, 0, &addr, sizeof(addr));
 
-	if (ret == -1)
+	net_stats[sock].send_calls++;
+
+	if (ret != -1)
+	{
+		net_stats[sock].send_packets++;
+		net_stats[sock].send_bytes += length;
+	}
+	else
 	{
 		int32_t err = WSAGetLastError();
 
+		net_stats[sock].send_errors++;
+
 		// wouldblock is silent
 		if (err == WSAEWOULDBLOCK)
 			return;
@@ -388,6 +465,26 @@ void Net_SendPacket(netsrc_t sock, int32_t length, void* data, netadr_t to)
 }
 
 
+/*
+====================
+Net_BeginSendBatch
+
+Winsock can only send one datagram per call, so everything still goes out as it is sent
+====================
+*/
+void Net_BeginSendBatch(netsrc_t sock)
+{
+}
+
+/*
+====================
+Net_FlushSendBatch
+====================
+*/
+void Net_FlushSendBatch(netsrc_t sock)
+{
+}
+
 //=============================================================================
 
 
@@ -519,6 +616,8 @@ void Net_Config(bool multiplayer)
 
 	if (!multiplayer)
 	{	// shut down any existing sockets
+		Net_StopReceiveThread();
+
 		for (i = 0; i < 2; i++)
 		{
 			if (ip_sockets[i])
@@ -531,7 +630,10 @@ void Net_Config(bool multiplayer)
 	else
 	{	// open sockets
 		if (!noudp->value)
+		{
 			Net_OpenIP();
+			Net_StartReceiveThread();
+		}
 	}
 }
 
@@ -546,6 +648,13 @@ void Net_Sleep(int32_t msec)
 	if (!dedicated || !dedicated->value)
 		return; // we're not a server, just run full speed
 
+	// the receive thread is the one reading the socket
+	if (Net_ReceiveThreadRunning())
+	{
+		Net_WaitForQueue(msec);
+		return;
+	}
+
 	FD_ZERO(&fdset);
 	i = 0;
 	if (ip_sockets[NS_SERVER]) {
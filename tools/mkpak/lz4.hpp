@@ -0,0 +1,155 @@
+/* lz4.hpp - raw LZ4 block encoder and decoder for compressed PAK v2 entries
+ * licensed under the MIT license
+ *
+ * Only the block format is used (no frames or checksums), so this is all
+ * that's needed; the engine has its own copy of the decoder in common/lz4.cpp
+ */
+#ifndef LZ4_H_
+#define LZ4_H_
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 /* the last 5 bytes are always literals */
+#define LZ4_MATCH_LIMIT 12  /* the last match must start at least this far from the end */
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_LOG 16
+
+static inline uint32_t lz4_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+/* writes a length over 15 as 255s and a remainder, returns 0 if it doesn't fit */
+static inline int lz4_put_length(uint8_t** op, uint8_t* oend, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (*op >= oend) return 0;
+        *(*op)++ = 255;
+    }
+    if (*op >= oend) return 0;
+    *(*op)++ = (uint8_t)len;
+    return 1;
+}
+
+static inline int lz4_put_sequence(uint8_t** op, uint8_t* oend, const uint8_t* lit,
+                                   size_t litlen, size_t offset, size_t matchlen) {
+    uint8_t* token = *op;
+    if (*op >= oend) return 0;
+    (*op)++;
+    *token = (uint8_t)((litlen >= 15 ? 15 : litlen) << 4);
+    if (litlen >= 15 && !lz4_put_length(op, oend, litlen - 15)) return 0;
+    if ((size_t)(oend - *op) < litlen) return 0;
+    memcpy(*op, lit, litlen);
+    *op += litlen;
+    if (!matchlen) return 1; /* last sequence */
+
+    if (oend - *op < 2) return 0;
+    *(*op)++ = (uint8_t)(offset & 0xFF);
+    *(*op)++ = (uint8_t)(offset >> 8);
+    matchlen -= LZ4_MIN_MATCH;
+    *token |= (uint8_t)(matchlen >= 15 ? 15 : matchlen);
+    if (matchlen >= 15 && !lz4_put_length(op, oend, matchlen - 15)) return 0;
+    return 1;
+}
+
+/* greedy single-probe compressor. returns the compressed size, or 0 if it
+ * would not fit in dstcap (so passing srclen as dstcap means "only if smaller") */
+static inline size_t lz4_compress(const uint8_t* src, size_t srclen, uint8_t* dst, size_t dstcap) {
+    size_t* table = (size_t*)calloc((size_t)1 << LZ4_HASH_LOG, sizeof(size_t));
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dstcap;
+    size_t ip = 0, anchor = 0;
+
+    if (table == NULL) return 0;
+
+    if (srclen > LZ4_MATCH_LIMIT) {
+        size_t limit = srclen - LZ4_MATCH_LIMIT;
+        size_t matchlimit = srclen - LZ4_LAST_LITERALS;
+
+        while (ip < limit) {
+            uint32_t v = lz4_read32(src + ip);
+            uint32_t h = lz4_hash(v);
+            size_t ref = table[h]; /* position + 1, 0 if empty */
+            table[h] = ip + 1;
+
+            if (!ref || ip - (ref - 1) > LZ4_MAX_OFFSET || lz4_read32(src + ref - 1) != v) {
+                ip++;
+                continue;
+            }
+            ref--;
+
+            size_t len = LZ4_MIN_MATCH;
+            while (ip + len < matchlimit && src[ref + len] == src[ip + len]) len++;
+
+            if (!lz4_put_sequence(&op, oend, src + anchor, ip - anchor, ip - ref, len)) {
+                free(table);
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    if (!lz4_put_sequence(&op, oend, src + anchor, srclen - anchor, 0, 0)) {
+        free(table);
+        return 0;
+    }
+
+    free(table);
+    return (size_t)(op - dst);
+}
+
+/* returns the decoded size, or -1 if the block is malformed or doesn't fit */
+static inline long lz4_decompress(const uint8_t* src, size_t srclen, uint8_t* dst, size_t dstcap) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + srclen;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dstcap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t len = token >> 4;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len) return -1;
+        memcpy(op, ip, len);
+        ip += len, op += len;
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+
+        len = token & 15;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += LZ4_MIN_MATCH;
+        if ((size_t)(oend - op) < len) return -1;
+
+        const uint8_t* match = op - offset;
+        while (len--) *op++ = *match++;
+    }
+
+    return (long)(op - dst);
+}
+
+#endif /* LZ4_H_ */
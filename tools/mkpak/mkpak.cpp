@@ -26,19 +26,38 @@ original author wishes to remain unnamed
 #include <stdlib.h>
 #include <string.h>
 
-#include "pak.h"
+#include "pak.hpp"
+#include "lz4.hpp"
 
 static FILE *pakfile = NULL;
 static size_t pakptr_header = 0;
 static size_t pakptr_data = 0;
 
+/* -2 writes a version 2 archive, -z also compresses its entries */
+static int pak_version = 1;
+static int pak_compress = 0;
+
+/* version 2 entries are collected first, since the directory is sorted by hash */
+typedef struct {
+    char *path;
+    char *name;
+    uint32_t hash;
+    size_t index;
+} pak2_entry;
+
+static pak2_entry *entries = NULL;
+static size_t num_entries = 0;
+
 typedef struct {
     char buf[4096];
     size_t p;
 } pathbuf;
 
 static inline uint32_t htol(uint32_t n);
+static inline uint64_t htol64(uint64_t n);
 static int32_t write_entry(pathbuf* pb);
+static void collect_entry(pathbuf* pb);
+static int32_t write_pak2(void);
 static size_t recurse_directory(pathbuf* pb, int w);
 static size_t enter_directory(char* path, int should_write);
 
@@ -48,6 +67,11 @@ static inline uint32_t htol(uint32_t n) {
            ((n>>8)&0xFF00) | ((n<<24)&0xFF000000);
 }
 
+static inline uint64_t htol64(uint64_t n) {
+    return (union {int32_t x; char c;}){1}.c ? n :
+           ((uint64_t)htol((uint32_t)n) << 32) | htol((uint32_t)(n >> 32));
+}
+
 static int32_t write_entry(pathbuf* pb) {
     size_t start_p = pakptr_data, n;
     file_header fh = {0};
@@ -81,6 +105,151 @@ static int32_t write_entry(pathbuf* pb) {
     return 0;
 }
 
+static void collect_entry(pathbuf* pb) {
+    pak2_entry *e;
+    entries = (pak2_entry*)realloc(entries, (num_entries + 1) * sizeof(pak2_entry));
+    if (entries == NULL) {
+        fputs("out of memory\nAborting...\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    e = &entries[num_entries];
+    e->path = strdup(pb->buf);
+    e->name = strdup(pb->buf + pb->p);
+    e->hash = pak2_hash(e->name);
+    e->index = num_entries++;
+}
+
+static uint32_t pak2_hashsize = 1;
+
+/* by bucket so every bucket is contiguous, then in directory order */
+static int compare_entries(const void* a, const void* b) {
+    const pak2_entry *ea = (const pak2_entry*)a, *eb = (const pak2_entry*)b;
+    uint32_t ba = ea->hash & (pak2_hashsize - 1), bb = eb->hash & (pak2_hashsize - 1);
+    if (ba != bb) return ba < bb ? -1 : 1;
+    return ea->index < eb->index ? -1 : ea->index > eb->index;
+}
+
+static uint8_t* read_whole_file(const char* path, size_t* size) {
+    uint8_t *data = NULL, buf[4096];
+    size_t n;
+    FILE *fd = fopen(path, "rb");
+    *size = 0;
+    if (fd == NULL) {
+        fprintf(stderr, "failed to open file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    while ( (n = fread(buf, 1, sizeof(buf), fd)) ) {
+        data = (uint8_t*)realloc(data, *size + n);
+        if (data == NULL) break;
+        memcpy(data + *size, buf, n);
+        *size += n;
+    }
+    fclose(fd);
+    if (data == NULL) data = (uint8_t*)malloc(1); /* empty file */
+    return data;
+}
+
+/* writes the whole version 2 archive from the collected entries */
+static int32_t write_pak2(void) {
+    size_t i, names_size = 0;
+    uint64_t data_ptr;
+
+    /* keep the load factor at or below 0.5, same as the engine does for version 1 paks */
+    while (pak2_hashsize < num_entries * 2) pak2_hashsize <<= 1;
+    qsort(entries, num_entries, sizeof(pak2_entry), compare_entries);
+
+    for (i = 0; i < num_entries; i++) names_size += strlen(entries[i].name) + 1;
+
+    uint32_t hashofs = PAK2_HEADER_SZ;
+    uint32_t dirofs = hashofs + pak2_hashsize * sizeof(uint32_t);
+    uint32_t namesofs = dirofs + num_entries * sizeof(pak2_file_header);
+    uint64_t dirlen = namesofs + names_size;
+    if (dirlen >= 2147483647) {
+        fputs("error: directory has exceeded 2 GiB limit\n", stderr);
+        return -1;
+    }
+
+    uint8_t *dir = (uint8_t*)calloc(1, dirlen);
+    pak2_header *h = (pak2_header*)dir;
+    uint32_t *hashtable = (uint32_t*)(dir + hashofs);
+    pak2_file_header *files = (pak2_file_header*)(dir + dirofs);
+    char *names = (char*)(dir + namesofs);
+    size_t name_ptr = 0;
+
+    memcpy(h->magic, "PAK2", 4);
+    h->version = htol(PAK2_VERSION);
+    h->numfiles = htol(num_entries);
+    h->hashsize = htol(pak2_hashsize);
+    h->hashofs = htol(hashofs);
+    h->dirofs = htol(dirofs);
+    h->namesofs = htol(namesofs);
+    h->dirlen = htol(dirlen);
+
+    for (i = 0; i < pak2_hashsize; i++) hashtable[i] = htol(0xFFFFFFFF);
+
+    /* file data goes after the directory, which is written last */
+    data_ptr = dirlen;
+    fseek(pakfile, dirlen, SEEK_SET);
+
+    for (i = 0; i < num_entries; i++) {
+        pak2_entry *e = &entries[i];
+        uint32_t bucket = e->hash & (pak2_hashsize - 1);
+        uint32_t compression = PAK2_COMPRESSION_NONE;
+        size_t size, disksize;
+        uint8_t *data = read_whole_file(e->path, &size), *packed = NULL;
+
+        if (data == NULL) {
+            free(dir);
+            return -1;
+        }
+
+        if (size >= 2147483647) {
+            fprintf(stderr, "error: %s is over 2 GiB\n", e->path);
+            free(dir);
+            return -1;
+        }
+
+        /* only keep the compressed copy if it is actually smaller */
+        disksize = size;
+        if (pak_compress && size) {
+            packed = (uint8_t*)malloc(size);
+            if (packed && (disksize = lz4_compress(data, size, packed, size - 1))) {
+                compression = PAK2_COMPRESSION_LZ4;
+            } else {
+                disksize = size;
+            }
+        }
+
+        fputs(e->name, stdout);
+        fwrite(compression == PAK2_COMPRESSION_LZ4 ? packed : data, 1, disksize, pakfile);
+        if (compression == PAK2_COMPRESSION_LZ4)
+            printf(" (%zu bytes, %zu compressed)\n", size, disksize);
+        else
+            printf(" (%zu bytes)\n", size);
+
+        if (htol(hashtable[bucket]) == 0xFFFFFFFF) hashtable[bucket] = htol(i);
+
+        files[i].hash = htol(e->hash);
+        files[i].nameofs = htol(name_ptr);
+        files[i].compression = htol(compression);
+        files[i].size = htol(size);
+        files[i].offset = htol64(data_ptr);
+        files[i].disksize = htol64(disksize);
+
+        strcpy(names + name_ptr, e->name);
+        name_ptr += strlen(e->name) + 1;
+        data_ptr += disksize;
+
+        free(packed);
+        free(data);
+    }
+
+    fseek(pakfile, 0, SEEK_SET);
+    fwrite(dir, 1, dirlen, pakfile);
+    free(dir);
+    return 0;
+}
+
 static size_t recurse_directory(pathbuf* pb, int32_t w) {
     size_t count = 0;
     size_t path_base = strlen(pb->buf);
@@ -128,16 +297,20 @@ static size_t recurse_directory(pathbuf* pb, int32_t w) {
             continue;
         }
 
-        if (strlen(pb->buf + pb->p) > sizeof(((file_header*)0)->name)-1) {
+        size_t max_name = pak_version == PAK2_VERSION ?
+                          PAK2_MAX_NAME-1 : sizeof(((file_header*)0)->name)-1;
+        if (strlen(pb->buf + pb->p) > max_name) {
             fprintf(stderr,
                     "path %s is too long (maximum %zu, got %zu)\nAborting...\n",
-                    pb->buf + pb->p, sizeof(((file_header*)0)->name)-1, strlen(pb->buf + pb->p));
+                    pb->buf + pb->p, max_name, strlen(pb->buf + pb->p));
             exit(EXIT_FAILURE);
         }
 
         ++count;
 
-        if (w) {
+        if (w && pak_version == PAK2_VERSION) {
+            collect_entry(pb);
+        } else if (w) {
             if (write_entry(pb)) {
                 puts("Aborting...");
                 exit(EXIT_FAILURE);
@@ -168,13 +341,48 @@ int main(int argc, char *argv[]) {
     assert(sizeof(pak_header) == PAK_HEADER_SZ);
     assert(sizeof(file_header) == FILE_HEADER_SZ);
 
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-2")) {
+            pak_version = PAK2_VERSION;
+        } else if (!strcmp(argv[1], "-z")) {
+            pak_version = PAK2_VERSION;
+            pak_compress = 1;
+        } else {
+            break;
+        }
+        argv++, argc--;
+    }
+
     if (argc != 3) {
-        fprintf(stderr, "usage: %s [input directory] [output archive]\n"\
-                "[input directory] will become the root of [output archive]\n",
+        fprintf(stderr, "usage: %s [-2] [-z] [input directory] [output archive]\n"\
+                "[input directory] will become the root of [output archive]\n"\
+                "-2 writes a version 2 archive, -z also compresses it with LZ4\n",
                 argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    if (pak_version == PAK2_VERSION) {
+        assert(sizeof(pak2_header) == PAK2_HEADER_SZ);
+        assert(sizeof(pak2_file_header) == PAK2_FILE_HEADER_SZ);
+
+        enter_directory(argv[1], 1);
+
+        pakfile = fopen(argv[2], "wb");
+        if (pakfile == NULL) {
+            fprintf(stderr, "failed to open output file %s: %s\n", argv[2], strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (write_pak2()) {
+            puts("Aborting...");
+            fclose(pakfile);
+            exit(EXIT_FAILURE);
+        }
+
+        fclose(pakfile);
+        return EXIT_SUCCESS;
+    }
+
     size_t file_table_size = enter_directory(argv[1], 0)*sizeof(file_header);
     pak_header h = {
         .magic = {'P', 'A', 'C', 'K'}, 
@@ -20,4 +20,45 @@ typedef struct {
     uint32_t size;
 } file_header;
 
+/* version 2: header, hash table, directory sorted by bucket, then names,
+ * all in one block at the start of the archive (see src/common/formats/pak.hpp) */
+#define PAK2_VERSION 2
+#define PAK2_MAX_NAME 256
+#define PAK2_COMPRESSION_NONE 0
+#define PAK2_COMPRESSION_LZ4 1
+
+#define PAK2_HEADER_SZ 32
+typedef struct {
+    uint8_t magic[4];
+    uint32_t version;
+    uint32_t numfiles;
+    uint32_t hashsize;
+    uint32_t hashofs;
+    uint32_t dirofs;
+    uint32_t namesofs;
+    uint32_t dirlen;
+} pak2_header;
+
+#define PAK2_FILE_HEADER_SZ 32
+typedef struct {
+    uint32_t hash;
+    uint32_t nameofs;
+    uint32_t compression;
+    uint32_t size;
+    uint64_t offset;
+    uint64_t disksize;
+} pak2_file_header;
+
+/* case-folded FNV-1a, must match FS_HashFileName in the engine */
+static inline uint32_t pak2_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        uint8_t c = (uint8_t)*name;
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 #endif /* PAK_H_ */
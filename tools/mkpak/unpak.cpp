@@ -10,8 +10,11 @@ original author wishes to remain unnamed
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+#define fseek64 _fseeki64
+
 #else
 #include <sys/stat.h>
+#define fseek64 fseeko
 #endif
 
 #include <assert.h>
@@ -21,10 +24,14 @@ original author wishes to remain unnamed
 #include <stdlib.h>
 #include <string.h>
 
-#include "pak.h"
+#include "pak.hpp"
+#include "lz4.hpp"
 
 static inline uint32_t ltoh(uint32_t n);
+static inline uint64_t ltoh64(uint64_t n);
 static int32_t mkdir_p(char* path);
+static FILE* open_output(char* path);
+static int32_t unpak2(FILE* pakfile, char* path, size_t path_p);
 
 static inline uint32_t ltoh(uint32_t n) {
     return (union {int32_t x; char c;}){1}.c ? n :
@@ -32,6 +39,11 @@ static inline uint32_t ltoh(uint32_t n) {
            ((n>>8)&0xFF00) | ((n<<24)&0xFF000000);
 }
 
+static inline uint64_t ltoh64(uint64_t n) {
+    return (union {int32_t x; char c;}){1}.c ? n :
+           ((uint64_t)ltoh((uint32_t)n) << 32) | ltoh((uint32_t)(n >> 32));
+}
+
 static int32_t mkdir_p(char* path) {
 #ifdef _WIN32
     for (char *p = strpbrk(path + 1, "/\\"); p; p = strpbrk(p + 1, "/\\")) {
@@ -53,6 +65,95 @@ static int32_t mkdir_p(char* path) {
     return 0;
 }
 
+static FILE* open_output(char* path) {
+    FILE *fd = fopen(path, "wb");
+    if (fd == NULL && errno == ENOENT) {
+        mkdir_p(path);
+        fd = fopen(path, "wb");
+    }
+    if (fd == NULL)
+        fprintf(stderr, "failed to open %s: %s\n"\
+                        "skipping file...\n", path, strerror(errno));
+    return fd;
+}
+
+/* version 2 archives: the directory block is read in one go, then each entry is
+ * read whole and decompressed if needed */
+static int32_t unpak2(FILE* pakfile, char* path, size_t path_p) {
+    pak2_header h;
+    fseek(pakfile, 0, SEEK_SET);
+    if (fread(&h, 1, sizeof(pak2_header), pakfile) != sizeof(pak2_header)
+        || ltoh(h.version) != PAK2_VERSION)
+        return -1;
+
+    uint32_t numfiles = ltoh(h.numfiles), dirofs = ltoh(h.dirofs);
+    uint32_t namesofs = ltoh(h.namesofs), dirlen = ltoh(h.dirlen);
+    if (dirofs + (uint64_t)numfiles * sizeof(pak2_file_header) > dirlen || namesofs >= dirlen)
+        return -1;
+
+    uint8_t *dir = (uint8_t*)malloc(dirlen);
+    fseek(pakfile, 0, SEEK_SET);
+    if (dir == NULL || fread(dir, 1, dirlen, pakfile) != dirlen || dir[dirlen-1] != '\0') {
+        free(dir);
+        return -1;
+    }
+
+    pak2_file_header *files = (pak2_file_header*)(dir + dirofs);
+    for (uint32_t i = 0; i < numfiles; i++) {
+        uint32_t nameofs = ltoh(files[i].nameofs), size = ltoh(files[i].size);
+        uint32_t compression = ltoh(files[i].compression);
+        uint64_t offset = ltoh64(files[i].offset), disksize = ltoh64(files[i].disksize);
+        const char *name;
+        FILE *fd;
+
+        if (namesofs + (uint64_t)nameofs >= dirlen) {
+            fprintf(stderr, "entry %u has a bad name, skipping file...\n", i);
+            continue;
+        }
+        name = (const char*)dir + namesofs + nameofs;
+
+        uint8_t *packed = (uint8_t*)malloc(disksize ? disksize : 1);
+        uint8_t *data = NULL;
+        if (packed == NULL
+            || fseek64(pakfile, offset, SEEK_SET)
+            || fread(packed, 1, disksize, pakfile) != disksize) {
+            fprintf(stderr, "%s is past the end of the archive, skipping file...\n", name);
+            free(packed);
+            continue;
+        }
+
+        if (compression == PAK2_COMPRESSION_LZ4) {
+            data = (uint8_t*)malloc(size ? size : 1);
+            if (data == NULL || lz4_decompress(packed, disksize, data, size) != (long)size) {
+                fprintf(stderr, "%s is corrupt, skipping file...\n", name);
+                free(data);
+                free(packed);
+                continue;
+            }
+            free(packed);
+        } else if (compression == PAK2_COMPRESSION_NONE) {
+            data = packed;
+            size = disksize;
+        } else {
+            fprintf(stderr, "%s has unknown compression %u, skipping file...\n", name, compression);
+            free(packed);
+            continue;
+        }
+
+        strcpy(path + path_p, name);
+        if ((fd = open_output(path)) != NULL) {
+            fputs(name, stdout);
+            fwrite(data, 1, size, fd);
+            fclose(fd);
+            printf(" (%u bytes)\n", size);
+        }
+        free(data);
+    }
+
+    free(dir);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     /* catch any possible struct padding */
     assert(sizeof(pak_header) == PAK_HEADER_SZ);
@@ -81,6 +182,17 @@ int main(int argc, char *argv[]) {
 
     pak_header h;
     fread(&h, 1, sizeof(pak_header), pakfile);
+    if (!memcmp(h.magic, "PAK2", 4)) {
+        assert(sizeof(pak2_header) == PAK2_HEADER_SZ);
+        assert(sizeof(pak2_file_header) == PAK2_FILE_HEADER_SZ);
+        if (unpak2(pakfile, path, path_p)) {
+            fprintf(stderr, "%s is not a valid PAK file\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+        fclose(pakfile);
+        return 0;
+    }
+
     h.offset = pakptr_header = ltoh(h.offset), h.size = ltoh(h.size);
     if (memcmp(h.magic, "PACK", 4) || h.size % sizeof(file_header) != 0) {
         fprintf(stderr, "%s is not a valid PAK file\n", argv[1]);